@@ -0,0 +1,201 @@
+# This file is part of the Fluggo Media Library for high-quality
+# video and audio processing.
+#
+# Copyright 2012 Brian J. Crowell <brian@fluggo.com>
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+'''Plans exports that copy untouched stretches of the timeline straight from
+their sources' packets, and only encode the frames that were actually changed.
+
+This only works for intra-only formats such as DV, where any packet can stand
+on its own and every packet is exactly one frame.'''
+
+import collections
+from fluggo.media import process
+from .video import SequenceVideoManager
+
+#: One stretch of an export plan, covering frames *start* through
+#: *start* + *length* - 1 of the output. If *packet_stream* is None, the frames
+#: have to be encoded; otherwise they are packets *offset* through
+#: *offset* + *length* - 1 of *packet_stream*, and *decoder* is the decoder
+#: connector reading it, which can open a copy of the stream for the export.
+ExportRange = collections.namedtuple('ExportRange', 'start length packet_stream offset decoder')
+
+def _frames_match(a, b):
+    '''Return True if frames in format *a* need no conversion to be frames in format *b*.'''
+    return (a.interlaced, a.pulldown_type, a.pulldown_phase, a.full_frame, a.pixel_aspect_ratio, a.frame_rate) == \
+        (b.interlaced, b.pulldown_type, b.pulldown_phase, b.full_frame, b.pixel_aspect_ratio, b.frame_rate)
+
+def _get_decoder(connector, offset, length, format_urn, format):
+    '''Return the decoder connector behind *connector* if frames *offset* through
+    *offset* + *length* - 1 can be copied as packets into an export of
+    *format_urn* in *format*, or None if they have to be decoded.'''
+    stream = connector.stream
+
+    if stream is None or connector.format is None:
+        return None
+
+    # Decoder connectors say which packets they decode; anything else has been
+    # through something we can't see past
+    packet_stream = getattr(stream, 'packet_stream', None)
+
+    if packet_stream is None or getattr(stream, 'format_urn', None) != format_urn:
+        return None
+
+    # The decoder is still reading packet_stream, so the export needs its own copy
+    if getattr(stream, 'open_packet_stream', None) is None:
+        return None
+
+    if not _frames_match(connector.format, format):
+        return None
+
+    min_frame, max_frame = connector.defined_range
+
+    if min_frame is None or offset < min_frame or offset + length - 1 > max_frame:
+        return None
+
+    return stream
+
+def _add_range(plan, start, length, packet_stream=None, offset=None, decoder=None):
+    '''Append a range to *plan*, merging it with the last one if they continue each other.'''
+    if length <= 0:
+        return
+
+    if plan:
+        last = plan[-1]
+
+        if last.start + last.length == start and last.packet_stream is packet_stream and \
+                (packet_stream is None or last.offset + last.length == offset):
+            plan[-1] = last._replace(length=last.length + length)
+            return
+
+    plan.append(ExportRange(start, length, packet_stream, offset, decoder))
+
+def _fill_plan(ranges, start, end):
+    '''Return a plan covering frames *start* through *end* - 1, made of the
+    passthrough *ranges* (which must be in order and not overlap) with encoded
+    ranges in the gaps between them.'''
+    plan = []
+    position = start
+
+    for range_ in ranges:
+        range_start, range_end = max(range_.start, start), min(range_.start + range_.length, end)
+
+        if range_end <= range_start:
+            continue
+
+        _add_range(plan, position, range_start - position)
+        _add_range(plan, range_start, range_end - range_start, range_.packet_stream,
+            range_.offset + (range_start - range_.start), range_.decoder)
+        position = range_end
+
+    _add_range(plan, position, end - position)
+    return plan
+
+def plan_sequence(manager, format_urn, start=0, end=None):
+    '''Plan an export of frames *start* through *end* - 1 (the end of the sequence
+    if None) of the sequence behind the SequenceVideoManager *manager* to packets
+    of *format_urn*. Returns a list of ExportRange covering every frame.
+
+    A clip's frames are copied when it comes straight from a source decoding
+    *format_urn* in the sequence's format; its transitions, and any gaps, are
+    encoded.'''
+    if end is None:
+        end = manager.sequence.length
+
+    ranges = []
+    watchers = manager.watchers
+
+    for i, watcher in enumerate(watchers):
+        item = watcher.seq_item
+        next_item = i + 1 < len(watchers) and watchers[i + 1].seq_item
+
+        # Leave out the transitions in and out of this clip
+        clean_start = item.x + max(item.transition_length, 0)
+        clean_end = item.x + item.length - (max(next_item.transition_length, 0) if next_item else 0)
+        offset = item.offset + (clean_start - item.x)
+
+        if clean_end <= clean_start:
+            continue
+
+        decoder = _get_decoder(watcher.connector, offset,
+            clean_end - clean_start, format_urn, manager.format)
+
+        if decoder is not None:
+            ranges.append(ExportRange(clean_start, clean_end - clean_start,
+                decoder.packet_stream, offset, decoder))
+
+    return _fill_plan(ranges, start, end)
+
+def plan_space(manager, format_urn, start, end):
+    '''Plan an export of frames *start* through *end* - 1 of the space behind the
+    SpaceVideoManager *manager* to packets of *format_urn*. Returns a list of
+    ExportRange covering every frame.
+
+    Frames are only copied where a single item covers them; where items overlap,
+    they're composited, and so encoded. Sequences are planned with plan_sequence.'''
+    watchers = list(manager.watchers.values())
+    edges = set([start, end])
+
+    for watcher in watchers:
+        item = watcher.workspace_item
+        edges.update(edge for edge in (item.x, item.x + item.length) if start < edge < end)
+
+    edges = sorted(edges)
+    ranges = []
+
+    for range_start, range_end in zip(edges[:-1], edges[1:]):
+        covering = [watcher for watcher in watchers
+            if watcher.workspace_item.x < range_end and range_start < watcher.workspace_item.x + watcher.workspace_item.length]
+
+        if len(covering) != 1:
+            continue
+
+        watcher = covering[0]
+        item = watcher.workspace_item
+
+        if watcher.stream is None:
+            continue
+
+        if isinstance(watcher.stream, SequenceVideoManager):
+            if not _frames_match(watcher.stream.format, manager.format):
+                continue
+
+            # Sequence frames count from the sequence's start
+            for range_ in plan_sequence(watcher.stream, format_urn,
+                    range_start - item.x + item.offset, range_end - item.x + item.offset):
+                if range_.packet_stream is not None:
+                    ranges.append(range_._replace(start=range_.start + item.x - item.offset))
+        else:
+            offset = item.offset + (range_start - item.x)
+            decoder = _get_decoder(watcher.stream, offset,
+                range_end - range_start, format_urn, manager.format)
+
+            if decoder is not None:
+                ranges.append(ExportRange(range_start, range_end - range_start,
+                    decoder.packet_stream, offset, decoder))
+
+    return _fill_plan(ranges, start, end)
+
+def create_packet_source(plan, encode):
+    '''Return a CodecPacketSequence that follows *plan*, a list of ExportRange.
+    Packets are copied for ranges that have them, each from a copy of the
+    stream opened just for that range, so the export never moves a stream a
+    decoder is reading. For the rest, *encode* is called with the range's first
+    and last frames and should return a codec packet source with just those frames.'''
+    return process.CodecPacketSequence([
+        (range_.decoder.open_packet_stream(), range_.offset, range_.length) if range_.packet_stream is not None
+        else (encode(range_.start, range_.start + range_.length - 1), None, range_.length)
+        for range_ in plan])
@@ -101,16 +101,21 @@ class _DecoderConnector(object):
     This class publishes alerts for any error that happens when finding the
     codec.'''
 
-    def __init__(self, packet_stream, format_urn, offset, length, model_obj=None, codec_urn=None, definition=None):
+    def __init__(self, packet_stream, format_urn, offset, length, model_obj=None, codec_urn=None, definition=None,
+            open_packet_stream=None):
         '''Creates a connector for the given *packet_stream*.
 
         If *codec_urn* is given, the connector tries to find the exact decoder
         and create it with the given *definition*. Otherwise, it tries to find
-        a codec that can decode *format_urn* and creates it with no settings.'''
+        a codec that can decode *format_urn* and creates it with no settings.
+
+        If given, *open_packet_stream* is called with no arguments to open
+        another packet source for the same packets, with its own position.'''
         if not packet_stream:
             raise ValueError('packet_stream cannot be None')
 
         self._pktstream = packet_stream
+        self.open_packet_stream = open_packet_stream
         self._offset = offset
         self._length = length
         self._start_definition = definition or {}
@@ -130,6 +135,16 @@ class _DecoderConnector(object):
         self.set_base_filter(None, new_range=(None, None))
         self.set_format(None)
 
+    @property
+    def packet_stream(self):
+        '''The codec packet source this connector decodes.'''
+        return self._pktstream
+
+    @property
+    def format_urn(self):
+        '''The URN of the format of the packets in packet_stream.'''
+        return self._format_urn
+
     def get_definition(self):
         if not self.decoder:
             return self._start_definition
@@ -164,6 +164,7 @@ class _LibavSource(plugins.Source):
         # Stream ID -> {urn: Codec URN, definition: definition}
         self._loaded_definitions = {}
         self._streams = []
+        self._raw_dv = False
 
         plugins.Source.__init__(self, name)
 
@@ -179,6 +180,10 @@ class _LibavSource(plugins.Source):
             container = libav.AVContainer(self.path)
             streams = []
 
+            # One reader for all the streams, so the file is only read once
+            demuxer = libav.AVSharedDemuxer(self.path)
+            self._raw_dv = (container.format_name == 'dv')
+
             for stream_desc in container.streams:
                 # TODO: Take into account relative stream start times
 
@@ -197,7 +202,7 @@ class _LibavSource(plugins.Source):
                     # Find codec
                     # We use the stream index because some formats don't have a
                     # proper stream ID (such as the dv format)
-                    stream = self._find_codec(plugins.VideoDecoderConnector, stream_desc, 0, video_length)
+                    stream = self._find_codec(plugins.VideoDecoderConnector, demuxer, stream_desc, 0, video_length)
                     stream.name = str(stream_desc.index)
                     stream.id = stream_desc.id
                     self.follow_alerts(stream)
@@ -215,7 +220,7 @@ class _LibavSource(plugins.Source):
                         audio_length = int(audio_length)
 
                     # Find codec
-                    stream = self._find_codec(plugins.AudioDecoderConnector, stream_desc, 0, audio_length)
+                    stream = self._find_codec(plugins.AudioDecoderConnector, demuxer, stream_desc, 0, audio_length)
                     stream.name = str(stream_desc.index)
                     stream.id = stream_desc.id
                     self.follow_alerts(stream)
@@ -236,7 +241,7 @@ class _LibavSource(plugins.Source):
                 QAction('Retry', None, statusTip='Try bringing the source online again', triggered=self._retry_load)], exc_info=True)
             self.show_alert(self._load_alert)
 
-    def _find_codec(self, cls, stream_desc, offset, length):
+    def _find_codec(self, cls, demuxer, stream_desc, offset, length):
         codec_id = _codec_format_names.get(stream_desc.codec_id)
 
         if codec_id:
@@ -245,15 +250,24 @@ class _LibavSource(plugins.Source):
             codec_id = 'unknown-' + str(stream_desc.codec_id)
 
         format_urn = 'urn:libav:codec-format:' + codec_id
-        demuxer = libav.AVDemuxer(self.path, stream_desc.index)
+        path, index = self.path, stream_desc.index
+
+        if self._raw_dv and stream_desc.type == 'video':
+            # Raw DV frames are all the same size; map the file and read them directly
+            open_packet_stream = lambda: process.RawDVSource(path)
+            packet_source = open_packet_stream()
+        else:
+            # A copy gets a reader of its own rather than another stream of the shared one
+            open_packet_stream = lambda: libav.AVDemuxer(path, index)
+            packet_source = demuxer.stream(index)
         loaded_desc = self._loaded_definitions.get(stream_desc.id)
         urn, definition = None, None
 
         if loaded_desc:
             urn, definition = loaded_desc['urn'], loaded_desc['definition']
 
-        return cls(demuxer, format_urn, offset, length,
-            model_obj=self, codec_urn=urn, definition=definition)
+        return cls(packet_source, format_urn, offset, length,
+            model_obj=self, codec_urn=urn, definition=definition, open_packet_stream=open_packet_stream)
 
     def _retry_load(self, checked):
         self.bring_online()
@@ -24,6 +24,7 @@
 #include <stdint.h>
 #include <inttypes.h>
 #include <stdbool.h>
+#include <stdio.h>
 #include "half.h"
 
 #if defined(WINNT)
@@ -411,6 +412,130 @@ void audio_mix_add( audio_frame *out, const audio_frame *a, float mix_a, int off
 
 void audio_mix_add_pull( audio_frame *out, const audio_source *a, float mix_a, int offset_a );
 
+/*
+    Varispeed resampler
+
+    Windowed-sinc resampler for playing an audio source at arbitrary (including
+    negative) rates. Quality trades CPU for kernel length:
+
+    AUDIO_RESAMPLE_QUALITY_FASTEST - Linear interpolation
+    AUDIO_RESAMPLE_QUALITY_LOW - 8-tap Kaiser-windowed sinc
+    AUDIO_RESAMPLE_QUALITY_MEDIUM - 24-tap Kaiser-windowed sinc
+    AUDIO_RESAMPLE_QUALITY_BEST - 64-tap Kaiser-windowed sinc
+
+    When speeding up, the kernel is widened to filter out what would alias.
+*/
+#define AUDIO_RESAMPLE_QUALITY_FASTEST  0
+#define AUDIO_RESAMPLE_QUALITY_LOW      1
+#define AUDIO_RESAMPLE_QUALITY_MEDIUM   2
+#define AUDIO_RESAMPLE_QUALITY_BEST     3
+#define AUDIO_RESAMPLE_QUALITY_COUNT    4
+
+typedef struct audio_resampler_t audio_resampler;
+
+G_GNUC_MALLOC audio_resampler *audio_resampler_new( int quality );
+void audio_resampler_free( audio_resampler *self );
+int audio_resampler_get_quality( audio_resampler *self );
+void audio_resampler_set_quality( audio_resampler *self, int quality );
+double audio_resampler_get_position( audio_resampler *self );
+void audio_resampler_set_position( audio_resampler *self, double position );
+double audio_resampler_get_rate( audio_resampler *self );
+void audio_resampler_set_rate( audio_resampler *self, double rate, bool ramp );
+void audio_resampler_render( audio_resampler *self, const audio_source *source, float *out, int channels, int count );
+
+/*
+    Audio ring
+
+    Lock-free ring of floats for handing interleaved samples from exactly one
+    producer thread to exactly one consumer thread. Counts are in floats, not samples.
+*/
+typedef struct audio_ring_t audio_ring;
+
+G_GNUC_MALLOC audio_ring *audio_ring_new( int capacity );
+void audio_ring_free( audio_ring *self );
+int audio_ring_get_capacity( audio_ring *self );
+int audio_ring_get_fill( audio_ring *self );
+int audio_ring_write( audio_ring *self, const float *data, int count );
+int audio_ring_read( audio_ring *self, float *data, int count );
+const float *audio_ring_peek( audio_ring *self, int *count );
+void audio_ring_advance( audio_ring *self, int count );
+void audio_ring_discard( audio_ring *self );
+
+/*
+    Audio sample conversion
+
+    Converts float samples in [-1.0, 1.0] to the integer formats sound hardware
+    wants. Values outside that range are clipped. For 16-bit output, pass an
+    audio_dither to add triangular (TPDF) dither of one LSB; pass NULL to round.
+*/
+typedef struct {
+    uint32_t state[4];
+} audio_dither;
+
+void audio_dither_init( audio_dither *dither, uint32_t seed );
+void audio_convert_f32_to_s16( int16_t *out, const float *in, int count, audio_dither *dither );
+void audio_convert_f32_to_s32( int32_t *out, const float *in, int count );
+
+/*
+    The other way, for decoders: integer and float samples, interleaved or one
+    plane per channel, to interleaved float. Integers are scaled so full scale
+    comes out as [-1.0, 1.0); U8 is unsigned with 128 at zero.
+*/
+#define AUDIO_SAMPLE_U8     0
+#define AUDIO_SAMPLE_S16    1
+#define AUDIO_SAMPLE_S32    2
+#define AUDIO_SAMPLE_FLT    3
+#define AUDIO_SAMPLE_DBL    4
+
+int audio_sample_get_size( int format );
+void audio_convert_to_f32( float *out, int out_channels, const void *const *in, int in_channels,
+    int format, bool planar, const int *channel_map, int offset, int count );
+
+/*
+    Audio peak index
+
+    Min, max, and RMS of an audio source at several resolutions, for drawing
+    waveforms without reading the source again. Peak values are fractions of full scale.
+*/
+typedef struct {
+    float min, max, rms;
+} audio_peak;
+
+typedef struct audio_peak_index_t audio_peak_index;
+
+G_GNUC_MALLOC audio_peak_index *audio_peak_index_new( int channels, int min_sample, int max_sample );
+void audio_peak_index_free( audio_peak_index *self );
+int audio_peak_index_get_channels( audio_peak_index *self );
+double audio_peak_index_get_progress( audio_peak_index *self );
+bool audio_peak_index_is_complete( audio_peak_index *self );
+bool audio_peak_index_build( audio_peak_index *self, const audio_source *source, volatile gint *cancel );
+void audio_peak_index_query( audio_peak_index *self, int min_sample, int max_sample, int pixels, audio_peak *out );
+bool audio_peak_index_save( audio_peak_index *self, const char *path, const char *key );
+audio_peak_index *audio_peak_index_load( const char *path, const char *key, int channels, int min_sample, int max_sample );
+
+/*
+    Audio block cache
+
+    Decoded samples kept in fixed-size blocks, least recently used first out,
+    so a decoder can answer requests for audio it has already decoded without
+    going back to the file. Samples are stored interleaved with the decoder's
+    own channel count. Not thread-safe; decoders call it under their own lock.
+*/
+typedef struct {
+    int64_t hits, misses, used;
+} audio_block_cache_stats;
+
+typedef struct audio_block_cache_t audio_block_cache;
+
+G_GNUC_MALLOC audio_block_cache *audio_block_cache_new( int channels, int block_size, int64_t max_size );
+void audio_block_cache_free( audio_block_cache *self );
+int64_t audio_block_cache_get_max_size( audio_block_cache *self );
+void audio_block_cache_set_max_size( audio_block_cache *self, int64_t max_size );
+void audio_block_cache_put( audio_block_cache *self, int64_t start_sample, int count, const float *data );
+bool audio_block_cache_get( audio_block_cache *self, audio_frame *frame );
+void audio_block_cache_clear( audio_block_cache *self );
+void audio_block_cache_get_stats( audio_block_cache *self, audio_block_cache_stats *stats );
+
 
 /************ Codec packet source ******/
 
@@ -436,6 +561,16 @@ typedef struct {
     GFreeFunc free_func;
 } codec_packet;
 
+/*
+    codec.getNextPacket:
+    Get the next packet from the source, which the caller frees with the
+    packet's free_func.
+
+    Returns NULL at the end of the stream. A source that fails also returns
+    NULL, after setting a Python exception (taking the GIL to do it, since
+    this is usually called without). Callers can tell the two apart with
+    py_codec_packet_source_failed.
+*/
 typedef codec_packet *(*codec_getNextPacketFunc)( void *self );
 typedef bool (*codec_seekFunc)( void *self, int64_t frame );
 
@@ -463,6 +598,96 @@ typedef struct {
     codec_packet_source_funcs *funcs;
 } codec_packet_source;
 
+/*
+    Read-ahead file
+
+    Reads a file through a cache of large blocks that a background thread fills
+    ahead of the reader, in whichever direction the reader is going. Meant for
+    feeding a demuxer from a slow disk without stalling the thread that wants
+    the packets. Only one thread should read or seek at a time.
+
+    With READAHEAD_FILE_NOCACHE, blocks are dropped from the system page cache
+    once they've been read, since they're cached here anyway.
+*/
+#define READAHEAD_FILE_NOCACHE      1
+
+typedef struct {
+    int64_t hits, misses, blocks_read, bytes_read;
+} readahead_file_stats;
+
+typedef struct readahead_file_t readahead_file;
+
+readahead_file *readahead_file_open( const char *path, int block_size, int block_count, int flags );
+void readahead_file_close( readahead_file *self );
+int64_t readahead_file_get_size( readahead_file *self );
+int readahead_file_read( readahead_file *self, void *buffer, int size );
+int64_t readahead_file_seek( readahead_file *self, int64_t offset, int whence );
+void readahead_file_get_stats( readahead_file *self, readahead_file_stats *stats );
+void readahead_file_set_latency( readahead_file *self, int64_t latency );
+
+/*
+    Matroska writer
+
+    Writes a Matroska or WebM file front to back through a write buffer: tracks,
+    then the header, then blocks in decode order, then close. The seek head,
+    duration, and segment size are left as placeholders at the start and filled
+    in when the file is closed, after the cues and tags. Timecodes are in units
+    of the timecode scale, which is in nanoseconds.
+
+    Functions returning bool set errno when they fail.
+*/
+typedef enum {
+    MATROSKA_TRACK_VIDEO = 1,
+    MATROSKA_TRACK_AUDIO = 2
+} matroska_track_type;
+
+typedef struct {
+    matroska_track_type type;
+    const char *codec_id;
+    const void *codec_private;
+    int codec_private_size;
+
+    // Nanoseconds per frame, or zero if not constant
+    int64_t default_duration;
+
+    // Video tracks; display_size can be zero to match pixel_size
+    v2i pixel_size, display_size;
+    bool interlaced;
+
+    // Audio tracks; bit_depth can be zero if it doesn't apply
+    double sample_rate;
+    int channels, bit_depth;
+} matroska_track_params;
+
+typedef struct matroska_writer_t matroska_writer;
+
+// Track numbers have to fit the one-byte form in the block header
+#define MATROSKA_MAX_TRACKS     126
+
+matroska_writer *matroska_writer_open( const char *path, const char *doc_type, int64_t timecode_scale );
+int matroska_writer_add_track( matroska_writer *self, const matroska_track_params *params );
+void matroska_writer_add_tag( matroska_writer *self, int target_type_value, const char *target_type, const char *name, const char *value );
+bool matroska_writer_write_header( matroska_writer *self, const char *writing_app, const char *title );
+bool matroska_writer_write_block( matroska_writer *self, int track, int64_t timecode,
+    const void *data, int length, bool keyframe, bool discardable );
+bool matroska_writer_close( matroska_writer *self, int64_t duration );
+void matroska_writer_abort( matroska_writer *self );
+
+/*
+    Cache files
+
+    Sidecar files for data that's expensive to work out, such as indexes. Each
+    starts with a signature, a version, and a key saying what it was made from;
+    readers only get the file if all of them match. Writes go to a temporary
+    file that replaces the old one when it's complete. The files use native
+    byte order; they're caches, not interchange formats.
+*/
+FILE *cache_file_begin_write( const char *path, const char *magic, int32_t version, const char *key,
+    const int32_t *header, int header_count );
+bool cache_file_end_write( FILE *file, const char *path, bool success );
+FILE *cache_file_open_read( const char *path, const char *magic, int32_t version, const char *key,
+    const int32_t *header, int header_count );
+
 /************ Coded image source ******/
 
 #define CODED_IMAGE_MAX_PLANES 4
@@ -523,6 +748,47 @@ typedef struct {
 } coded_image_source;
 
 // Video subsampling/reconstruction
+typedef enum {
+    VIDEO_CHROMA_411,       // Quarter horizontal, co-sited with the left pixel (DV)
+    VIDEO_CHROMA_420,       // Half in each direction, co-sited horizontally, between lines vertically (MPEG-2)
+    VIDEO_CHROMA_422        // Half horizontal, co-sited with the left pixel
+} video_chroma_format;
+
+typedef struct {
+    video_chroma_format chroma;
+
+    // Bits per sample; 8 gives one byte per sample, anything larger
+    // gives a native-endian uint16_t per sample
+    int bit_depth;
+
+    // For 4:2:0, filter the chroma within each field instead of across the frame
+    bool interlaced;
+
+    // Size of the luma plane, and the point in the frame that lands on its
+    // top-left sample
+    v2i size, offset;
+} video_subsample_params;
+
+/*
+    Function: video_subsample_planar
+    Converts linear RGB to Rec. 709 gamma-encoded, studio-range planar YCbCr.
+
+    Parameters:
+    frame - Source frame. Anything outside its current window is taken as black.
+    params - Layout of the result.
+    planes - Y, Cb, and Cr planes to receive the result.
+    strides - Stride, in bytes, of each plane.
+*/
+void video_subsample_planar( rgba_frame_f16 *frame, const video_subsample_params *params,
+    void *const planes[3], const int strides[3] );
+
+/*
+    Function: video_subsample_coded
+    Like <video_subsample_planar>, but allocates and returns a new coded_image
+    with tightly packed planes.
+*/
+G_GNUC_MALLOC coded_image *video_subsample_coded( rgba_frame_f16 *frame, const video_subsample_params *params );
+
 void video_reconstruct_dv( rgba_frame_f16 *frame, coded_image *planar );
 void video_reconstruct_dv_gl( rgba_frame_gl *frame, coded_image *planar );
 coded_image *video_subsample_dv( rgba_frame_f16 *frame );
@@ -43,6 +43,13 @@ bool py_parse_box2i( PyObject *obj, box2i *box );
 bool py_parse_v2f( PyObject *obj, v2f *v );
 bool py_parse_v2i( PyObject *obj, v2i *v );
 
+/**** Buffers **/
+
+int py_get_array_buffer( PyObject *exporter, Py_buffer *view, int flags, void *data, bool readonly,
+    const char *format, Py_ssize_t itemsize, int ndim, const Py_ssize_t *shape );
+void py_release_array_buffer( PyObject *exporter, Py_buffer *view );
+bool py_wrap_buffer( PyObject *obj, Py_buffer *view, Py_ssize_t length, Py_ssize_t alignment );
+
 /**** Video **/
 
 bool py_video_take_source( PyObject *obj, video_source **source );
@@ -86,6 +93,7 @@ float framefunc_get_f32( FrameFunctionHolder *holder, double frame );
 void framefunc_get_v2f( v2f *result, FrameFunctionHolder *holder, double frame );
 void framefunc_get_box2i( box2i *result, FrameFunctionHolder *holder, double frame );
 void framefunc_get_rgba_f32( rgba_f32 *result, FrameFunctionHolder *holder, double frame );
+void framefunc_get_values( FrameFunctionHolder *holder, ssize_t count, double *frames, double (*result)[4] );
 void framefunc_init( FrameFunctionHolder *holder, double c0, double c1, double c2, double c3 );
 
 extern PyTypeObject py_type_FrameFunction;
@@ -113,6 +121,8 @@ typedef struct {
 } CodecPacketSourceHolder;
 
 bool py_codec_packet_take_source( PyObject *source, CodecPacketSourceHolder *holder );
+bool py_codec_packet_source_failed();
+void py_codec_packet_set_error( PyObject *type, const char *format, ... );
 
 extern PyTypeObject py_type_CodecPacketSource;
 
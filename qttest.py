@@ -827,33 +827,33 @@ class MainWindow(QMainWindow):
             yaml.dump_all(self.uimgr.asset_list.get_asset_list(), stream)
 
     def render_dv(self):
-        # FIXME: This code path has LONG since been outdated
         if not len(self.space_asset.space):
             return
 
         path = QFileDialog.getSaveFileName(self, "Render DV", filter='AVI Files (*.avi)')
 
         if path:
-            # Create a private workspace for this render
-            # TODO: Changes to *filters* in the original workspace may alter this one, too
-            # Be sure to check for that before making this process asynchronous
-            workspace = process.VideoWorkspace()
-            items = sorted(self.space, key=lambda a: a.z_sort_key())
-
-            for i, item in enumerate(items):
-                source = self.asset_list.get_stream(item.asset_path, item.stream)
-                workspace.add(x=item.x, width=item.width, z=i, offset=item.offset, source=source)
-
             from fluggo.media import libav
+            from fluggo.editor.graph import SpaceVideoManager, smartrender
 
-            right = max(item.x + item.width for item in self.space)
+            # Create a private graph for this render
+            # TODO: Changes to the space during the render will show up in it
+            # Be sure to check for that before making this process asynchronous
+            space = self.space_asset.space
+            manager = SpaceVideoManager(space, self.uimgr.asset_list)
+            right = max(item.x + item.length for item in space if item.type() == 'video')
 
             # TODO: Put black at the bottom so that we always composite against it
 
-            packet_source = libav.AVVideoEncoder(process.DVSubsampleFilter(workspace),
-                'dvvideo', start_frame=0, end_frame=right - 1,
-                frame_size=v2i(720, 480), sample_aspect_ratio=fractions.Fraction(33, 40),
-                interlaced=True, top_field_first=False, frame_rate=fractions.Fraction(30000/1001))
+            def encode(first_frame, last_frame):
+                return libav.AVVideoEncoder(process.DVSubsampleFilter(manager),
+                    'dvvideo', start_frame=first_frame, end_frame=last_frame,
+                    frame_size=v2i(720, 480), sample_aspect_ratio=fractions.Fraction(33, 40),
+                    interlaced=True, top_field_first=False, frame_rate=fractions.Fraction(30000, 1001))
+
+            # Untouched DV goes straight through; only changed frames are encoded
+            plan = smartrender.plan_space(manager, 'urn:libav:codec-format:dvvideo', 0, right)
+            packet_source = smartrender.create_packet_source(plan, encode)
 
             muxer = libav.AVMuxer(str(path), 'avi')
             muxer.add_video_stream(packet_source, 'dvvideo', frame_rate=fractions.Fraction(30000, 1001),
@@ -19,7 +19,9 @@
 */
 
 #include "pyframework.h"
-#include <asoundlib.h>
+#include "audio_sink.h"
+#include <errno.h>
+#include <math.h>
 
 typedef struct __tag_callback_info {
     void *data;
@@ -28,213 +30,381 @@ typedef struct __tag_callback_info {
     struct __tag_callback_info *next;
 } callback_info;
 
+// Default and maximum read-ahead
+#define DEFAULT_LATENCY     (NS_PER_SEC / 4)
+#define MAX_LATENCY         NS_PER_SEC
+
+// How long to wait, in milliseconds, for the device to make room before
+// checking whether we should stop
+#define SINK_WAIT_TIMEOUT   50
+
 typedef struct {
     PyObject_HEAD
 
     int nextSample;
     int64_t seekTime, baseTime;
     AudioSourceHolder audioSource;
-    snd_pcm_t *pcmDevice;
-    GThread *playbackThread;
+    audio_sink *sink;
+    GThread *playbackThread, *producerThread;
     GMutex mutex, configMutex;
-    GCond cond;
+    GCond cond, fillCond, dataCond;
     bool quit, stop;
     rational rate, playSpeed;
     int bufferSize, channelCount;
-    float *inBuffer;
-    void *outBuffer;
-    snd_pcm_hw_params_t *hwParams;
+    audio_resampler *resampler;
+    int resampleQuality;
     bool time_change;
 
+    // Read-ahead: the producer thread renders into the ring ahead of the
+    // device writer. The epoch changes whenever the ring is flushed, so the
+    // producer can tell its work has been thrown away.
+    audio_ring *ring;
+    int64_t latency;
+    int epoch;
+    double producedPosition;
+    int underrunCount, starveCount;
+
+    // Negative errno of the device error that stopped playback, or zero
+    int deviceError;
+
     GRWLock callback_lock, frame_read_rwlock;
     callback_info *callbacks;
 } py_obj_AlsaPlayer;
 
-static int64_t _getPresentationTime( py_obj_AlsaPlayer *self );
+static int64_t _getPresentationTime_nolock( py_obj_AlsaPlayer *self );
+
+static void
+ensure_buffer( float **buffer, int *capacity, int needed ) {
+    if( *capacity >= needed )
+        return;
+
+    *capacity = needed;
+    *buffer = g_realloc( *buffer, sizeof(float) * needed );
+}
+
+/*
+    Size the ring for the longest latency we allow at the configured rate,
+    plus a period of slack.
+*/
+static audio_ring *
+_createRing( py_obj_AlsaPlayer *self ) {
+    int64_t samples = MAX_LATENCY * self->rate.n / (NS_PER_SEC * self->rate.d) + self->bufferSize;
+
+    return audio_ring_new( (int) samples * self->channelCount );
+}
+
+/*
+    Target fill level of the ring in floats, for a ring of the given channel
+    count. Call with the mutex held.
+*/
+static int
+_getRingTarget( py_obj_AlsaPlayer *self, int channels ) {
+    int64_t samples = self->latency * self->rate.n / (NS_PER_SEC * self->rate.d);
+    int64_t floats = samples * channels;
+
+    return (int) MIN(floats, (int64_t)(audio_ring_get_capacity( self->ring ) - self->bufferSize * channels));
+}
+
+/*
+    Throw away the read-ahead and restart the producer at nextSample.
+    Consumer (playback thread) only, with the mutex held.
+*/
+static void
+_flushRing( py_obj_AlsaPlayer *self ) {
+    audio_ring_discard( self->ring );
+    self->epoch++;
+    self->producedPosition = self->nextSample;
+    g_cond_signal( &self->fillCond );
+}
 
 static gpointer
-playbackThread( py_obj_AlsaPlayer *self ) {
-    for( ;; ) {
-        g_mutex_lock( &self->mutex );
+producerThread( py_obj_AlsaPlayer *self ) {
+    float *buffer = NULL;
+    int buffer_capacity = 0;
+    bool was_stopped = true;
 
-        // BJC: I'd much prefer to use snd_pcm_rewind in the case of a time_change,
-        // but studies show that doesn't work in all cases
-        if( self->stop || self->time_change ) {
-            snd_pcm_drop( self->pcmDevice );
-            self->time_change = false;
-        }
+    g_mutex_lock( &self->mutex );
+    int epoch = self->epoch - 1, channels = 0;
 
-        while( !self->quit && self->stop )
-            g_cond_wait( &self->cond, &self->mutex );
+    for( ;; ) {
+        // Sleep while stopped or full; the playback thread wakes us when
+        // it drains, and anyone changing the state wakes us too
+        while( !self->quit && (self->stop ||
+                (epoch == self->epoch && audio_ring_get_fill( self->ring ) >= _getRingTarget( self, channels ))) ) {
+            if( self->stop )
+                was_stopped = true;
+
+            g_cond_wait( &self->fillCond, &self->mutex );
+        }
 
-        if( snd_pcm_state( self->pcmDevice ) == SND_PCM_STATE_SETUP )
-            snd_pcm_prepare( self->pcmDevice );
+        if( G_UNLIKELY(self->quit) )
+            break;
 
-        if( G_UNLIKELY(self->quit) ) {
+        if( epoch != self->epoch ) {
+            // The channel count is written under the config lock, and changing
+            // it starts a new epoch; take both locks (in the same order as
+            // everyone else) so the two match
             g_mutex_unlock( &self->mutex );
-            break;
+            g_mutex_lock( &self->configMutex );
+            g_mutex_lock( &self->mutex );
+            channels = self->channelCount;
+            epoch = self->epoch;
+            g_mutex_unlock( &self->configMutex );
+
+            if( G_UNLIKELY(self->quit) )
+                break;
+
+            audio_resampler_set_position( self->resampler, self->nextSample );
         }
 
         rational speed = self->playSpeed;
-        rational rate = self->rate;
-        int nextSample = self->nextSample;
-        float *inptr = self->inBuffer;
-        void *outptr = self->outBuffer;
-        int hwCount = min(self->bufferSize, self->bufferSize * speed.d / abs(speed.n));
-        int swCount = min(self->bufferSize, self->bufferSize * abs(speed.n) / speed.d);
-
-        // Grab the current buffer/period size
-        snd_pcm_uframes_t hwBufferSize, hwPeriodSize;
-        snd_pcm_get_params( self->pcmDevice, &hwBufferSize, &hwPeriodSize );
-
-        audio_frame frame;
-        frame.channels = self->channelCount;
-        frame.data = self->inBuffer;
-
-        if( G_LIKELY(speed.n > 0) ) {
-            frame.full_min_sample = nextSample;
-            frame.full_max_sample = nextSample + swCount - 1;
-            self->nextSample += swCount;
-        }
-        else {
-            frame.full_min_sample = nextSample - swCount + 1;
-            frame.full_max_sample = nextSample;
-            self->nextSample -= swCount;
-        }
+        int count = self->bufferSize;
 
-        frame.current_min_sample = frame.full_min_sample;
-        frame.current_max_sample = frame.full_max_sample;
+        // Glide between speeds while shuttling, but start cleanly from a stop
+        audio_resampler_set_rate( self->resampler, (double) speed.n / (double) speed.d, !was_stopped );
+        audio_resampler_set_quality( self->resampler, self->resampleQuality );
+        was_stopped = false;
 
         g_mutex_unlock( &self->mutex );
 
+        ensure_buffer( &buffer, &buffer_capacity, count * channels );
+
         g_rw_lock_reader_lock( &self->frame_read_rwlock );
-        self->audioSource.source.funcs->getFrame( self->audioSource.source.obj, &frame );
+        audio_resampler_render( self->resampler, &self->audioSource.source, buffer, channels, count );
         g_rw_lock_reader_unlock( &self->frame_read_rwlock );
 
+        g_mutex_lock( &self->mutex );
 
-        // Zero out anything that wasn't provided
-        //printf( "current min %d, max %d\n", frame.current_min_sample, frame.current_max_sample );
-        //printf( "full min %d, max %d\n", frame.full_min_sample, frame.full_max_sample );
-
-        if( frame.current_min_sample > frame.current_max_sample ) {
-            memset( frame.data, 0, sizeof(float) * (frame.full_max_sample - frame.full_min_sample + 1) * frame.channels );
+        // Only publish if nobody flushed the ring (or changed its format) while we were working
+        if( epoch == self->epoch ) {
+            audio_ring_write( self->ring, buffer, count * channels );
+            self->producedPosition = audio_resampler_get_position( self->resampler );
+            g_cond_signal( &self->dataCond );
         }
-        else {
-            // Provide some sanity if the audio source gives us bad values
-            if( G_UNLIKELY(frame.current_min_sample < frame.full_min_sample || frame.current_min_sample > frame.full_max_sample) ) {
-                g_warning( "AlsaPlayer Audio source gave min sample (%d) outside valid range [%d, %d]",
-                    frame.current_min_sample, frame.full_min_sample, frame.full_max_sample );
+    }
 
-                if( frame.current_min_sample < frame.full_min_sample )
-                    frame.current_min_sample = frame.full_min_sample;
+    g_mutex_unlock( &self->mutex );
+    g_free( buffer );
 
-                if( frame.current_min_sample > frame.full_max_sample )
-                    frame.current_min_sample = frame.full_max_sample;
-            }
+    return NULL;
+}
 
-            if( G_UNLIKELY(frame.current_max_sample < frame.full_min_sample || frame.current_max_sample > frame.full_max_sample) ) {
-                g_warning( "AlsaPlayer Audio source gave max sample (%d) past full max sample [%d, %d]",
-                    frame.current_max_sample, frame.full_min_sample, frame.full_max_sample );
+/*
+    Handle an error from the sink. Returns false if playback can't continue,
+    in which case the error is kept for the device_error property.
+*/
+static bool
+_recover( py_obj_AlsaPlayer *self, int error ) {
+    if( error == -EPIPE )
+        g_atomic_int_inc( &self->underrunCount );
+
+    if( G_UNLIKELY(self->sink->funcs->recover( self->sink, error ) < 0) ) {
+        g_warning( "Audio device returned error %d (%s); stopping playback", error, g_strerror( -error ) );
+        g_atomic_int_set( &self->deviceError, error );
+        return false;
+    }
 
-                if( frame.current_max_sample < frame.full_min_sample )
-                    frame.current_max_sample = frame.full_min_sample;
+    return true;
+}
 
-                if( frame.current_max_sample > frame.full_max_sample )
-                    frame.current_max_sample = frame.full_max_sample;
+/*
+    Fill a piece of the sink's buffer straight from the ring, converting on the way.
+    Returns true if the ring ran dry and the rest had to be filled with silence.
+*/
+static bool
+_fillArea( py_obj_AlsaPlayer *self, uint8_t *area, int frames, float *straddle, audio_dither *dither ) {
+    const audio_sink *sink = self->sink;
+    const int channels = sink->channels;
+
+    while( frames > 0 ) {
+        int count;
+        const float *src = audio_ring_peek( self->ring, &count );
+        int n = min( count / channels, frames );
+
+        if( n == 0 ) {
+            if( audio_ring_get_fill( self->ring ) < channels ) {
+                // Every format we support is silent at all-bits-zero
+                memset( area, 0, frames * sink->frame_size );
+                return true;
             }
 
-            // Now zero
-            if( frame.full_min_sample < frame.current_min_sample )
-                memset( frame.data, 0, sizeof(float) * (frame.current_min_sample - frame.full_min_sample) * frame.channels );
+            // One frame wraps around the end of the ring
+            audio_ring_read( self->ring, straddle, channels );
+            src = straddle;
+            n = 1;
+        }
+
+        switch( sink->format ) {
+            case AUDIO_SINK_FORMAT_FLOAT:
+                memcpy( area, src, sizeof(float) * n * channels );
+                break;
+
+            case AUDIO_SINK_FORMAT_S16:
+                audio_convert_f32_to_s16( (int16_t *) area, src, n * channels, dither );
+                break;
+
+            case AUDIO_SINK_FORMAT_S32:
+                audio_convert_f32_to_s32( (int32_t *) area, src, n * channels );
+                break;
 
-            if( frame.full_max_sample > frame.current_max_sample )
-                memset( audio_get_sample( &frame, frame.current_max_sample + 1, 0 ), 0,
-                    sizeof(float) * (frame.full_max_sample - frame.current_max_sample) * frame.channels );
+            default:
+                g_assert_not_reached();
         }
 
-        // Convert speed differences
-        if( G_LIKELY(speed.n == 1 && speed.d == 1) ) {
-            // As long as the output is float, we can use the original buffer
-            outptr = inptr;
+        if( src != straddle )
+            audio_ring_advance( self->ring, n * channels );
+
+        area += n * sink->frame_size;
+        frames -= n;
+    }
+
+    return false;
+}
+
+static gpointer
+playbackThread( py_obj_AlsaPlayer *self ) {
+    float *straddle = NULL;
+    int straddle_capacity = 0;
+    audio_dither dither;
+
+    audio_dither_init( &dither, (uint32_t) gettime() );
+
+    for( ;; ) {
+        // The config lock guards the channel count; we check it again below
+        // before touching the ring
+        g_mutex_lock( &self->configMutex );
+        int channels = self->channelCount;
+        g_mutex_unlock( &self->configMutex );
+
+        g_mutex_lock( &self->mutex );
+
+        // BJC: I'd much prefer to use snd_pcm_rewind in the case of a time_change,
+        // but studies show that doesn't work in all cases
+        if( self->stop || self->time_change ) {
+            self->sink->funcs->drop( self->sink );
+            _flushRing( self );
+            self->time_change = false;
         }
-        else if( speed.n > 0 ) {
-            for( int i = 0; i < hwCount; i++ ) {
-                for( int ch = 0; ch < frame.channels; ch++ ) {
-                    ((float *) outptr)[i * frame.channels + ch] =
-                        inptr[(i * speed.n / speed.d) * frame.channels + ch];
-                }
-            }
+
+        while( !self->quit && self->stop )
+            g_cond_wait( &self->cond, &self->mutex );
+
+        // We already dropped when we stopped, so a restart just needs the new position
+        if( self->time_change ) {
+            _flushRing( self );
+            self->time_change = false;
         }
-        else {
-            for( int i = 0; i < hwCount; i++ ) {
-                for( int ch = 0; ch < frame.channels; ch++ ) {
-                    ((float *) outptr)[(hwCount - i - 1) * frame.channels + ch] =
-                        inptr[(i * -speed.n / speed.d) * frame.channels + ch];
-                }
-            }
+
+        if( G_UNLIKELY(self->quit) ) {
+            g_mutex_unlock( &self->mutex );
+            break;
         }
 
+        rational speed = self->playSpeed;
+        rational rate = self->rate;
+        int epoch = self->epoch;
+        int wanted = self->bufferSize * channels;
+
+        ensure_buffer( &straddle, &straddle_capacity, channels );
+
+        // Give the producer up to a period to catch up before we starve the device
+        int64_t deadline = g_get_monotonic_time() +
+            (int64_t) self->bufferSize * G_TIME_SPAN_SECOND * rate.d / rate.n;
+
+        while( audio_ring_get_fill( self->ring ) < wanted && !self->quit && !self->stop &&
+                !self->time_change && g_cond_wait_until( &self->dataCond, &self->mutex, deadline ) );
+
+        g_mutex_unlock( &self->mutex );
+
         // Do this next part under a lock, because the
         // Python thread may want to stop the device/change the config
+        // (and with it, the ring)
         g_mutex_lock( &self->configMutex );
 
-        if( G_UNLIKELY(self->stop) ) {
+        if( G_UNLIKELY(self->stop || channels != self->channelCount) ) {
             g_mutex_unlock( &self->configMutex );
             continue;
         }
 
-        while( hwCount > 0 ) {
-            int error;
+        // Convert from the ring right into the sink; in mmap mode, that's the device's buffer
+        int frames_left = self->bufferSize;
+        bool starved = false, failed = false;
 
-            // BJC: I like someone who makes my life easy:
-            // the ALSA API here is self-limiting
-            error = snd_pcm_writei( self->pcmDevice, outptr, hwCount );
+        while( frames_left > 0 ) {
+            void *area;
+            int frames = self->sink->funcs->begin( self->sink, &area, frames_left );
 
-            if( error == -EAGAIN )
-                continue;
+            if( frames == -EAGAIN || frames == 0 ) {
+                // The device is full; the period can wait if we're stopping
+                if( self->quit || self->stop || self->time_change )
+                    break;
 
-            if( G_UNLIKELY(error == -EPIPE) ) {
-                // Underrun!
-                printf("ALSA playback underrun\n" );
-                snd_pcm_recover( self->pcmDevice, error, 1 );
-                self->nextSample = get_time_frame( &rate, _getPresentationTime( self ) );
-                break;
-            }
+                frames = self->sink->funcs->wait( self->sink, SINK_WAIT_TIMEOUT );
 
-            if( G_UNLIKELY(error < 0) ) {
-                // Other error; check snd_pcm_state()
-                snd_pcm_state_t state = snd_pcm_state( self->pcmDevice );
+                if( frames >= 0 )
+                    continue;
+            }
 
-                switch( state ) {
-                    default:
-                        g_error( "PCM device returned error %d; aborting", state );
+            if( G_UNLIKELY(frames < 0) ) {
+                // Underrun! The ring still has the right data after this,
+                // so recover and keep going
+                if( !_recover( self, frames ) ) {
+                    failed = true;
+                    break;
                 }
+
+                continue;
+            }
+
+            starved |= _fillArea( self, area, frames, straddle, &dither );
+
+            int error = self->sink->funcs->commit( self->sink, frames );
+
+            if( G_UNLIKELY(error < 0) && !_recover( self, error ) ) {
+                failed = true;
+                break;
             }
 
-            outptr += error * frame.channels * sizeof(float);
-            hwCount -= error;
+            frames_left -= frames;
         }
 
+        if( G_UNLIKELY(failed) ) {
+            // The device is gone; the clock keeps running, but there's nothing more to play
+            g_mutex_unlock( &self->configMutex );
+            break;
+        }
+
+        // The source couldn't keep up, so we padded with silence rather than let the device run dry
+        if( G_UNLIKELY(starved) )
+            g_atomic_int_inc( &self->starveCount );
+
         // Reset the clock so that it stays in sync
-        snd_pcm_sframes_t frame_delay;
-        snd_pcm_delay( self->pcmDevice, &frame_delay );
+        int frame_delay = self->sink->funcs->get_delay( self->sink );
 
         g_mutex_lock( &self->mutex );
-        if( !self->stop && !self->time_change ) {
+
+        // We drained the ring; signal under the mutex so the producer can't miss it
+        g_cond_signal( &self->fillCond );
+
+        if( !self->stop && !self->time_change && epoch == self->epoch ) {
+            // What the listener hears now is behind the producer by
+            // everything in the ring plus everything in the device
+            int queued = audio_ring_get_fill( self->ring ) / channels + frame_delay;
+
             self->baseTime = gettime();
-            self->seekTime = get_frame_time( &rate, self->nextSample ) -
-                get_frame_time( &rate, frame_delay ) * speed.n / speed.d;
+            self->seekTime = get_frame_time( &rate, (int) floor( self->producedPosition ) ) -
+                get_frame_time( &rate, queued ) * speed.n / speed.d;
 
-            //printf( "ALSA thread new seek time: %ld (nextSample: %d, hwBufferSize: %lu, avail: %lu, speed: %d)\n", self->seekTime, self->nextSample, hwBufferSize, frame_delay, speed.n );
+            //printf( "ALSA thread new seek time: %ld (queued: %d, speed: %d)\n", self->seekTime, queued, speed.n );
         }
 
-        //printf( "nextSample: %d, hwBufferSize: %d, avail: %d\n", self->nextSample, hwBufferSize, avail );
         g_mutex_unlock( &self->mutex );
 
         g_mutex_unlock( &self->configMutex );
     }
 
-    snd_pcm_drop( self->pcmDevice );
+    self->sink->funcs->drop( self->sink );
+    g_free( straddle );
 
     return NULL;
 }
@@ -242,103 +412,22 @@ playbackThread( py_obj_AlsaPlayer *self ) {
 static bool _setConfig( py_obj_AlsaPlayer *self, unsigned int *ratePtr, unsigned int *channelsPtr ) {
     // This is a Python-only method; we include a raw version here
     // for use inside the init method
+    unsigned int rate = ratePtr ? *ratePtr : 0, channels = channelsPtr ? *channelsPtr : 0;
 
-    int error;
-
-    unsigned int channels = (channelsPtr && *channelsPtr) ? *channelsPtr : 2,
-        rate = (ratePtr && *ratePtr) ? *ratePtr : 48000;
-
-    if( !self->hwParams ) {
-        self->hwParams = PyMem_Malloc( snd_pcm_hw_params_sizeof() );
-
-        if( self->hwParams == NULL ) {
-            PyErr_NoMemory();
-            return false;
-        }
-    }
-    else {
-        if( (error = snd_pcm_drop( self->pcmDevice )) < 0 ) {
-            PyErr_Format( PyExc_Exception, "Could not stop device: %s", snd_strerror( error ) );
-            return false;
-        }
-
-        // Existing config; swipe numbers from it if we can
-        if( channelsPtr && !*channelsPtr ) {
-            if( (error = snd_pcm_hw_params_get_channels( self->hwParams, &channels )) < 0 ) {
-                PyErr_Format( PyExc_Exception, "Could not read channels from existing config: %s", snd_strerror( error ) );
-                return false;
-            }
-        }
-
-        if( ratePtr && !*ratePtr ) {
-            unsigned int num, den;
-
-            if( (error = snd_pcm_hw_params_get_rate_numden( self->hwParams, &num, &den )) < 0 ) {
-                PyErr_Format( PyExc_Exception, "Could not read rate from existing config: %s", snd_strerror( error ) );
-                return false;
-            }
-
-            rate = num / den;
-        }
-    }
-
-    if( (error = snd_pcm_hw_params_any( self->pcmDevice, self->hwParams )) < 0 ) {
-        PyErr_Format( PyExc_Exception, "Could not open configuration for playback: %s", snd_strerror( error ) );
+    if( !self->sink->funcs->configure( self->sink, &rate, &channels ) )
         return false;
-    }
 
-    do {
-        // Whatever happens in here, self->hwParams needs to try to have the current HW state by the end
-        if( (error = snd_pcm_hw_params_set_access( self->pcmDevice, self->hwParams, SND_PCM_ACCESS_RW_INTERLEAVED )) < 0 ) {
-            PyErr_Format( PyExc_Exception, "Failed to set interleaved access: %s", snd_strerror( error ) );
-            break;
-        }
+    self->rate.n = rate;
+    self->rate.d = 1;
+    self->channelCount = channels;
 
-        // Set stereo channels for now
-        if( (error = snd_pcm_hw_params_set_channels_near( self->pcmDevice, self->hwParams, &channels )) < 0 ) {
-            PyErr_Format( PyExc_Exception, "Failed to set channel count: %s", snd_strerror( error ) );
-            break;
-        }
+    if( ratePtr )
+        *ratePtr = rate;
 
-        // Grab what should be an easy-to-find format
-        if( (error = snd_pcm_hw_params_set_format( self->pcmDevice, self->hwParams, SND_PCM_FORMAT_FLOAT )) < 0 ) {
-            PyErr_Format( PyExc_Exception, "Failed to set sample format: %s", snd_strerror( error ) );
-            break;
-        }
-
-        if( (error = snd_pcm_hw_params_set_rate_near( self->pcmDevice, self->hwParams, &rate, NULL )) < 0 ) {
-            PyErr_Format( PyExc_Exception, "Failed to set sample rate: %s", snd_strerror( error ) );
-            break;
-        }
+    if( channelsPtr )
+        *channelsPtr = channels;
 
-        if( (error = snd_pcm_hw_params( self->pcmDevice, self->hwParams )) < 0 ) {
-            PyErr_Format( PyExc_Exception, "Failed to write parameter set: %s", snd_strerror( error ) );
-            break;
-        }
-
-        // Read back config
-        if( (error = snd_pcm_hw_params_current( self->pcmDevice, self->hwParams )) < 0 ) {
-            PyErr_Format( PyExc_Exception, "Could not read current config: %s", snd_strerror( error ) );
-            return false;
-        }
-
-        self->rate.n = rate;
-        self->rate.d = 1;
-        self->channelCount = channels;
-
-        if( ratePtr )
-            *ratePtr = rate;
-
-        if( channelsPtr )
-            *channelsPtr = channels;
-
-        return true;
-    } while( 0 );
-
-    // Emergency get hw state
-    snd_pcm_hw_params_current( self->pcmDevice, self->hwParams );
-    snd_pcm_prepare( self->pcmDevice );
-    return false;
+    return true;
 }
 
 static int
@@ -346,53 +435,85 @@ AlsaPlayer_init( py_obj_AlsaPlayer *self, PyObject *args, PyObject *kw ) {
     PyObject *frameSource = NULL;
 
     unsigned int rate = 0, channels = 0;
-    static char *kwlist[] = { "rate", "channels", "source", NULL };
+    int quality = AUDIO_RESAMPLE_QUALITY_MEDIUM;
+    int64_t latency = DEFAULT_LATENCY;
+    const char *backend = "alsa", *device = NULL, *format_name = NULL;
+    int allow_mmap = 1;
+    static char *kwlist[] = { "rate", "channels", "source", "resample_quality", "latency",
+        "backend", "device", "sample_format", "mmap", NULL };
+
+    if( !PyArg_ParseTupleAndKeywords( args, kw, "|IIOiLszzi", kwlist,
+            &rate, &channels, &frameSource, &quality, &latency,
+            &backend, &device, &format_name, &allow_mmap ) )
+        return -1;
+
+    audio_sink_format format = AUDIO_SINK_FORMAT_AUTO;
+
+    if( format_name && !audio_sink_parse_format( format_name, &format ) ) {
+        PyErr_Format( PyExc_ValueError, "Unknown sample format \"%s\"; expected \"float\", \"s16\", or \"s32\".", format_name );
+        return -1;
+    }
+
+    if( latency <= 0 || latency > MAX_LATENCY ) {
+        PyErr_SetString( PyExc_ValueError, "latency must be greater than zero and no more than one second." );
+        return -1;
+    }
 
-    if( !PyArg_ParseTupleAndKeywords( args, kw, "|IIO", kwlist,
-            &rate, &channels, &frameSource ) )
+    if( quality < 0 || quality >= AUDIO_RESAMPLE_QUALITY_COUNT ) {
+        PyErr_Format( PyExc_ValueError, "resample_quality must be between 0 and %d.", AUDIO_RESAMPLE_QUALITY_COUNT - 1 );
         return -1;
+    }
 
     if( !py_audio_take_source( frameSource, &self->audioSource ) )
         return -1;
 
-    int error;
-    const char *deviceName = "default";
+    if( strcmp( backend, "alsa" ) == 0 ) {
+        self->sink = audio_sink_new_alsa( device ? device : "default", format, allow_mmap );
+    }
+    else if( strcmp( backend, "null" ) == 0 ) {
+        self->sink = audio_sink_new_null( format );
+    }
+    else if( strcmp( backend, "file" ) == 0 ) {
+        if( !device ) {
+            PyErr_SetString( PyExc_ValueError, "The file backend needs a file name in device." );
+            return -1;
+        }
 
-    if( (error = snd_pcm_open( &self->pcmDevice, "default", SND_PCM_STREAM_PLAYBACK, 0 )) < 0 ) {
-        PyErr_Format( PyExc_Exception, "Could not open PCM device %s: %s", deviceName, snd_strerror( error ) );
+        self->sink = audio_sink_new_file( device, format );
+    }
+    else {
+        PyErr_Format( PyExc_ValueError, "Unknown backend \"%s\"; expected \"alsa\", \"null\", or \"file\".", backend );
         return -1;
     }
 
+    if( !self->sink )
+        return -1;
+
     if( !_setConfig( self, &rate, &channels ) )
         return -1;
 
     g_mutex_init( &self->mutex );
     g_mutex_init( &self->configMutex );
     g_cond_init( &self->cond );
+    g_cond_init( &self->fillCond );
+    g_cond_init( &self->dataCond );
     self->stop = true;
     self->playSpeed = (rational) { 0, 1 };
     self->bufferSize = 1024;
     self->time_change = false;
-    self->inBuffer = PyMem_Malloc( self->bufferSize * self->channelCount * sizeof(float) );
+    self->resampleQuality = quality;
+    self->resampler = audio_resampler_new( quality );
+    self->latency = latency;
 
-    if( self->inBuffer == NULL ) {
-        PyErr_NoMemory();
-        return -1;
-    }
-
-    self->outBuffer = PyMem_Malloc( self->bufferSize * self->channelCount * sizeof(float) );
-
-    if( self->outBuffer == NULL ) {
-        PyErr_NoMemory();
-        return -1;
-    }
-
-    self->playbackThread = g_thread_new( "AlsaPlayer playback thread", (GThreadFunc) playbackThread, self );
+    self->ring = _createRing( self );
 
     self->callbacks = NULL;
     g_rw_lock_init( &self->callback_lock );
     g_rw_lock_init( &self->frame_read_rwlock );
 
+    self->playbackThread = g_thread_new( "AlsaPlayer playback thread", (GThreadFunc) playbackThread, self );
+    self->producerThread = g_thread_new( "AlsaPlayer read-ahead thread", (GThreadFunc) producerThread, self );
+
     return 0;
 }
 
@@ -401,38 +522,42 @@ AlsaPlayer_dealloc( py_obj_AlsaPlayer *self ) {
     g_mutex_lock( &self->mutex );
     self->quit = true;
     g_cond_signal( &self->cond );
+    g_cond_signal( &self->fillCond );
+    g_cond_signal( &self->dataCond );
     g_mutex_unlock( &self->mutex );
 
-    py_audio_take_source( NULL, &self->audioSource );
+    if( self->producerThread != NULL ) {
+        g_thread_join( self->producerThread );
+        self->producerThread = NULL;
+    }
 
     if( self->playbackThread != NULL ) {
         g_thread_join( self->playbackThread );
         self->playbackThread = NULL;
     }
 
-    if( self->inBuffer != NULL ) {
-        PyMem_Free( self->inBuffer );
-        self->inBuffer = NULL;
-    }
+    py_audio_take_source( NULL, &self->audioSource );
 
-    if( self->outBuffer != NULL ) {
-        PyMem_Free( self->outBuffer );
-        self->inBuffer = NULL;
+    if( self->ring != NULL ) {
+        audio_ring_free( self->ring );
+        self->ring = NULL;
     }
 
-    if( self->hwParams != NULL ) {
-        PyMem_Free( self->hwParams );
-        self->hwParams = NULL;
+    if( self->resampler != NULL ) {
+        audio_resampler_free( self->resampler );
+        self->resampler = NULL;
     }
 
-    if( self->pcmDevice != NULL ) {
-        snd_pcm_close( self->pcmDevice );
-        self->pcmDevice = NULL;
+    if( self->sink != NULL ) {
+        self->sink->funcs->free( self->sink );
+        self->sink = NULL;
     }
 
     g_mutex_clear( &self->configMutex );
     g_mutex_clear( &self->mutex );
     g_cond_clear( &self->cond );
+    g_cond_clear( &self->fillCond );
+    g_cond_clear( &self->dataCond );
 
     // Free the callback list
     while( self->callbacks ) {
@@ -465,6 +590,20 @@ static PyObject *AlsaPlayer_setConfig( py_obj_AlsaPlayer *self, PyObject *args,
         g_mutex_unlock( &self->configMutex );
         return NULL;
     }
+
+    // Anything read ahead was rendered for the old format; the playback
+    // thread can't be reading the ring while we hold the config lock, and
+    // the producer only writes it under the mutex
+    g_mutex_lock( &self->mutex );
+    audio_ring_free( self->ring );
+    self->ring = _createRing( self );
+    self->epoch++;
+    self->nextSample = get_time_frame( &self->rate, _getPresentationTime_nolock( self ) );
+    self->time_change = true;
+    g_cond_signal( &self->cond );
+    g_cond_signal( &self->fillCond );
+    g_mutex_unlock( &self->mutex );
+
     g_mutex_unlock( &self->configMutex );
 
     return Py_BuildValue( "II", rate, channels );
@@ -514,6 +653,7 @@ _set( py_obj_AlsaPlayer *self, int64_t seek_time, rational *speed ) {
     seek_time = self->seekTime;
     self->time_change = true;
     g_cond_signal( &self->cond );
+    g_cond_signal( &self->fillCond );
     g_mutex_unlock( &self->mutex );
 
     // Call callbacks (taking the lock here *might* not be the best idea)
@@ -617,8 +757,141 @@ AlsaPlayer_getFuncs( py_obj_AlsaPlayer *self, void *closure ) {
     return pysourceFuncs;
 }
 
+static PyObject *
+AlsaPlayer_get_resample_quality( py_obj_AlsaPlayer *self, void *closure ) {
+    g_mutex_lock( &self->mutex );
+    int quality = self->resampleQuality;
+    g_mutex_unlock( &self->mutex );
+
+    return PyLong_FromLong( quality );
+}
+
+static int
+AlsaPlayer_set_resample_quality( py_obj_AlsaPlayer *self, PyObject *value, void *closure ) {
+    if( value == NULL ) {
+        PyErr_SetString( PyExc_TypeError, "Cannot delete resample_quality." );
+        return -1;
+    }
+
+    long quality = PyLong_AsLong( value );
+
+    if( quality == -1 && PyErr_Occurred() )
+        return -1;
+
+    if( quality < 0 || quality >= AUDIO_RESAMPLE_QUALITY_COUNT ) {
+        PyErr_Format( PyExc_ValueError, "resample_quality must be between 0 and %d.", AUDIO_RESAMPLE_QUALITY_COUNT - 1 );
+        return -1;
+    }
+
+    // The read-ahead thread picks this up on its next period
+    g_mutex_lock( &self->mutex );
+    self->resampleQuality = (int) quality;
+    g_mutex_unlock( &self->mutex );
+
+    return 0;
+}
+
+static PyObject *
+AlsaPlayer_get_latency( py_obj_AlsaPlayer *self, void *closure ) {
+    g_mutex_lock( &self->mutex );
+    int64_t latency = self->latency;
+    g_mutex_unlock( &self->mutex );
+
+    return PyLong_FromLongLong( latency );
+}
+
+static int
+AlsaPlayer_set_latency( py_obj_AlsaPlayer *self, PyObject *value, void *closure ) {
+    if( value == NULL ) {
+        PyErr_SetString( PyExc_TypeError, "Cannot delete latency." );
+        return -1;
+    }
+
+    long long latency = PyLong_AsLongLong( value );
+
+    if( latency == -1 && PyErr_Occurred() )
+        return -1;
+
+    if( latency <= 0 || latency > MAX_LATENCY ) {
+        PyErr_SetString( PyExc_ValueError, "latency must be greater than zero and no more than one second." );
+        return -1;
+    }
+
+    g_mutex_lock( &self->mutex );
+    self->latency = latency;
+    g_cond_signal( &self->fillCond );
+    g_mutex_unlock( &self->mutex );
+
+    return 0;
+}
+
+static PyObject *
+AlsaPlayer_get_underruns( py_obj_AlsaPlayer *self, void *closure ) {
+    return PyLong_FromLong( g_atomic_int_get( &self->underrunCount ) );
+}
+
+static PyObject *
+AlsaPlayer_get_starvations( py_obj_AlsaPlayer *self, void *closure ) {
+    return PyLong_FromLong( g_atomic_int_get( &self->starveCount ) );
+}
+
+static PyObject *
+AlsaPlayer_get_device_error( py_obj_AlsaPlayer *self, void *closure ) {
+    int error = g_atomic_int_get( &self->deviceError );
+
+    if( !error )
+        Py_RETURN_NONE;
+
+    return PyObject_CallFunction( PyExc_OSError, "is", -error, g_strerror( -error ) );
+}
+
+static PyObject *
+AlsaPlayer_get_fill_level( py_obj_AlsaPlayer *self, void *closure ) {
+    g_mutex_lock( &self->configMutex );
+    g_mutex_lock( &self->mutex );
+    int samples = audio_ring_get_fill( self->ring ) / self->channelCount;
+    g_mutex_unlock( &self->mutex );
+    g_mutex_unlock( &self->configMutex );
+
+    return PyLong_FromLong( samples );
+}
+
+static PyObject *
+AlsaPlayer_get_sample_format( py_obj_AlsaPlayer *self, void *closure ) {
+    g_mutex_lock( &self->configMutex );
+    const char *name = audio_sink_format_name( self->sink->format );
+    g_mutex_unlock( &self->configMutex );
+
+    return PyUnicode_FromString( name );
+}
+
+static PyObject *
+AlsaPlayer_get_mmap( py_obj_AlsaPlayer *self, void *closure ) {
+    g_mutex_lock( &self->configMutex );
+    bool mmap = self->sink->mmap;
+    g_mutex_unlock( &self->configMutex );
+
+    return PyBool_FromLong( mmap );
+}
+
 static PyGetSetDef AlsaPlayer_getsetters[] = {
     { PRESENTATION_CLOCK_FUNCS, (getter) AlsaPlayer_getFuncs, NULL, "Presentation clock C API." },
+    { "resample_quality", (getter) AlsaPlayer_get_resample_quality, (setter) AlsaPlayer_set_resample_quality,
+        "Quality of the varispeed resampler used when playing at other than normal speed, from 0 (linear interpolation) to 3 (best)." },
+    { "latency", (getter) AlsaPlayer_get_latency, (setter) AlsaPlayer_set_latency,
+        "How far ahead of the device, in nanoseconds, audio is read from the source." },
+    { "underruns", (getter) AlsaPlayer_get_underruns, NULL,
+        "Number of times the sound device ran out of data." },
+    { "starvations", (getter) AlsaPlayer_get_starvations, NULL,
+        "Number of periods padded with silence because the source fell behind the read-ahead." },
+    { "device_error", (getter) AlsaPlayer_get_device_error, NULL,
+        "None, or an OSError for the device error that stopped playback." },
+    { "fill_level", (getter) AlsaPlayer_get_fill_level, NULL,
+        "Number of samples currently read ahead of the device." },
+    { "sample_format", (getter) AlsaPlayer_get_sample_format, NULL,
+        "Sample format sent to the device: \"float\", \"s16\", or \"s32\"." },
+    { "mmap", (getter) AlsaPlayer_get_mmap, NULL,
+        "True if samples are written directly into the device's buffer." },
     { NULL }
 };
 
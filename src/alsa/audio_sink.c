@@ -0,0 +1,570 @@
+/*
+    This file is part of the Fluggo Media Library for high-quality
+    video and audio processing.
+
+    Copyright 2012 Brian J. Crowell <brian@fluggo.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "audio_sink.h"
+#include <asoundlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#undef G_LOG_DOMAIN
+#define G_LOG_DOMAIN "fluggo.media.alsa.audio_sink"
+
+#define DEFAULT_RATE        48000
+#define DEFAULT_CHANNELS    2
+
+// Size of the bounce buffer for sinks that can't hand out their own memory
+#define STAGING_FRAMES      4096
+
+static const struct {
+    const char *name;
+    int sample_size;
+    snd_pcm_format_t alsa_format;
+} format_table[AUDIO_SINK_FORMAT_COUNT] = {
+    { "float", sizeof(float), SND_PCM_FORMAT_FLOAT },
+    { "s16", sizeof(int16_t), SND_PCM_FORMAT_S16 },
+    { "s32", sizeof(int32_t), SND_PCM_FORMAT_S32 },
+};
+
+const char *
+audio_sink_format_name( audio_sink_format format ) {
+    if( format < 0 || format >= AUDIO_SINK_FORMAT_COUNT )
+        return NULL;
+
+    return format_table[format].name;
+}
+
+bool
+audio_sink_parse_format( const char *name, audio_sink_format *format ) {
+    for( int i = 0; i < AUDIO_SINK_FORMAT_COUNT; i++ ) {
+        if( strcmp( name, format_table[i].name ) == 0 ) {
+            *format = (audio_sink_format) i;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static void
+choose_rate_channels( audio_sink *self, unsigned int *rate, unsigned int *channels ) {
+    // Zero means "keep what we have," or the default if we have nothing
+    if( !*rate )
+        *rate = self->rate ? self->rate : DEFAULT_RATE;
+
+    if( !*channels )
+        *channels = self->channels ? self->channels : DEFAULT_CHANNELS;
+}
+
+/******** ALSA sink ********/
+
+typedef struct {
+    audio_sink sink;
+
+    snd_pcm_t *pcm;
+    snd_pcm_hw_params_t *hw_params;
+    audio_sink_format requested_format;
+    bool allow_mmap;
+
+    // Offset of the area handed out by begin, in mmap mode
+    snd_pcm_uframes_t mmap_offset;
+
+    // Bounce buffer for read/write mode
+    void *staging;
+} alsa_sink;
+
+static bool
+alsa_sink_configure( audio_sink *sink, unsigned int *ratePtr, unsigned int *channelsPtr ) {
+    alsa_sink *self = (alsa_sink *) sink;
+    int error;
+    unsigned int rate = *ratePtr, channels = *channelsPtr;
+
+    choose_rate_channels( &self->sink, &rate, &channels );
+
+    if( self->hw_params ) {
+        if( (error = snd_pcm_drop( self->pcm )) < 0 ) {
+            PyErr_Format( PyExc_Exception, "Could not stop device: %s", snd_strerror( error ) );
+            return false;
+        }
+    }
+    else {
+        self->hw_params = PyMem_Malloc( snd_pcm_hw_params_sizeof() );
+
+        if( self->hw_params == NULL ) {
+            PyErr_NoMemory();
+            return false;
+        }
+    }
+
+    if( (error = snd_pcm_hw_params_any( self->pcm, self->hw_params )) < 0 ) {
+        PyErr_Format( PyExc_Exception, "Could not open configuration for playback: %s", snd_strerror( error ) );
+        return false;
+    }
+
+    do {
+        // Whatever happens in here, self->hw_params needs to try to have the current HW state by the end
+
+        // Writing straight into the device's buffer saves a copy; not every device can do it
+        bool mmap = self->allow_mmap &&
+            snd_pcm_hw_params_test_access( self->pcm, self->hw_params, SND_PCM_ACCESS_MMAP_INTERLEAVED ) == 0;
+
+        if( (error = snd_pcm_hw_params_set_access( self->pcm, self->hw_params,
+                mmap ? SND_PCM_ACCESS_MMAP_INTERLEAVED : SND_PCM_ACCESS_RW_INTERLEAVED )) < 0 ) {
+            PyErr_Format( PyExc_Exception, "Failed to set interleaved access: %s", snd_strerror( error ) );
+            break;
+        }
+
+        if( (error = snd_pcm_hw_params_set_channels_near( self->pcm, self->hw_params, &channels )) < 0 ) {
+            PyErr_Format( PyExc_Exception, "Failed to set channel count: %s", snd_strerror( error ) );
+            break;
+        }
+
+        // Prefer float, since that's what we have, but take integers if that's all the hardware does
+        audio_sink_format format = self->requested_format;
+
+        if( format == AUDIO_SINK_FORMAT_AUTO ) {
+            for( format = AUDIO_SINK_FORMAT_FLOAT; format < AUDIO_SINK_FORMAT_COUNT; format++ ) {
+                if( snd_pcm_hw_params_test_format( self->pcm, self->hw_params, format_table[format].alsa_format ) == 0 )
+                    break;
+            }
+
+            if( format == AUDIO_SINK_FORMAT_COUNT ) {
+                PyErr_SetString( PyExc_Exception, "Device doesn't support float, 32-bit, or 16-bit samples." );
+                break;
+            }
+        }
+
+        if( (error = snd_pcm_hw_params_set_format( self->pcm, self->hw_params, format_table[format].alsa_format )) < 0 ) {
+            PyErr_Format( PyExc_Exception, "Failed to set sample format: %s", snd_strerror( error ) );
+            break;
+        }
+
+        if( (error = snd_pcm_hw_params_set_rate_near( self->pcm, self->hw_params, &rate, NULL )) < 0 ) {
+            PyErr_Format( PyExc_Exception, "Failed to set sample rate: %s", snd_strerror( error ) );
+            break;
+        }
+
+        if( (error = snd_pcm_hw_params( self->pcm, self->hw_params )) < 0 ) {
+            PyErr_Format( PyExc_Exception, "Failed to write parameter set: %s", snd_strerror( error ) );
+            break;
+        }
+
+        // Read back config
+        if( (error = snd_pcm_hw_params_current( self->pcm, self->hw_params )) < 0 ) {
+            PyErr_Format( PyExc_Exception, "Could not read current config: %s", snd_strerror( error ) );
+            return false;
+        }
+
+        self->sink.format = format;
+        self->sink.rate = rate;
+        self->sink.channels = channels;
+        self->sink.frame_size = format_table[format].sample_size * channels;
+        self->sink.mmap = mmap;
+
+        g_free( self->staging );
+        self->staging = mmap ? NULL : g_malloc( STAGING_FRAMES * self->sink.frame_size );
+
+        *ratePtr = rate;
+        *channelsPtr = channels;
+
+        return true;
+    } while( 0 );
+
+    // Emergency get hw state
+    snd_pcm_hw_params_current( self->pcm, self->hw_params );
+    snd_pcm_prepare( self->pcm );
+    return false;
+}
+
+static int
+alsa_sink_begin( audio_sink *sink, void **area, int frames ) {
+    alsa_sink *self = (alsa_sink *) sink;
+
+    if( !self->sink.mmap ) {
+        // BJC: I like someone who makes my life easy:
+        // the ALSA API here is self-limiting, so just hand out the bounce buffer
+        *area = self->staging;
+        return min( frames, STAGING_FRAMES );
+    }
+
+    snd_pcm_sframes_t avail = snd_pcm_avail_update( self->pcm );
+
+    if( avail < 0 )
+        return (int) avail;
+
+    if( avail == 0 ) {
+        // Full; wait for the device to make room
+        int error = snd_pcm_wait( self->pcm, 100 );
+
+        if( error < 0 )
+            return error;
+
+        if( (avail = snd_pcm_avail_update( self->pcm )) <= 0 )
+            return (int) avail;
+    }
+
+    const snd_pcm_channel_area_t *areas;
+    snd_pcm_uframes_t count = min( frames, (int) avail );
+    int error = snd_pcm_mmap_begin( self->pcm, &areas, &self->mmap_offset, &count );
+
+    if( error < 0 )
+        return error;
+
+    // Interleaved, so the first channel's area covers them all
+    *area = (uint8_t *) areas[0].addr + (areas[0].first + self->mmap_offset * areas[0].step) / 8;
+    return (int) count;
+}
+
+static int
+alsa_sink_commit( audio_sink *sink, int frames ) {
+    alsa_sink *self = (alsa_sink *) sink;
+
+    if( !self->sink.mmap ) {
+        uint8_t *ptr = self->staging;
+
+        while( frames > 0 ) {
+            snd_pcm_sframes_t result = snd_pcm_writei( self->pcm, ptr, frames );
+
+            if( result == -EAGAIN )
+                continue;
+
+            if( result < 0 )
+                return (int) result;
+
+            ptr += result * self->sink.frame_size;
+            frames -= result;
+        }
+
+        return 0;
+    }
+
+    snd_pcm_sframes_t result = snd_pcm_mmap_commit( self->pcm, self->mmap_offset, frames );
+
+    if( result < 0 )
+        return (int) result;
+
+    if( result != frames )
+        return -EPIPE;
+
+    // Nothing starts an mmap stream for us
+    if( snd_pcm_state( self->pcm ) == SND_PCM_STATE_PREPARED ) {
+        int error = snd_pcm_start( self->pcm );
+
+        if( error < 0 )
+            return error;
+    }
+
+    return 0;
+}
+
+static int
+alsa_sink_wait( audio_sink *sink, int timeout ) {
+    alsa_sink *self = (alsa_sink *) sink;
+
+    int error = snd_pcm_wait( self->pcm, timeout );
+
+    return (error < 0) ? error : 0;
+}
+
+static int
+alsa_sink_recover( audio_sink *sink, int error ) {
+    alsa_sink *self = (alsa_sink *) sink;
+
+    return snd_pcm_recover( self->pcm, error, 1 );
+}
+
+static void
+alsa_sink_drop( audio_sink *sink ) {
+    alsa_sink *self = (alsa_sink *) sink;
+
+    snd_pcm_drop( self->pcm );
+    snd_pcm_prepare( self->pcm );
+}
+
+static int
+alsa_sink_get_delay( audio_sink *sink ) {
+    alsa_sink *self = (alsa_sink *) sink;
+
+    snd_pcm_sframes_t delay;
+
+    if( snd_pcm_delay( self->pcm, &delay ) < 0 || delay < 0 )
+        return 0;
+
+    return (int) delay;
+}
+
+static void
+alsa_sink_free( audio_sink *sink ) {
+    alsa_sink *self = (alsa_sink *) sink;
+
+    if( self->pcm != NULL ) {
+        snd_pcm_drop( self->pcm );
+        snd_pcm_close( self->pcm );
+    }
+
+    if( self->hw_params != NULL )
+        PyMem_Free( self->hw_params );
+
+    g_free( self->staging );
+    g_slice_free( alsa_sink, self );
+}
+
+static const audio_sink_funcs alsa_sink_funcs = {
+    .configure = alsa_sink_configure,
+    .begin = alsa_sink_begin,
+    .commit = alsa_sink_commit,
+    .wait = alsa_sink_wait,
+    .recover = alsa_sink_recover,
+    .drop = alsa_sink_drop,
+    .get_delay = alsa_sink_get_delay,
+    .free = alsa_sink_free,
+};
+
+/*
+    Function: audio_sink_new_alsa
+    Opens an ALSA playback device.
+
+    device - ALSA device name, such as "default".
+    format - Sample format to insist on, or AUDIO_SINK_FORMAT_AUTO to take the
+        best one the device offers.
+    allow_mmap - True to write directly into the device's buffer when the device allows it.
+
+    The sink isn't usable until it's configured. On failure, sets a Python exception and returns NULL.
+*/
+audio_sink *
+audio_sink_new_alsa( const char *device, audio_sink_format format, bool allow_mmap ) {
+    alsa_sink *self = g_slice_new0( alsa_sink );
+    int error;
+
+    self->sink.funcs = &alsa_sink_funcs;
+    self->sink.format = AUDIO_SINK_FORMAT_AUTO;
+    self->requested_format = format;
+    self->allow_mmap = allow_mmap;
+
+    if( (error = snd_pcm_open( &self->pcm, device, SND_PCM_STREAM_PLAYBACK, 0 )) < 0 ) {
+        PyErr_Format( PyExc_Exception, "Could not open PCM device %s: %s", device, snd_strerror( error ) );
+        self->pcm = NULL;
+        alsa_sink_free( &self->sink );
+        return NULL;
+    }
+
+    return &self->sink;
+}
+
+/******** Null and file sinks ********/
+
+// Pretend device buffer for the paced sinks, in nanoseconds
+#define PACED_BUFFER_TIME   (NS_PER_SEC / 10)
+
+/*
+    The null and file sinks eat samples at the sample rate, like a real device
+    would, so the presentation clock behaves the same as it does on hardware.
+*/
+typedef struct {
+    audio_sink sink;
+
+    FILE *file;
+    void *staging;
+
+    bool started;
+    int64_t start_time, frames_written;
+} paced_sink;
+
+static bool
+paced_sink_configure( audio_sink *sink, unsigned int *rate, unsigned int *channels ) {
+    paced_sink *self = (paced_sink *) sink;
+    audio_sink_format format = self->sink.format;
+
+    choose_rate_channels( &self->sink, rate, channels );
+
+    self->sink.rate = *rate;
+    self->sink.channels = *channels;
+    self->sink.frame_size = format_table[format].sample_size * *channels;
+
+    g_free( self->staging );
+    self->staging = g_malloc( STAGING_FRAMES * self->sink.frame_size );
+
+    self->started = false;
+    self->frames_written = 0;
+
+    return true;
+}
+
+static int64_t
+paced_sink_get_queued( paced_sink *self ) {
+    if( !self->started )
+        return self->frames_written;
+
+    int64_t elapsed = (gettime() - self->start_time) * self->sink.rate / NS_PER_SEC;
+    return self->frames_written - elapsed;
+}
+
+static int
+paced_sink_begin( audio_sink *sink, void **area, int frames ) {
+    paced_sink *self = (paced_sink *) sink;
+
+    const int64_t buffer_frames = PACED_BUFFER_TIME * self->sink.rate / NS_PER_SEC;
+    int64_t queued = paced_sink_get_queued( self );
+
+    if( queued < 0 )
+        return -EPIPE;
+
+    if( queued >= buffer_frames ) {
+        // Sleep until the pretend device has room for at least part of this request
+        int64_t wait_frames = queued - buffer_frames + min( frames, (int)(buffer_frames / 2) );
+        g_usleep( (gulong)(wait_frames * G_USEC_PER_SEC / self->sink.rate) );
+
+        queued = paced_sink_get_queued( self );
+    }
+
+    *area = self->staging;
+    return clamp( (int)(buffer_frames - queued), 0, min( frames, STAGING_FRAMES ) );
+}
+
+static int
+paced_sink_commit( audio_sink *sink, int frames ) {
+    paced_sink *self = (paced_sink *) sink;
+
+    if( self->file && fwrite( self->staging, self->sink.frame_size, frames, self->file ) != (size_t) frames )
+        return -EIO;
+
+    if( !self->started ) {
+        self->started = true;
+        self->start_time = gettime();
+    }
+
+    self->frames_written += frames;
+    return 0;
+}
+
+static int
+paced_sink_wait( audio_sink *sink, int timeout ) {
+    paced_sink *self = (paced_sink *) sink;
+
+    const int64_t buffer_frames = PACED_BUFFER_TIME * self->sink.rate / NS_PER_SEC;
+    int64_t wait_frames = paced_sink_get_queued( self ) - buffer_frames + 1;
+
+    if( wait_frames > 0 ) {
+        int64_t usec = min( (int)(wait_frames * G_USEC_PER_SEC / self->sink.rate), timeout * 1000 );
+        g_usleep( (gulong) usec );
+    }
+
+    return 0;
+}
+
+static int
+paced_sink_recover( audio_sink *sink, int error ) {
+    paced_sink *self = (paced_sink *) sink;
+
+    if( error != -EPIPE )
+        return error;
+
+    self->started = false;
+    self->frames_written = 0;
+    return 0;
+}
+
+static void
+paced_sink_drop( audio_sink *sink ) {
+    paced_sink *self = (paced_sink *) sink;
+
+    self->started = false;
+    self->frames_written = 0;
+
+    if( self->file )
+        fflush( self->file );
+}
+
+static int
+paced_sink_get_delay( audio_sink *sink ) {
+    paced_sink *self = (paced_sink *) sink;
+
+    int64_t queued = paced_sink_get_queued( self );
+
+    return queued > 0 ? (int) queued : 0;
+}
+
+static void
+paced_sink_free( audio_sink *sink ) {
+    paced_sink *self = (paced_sink *) sink;
+
+    if( self->file )
+        fclose( self->file );
+
+    g_free( self->staging );
+    g_slice_free( paced_sink, self );
+}
+
+static const audio_sink_funcs paced_sink_funcs = {
+    .configure = paced_sink_configure,
+    .begin = paced_sink_begin,
+    .commit = paced_sink_commit,
+    .wait = paced_sink_wait,
+    .recover = paced_sink_recover,
+    .drop = paced_sink_drop,
+    .get_delay = paced_sink_get_delay,
+    .free = paced_sink_free,
+};
+
+static paced_sink *
+paced_sink_new( audio_sink_format format ) {
+    paced_sink *self = g_slice_new0( paced_sink );
+
+    self->sink.funcs = &paced_sink_funcs;
+    self->sink.format = (format == AUDIO_SINK_FORMAT_AUTO) ? AUDIO_SINK_FORMAT_FLOAT : format;
+
+    return self;
+}
+
+/*
+    Function: audio_sink_new_null
+    Creates a sink that throws samples away in real time.
+
+    format - Sample format to convert to before throwing the samples away.
+*/
+audio_sink *
+audio_sink_new_null( audio_sink_format format ) {
+    return &paced_sink_new( format )->sink;
+}
+
+/*
+    Function: audio_sink_new_file
+    Creates a sink that writes raw interleaved samples to a file in real time.
+
+    path - Name of the file to write. It's created or truncated.
+    format - Sample format to write.
+
+    On failure, sets a Python exception and returns NULL.
+*/
+audio_sink *
+audio_sink_new_file( const char *path, audio_sink_format format ) {
+    FILE *file = fopen( path, "wb" );
+
+    if( !file ) {
+        PyErr_SetFromErrnoWithFilename( PyExc_IOError, path );
+        return NULL;
+    }
+
+    paced_sink *self = paced_sink_new( format );
+    self->file = file;
+
+    return &self->sink;
+}
+
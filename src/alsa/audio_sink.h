@@ -0,0 +1,81 @@
+/*
+    This file is part of the Fluggo Media Library for high-quality
+    video and audio processing.
+
+    Copyright 2012 Brian J. Crowell <brian@fluggo.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#if !defined(fluggo_audio_sink)
+#define fluggo_audio_sink
+
+#include "pyframework.h"
+
+/*
+    Audio sinks
+
+    An audio sink is where AlsaPlayer's playback thread sends finished samples.
+    The sink hands out a piece of its own buffer with begin, the caller fills
+    it with interleaved samples in the sink's format, and commit sends it on.
+    For an ALSA device in mmap mode, that buffer is the device's ring itself.
+    If begin has no room to hand out, wait blocks until there is some or the
+    timeout (in milliseconds) passes.
+
+    configure is called from Python and sets a Python exception on failure.
+    Everything else is called from the playback thread and returns a negative
+    errno on failure; -EPIPE means an underrun, which recover can fix.
+*/
+
+typedef enum {
+    AUDIO_SINK_FORMAT_AUTO = -1,
+    AUDIO_SINK_FORMAT_FLOAT,
+    AUDIO_SINK_FORMAT_S16,
+    AUDIO_SINK_FORMAT_S32,
+    AUDIO_SINK_FORMAT_COUNT
+} audio_sink_format;
+
+typedef struct audio_sink_t audio_sink;
+
+typedef struct {
+    bool (*configure)( audio_sink *self, unsigned int *rate, unsigned int *channels );
+    int (*begin)( audio_sink *self, void **area, int frames );
+    int (*commit)( audio_sink *self, int frames );
+    int (*wait)( audio_sink *self, int timeout );
+    int (*recover)( audio_sink *self, int error );
+    void (*drop)( audio_sink *self );
+    int (*get_delay)( audio_sink *self );
+    void (*free)( audio_sink *self );
+} audio_sink_funcs;
+
+struct audio_sink_t {
+    const audio_sink_funcs *funcs;
+
+    // Current configuration
+    audio_sink_format format;
+    unsigned int rate, channels;
+    int frame_size;
+
+    // True if begin hands out the device's own buffer
+    bool mmap;
+};
+
+audio_sink *audio_sink_new_alsa( const char *device, audio_sink_format format, bool allow_mmap );
+audio_sink *audio_sink_new_null( audio_sink_format format );
+audio_sink *audio_sink_new_file( const char *path, audio_sink_format format );
+
+const char *audio_sink_format_name( audio_sink_format format );
+bool audio_sink_parse_format( const char *name, audio_sink_format *format );
+
+#endif
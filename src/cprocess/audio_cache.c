@@ -0,0 +1,253 @@
+/*
+    This file is part of the Fluggo Media Library for high-quality
+    video and audio processing.
+
+    Copyright 2012 Brian J. Crowell <brian@fluggo.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <string.h>
+#include "framework.h"
+
+typedef struct {
+    int64_t index;
+    float *data;
+
+    // Samples in the block that hold decoded audio, [valid_min, valid_max)
+    int valid_min, valid_max;
+
+    GList link;
+} cache_block;
+
+struct audio_block_cache_t {
+    int channels, block_size;
+    int64_t max_size, used;
+
+    // Blocks by index, most recently used at the head of lru
+    GHashTable *blocks;
+    GQueue lru;
+
+    int64_t hits, misses;
+};
+
+static void
+cache_block_free( cache_block *block ) {
+    g_free( block->data );
+    g_slice_free( cache_block, block );
+}
+
+static int64_t
+block_bytes( audio_block_cache *self ) {
+    return (int64_t) sizeof(float) * self->channels * self->block_size;
+}
+
+// Block holding the given sample, rounding toward negative infinity
+static int64_t
+block_of( audio_block_cache *self, int64_t sample ) {
+    return (sample >= 0) ? sample / self->block_size : -((-sample - 1) / self->block_size) - 1;
+}
+
+static void
+cache_trim( audio_block_cache *self, int64_t size ) {
+    while( self->used > size && !g_queue_is_empty( &self->lru ) ) {
+        cache_block *block = (cache_block*) g_queue_peek_tail_link( &self->lru )->data;
+
+        g_queue_unlink( &self->lru, &block->link );
+        self->used -= block_bytes( self );
+
+        // The hash table frees the block
+        g_hash_table_remove( self->blocks, &block->index );
+    }
+}
+
+/*
+    Function: audio_block_cache_new
+    Creates an empty cache.
+
+    channels - Number of interleaved channels in the samples to be stored.
+    block_size - Samples per block. Requests are answered in whole blocks, so
+        this should be somewhere near a typical request, say 4096 samples.
+    max_size - Most memory, in bytes, to spend on samples.
+*/
+EXPORT audio_block_cache *
+audio_block_cache_new( int channels, int block_size, int64_t max_size ) {
+    g_assert( channels > 0 );
+    g_assert( block_size > 0 );
+
+    audio_block_cache *self = g_slice_new0( audio_block_cache );
+
+    self->channels = channels;
+    self->block_size = block_size;
+    self->max_size = max_size;
+    self->blocks = g_hash_table_new_full( g_int64_hash, g_int64_equal, NULL, (GDestroyNotify) cache_block_free );
+    g_queue_init( &self->lru );
+
+    return self;
+}
+
+EXPORT void
+audio_block_cache_free( audio_block_cache *self ) {
+    if( !self )
+        return;
+
+    g_queue_init( &self->lru );
+    g_hash_table_destroy( self->blocks );
+    g_slice_free( audio_block_cache, self );
+}
+
+EXPORT int64_t
+audio_block_cache_get_max_size( audio_block_cache *self ) {
+    return self->max_size;
+}
+
+EXPORT void
+audio_block_cache_set_max_size( audio_block_cache *self, int64_t max_size ) {
+    self->max_size = max_size;
+    cache_trim( self, max_size );
+}
+
+/*
+    Function: audio_block_cache_put
+    Stores decoded samples.
+
+    start_sample - Index of the first sample in data.
+    count - Number of samples in data.
+    data - Interleaved samples, with as many channels as the cache was created with.
+
+    Each block tracks one run of valid samples. Samples that overlap or extend
+    a block's run are added to it; samples that don't touch it replace it,
+    since whatever was just decoded is the likeliest to be asked for again.
+*/
+EXPORT void
+audio_block_cache_put( audio_block_cache *self, int64_t start_sample, int count, const float *data ) {
+    if( count <= 0 || block_bytes( self ) > self->max_size )
+        return;
+
+    int64_t end_sample = start_sample + count;
+
+    for( int64_t index = block_of( self, start_sample ); index <= block_of( self, end_sample - 1 ); index++ ) {
+        int64_t block_start = index * self->block_size;
+        int put_min = (int) (max( start_sample, block_start ) - block_start);
+        int put_max = (int) (min( end_sample, block_start + self->block_size ) - block_start);
+
+        cache_block *block = (cache_block*) g_hash_table_lookup( self->blocks, &index );
+
+        if( block ) {
+            g_queue_unlink( &self->lru, &block->link );
+        }
+        else {
+            block = g_slice_new0( cache_block );
+            block->index = index;
+            block->data = g_new( float, self->channels * self->block_size );
+            block->link.data = block;
+
+            g_hash_table_insert( self->blocks, &block->index, block );
+            self->used += block_bytes( self );
+        }
+
+        g_queue_push_head_link( &self->lru, &block->link );
+
+        if( block->valid_max > block->valid_min && put_max >= block->valid_min && put_min <= block->valid_max ) {
+            block->valid_min = min( block->valid_min, put_min );
+            block->valid_max = max( block->valid_max, put_max );
+        }
+        else {
+            block->valid_min = put_min;
+            block->valid_max = put_max;
+        }
+
+        memcpy( block->data + put_min * self->channels,
+            data + (block_start + put_min - start_sample) * self->channels,
+            sizeof(float) * self->channels * (put_max - put_min) );
+    }
+
+    cache_trim( self, self->max_size );
+}
+
+/*
+    Function: audio_block_cache_get
+    Fills a frame from the cache, if the cache has all of it.
+
+    Returns true and sets the frame's current range to its full range if every
+    sample was there. Otherwise, returns false and leaves the frame alone, and
+    the caller should decode it.
+*/
+EXPORT bool
+audio_block_cache_get( audio_block_cache *self, audio_frame *frame ) {
+    int64_t first = block_of( self, frame->full_min_sample ),
+        last = block_of( self, frame->full_max_sample );
+
+    // Check before touching anything
+    for( int64_t index = first; index <= last; index++ ) {
+        cache_block *block = (cache_block*) g_hash_table_lookup( self->blocks, &index );
+        int64_t block_start = index * self->block_size;
+
+        if( !block ||
+                block_start + block->valid_min > max( frame->full_min_sample, block_start ) ||
+                block_start + block->valid_max < min( (int64_t) frame->full_max_sample + 1, block_start + self->block_size ) ) {
+            self->misses++;
+            return false;
+        }
+    }
+
+    for( int64_t index = first; index <= last; index++ ) {
+        cache_block *block = (cache_block*) g_hash_table_lookup( self->blocks, &index );
+        int64_t block_start = index * self->block_size;
+        int64_t start = max( frame->full_min_sample, block_start );
+        int64_t end = min( (int64_t) frame->full_max_sample + 1, block_start + self->block_size );
+
+        g_queue_unlink( &self->lru, &block->link );
+        g_queue_push_head_link( &self->lru, &block->link );
+
+        const float *in = block->data + (start - block_start) * self->channels;
+        float *out = audio_get_sample( frame, (int) start, 0 );
+
+        if( frame->channels == self->channels ) {
+            memcpy( out, in, sizeof(float) * self->channels * (end - start) );
+            continue;
+        }
+
+        for( int64_t sample = start; sample < end; sample++ ) {
+            for( int channel = 0; channel < frame->channels; channel++ )
+                out[channel] = (channel < self->channels) ? in[channel] : 0.0f;
+
+            in += self->channels;
+            out += frame->channels;
+        }
+    }
+
+    frame->current_min_sample = frame->full_min_sample;
+    frame->current_max_sample = frame->full_max_sample;
+    self->hits++;
+
+    return true;
+}
+
+/*
+    Function: audio_block_cache_clear
+    Throws out every block, for when the decoder's idea of sample positions changes.
+*/
+EXPORT void
+audio_block_cache_clear( audio_block_cache *self ) {
+    cache_trim( self, 0 );
+}
+
+EXPORT void
+audio_block_cache_get_stats( audio_block_cache *self, audio_block_cache_stats *stats ) {
+    stats->hits = self->hits;
+    stats->misses = self->misses;
+    stats->used = self->used;
+}
+
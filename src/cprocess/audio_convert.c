@@ -0,0 +1,320 @@
+/*
+    This file is part of the Fluggo Media Library for high-quality
+    video and audio processing.
+
+    Copyright 2012 Brian J. Crowell <brian@fluggo.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <string.h>
+#include "framework.h"
+
+typedef float v4f __attribute__ ((vector_size (16)));
+typedef int32_t v4i __attribute__ ((vector_size (16)));
+typedef uint32_t v4u __attribute__ ((vector_size (16)));
+
+// Four samples of each of the other source formats
+typedef uint8_t v4u8 __attribute__ ((vector_size (4)));
+typedef int16_t v4s16 __attribute__ ((vector_size (8)));
+typedef double v4d __attribute__ ((vector_size (32)));
+
+// Largest float that still fits in an int32_t
+#define S32_MAX_FLOAT   2147483520.0f
+
+static inline v4f
+v4f_clamp( v4f x, v4f low, v4f high ) {
+    v4i mask = x < low;
+    x = (v4f)((mask & (v4i) low) | (~mask & (v4i) x));
+    mask = x > high;
+    return (v4f)((mask & (v4i) high) | (~mask & (v4i) x));
+}
+
+static inline v4f
+v4u_to_v4f( v4u x ) {
+    return __builtin_convertvector( x, v4f );
+}
+
+static inline v4i
+v4f_to_v4i( v4f x ) {
+    return __builtin_convertvector( x, v4i );
+}
+
+/*
+    Function: audio_dither_init
+    Seeds a dither generator.
+*/
+EXPORT void
+audio_dither_init( audio_dither *dither, uint32_t seed ) {
+    // Spread the seed across the lanes so they don't run in lockstep
+    for( int i = 0; i < 4; i++ ) {
+        seed = seed * UINT32_C(2654435761) + UINT32_C(0x9E3779B9);
+        dither->state[i] = seed;
+    }
+}
+
+static inline v4u
+lcg_next( v4u state ) {
+    return state * UINT32_C(1664525) + UINT32_C(1013904223);
+}
+
+// Uniform in [0, 1) from the top 24 bits of each lane
+static inline v4f
+lcg_uniform( v4u state ) {
+    return v4u_to_v4f( state >> 8 ) * (1.0f / 16777216.0f);
+}
+
+/*
+    Function: audio_convert_f32_to_s16
+    Converts float samples to signed 16-bit.
+
+    out - Destination for count samples.
+    in - Source samples.
+    count - Number of samples (not frames) to convert.
+    dither - Dither generator, or NULL to round without dither.
+*/
+EXPORT void
+audio_convert_f32_to_s16( int16_t *out, const float *in, int count, audio_dither *dither ) {
+    const v4f scale = { 32768.0f, 32768.0f, 32768.0f, 32768.0f };
+    const v4f low = { -32768.0f, -32768.0f, -32768.0f, -32768.0f };
+    const v4f high = { 32767.0f, 32767.0f, 32767.0f, 32767.0f };
+
+    // Offset everything positive so truncation rounds to nearest
+    const v4f bias = { 32768.5f, 32768.5f, 32768.5f, 32768.5f };
+    const v4i unbias = { 32768, 32768, 32768, 32768 };
+    const v4f one = { 1.0f, 1.0f, 1.0f, 1.0f };
+
+    v4u state = { 0, 0, 0, 0 };
+
+    if( dither )
+        memcpy( &state, dither->state, sizeof(v4u) );
+
+    int i = 0;
+
+    for( ; i + 4 <= count; i += 4 ) {
+        v4f x;
+        memcpy( &x, in + i, sizeof(v4f) );
+        x *= scale;
+
+        if( dither ) {
+            // Sum of two uniform variables gives a triangular distribution over (-1, 1) LSB
+            v4u a = lcg_next( state ), b = lcg_next( a );
+            state = b;
+            x += lcg_uniform( a ) + lcg_uniform( b ) - one;
+        }
+
+        v4i result = v4f_to_v4i( v4f_clamp( x, low, high ) + bias ) - unbias;
+
+        for( int j = 0; j < 4; j++ )
+            out[i + j] = (int16_t) result[j];
+    }
+
+    for( ; i < count; i++ ) {
+        float x = in[i] * 32768.0f;
+
+        if( dither ) {
+            v4u a = lcg_next( state ), b = lcg_next( a );
+            state = b;
+            x += lcg_uniform( a )[0] + lcg_uniform( b )[0] - 1.0f;
+        }
+
+        x = clampf( x, -32768.0f, 32767.0f );
+        out[i] = (int16_t)((int32_t)(x + 32768.5f) - 32768);
+    }
+
+    if( dither )
+        memcpy( dither->state, &state, sizeof(v4u) );
+}
+
+/*
+    Function: audio_convert_f32_to_s32
+    Converts float samples to signed 32-bit.
+
+    out - Destination for count samples.
+    in - Source samples.
+    count - Number of samples (not frames) to convert.
+
+    A float only carries 24 bits of precision, so there's nothing here to dither.
+*/
+EXPORT void
+audio_convert_f32_to_s32( int32_t *out, const float *in, int count ) {
+    const v4f scale = { 2147483648.0f, 2147483648.0f, 2147483648.0f, 2147483648.0f };
+    const v4f low = { -2147483648.0f, -2147483648.0f, -2147483648.0f, -2147483648.0f };
+    const v4f high = { S32_MAX_FLOAT, S32_MAX_FLOAT, S32_MAX_FLOAT, S32_MAX_FLOAT };
+
+    int i = 0;
+
+    for( ; i + 4 <= count; i += 4 ) {
+        v4f x;
+        memcpy( &x, in + i, sizeof(v4f) );
+
+        v4i result = v4f_to_v4i( v4f_clamp( x * scale, low, high ) );
+        memcpy( out + i, &result, sizeof(v4i) );
+    }
+
+    for( ; i < count; i++ )
+        out[i] = (int32_t) clampf( in[i] * 2147483648.0f, -2147483648.0f, S32_MAX_FLOAT );
+}
+
+/*
+    Each format gets a function that loads four source samples as a vector of
+    their own type and converts them to floats all at once, and from that,
+    three loops: a straight run for interleaved data that already matches the
+    output, one plane into one output channel, and a sample-by-sample remap for
+    everything else. Picking the loop once per call keeps the switches out of
+    the inner loops.
+*/
+#define DEFINE_CONVERTERS(name, type, vtype, scale, bias) \
+    static inline v4f \
+    load4_##name( const type *in ) { \
+        vtype x; \
+        memcpy( &x, in, sizeof(vtype) ); \
+        return (__builtin_convertvector( x, v4f ) - (bias)) * (scale); \
+    } \
+    \
+    static void \
+    convert_run_##name( float *out, const type *in, int count ) { \
+        int i = 0; \
+        for( ; i + 4 <= count; i += 4 ) { \
+            v4f x = load4_##name( in + i ); \
+            memcpy( out + i, &x, sizeof(v4f) ); \
+        } \
+        for( ; i < count; i++ ) \
+            out[i] = ((float) in[i] - (bias)) * (scale); \
+    } \
+    \
+    static void \
+    convert_plane_##name( float *out, int out_channels, const type *in, int count ) { \
+        int i = 0; \
+        for( ; i + 4 <= count; i += 4 ) { \
+            v4f x = load4_##name( in + i ); \
+            for( int j = 0; j < 4; j++ ) \
+                out[(i + j) * out_channels] = x[j]; \
+        } \
+        for( ; i < count; i++ ) \
+            out[i * out_channels] = ((float) in[i] - (bias)) * (scale); \
+    } \
+    \
+    static void \
+    convert_remap_##name( float *out, int out_channels, const type *in, int in_channels, const int *map, int count ) { \
+        for( int i = 0; i < count; i++ ) { \
+            for( int c = 0; c < out_channels; c++ ) \
+                out[c] = (map[c] < 0) ? 0.0f : ((float) in[map[c]] - (bias)) * (scale); \
+            in += in_channels; \
+            out += out_channels; \
+        } \
+    }
+
+DEFINE_CONVERTERS(u8, uint8_t, v4u8, 1.0f / 128.0f, 128.0f)
+DEFINE_CONVERTERS(s16, int16_t, v4s16, 1.0f / 32768.0f, 0.0f)
+DEFINE_CONVERTERS(s32, int32_t, v4i, 1.0f / 2147483648.0f, 0.0f)
+DEFINE_CONVERTERS(flt, float, v4f, 1.0f, 0.0f)
+DEFINE_CONVERTERS(dbl, double, v4d, 1.0f, 0.0f)
+
+/*
+    Function: audio_sample_get_size
+    Returns the size in bytes of one sample in the given format, or zero if
+    the format isn't one we know.
+*/
+EXPORT int
+audio_sample_get_size( int format ) {
+    static const int sizes[] = { 1, 2, 4, 4, 8 };
+
+    if( format < 0 || format >= (int) G_N_ELEMENTS(sizes) )
+        return 0;
+
+    return sizes[format];
+}
+
+/*
+    Function: audio_convert_to_f32
+    Converts decoded samples to interleaved float.
+
+    out - Destination for count frames of out_channels samples each. For an
+        audio_frame, pass audio_get_sample( frame, first_sample, 0 ).
+    out_channels - Number of channels in the output.
+    in - Source data. For interleaved data, in[0] is the only buffer; for
+        planar data, in[i] is the plane for channel i.
+    in_channels - Number of channels in the source.
+    format - One of the AUDIO_SAMPLE_* formats.
+    planar - True if the source has one plane per channel.
+    channel_map - For each output channel, the source channel to take it from,
+        or -1 for silence. Pass NULL to take channels in order, with silence
+        for output channels past the end of the source.
+    offset - Number of frames to skip at the start of the source.
+    count - Number of frames to convert.
+
+    Source channels that nothing maps to are dropped.
+*/
+EXPORT void
+audio_convert_to_f32( float *out, int out_channels, const void *const *in, int in_channels,
+        int format, bool planar, const int *channel_map, int offset, int count ) {
+    int map[out_channels];
+    bool identity = (in_channels == out_channels);
+
+    for( int c = 0; c < out_channels; c++ ) {
+        map[c] = channel_map ? channel_map[c] : c;
+
+        if( map[c] < 0 || map[c] >= in_channels )
+            map[c] = -1;
+
+        if( map[c] != c )
+            identity = false;
+    }
+
+    const int size = audio_sample_get_size( format );
+
+    if( !size || count <= 0 )
+        return;
+
+#define DISPATCH(name, type) \
+    if( planar ) { \
+        for( int c = 0; c < out_channels; c++ ) { \
+            if( map[c] < 0 ) { \
+                for( int i = 0; i < count; i++ ) \
+                    out[i * out_channels + c] = 0.0f; \
+            } \
+            else { \
+                convert_plane_##name( out + c, out_channels, (const type *) in[map[c]] + offset, count ); \
+            } \
+        } \
+    } \
+    else if( identity ) { \
+        convert_run_##name( out, (const type *) in[0] + offset * in_channels, count * in_channels ); \
+    } \
+    else { \
+        convert_remap_##name( out, out_channels, (const type *) in[0] + offset * in_channels, in_channels, map, count ); \
+    } \
+    return;
+
+    switch( format ) {
+        case AUDIO_SAMPLE_U8:
+            DISPATCH(u8, uint8_t)
+
+        case AUDIO_SAMPLE_S16:
+            DISPATCH(s16, int16_t)
+
+        case AUDIO_SAMPLE_S32:
+            DISPATCH(s32, int32_t)
+
+        case AUDIO_SAMPLE_FLT:
+            DISPATCH(flt, float)
+
+        case AUDIO_SAMPLE_DBL:
+            DISPATCH(dbl, double)
+    }
+
+#undef DISPATCH
+}
+
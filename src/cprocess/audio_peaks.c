@@ -0,0 +1,423 @@
+/*
+    This file is part of the Fluggo Media Library for high-quality
+    video and audio processing.
+
+    Copyright 2012 Brian J. Crowell <brian@fluggo.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include "framework.h"
+
+#undef G_LOG_DOMAIN
+#define G_LOG_DOMAIN "fluggo.media.cprocess.audio_peaks"
+
+// Samples per block at the finest level, and how many blocks of one level
+// make a block of the next
+#define BASE_BLOCK_SIZE     256
+#define LEVEL_FACTOR        8
+#define MAX_LEVELS          10
+
+// Base blocks to pull from the source at a time
+#define READ_BLOCKS         256
+
+#define FILE_MAGIC          "FLGPEAKS"
+#define FILE_VERSION        1
+
+// Peaks are stored as 16-bit fractions of full scale; that's plenty for drawing
+// and keeps hours of audio down to a few megabytes
+typedef struct {
+    int16_t min, max, rms;
+} peak_block;
+
+typedef struct {
+    int block_size, block_count;
+
+    // block_count * channels blocks, interleaved by channel
+    peak_block *blocks;
+} peak_level;
+
+struct audio_peak_index_t {
+    int channels, min_sample, max_sample;
+    int level_count;
+    peak_level levels[MAX_LEVELS];
+
+    // Number of base blocks filled in so far
+    volatile gint built_blocks;
+};
+
+static inline int16_t
+quantize( float value ) {
+    return (int16_t) lrintf( clampf( value, -1.0f, 1.0f ) * 32767.0f );
+}
+
+/*
+    Function: audio_peak_index_new
+    Creates an empty peak index.
+
+    channels - Number of channels to index.
+    min_sample - First sample to index.
+    max_sample - Last sample to index.
+
+    Fill the index with audio_peak_index_build or use audio_peak_index_load instead.
+*/
+EXPORT audio_peak_index *
+audio_peak_index_new( int channels, int min_sample, int max_sample ) {
+    g_assert( channels > 0 );
+    g_assert( max_sample >= min_sample );
+
+    audio_peak_index *self = g_slice_new0( audio_peak_index );
+
+    self->channels = channels;
+    self->min_sample = min_sample;
+    self->max_sample = max_sample;
+
+    int64_t length = (int64_t) max_sample - min_sample + 1;
+    int64_t block_size = BASE_BLOCK_SIZE;
+
+    // Keep adding coarser levels until one block covers everything
+    do {
+        peak_level *level = &self->levels[self->level_count++];
+
+        level->block_size = (int) block_size;
+        level->block_count = (int)((length + block_size - 1) / block_size);
+        level->blocks = g_new0( peak_block, level->block_count * channels );
+
+        block_size *= LEVEL_FACTOR;
+    } while( self->level_count < MAX_LEVELS && self->levels[self->level_count - 1].block_count > 1 &&
+        block_size <= G_MAXINT );
+
+    return self;
+}
+
+EXPORT void
+audio_peak_index_free( audio_peak_index *self ) {
+    if( !self )
+        return;
+
+    for( int i = 0; i < self->level_count; i++ )
+        g_free( self->levels[i].blocks );
+
+    g_slice_free( audio_peak_index, self );
+}
+
+EXPORT int
+audio_peak_index_get_channels( audio_peak_index *self ) {
+    return self->channels;
+}
+
+/*
+    Function: audio_peak_index_get_progress
+    Returns the fraction of the index that has been built, from 0.0 to 1.0.
+*/
+EXPORT double
+audio_peak_index_get_progress( audio_peak_index *self ) {
+    return (double) g_atomic_int_get( &self->built_blocks ) / (double) self->levels[0].block_count;
+}
+
+EXPORT bool
+audio_peak_index_is_complete( audio_peak_index *self ) {
+    return g_atomic_int_get( &self->built_blocks ) == self->levels[0].block_count;
+}
+
+/*
+    Number of samples covered by a block; only the last one in a level is short.
+*/
+static inline int
+block_length( const audio_peak_index *self, const peak_level *level, int block ) {
+    int64_t length = (int64_t) self->max_sample - self->min_sample + 1;
+
+    return (int) MIN( (int64_t) level->block_size, length - (int64_t) block * level->block_size );
+}
+
+/*
+    Recompute blocks [first, last] of the given level (above zero) from the level below.
+*/
+static void
+update_level( audio_peak_index *self, int level_index, int first, int last ) {
+    const peak_level *child = &self->levels[level_index - 1];
+    peak_level *level = &self->levels[level_index];
+    const int channels = self->channels;
+
+    for( int block = first; block <= last; block++ ) {
+        int child_first = block * LEVEL_FACTOR;
+        int child_last = min( child_first + LEVEL_FACTOR, child->block_count ) - 1;
+
+        for( int ch = 0; ch < channels; ch++ ) {
+            int16_t bmin = INT16_MAX, bmax = INT16_MIN;
+            double sum_squares = 0.0;
+
+            for( int i = child_first; i <= child_last; i++ ) {
+                const peak_block *src = &child->blocks[i * channels + ch];
+
+                if( src->min < bmin )
+                    bmin = src->min;
+
+                if( src->max > bmax )
+                    bmax = src->max;
+
+                sum_squares += (double) src->rms * (double) src->rms * block_length( self, child, i );
+            }
+
+            peak_block *dest = &level->blocks[block * channels + ch];
+            dest->min = bmin;
+            dest->max = bmax;
+            dest->rms = (int16_t) lrint( sqrt( sum_squares / block_length( self, level, block ) ) );
+        }
+    }
+}
+
+/*
+    Bring every level above the base up to date for base blocks [first, last].
+*/
+static void
+update_levels( audio_peak_index *self, int first, int last ) {
+    for( int level = 1; level < self->level_count; level++ ) {
+        first /= LEVEL_FACTOR;
+        last /= LEVEL_FACTOR;
+        update_level( self, level, first, last );
+    }
+}
+
+/*
+    Function: audio_peak_index_build
+    Reads the source from start to finish and fills in the index.
+
+    self - Index to fill.
+    source - Audio source to read.
+    cancel - Optional flag; if another thread sets it to a non-zero value,
+        the build stops early.
+
+    Returns true if the index was completed. This can take a long time; queries
+    from other threads are safe while it runs and see the part built so far.
+*/
+EXPORT bool
+audio_peak_index_build( audio_peak_index *self, const audio_source *source, volatile gint *cancel ) {
+    const int channels = self->channels;
+    const int block_count = self->levels[0].block_count;
+    peak_block *blocks = self->levels[0].blocks;
+
+    const int chunk_samples = BASE_BLOCK_SIZE * READ_BLOCKS;
+    float *data = g_malloc( sizeof(float) * chunk_samples * channels );
+
+    for( int first_block = g_atomic_int_get( &self->built_blocks ); first_block < block_count; first_block += READ_BLOCKS ) {
+        if( cancel && g_atomic_int_get( cancel ) ) {
+            g_free( data );
+            return false;
+        }
+
+        int last_block = min( first_block + READ_BLOCKS, block_count ) - 1;
+        int first_sample = self->min_sample + first_block * BASE_BLOCK_SIZE;
+        int last_sample = (int) MIN( (int64_t) self->min_sample + (int64_t)(last_block + 1) * BASE_BLOCK_SIZE - 1,
+            (int64_t) self->max_sample );
+
+        audio_frame frame = {
+            .data = data,
+            .channels = channels,
+            .full_min_sample = first_sample,
+            .full_max_sample = last_sample,
+            .current_min_sample = first_sample,
+            .current_max_sample = last_sample,
+        };
+
+        audio_get_frame( source, &frame );
+
+        for( int block = first_block; block <= last_block; block++ ) {
+            int block_min = self->min_sample + block * BASE_BLOCK_SIZE;
+            int block_max = min( block_min + BASE_BLOCK_SIZE - 1, last_sample );
+
+            // Whatever the source didn't supply is silence
+            int have_min = max( block_min, frame.current_min_sample );
+            int have_max = min( block_max, frame.current_max_sample );
+            bool silent_part = have_min > block_min || have_max < block_max;
+
+            for( int ch = 0; ch < channels; ch++ ) {
+                float bmin = silent_part ? 0.0f : 1.0f, bmax = silent_part ? 0.0f : -1.0f;
+                float sum_squares = 0.0f;
+
+                for( int sample = have_min; sample <= have_max; sample++ ) {
+                    float value = data[(sample - first_sample) * channels + ch];
+
+                    bmin = minf( bmin, value );
+                    bmax = maxf( bmax, value );
+                    sum_squares += value * value;
+                }
+
+                peak_block *dest = &blocks[block * channels + ch];
+                dest->min = quantize( bmin );
+                dest->max = quantize( bmax );
+                dest->rms = quantize( sqrtf( sum_squares / (block_max - block_min + 1) ) );
+            }
+        }
+
+        update_levels( self, first_block, last_block );
+        g_atomic_int_set( &self->built_blocks, last_block + 1 );
+    }
+
+    g_free( data );
+    return true;
+}
+
+/*
+    Function: audio_peak_index_query
+    Gets peaks for drawing a range of samples across a number of pixels.
+
+    self - Index to read.
+    min_sample - First sample at the left edge.
+    max_sample - Last sample at the right edge.
+    pixels - Number of columns to produce.
+    out - Array of pixels * channels peaks to fill, interleaved by channel.
+
+    Columns outside the index, or not built yet, come back as silence. The
+    coarsest level that still has at least one block per column is used, so
+    the cost depends on the number of pixels, not the number of samples.
+*/
+EXPORT void
+audio_peak_index_query( audio_peak_index *self, int min_sample, int max_sample, int pixels, audio_peak *out ) {
+    const int channels = self->channels;
+
+    if( pixels <= 0 )
+        return;
+
+    memset( out, 0, sizeof(audio_peak) * pixels * channels );
+
+    if( max_sample < min_sample )
+        return;
+
+    const double samples_per_pixel = ((double) max_sample - min_sample + 1.0) / pixels;
+
+    int level_index = 0;
+
+    while( level_index + 1 < self->level_count && self->levels[level_index + 1].block_size <= samples_per_pixel )
+        level_index++;
+
+    const peak_level *level = &self->levels[level_index];
+    const int64_t built_base = g_atomic_int_get( &self->built_blocks );
+    int64_t base_per_block = 1;
+
+    for( int i = 0; i < level_index; i++ )
+        base_per_block *= LEVEL_FACTOR;
+
+    const int built = (int)((built_base + base_per_block - 1) / base_per_block);
+
+    for( int pixel = 0; pixel < pixels; pixel++ ) {
+        // Sample range of this column, relative to the start of the index
+        int64_t first = (int64_t) min_sample + (int64_t) floor( pixel * samples_per_pixel ) - self->min_sample;
+        int64_t last = (int64_t) min_sample + (int64_t) floor( (pixel + 1) * samples_per_pixel ) - 1 - self->min_sample;
+
+        if( last < first )
+            last = first;
+
+        if( last < 0 || first > (int64_t) self->max_sample - self->min_sample )
+            continue;
+
+        int first_block = (int)(MAX(first, 0) / level->block_size);
+        int last_block = (int) MIN(last / level->block_size, (int64_t) built - 1);
+
+        if( last_block < first_block )
+            continue;
+
+        int64_t covered = 0;
+
+        for( int block = first_block; block <= last_block; block++ )
+            covered += block_length( self, level, block );
+
+        for( int ch = 0; ch < channels; ch++ ) {
+            int bmin = INT16_MAX, bmax = INT16_MIN;
+            double sum_squares = 0.0;
+
+            for( int block = first_block; block <= last_block; block++ ) {
+                const peak_block *src = &level->blocks[block * channels + ch];
+
+                bmin = min( bmin, src->min );
+                bmax = max( bmax, src->max );
+                sum_squares += (double) src->rms * (double) src->rms * block_length( self, level, block );
+            }
+
+            audio_peak *dest = &out[pixel * channels + ch];
+            dest->min = bmin * (1.0f / 32767.0f);
+            dest->max = bmax * (1.0f / 32767.0f);
+            dest->rms = (float)(sqrt( sum_squares / covered ) * (1.0 / 32767.0));
+        }
+    }
+}
+
+/*
+    Function: audio_peak_index_save
+    Writes a completed index to a file.
+
+    self - Index to save. It must be complete.
+    path - File to write. It's replaced atomically.
+    key - String identifying the source, such as its file name, size, and modification
+        time. audio_peak_index_load will only accept the file back with the same key.
+
+    Returns true on success. The file uses native byte order; it's a cache, not an
+    interchange format.
+*/
+EXPORT bool
+audio_peak_index_save( audio_peak_index *self, const char *path, const char *key ) {
+    g_assert( audio_peak_index_is_complete( self ) );
+
+    const int32_t header[] = { self->channels, self->min_sample, self->max_sample };
+    FILE *file = cache_file_begin_write( path, FILE_MAGIC, FILE_VERSION, key, header, G_N_ELEMENTS(header) );
+
+    if( !file )
+        return false;
+
+    const peak_level *base = &self->levels[0];
+
+    return cache_file_end_write( file, path,
+        fwrite( base->blocks, sizeof(peak_block) * self->channels, base->block_count, file ) == (size_t) base->block_count );
+}
+
+/*
+    Function: audio_peak_index_load
+    Reads an index written by audio_peak_index_save.
+
+    path - File to read.
+    key - Source identity the file must have been saved with.
+    channels, min_sample, max_sample - Layout the index must have.
+
+    Returns the index, or NULL if the file is missing, damaged, or was made for
+    a different source or layout. In that case, build a new one.
+*/
+EXPORT audio_peak_index *
+audio_peak_index_load( const char *path, const char *key, int channels, int min_sample, int max_sample ) {
+    const int32_t header[] = { channels, min_sample, max_sample };
+    FILE *file = cache_file_open_read( path, FILE_MAGIC, FILE_VERSION, key, header, G_N_ELEMENTS(header) );
+
+    if( !file )
+        return NULL;
+
+    audio_peak_index *self = audio_peak_index_new( channels, min_sample, max_sample );
+    peak_level *base = &self->levels[0];
+
+    if( fread( base->blocks, sizeof(peak_block) * channels, base->block_count, file ) != (size_t) base->block_count ) {
+        g_debug( "Peak index %s is truncated", path );
+        audio_peak_index_free( self );
+        fclose( file );
+        return NULL;
+    }
+
+    fclose( file );
+
+    update_levels( self, 0, base->block_count - 1 );
+    self->built_blocks = base->block_count;
+
+    return self;
+}
+
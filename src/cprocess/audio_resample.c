@@ -0,0 +1,377 @@
+/*
+    This file is part of the Fluggo Media Library for high-quality
+    video and audio processing.
+
+    Copyright 2012 Brian J. Crowell <brian@fluggo.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <string.h>
+#include <math.h>
+#include "framework.h"
+
+#undef G_LOG_DOMAIN
+#define G_LOG_DOMAIN "fluggo.media.cprocess.audio_resample"
+
+// Number of table entries per zero crossing of the kernel
+#define PHASES          256
+
+// Beyond this speed, we stop widening the kernel and let it alias;
+// nobody is listening that closely at 8x
+#define MAX_DECIMATION  8.0
+
+typedef float v4f __attribute__ ((vector_size (16)));
+
+typedef struct {
+    // Half-width of the kernel in zero crossings
+    int zero_crossings;
+
+    // Kaiser window shape, or zero for a plain triangle (linear interpolation)
+    double beta;
+} quality_params;
+
+static const quality_params quality_table[AUDIO_RESAMPLE_QUALITY_COUNT] = {
+    { 1, 0.0 },
+    { 4, 5.0 },
+    { 12, 7.0 },
+    { 32, 9.0 },
+};
+
+struct audio_resampler_t {
+    int quality;
+    int zero_crossings;
+
+    // Kernel from zero to zero_crossings, PHASES entries per crossing,
+    // with a zero guard entry at the end
+    float *kernel;
+    int kernel_size;
+
+    double position, rate, target_rate;
+
+    // Interleaved pull buffer and its planar copy
+    float *in;
+    float *planar;
+    int in_capacity, planar_capacity;
+
+    float *coeff;
+    int coeff_capacity;
+};
+
+static double
+bessel_i0( double x ) {
+    // Power series; converges quickly for the betas we use
+    double sum = 1.0, term = 1.0;
+
+    for( int k = 1; k < 50; k++ ) {
+        term *= (x * 0.5 / k) * (x * 0.5 / k);
+        sum += term;
+
+        if( term < sum * 1e-12 )
+            break;
+    }
+
+    return sum;
+}
+
+static void
+build_kernel( audio_resampler *self ) {
+    const quality_params *params = &quality_table[self->quality];
+
+    if( self->kernel )
+        g_slice_free1( sizeof(float) * self->kernel_size, self->kernel );
+
+    self->zero_crossings = params->zero_crossings;
+    self->kernel_size = params->zero_crossings * PHASES + 2;
+    self->kernel = g_slice_alloc( sizeof(float) * self->kernel_size );
+
+    const int last = params->zero_crossings * PHASES;
+
+    if( params->beta == 0.0 ) {
+        for( int i = 0; i <= last; i++ )
+            self->kernel[i] = 1.0f - (float) i / (float) PHASES;
+    }
+    else {
+        const double i0_beta = bessel_i0( params->beta );
+
+        self->kernel[0] = 1.0f;
+
+        for( int i = 1; i <= last; i++ ) {
+            double x = (double) i / (double) PHASES;
+            double ratio = x / params->zero_crossings;
+            double window = bessel_i0( params->beta * sqrt( 1.0 - ratio * ratio ) ) / i0_beta;
+
+            self->kernel[i] = (float)(sin( G_PI * x ) / (G_PI * x) * window);
+        }
+    }
+
+    // Guard entries so interpolation off the end reads zero
+    self->kernel[last] = 0.0f;
+    self->kernel[last + 1] = 0.0f;
+}
+
+/*
+    Function: audio_resampler_new
+    Creates a new varispeed resampler.
+
+    quality - Kernel quality, from AUDIO_RESAMPLE_QUALITY_FASTEST to AUDIO_RESAMPLE_QUALITY_BEST.
+
+    The resampler starts at position zero with a rate of one.
+*/
+EXPORT audio_resampler *
+audio_resampler_new( int quality ) {
+    audio_resampler *self = g_slice_new0( audio_resampler );
+
+    self->quality = clamp( quality, 0, AUDIO_RESAMPLE_QUALITY_COUNT - 1 );
+    self->rate = 1.0;
+    self->target_rate = 1.0;
+
+    build_kernel( self );
+
+    return self;
+}
+
+EXPORT void
+audio_resampler_free( audio_resampler *self ) {
+    if( !self )
+        return;
+
+    g_slice_free1( sizeof(float) * self->kernel_size, self->kernel );
+    g_free( self->in );
+    g_free( self->planar );
+    g_free( self->coeff );
+    g_slice_free( audio_resampler, self );
+}
+
+EXPORT int
+audio_resampler_get_quality( audio_resampler *self ) {
+    return self->quality;
+}
+
+EXPORT void
+audio_resampler_set_quality( audio_resampler *self, int quality ) {
+    quality = clamp( quality, 0, AUDIO_RESAMPLE_QUALITY_COUNT - 1 );
+
+    if( quality == self->quality )
+        return;
+
+    self->quality = quality;
+    build_kernel( self );
+}
+
+EXPORT double
+audio_resampler_get_position( audio_resampler *self ) {
+    return self->position;
+}
+
+EXPORT void
+audio_resampler_set_position( audio_resampler *self, double position ) {
+    self->position = position;
+}
+
+EXPORT double
+audio_resampler_get_rate( audio_resampler *self ) {
+    return self->target_rate;
+}
+
+/*
+    Function: audio_resampler_set_rate
+    Sets the playback rate, in input samples per output sample.
+
+    rate - New rate. Negative rates play backwards.
+    ramp - If true, the rate glides from the current rate to the new rate over
+        the next call to audio_resampler_render. If false, it takes effect immediately.
+*/
+EXPORT void
+audio_resampler_set_rate( audio_resampler *self, double rate, bool ramp ) {
+    self->target_rate = rate;
+
+    if( !ramp )
+        self->rate = rate;
+}
+
+static void
+ensure_capacity( float **buffer, int *capacity, int needed ) {
+    if( *capacity >= needed )
+        return;
+
+    *capacity = needed;
+    *buffer = g_realloc( *buffer, sizeof(float) * needed );
+}
+
+/*
+    Pull [min_sample, max_sample] from the source into data, zeroing anything the
+    source doesn't supply.
+*/
+static void
+pull_zero_filled( const audio_source *source, float *data, int channels, int min_sample, int max_sample ) {
+    audio_frame frame = {
+        .data = data,
+        .channels = channels,
+        .full_min_sample = min_sample,
+        .full_max_sample = max_sample,
+        .current_min_sample = min_sample,
+        .current_max_sample = max_sample,
+    };
+
+    audio_get_frame( source, &frame );
+
+    if( frame.current_min_sample > frame.current_max_sample ) {
+        memset( frame.data, 0, sizeof(float) * (frame.full_max_sample - frame.full_min_sample + 1) * frame.channels );
+        return;
+    }
+
+    // Provide some sanity if the audio source gives us bad values
+    if( G_UNLIKELY(frame.current_min_sample < frame.full_min_sample || frame.current_max_sample > frame.full_max_sample) ) {
+        g_warning( "Audio source gave sample range [%d, %d] outside requested range [%d, %d]",
+            frame.current_min_sample, frame.current_max_sample, frame.full_min_sample, frame.full_max_sample );
+
+        frame.current_min_sample = clamp( frame.current_min_sample, frame.full_min_sample, frame.full_max_sample );
+        frame.current_max_sample = clamp( frame.current_max_sample, frame.full_min_sample, frame.full_max_sample );
+    }
+
+    if( frame.full_min_sample < frame.current_min_sample )
+        memset( frame.data, 0, sizeof(float) * (frame.current_min_sample - frame.full_min_sample) * frame.channels );
+
+    if( frame.full_max_sample > frame.current_max_sample )
+        memset( audio_get_sample( &frame, frame.current_max_sample + 1, 0 ), 0,
+            sizeof(float) * (frame.full_max_sample - frame.current_max_sample) * frame.channels );
+}
+
+G_GNUC_PURE static inline float
+dot_f32( const float *a, const float *b, int count ) {
+    v4f acc = { 0.0f, 0.0f, 0.0f, 0.0f };
+    int i = 0;
+
+    for( ; i + 4 <= count; i += 4 ) {
+        v4f va, vb;
+        memcpy( &va, a + i, sizeof(v4f) );
+        memcpy( &vb, b + i, sizeof(v4f) );
+        acc += va * vb;
+    }
+
+    float sum = acc[0] + acc[1] + acc[2] + acc[3];
+
+    for( ; i < count; i++ )
+        sum += a[i] * b[i];
+
+    return sum;
+}
+
+/*
+    Function: audio_resampler_render
+    Renders output samples from the source at the current position and rate.
+
+    self - Resampler.
+    source - Source to read input samples from.
+    out - Buffer of at least count * channels floats to receive interleaved output.
+    channels - Number of channels to produce.
+    count - Number of output samples to produce.
+
+    The resampler's position is advanced by the rate for each sample written. If a
+    ramped rate change is pending, the rate moves linearly to the new rate across
+    the rendered block.
+*/
+EXPORT void
+audio_resampler_render( audio_resampler *self, const audio_source *source, float *out, int channels, int count ) {
+    g_assert( self );
+    g_assert( out );
+
+    if( count <= 0 || channels <= 0 )
+        return;
+
+    const double rate_start = self->rate, rate_end = self->target_rate;
+    const double rate_step = (rate_end - rate_start) / count;
+
+    // Fast path: unity rate on an integer position is just a copy
+    if( rate_start == 1.0 && rate_end == 1.0 && self->position == floor( self->position ) &&
+            fabs( self->position ) < (double) INT32_MAX ) {
+        int first = (int) self->position;
+
+        pull_zero_filled( source, out, channels, first, first + count - 1 );
+        self->position += count;
+        return;
+    }
+
+    // Determine the range of positions we'll visit and the kernel width
+    double pos_min = self->position, pos_max = self->position, pos = self->position;
+    double max_speed = fmax( fabs( rate_start ), fabs( rate_end ) );
+
+    for( int i = 0; i < count; i++ ) {
+        pos += rate_start + rate_step * (i + 1);
+        pos_min = fmin( pos_min, pos );
+        pos_max = fmax( pos_max, pos );
+    }
+
+    // Cutoff relative to the input Nyquist frequency
+    const double cutoff = 1.0 / fmin( fmax( max_speed, 1.0 ), MAX_DECIMATION );
+    const double reach = self->zero_crossings / cutoff;
+    const int max_taps = (int) ceil( 2.0 * reach ) + 2;
+
+    const int in_min = (int) floor( pos_min - reach ) - 1;
+    const int in_max = (int) ceil( pos_max + reach ) + 1;
+    const int in_count = in_max - in_min + 1;
+
+    ensure_capacity( &self->in, &self->in_capacity, in_count * channels );
+    ensure_capacity( &self->planar, &self->planar_capacity, in_count * channels );
+    ensure_capacity( &self->coeff, &self->coeff_capacity, max_taps );
+
+    pull_zero_filled( source, self->in, channels, in_min, in_max );
+
+    // Deinterleave so each channel's dot product runs over contiguous memory
+    for( int ch = 0; ch < channels; ch++ ) {
+        float *plane = self->planar + ch * in_count;
+
+        for( int i = 0; i < in_count; i++ )
+            plane[i] = self->in[i * channels + ch];
+    }
+
+    const float *kernel = self->kernel;
+    const float scale = (float) cutoff;
+    const double phase_step = cutoff * PHASES;
+    const int kernel_last = self->zero_crossings * PHASES;
+
+    pos = self->position;
+
+    for( int i = 0; i < count; i++ ) {
+        int first = (int) ceil( pos - reach );
+        int last = (int) floor( pos + reach );
+        int taps = last - first + 1;
+
+        g_assert( first >= in_min && last <= in_max && taps <= max_taps );
+
+        for( int k = 0; k < taps; k++ ) {
+            double x = fabs( pos - (first + k) ) * phase_step;
+            int index = (int) x;
+
+            if( G_UNLIKELY(index >= kernel_last) ) {
+                self->coeff[k] = 0.0f;
+                continue;
+            }
+
+            float frac = (float)(x - index);
+            self->coeff[k] = (kernel[index] + frac * (kernel[index + 1] - kernel[index])) * scale;
+        }
+
+        for( int ch = 0; ch < channels; ch++ ) {
+            out[i * channels + ch] = dot_f32( self->planar + ch * in_count + (first - in_min),
+                self->coeff, taps );
+        }
+
+        pos += rate_start + rate_step * (i + 1);
+    }
+
+    self->position = pos;
+    self->rate = rate_end;
+}
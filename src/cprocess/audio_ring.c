@@ -0,0 +1,177 @@
+/*
+    This file is part of the Fluggo Media Library for high-quality
+    video and audio processing.
+
+    Copyright 2012 Brian J. Crowell <brian@fluggo.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <string.h>
+#include "framework.h"
+
+struct audio_ring_t {
+    float *data;
+    int capacity, mask;
+
+    // Free-running counts of floats written and read. Only the producer
+    // stores write_count and only the consumer stores read_count; the
+    // difference (mod 2^32) is the fill level.
+    volatile gint write_count, read_count;
+};
+
+/*
+    Function: audio_ring_new
+    Creates a single-producer, single-consumer ring of floats.
+
+    capacity - Minimum number of floats the ring should hold. This is
+        rounded up to a power of two.
+*/
+EXPORT audio_ring *
+audio_ring_new( int capacity ) {
+    g_assert( capacity > 0 );
+
+    audio_ring *self = g_slice_new0( audio_ring );
+
+    self->capacity = 1;
+
+    while( self->capacity < capacity )
+        self->capacity <<= 1;
+
+    self->mask = self->capacity - 1;
+    self->data = g_malloc( sizeof(float) * self->capacity );
+
+    return self;
+}
+
+EXPORT void
+audio_ring_free( audio_ring *self ) {
+    if( !self )
+        return;
+
+    g_free( self->data );
+    g_slice_free( audio_ring, self );
+}
+
+EXPORT int
+audio_ring_get_capacity( audio_ring *self ) {
+    return self->capacity;
+}
+
+/*
+    Function: audio_ring_get_fill
+    Returns the number of floats waiting to be read. Safe to call from either side.
+*/
+EXPORT int
+audio_ring_get_fill( audio_ring *self ) {
+    guint read = (guint) g_atomic_int_get( &self->read_count );
+    guint write = (guint) g_atomic_int_get( &self->write_count );
+
+    return (int)(write - read);
+}
+
+/*
+    Function: audio_ring_write
+    Copies as many floats as will fit into the ring. Producer only.
+
+    Returns the number of floats written.
+*/
+EXPORT int
+audio_ring_write( audio_ring *self, const float *data, int count ) {
+    guint write = (guint) self->write_count;
+    guint read = (guint) g_atomic_int_get( &self->read_count );
+
+    count = min( count, self->capacity - (int)(write - read) );
+
+    if( count <= 0 )
+        return 0;
+
+    int start = (int)(write & self->mask);
+    int first = min( count, self->capacity - start );
+
+    memcpy( self->data + start, data, sizeof(float) * first );
+    memcpy( self->data, data + first, sizeof(float) * (count - first) );
+
+    // Publish the data before the new count
+    g_atomic_int_set( &self->write_count, (gint)(write + count) );
+
+    return count;
+}
+
+/*
+    Function: audio_ring_read
+    Copies up to count floats out of the ring. Consumer only.
+
+    Returns the number of floats read.
+*/
+EXPORT int
+audio_ring_read( audio_ring *self, float *data, int count ) {
+    guint read = (guint) self->read_count;
+    guint write = (guint) g_atomic_int_get( &self->write_count );
+
+    count = min( count, (int)(write - read) );
+
+    if( count <= 0 )
+        return 0;
+
+    int start = (int)(read & self->mask);
+    int first = min( count, self->capacity - start );
+
+    memcpy( data, self->data + start, sizeof(float) * first );
+    memcpy( data + first, self->data, sizeof(float) * (count - first) );
+
+    g_atomic_int_set( &self->read_count, (gint)(read + count) );
+
+    return count;
+}
+
+/*
+    Function: audio_ring_peek
+    Gets the next contiguous run of floats waiting in the ring without copying them. Consumer only.
+
+    count - Receives the number of floats available at the returned pointer. This
+        can be less than the fill level if the data wraps around the end of the ring.
+
+    Call audio_ring_advance to release the floats once you're done with them.
+*/
+EXPORT const float *
+audio_ring_peek( audio_ring *self, int *count ) {
+    guint read = (guint) self->read_count;
+    guint write = (guint) g_atomic_int_get( &self->write_count );
+    int start = (int)(read & self->mask);
+
+    *count = min( (int)(write - read), self->capacity - start );
+    return self->data + start;
+}
+
+/*
+    Function: audio_ring_advance
+    Releases floats obtained from audio_ring_peek. Consumer only.
+*/
+EXPORT void
+audio_ring_advance( audio_ring *self, int count ) {
+    guint read = (guint) self->read_count;
+
+    g_assert( count >= 0 && count <= audio_ring_get_fill( self ) );
+    g_atomic_int_set( &self->read_count, (gint)(read + count) );
+}
+
+/*
+    Function: audio_ring_discard
+    Throws away everything currently in the ring. Consumer only.
+*/
+EXPORT void
+audio_ring_discard( audio_ring *self ) {
+    g_atomic_int_set( &self->read_count, g_atomic_int_get( &self->write_count ) );
+}
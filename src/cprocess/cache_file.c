@@ -0,0 +1,153 @@
+/*
+    This file is part of the Fluggo Media Library for high-quality
+    video and audio processing.
+
+    Copyright 2012 Brian J. Crowell <brian@fluggo.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include "framework.h"
+
+#undef G_LOG_DOMAIN
+#define G_LOG_DOMAIN "fluggo.media.cprocess.cache_file"
+
+#define MAGIC_LENGTH        8
+
+static gchar *
+get_temp_path( const char *path ) {
+    return g_strdup_printf( "%s.tmp", path );
+}
+
+/*
+    Function: cache_file_begin_write
+    Starts writing a cache file.
+
+    path - File to write. The data goes to a temporary file next to it until
+        cache_file_end_write, so a crash won't leave a damaged file behind.
+    magic - Eight-character signature for the kind of file.
+    version - Version of the file's layout.
+    key - String identifying what the file was made from, such as its size and
+        modification time. cache_file_open_read won't open the file unless it
+        gets the same key.
+    header, header_count - Values describing the data, such as its dimensions,
+        that must also match when the file is read back.
+
+    Returns the file, positioned after the header, or NULL if it couldn't be
+    written. Write the data and pass the file to cache_file_end_write.
+*/
+EXPORT FILE *
+cache_file_begin_write( const char *path, const char *magic, int32_t version, const char *key,
+        const int32_t *header, int header_count ) {
+    gchar *temp_path = get_temp_path( path );
+    FILE *file = fopen( temp_path, "wb" );
+
+    if( !file ) {
+        g_warning( "Could not open %s to write: %s", temp_path, g_strerror( errno ) );
+        g_free( temp_path );
+        return NULL;
+    }
+
+    const int32_t prefix[] = { version, (int32_t) strlen( key ) };
+
+    if( fwrite( magic, MAGIC_LENGTH, 1, file ) != 1 ||
+            fwrite( prefix, sizeof(prefix), 1, file ) != 1 ||
+            fwrite( header, sizeof(int32_t), header_count, file ) != (size_t) header_count ||
+            fwrite( key, 1, prefix[1], file ) != (size_t) prefix[1] ) {
+        g_warning( "Could not write %s: %s", temp_path, g_strerror( errno ) );
+        fclose( file );
+        remove( temp_path );
+        g_free( temp_path );
+        return NULL;
+    }
+
+    g_free( temp_path );
+    return file;
+}
+
+/*
+    Function: cache_file_end_write
+    Finishes a file started with cache_file_begin_write.
+
+    file - File from cache_file_begin_write. It's closed either way.
+    path - Path given to cache_file_begin_write.
+    success - False if writing the data failed.
+
+    If everything was written, the file replaces the one at path. Otherwise,
+    it's removed. Returns true if the file was replaced.
+*/
+EXPORT bool
+cache_file_end_write( FILE *file, const char *path, bool success ) {
+    gchar *temp_path = get_temp_path( path );
+
+    success = (fclose( file ) == 0) && success;
+
+    if( success && rename( temp_path, path ) != 0 )
+        success = false;
+
+    if( !success ) {
+        g_warning( "Could not write %s: %s", path, g_strerror( errno ) );
+        remove( temp_path );
+    }
+
+    g_free( temp_path );
+    return success;
+}
+
+/*
+    Function: cache_file_open_read
+    Opens a file written with cache_file_begin_write.
+
+    path - File to read.
+    magic, version, key, header, header_count - What the file must have been
+        written with.
+
+    Returns the file, positioned after the header, or NULL if it's missing or
+    doesn't match. Close it with fclose.
+*/
+EXPORT FILE *
+cache_file_open_read( const char *path, const char *magic, int32_t version, const char *key,
+        const int32_t *header, int header_count ) {
+    FILE *file = fopen( path, "rb" );
+
+    if( !file )
+        return NULL;
+
+    char file_magic[MAGIC_LENGTH];
+    int32_t prefix[2];
+    int32_t *file_header = g_new( int32_t, header_count + 1 );
+    const int32_t key_length = (int32_t) strlen( key );
+    gchar *file_key = g_malloc( key_length + 1 );
+
+    bool match =
+        fread( file_magic, MAGIC_LENGTH, 1, file ) == 1 && memcmp( file_magic, magic, MAGIC_LENGTH ) == 0 &&
+        fread( prefix, sizeof(prefix), 1, file ) == 1 && prefix[0] == version && prefix[1] == key_length &&
+        fread( file_header, sizeof(int32_t), header_count, file ) == (size_t) header_count &&
+        memcmp( file_header, header, sizeof(int32_t) * header_count ) == 0 &&
+        fread( file_key, 1, key_length, file ) == (size_t) key_length && memcmp( file_key, key, key_length ) == 0;
+
+    g_free( file_header );
+    g_free( file_key );
+
+    if( !match ) {
+        fclose( file );
+        return NULL;
+    }
+
+    return file;
+}
+
@@ -0,0 +1,789 @@
+/*
+    This file is part of the Fluggo Media Library for high-quality
+    video and audio processing.
+
+    Copyright 2012 Brian J. Crowell <brian@fluggo.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include "framework.h"
+
+#undef G_LOG_DOMAIN
+#define G_LOG_DOMAIN "fluggo.media.cprocess.matroska_writer"
+
+#define WRITE_BUFFER_SIZE       (1024 * 1024)
+#define MAX_CLUSTER_SIZE        (5 * 1024 * 1024)
+
+// Room for a seek head with four entries, each at most
+// Seek (2 + 1) + SeekID (2 + 1 + 4) + SeekPosition (2 + 1 + 8)
+#define SEEK_HEAD_RESERVE       (4 + 1 + 4 * 21 + 7)
+
+enum {
+    ID_EBML = 0x1A45DFA3,
+    ID_EBML_VERSION = 0x4286,
+    ID_EBML_READ_VERSION = 0x42F7,
+    ID_EBML_MAX_ID_LENGTH = 0x42F2,
+    ID_EBML_MAX_SIZE_LENGTH = 0x42F3,
+    ID_DOC_TYPE = 0x4282,
+    ID_DOC_TYPE_VERSION = 0x4287,
+    ID_DOC_TYPE_READ_VERSION = 0x4285,
+    ID_VOID = 0xEC,
+
+    ID_SEGMENT = 0x18538067,
+    ID_SEEK_HEAD = 0x114D9B74,
+    ID_SEEK = 0x4DBB,
+    ID_SEEK_ID = 0x53AB,
+    ID_SEEK_POSITION = 0x53AC,
+
+    ID_INFO = 0x1549A966,
+    ID_TIMECODE_SCALE = 0x2AD7B1,
+    ID_DURATION = 0x4489,
+    ID_TITLE = 0x7BA9,
+    ID_MUXING_APP = 0x4D80,
+    ID_WRITING_APP = 0x5741,
+
+    ID_TRACKS = 0x1654AE6B,
+    ID_TRACK_ENTRY = 0xAE,
+    ID_TRACK_NUMBER = 0xD7,
+    ID_TRACK_UID = 0x73C5,
+    ID_TRACK_TYPE = 0x83,
+    ID_FLAG_LACING = 0x9C,
+    ID_DEFAULT_DURATION = 0x23E383,
+    ID_CODEC_ID = 0x86,
+    ID_CODEC_PRIVATE = 0x63A2,
+    ID_VIDEO = 0xE0,
+    ID_FLAG_INTERLACED = 0x9A,
+    ID_PIXEL_WIDTH = 0xB0,
+    ID_PIXEL_HEIGHT = 0xBA,
+    ID_DISPLAY_WIDTH = 0x54B0,
+    ID_DISPLAY_HEIGHT = 0x54BA,
+    ID_AUDIO = 0xE1,
+    ID_SAMPLING_FREQUENCY = 0xB5,
+    ID_CHANNELS = 0x9F,
+    ID_BIT_DEPTH = 0x6264,
+
+    ID_CLUSTER = 0x1F43B675,
+    ID_CLUSTER_TIMECODE = 0xE7,
+    ID_SIMPLE_BLOCK = 0xA3,
+
+    ID_CUES = 0x1C53BB6B,
+    ID_CUE_POINT = 0xBB,
+    ID_CUE_TIME = 0xB3,
+    ID_CUE_TRACK_POSITIONS = 0xB7,
+    ID_CUE_TRACK = 0xF7,
+    ID_CUE_CLUSTER_POSITION = 0xF1,
+
+    ID_TAGS = 0x1254C367,
+    ID_TAG = 0x7373,
+    ID_TARGETS = 0x63C0,
+    ID_TARGET_TYPE_VALUE = 0x68CA,
+    ID_TARGET_TYPE = 0x63CA,
+    ID_SIMPLE_TAG = 0x67C8,
+    ID_TAG_NAME = 0x45A3,
+    ID_TAG_STRING = 0x4487,
+};
+
+typedef struct {
+    matroska_track_params params;
+    char *codec_id;
+    void *codec_private;
+} track_t;
+
+typedef struct {
+    int64_t time, cluster_position;
+    int track;
+} cue_point;
+
+struct matroska_writer_t {
+    int fd;
+    char *doc_type;
+    int64_t timecode_scale;
+
+    // Bytes waiting to go out, and the file position of the first
+    uint8_t *buffer;
+    int buffer_used;
+    int64_t buffer_position;
+
+    // First error seen, or zero; once set, nothing more is written
+    int error;
+
+    GArray *tracks, *cues;
+    GByteArray *tags;
+
+    // Positions in the file of the placeholders
+    int64_t segment_size_position, segment_start, seek_head_position, duration_position;
+
+    // Positions relative to segment_start, or -1 if not written
+    int64_t info_position, tracks_position, cues_position, tags_position;
+
+    // Current cluster, if cluster_position >= 0
+    int64_t cluster_position, cluster_timecode;
+    int cluster_size;
+};
+
+/*
+    EBML elements for the header and trailer are put together in memory first.
+    Blocks skip all of this and go straight to the write buffer.
+*/
+
+static int
+id_width( uint32_t id ) {
+    return (id > 0xFFFFFF) ? 4 : (id > 0xFFFF) ? 3 : (id > 0xFF) ? 2 : 1;
+}
+
+static int
+size_width( uint64_t size ) {
+    int width = 1;
+
+    // All ones is reserved for unknown sizes
+    while( width < 8 && size >= (UINT64_C(1) << (7 * width)) - 1 )
+        width++;
+
+    return width;
+}
+
+static int
+encode_id( uint8_t *out, uint32_t id ) {
+    const int width = id_width( id );
+
+    for( int i = 0; i < width; i++ )
+        out[i] = (uint8_t)(id >> (8 * (width - i - 1)));
+
+    return width;
+}
+
+static int
+encode_size( uint8_t *out, uint64_t size, int width ) {
+    size |= UINT64_C(1) << (7 * width);
+
+    for( int i = 0; i < width; i++ )
+        out[i] = (uint8_t)(size >> (8 * (width - i - 1)));
+
+    return width;
+}
+
+static void
+put_header( GByteArray *buffer, uint32_t id, uint64_t size, int width ) {
+    uint8_t header[12];
+    int length = encode_id( header, id );
+
+    length += encode_size( header + length, size, width ? width : size_width( size ) );
+    g_byte_array_append( buffer, header, length );
+}
+
+static void
+put_binary( GByteArray *buffer, uint32_t id, const void *data, int length ) {
+    put_header( buffer, id, length, 0 );
+    g_byte_array_append( buffer, data, length );
+}
+
+static void
+put_string( GByteArray *buffer, uint32_t id, const char *value ) {
+    if( value )
+        put_binary( buffer, id, value, strlen( value ) );
+}
+
+static void
+put_uint( GByteArray *buffer, uint32_t id, uint64_t value ) {
+    uint8_t data[8];
+    int length = 1;
+
+    while( length < 8 && (value >> (8 * length)) )
+        length++;
+
+    for( int i = 0; i < length; i++ )
+        data[i] = (uint8_t)(value >> (8 * (length - i - 1)));
+
+    put_binary( buffer, id, data, length );
+}
+
+static void
+encode_double( uint8_t *out, double value ) {
+    uint64_t bits;
+    memcpy( &bits, &value, sizeof(bits) );
+
+    for( int i = 0; i < 8; i++ )
+        out[i] = (uint8_t)(bits >> (8 * (7 - i)));
+}
+
+static void
+put_double( GByteArray *buffer, uint32_t id, double value ) {
+    uint8_t data[8];
+    encode_double( data, value );
+    put_binary( buffer, id, data, 8 );
+}
+
+// Appends the contents of child as the body of a new element, and frees child
+static void
+put_master( GByteArray *buffer, uint32_t id, GByteArray *child, int width ) {
+    put_header( buffer, id, child->len, width );
+    g_byte_array_append( buffer, child->data, child->len );
+    g_byte_array_free( child, TRUE );
+}
+
+/*
+    File output
+*/
+
+static int64_t
+get_position( matroska_writer *self ) {
+    return self->buffer_position + self->buffer_used;
+}
+
+static bool
+write_fully( int fd, const uint8_t *data, size_t length ) {
+    while( length ) {
+        ssize_t written = write( fd, data, length );
+
+        if( written < 0 ) {
+            if( errno == EINTR )
+                continue;
+
+            return false;
+        }
+
+        data += written;
+        length -= written;
+    }
+
+    return true;
+}
+
+static bool
+flush_buffer( matroska_writer *self ) {
+    if( self->error )
+        return false;
+
+    if( !write_fully( self->fd, self->buffer, self->buffer_used ) ) {
+        self->error = errno;
+        return false;
+    }
+
+    self->buffer_position += self->buffer_used;
+    self->buffer_used = 0;
+    return true;
+}
+
+static bool
+write_bytes( matroska_writer *self, const void *data, int length ) {
+    if( self->error )
+        return false;
+
+    if( self->buffer_used + length > WRITE_BUFFER_SIZE ) {
+        if( !flush_buffer( self ) )
+            return false;
+
+        // Big enough to skip the buffer entirely
+        if( length >= WRITE_BUFFER_SIZE ) {
+            if( !write_fully( self->fd, data, length ) ) {
+                self->error = errno;
+                return false;
+            }
+
+            self->buffer_position += length;
+            return true;
+        }
+    }
+
+    memcpy( self->buffer + self->buffer_used, data, length );
+    self->buffer_used += length;
+    return true;
+}
+
+static bool
+write_array( matroska_writer *self, GByteArray *array ) {
+    bool result = write_bytes( self, array->data, array->len );
+    g_byte_array_free( array, TRUE );
+    return result;
+}
+
+/*
+    Function: patch
+    Overwrites bytes that were written earlier, whether they've left the
+    buffer or not.
+*/
+static bool
+patch( matroska_writer *self, int64_t position, const uint8_t *data, int length ) {
+    if( self->error )
+        return false;
+
+    g_assert( position + length <= get_position( self ) );
+
+    if( position < self->buffer_position ) {
+        const int flushed = (position + length <= self->buffer_position) ?
+            length : (int)(self->buffer_position - position);
+
+        if( lseek( self->fd, position, SEEK_SET ) < 0 || !write_fully( self->fd, data, flushed ) ||
+                lseek( self->fd, self->buffer_position, SEEK_SET ) < 0 ) {
+            self->error = errno;
+            return false;
+        }
+
+        data += flushed;
+        position += flushed;
+        length -= flushed;
+    }
+
+    if( length )
+        memcpy( self->buffer + (position - self->buffer_position), data, length );
+
+    return true;
+}
+
+static bool
+write_void( matroska_writer *self, int length ) {
+    GByteArray *array = g_byte_array_new();
+
+    // Header is two bytes for a body up to 126
+    g_assert( length >= 2 && length <= 128 );
+
+    put_header( array, ID_VOID, length - 2, 1 );
+    g_byte_array_set_size( array, length );
+    memset( array->data + 2, 0, length - 2 );
+
+    return write_array( self, array );
+}
+
+/*
+    Function: matroska_writer_open
+    Creates a file to write Matroska into.
+
+    path - File to create. If it exists, it's replaced.
+    doc_type - "matroska" or "webm".
+    timecode_scale - Nanoseconds per timecode unit; a million is the usual.
+
+    Returns the writer, or NULL with errno set if the file couldn't be created.
+*/
+EXPORT matroska_writer *
+matroska_writer_open( const char *path, const char *doc_type, int64_t timecode_scale ) {
+    g_assert( timecode_scale > 0 );
+
+    int fd = open( path, O_WRONLY | O_CREAT | O_TRUNC, 0666 );
+
+    if( fd < 0 )
+        return NULL;
+
+    matroska_writer *self = g_slice_new0( matroska_writer );
+
+    self->fd = fd;
+    self->doc_type = g_strdup( doc_type );
+    self->timecode_scale = timecode_scale;
+    self->buffer = g_malloc( WRITE_BUFFER_SIZE );
+    self->tracks = g_array_new( FALSE, FALSE, sizeof(track_t) );
+    self->cues = g_array_new( FALSE, FALSE, sizeof(cue_point) );
+    self->tags = g_byte_array_new();
+    self->info_position = self->tracks_position = self->cues_position = self->tags_position = -1;
+    self->cluster_position = -1;
+
+    return self;
+}
+
+/*
+    Function: matroska_writer_add_track
+    Adds a track. Tracks have to be added before the header is written.
+
+    Returns the track number to pass to matroska_writer_write_block.
+*/
+EXPORT int
+matroska_writer_add_track( matroska_writer *self, const matroska_track_params *params ) {
+    g_assert( self->info_position < 0 );
+
+    g_assert( self->tracks->len < MATROSKA_MAX_TRACKS );
+
+    track_t track = { .params = *params };
+
+    track.codec_id = g_strdup( params->codec_id );
+    track.params.codec_id = track.codec_id;
+
+    if( params->codec_private_size ) {
+        track.codec_private = g_malloc( params->codec_private_size );
+        memcpy( track.codec_private, params->codec_private, params->codec_private_size );
+        track.params.codec_private = track.codec_private;
+    }
+
+    g_array_append_val( self->tracks, track );
+    return self->tracks->len;
+}
+
+/*
+    Function: matroska_writer_add_tag
+    Adds a simple tag, such as a title or description. Tags are written at the
+    end, so this can be called any time before the file is closed.
+
+    target_type_value - Level of the target, such as 50 for a movie or album.
+    target_type - Name for the level, such as "MOVIE", or NULL.
+*/
+EXPORT void
+matroska_writer_add_tag( matroska_writer *self, int target_type_value, const char *target_type, const char *name, const char *value ) {
+    GByteArray *tag = g_byte_array_new(), *targets = g_byte_array_new(), *simple_tag = g_byte_array_new();
+
+    put_uint( targets, ID_TARGET_TYPE_VALUE, target_type_value );
+    put_string( targets, ID_TARGET_TYPE, target_type );
+
+    put_string( simple_tag, ID_TAG_NAME, name );
+    put_string( simple_tag, ID_TAG_STRING, value );
+
+    put_master( tag, ID_TARGETS, targets, 0 );
+    put_master( tag, ID_SIMPLE_TAG, simple_tag, 0 );
+    put_master( self->tags, ID_TAG, tag, 0 );
+}
+
+static GByteArray *
+make_track_entry( int number, const matroska_track_params *params ) {
+    GByteArray *entry = g_byte_array_new();
+
+    put_uint( entry, ID_TRACK_NUMBER, number );
+    put_uint( entry, ID_TRACK_UID, number );
+    put_uint( entry, ID_TRACK_TYPE, params->type );
+    put_uint( entry, ID_FLAG_LACING, 0 );
+    put_string( entry, ID_CODEC_ID, params->codec_id );
+
+    if( params->codec_private_size )
+        put_binary( entry, ID_CODEC_PRIVATE, params->codec_private, params->codec_private_size );
+
+    if( params->default_duration )
+        put_uint( entry, ID_DEFAULT_DURATION, params->default_duration );
+
+    if( params->type == MATROSKA_TRACK_VIDEO ) {
+        GByteArray *video = g_byte_array_new();
+
+        if( params->interlaced )
+            put_uint( video, ID_FLAG_INTERLACED, 1 );
+
+        put_uint( video, ID_PIXEL_WIDTH, params->pixel_size.x );
+        put_uint( video, ID_PIXEL_HEIGHT, params->pixel_size.y );
+
+        if( params->display_size.x && params->display_size.y ) {
+            put_uint( video, ID_DISPLAY_WIDTH, params->display_size.x );
+            put_uint( video, ID_DISPLAY_HEIGHT, params->display_size.y );
+        }
+
+        put_master( entry, ID_VIDEO, video, 0 );
+    }
+    else if( params->type == MATROSKA_TRACK_AUDIO ) {
+        GByteArray *audio = g_byte_array_new();
+
+        put_double( audio, ID_SAMPLING_FREQUENCY, params->sample_rate );
+        put_uint( audio, ID_CHANNELS, params->channels );
+
+        if( params->bit_depth )
+            put_uint( audio, ID_BIT_DEPTH, params->bit_depth );
+
+        put_master( entry, ID_AUDIO, audio, 0 );
+    }
+
+    return entry;
+}
+
+/*
+    Function: matroska_writer_write_header
+    Writes everything before the first cluster.
+
+    writing_app - Name of the application writing the file.
+    title - Title of the segment, or NULL.
+*/
+EXPORT bool
+matroska_writer_write_header( matroska_writer *self, const char *writing_app, const char *title ) {
+    GByteArray *array = g_byte_array_new(), *child = g_byte_array_new();
+
+    put_uint( child, ID_EBML_VERSION, 1 );
+    put_uint( child, ID_EBML_READ_VERSION, 1 );
+    put_uint( child, ID_EBML_MAX_ID_LENGTH, 4 );
+    put_uint( child, ID_EBML_MAX_SIZE_LENGTH, 8 );
+    put_string( child, ID_DOC_TYPE, self->doc_type );
+    put_uint( child, ID_DOC_TYPE_VERSION, 2 );
+    put_uint( child, ID_DOC_TYPE_READ_VERSION, 2 );
+    put_master( array, ID_EBML, child, 0 );
+
+    // The segment's size is a full eight bytes so it can be filled in later
+    self->segment_size_position = get_position( self ) + array->len + 4;
+    put_header( array, ID_SEGMENT, (UINT64_C(1) << 56) - 1, 8 );
+    self->segment_start = get_position( self ) + array->len;
+
+    if( !write_array( self, array ) )
+        goto error;
+
+    self->seek_head_position = get_position( self );
+
+    if( !write_void( self, SEEK_HEAD_RESERVE ) )
+        goto error;
+
+    // Duration goes first so we know where it lands
+    self->info_position = get_position( self ) - self->segment_start;
+    array = g_byte_array_new();
+    child = g_byte_array_new();
+
+    put_double( child, ID_DURATION, 0.0 );
+    put_uint( child, ID_TIMECODE_SCALE, self->timecode_scale );
+    put_string( child, ID_MUXING_APP, "Fluggo MatroskaWriter" );
+    put_string( child, ID_WRITING_APP, writing_app );
+    put_string( child, ID_TITLE, title );
+
+    self->duration_position = get_position( self ) + 4 + size_width( child->len ) + 3;
+    put_master( array, ID_INFO, child, 0 );
+
+    child = g_byte_array_new();
+
+    for( guint i = 0; i < self->tracks->len; i++ ) {
+        put_master( child, ID_TRACK_ENTRY,
+            make_track_entry( i + 1, &g_array_index( self->tracks, track_t, i ).params ), 0 );
+    }
+
+    self->tracks_position = get_position( self ) + array->len - self->segment_start;
+    put_master( array, ID_TRACKS, child, 0 );
+
+    if( !write_array( self, array ) )
+        goto error;
+
+    return true;
+
+error:
+    errno = self->error;
+    return false;
+}
+
+static bool
+finish_cluster( matroska_writer *self ) {
+    if( self->cluster_position < 0 )
+        return true;
+
+    uint8_t size[8];
+    const int64_t body = self->cluster_position + 4 + 8;
+
+    encode_size( size, get_position( self ) - body, 8 );
+    self->cluster_position = -1;
+
+    return patch( self, body - 8, size, 8 );
+}
+
+static bool
+start_cluster( matroska_writer *self, int64_t timecode ) {
+    GByteArray *array = g_byte_array_new();
+
+    self->cluster_position = get_position( self );
+    self->cluster_timecode = timecode;
+    self->cluster_size = 0;
+
+    // Unknown size until the cluster is done
+    put_header( array, ID_CLUSTER, (UINT64_C(1) << 56) - 1, 8 );
+    put_uint( array, ID_CLUSTER_TIMECODE, timecode );
+
+    return write_array( self, array );
+}
+
+/*
+    Function: matroska_writer_write_block
+    Writes a packet as a SimpleBlock. Blocks should come in decode order, with
+    the tracks interleaved.
+
+    track - Track number from matroska_writer_add_track.
+    timecode - Presentation time of the packet.
+*/
+EXPORT bool
+matroska_writer_write_block( matroska_writer *self, int track, int64_t timecode,
+        const void *data, int length, bool keyframe, bool discardable ) {
+    g_assert( track >= 1 && track <= (int) self->tracks->len );
+    g_assert( self->tracks_position >= 0 );
+
+    const bool video = g_array_index( self->tracks, track_t, track - 1 ).params.type == MATROSKA_TRACK_VIDEO;
+    const int64_t relative = timecode - self->cluster_timecode;
+
+    // Start clusters on video keyframes where we can, so the cues land on them
+    if( self->cluster_position < 0 || relative < INT16_MIN || relative > INT16_MAX ||
+            self->cluster_size > MAX_CLUSTER_SIZE ||
+            (video && keyframe && relative * self->timecode_scale >= INT64_C(1000000000)) ) {
+        if( !finish_cluster( self ) || !start_cluster( self, timecode ) )
+            goto error;
+    }
+
+    if( video && keyframe ) {
+        cue_point cue = { .time = timecode, .track = track,
+            .cluster_position = self->cluster_position - self->segment_start };
+        g_array_append_val( self->cues, cue );
+    }
+
+    uint8_t header[13];
+    int header_length = encode_id( header, ID_SIMPLE_BLOCK );
+    const int16_t block_timecode = (int16_t)(timecode - self->cluster_timecode);
+
+    header_length += encode_size( header + header_length, length + 4, size_width( length + 4 ) );
+    header[header_length++] = 0x80 | track;
+    header[header_length++] = (uint8_t)((uint16_t) block_timecode >> 8);
+    header[header_length++] = (uint8_t) block_timecode;
+    header[header_length++] = (keyframe ? 0x80 : 0) | (discardable ? 0x01 : 0);
+
+    if( !write_bytes( self, header, header_length ) || !write_bytes( self, data, length ) )
+        goto error;
+
+    self->cluster_size += header_length + length;
+    return true;
+
+error:
+    errno = self->error;
+    return false;
+}
+
+static void
+add_seek( GByteArray *seek_head, uint32_t id, int64_t position ) {
+    if( position < 0 )
+        return;
+
+    GByteArray *seek = g_byte_array_new();
+    uint8_t id_bytes[4];
+
+    put_binary( seek, ID_SEEK_ID, id_bytes, encode_id( id_bytes, id ) );
+    put_uint( seek, ID_SEEK_POSITION, position );
+    put_master( seek_head, ID_SEEK, seek, 0 );
+}
+
+static void
+free_writer( matroska_writer *self ) {
+    for( guint i = 0; i < self->tracks->len; i++ ) {
+        track_t *track = &g_array_index( self->tracks, track_t, i );
+
+        g_free( track->codec_id );
+        g_free( track->codec_private );
+    }
+
+    g_array_free( self->tracks, TRUE );
+    g_array_free( self->cues, TRUE );
+    g_byte_array_free( self->tags, TRUE );
+    g_free( self->buffer );
+    g_free( self->doc_type );
+    g_slice_free( matroska_writer, self );
+}
+
+/*
+    Function: matroska_writer_close
+    Writes the cues and tags, fills in the placeholders from the start of
+    the file, and closes it. The writer is freed either way.
+
+    duration - Length of the segment in timecode units.
+*/
+EXPORT bool
+matroska_writer_close( matroska_writer *self, int64_t duration ) {
+    if( !finish_cluster( self ) )
+        goto error;
+
+    if( self->cues->len ) {
+        GByteArray *array = g_byte_array_new(), *cues = g_byte_array_new();
+
+        for( guint i = 0; i < self->cues->len; i++ ) {
+            const cue_point *cue = &g_array_index( self->cues, cue_point, i );
+            GByteArray *point = g_byte_array_new(), *positions = g_byte_array_new();
+
+            put_uint( positions, ID_CUE_TRACK, cue->track );
+            put_uint( positions, ID_CUE_CLUSTER_POSITION, cue->cluster_position );
+
+            put_uint( point, ID_CUE_TIME, cue->time );
+            put_master( point, ID_CUE_TRACK_POSITIONS, positions, 0 );
+            put_master( cues, ID_CUE_POINT, point, 0 );
+        }
+
+        self->cues_position = get_position( self ) - self->segment_start;
+        put_master( array, ID_CUES, cues, 0 );
+
+        if( !write_array( self, array ) )
+            goto error;
+    }
+
+    if( self->tags->len ) {
+        GByteArray *array = g_byte_array_new();
+
+        self->tags_position = get_position( self ) - self->segment_start;
+        put_master( array, ID_TAGS, self->tags, 0 );
+        self->tags = g_byte_array_new();
+
+        if( !write_array( self, array ) )
+            goto error;
+    }
+
+    // Seek head, padded out to its reserved space
+    GByteArray *array = g_byte_array_new(), *seek_head = g_byte_array_new();
+
+    add_seek( seek_head, ID_INFO, self->info_position );
+    add_seek( seek_head, ID_TRACKS, self->tracks_position );
+    add_seek( seek_head, ID_CUES, self->cues_position );
+    add_seek( seek_head, ID_TAGS, self->tags_position );
+
+    int width = size_width( seek_head->len );
+
+    // A void can't be one byte long, so take up the slack in the size instead
+    if( SEEK_HEAD_RESERVE - (4 + width + (int) seek_head->len) == 1 )
+        width++;
+
+    put_master( array, ID_SEEK_HEAD, seek_head, width );
+
+    const int slack = SEEK_HEAD_RESERVE - array->len;
+
+    if( slack ) {
+        g_byte_array_set_size( array, SEEK_HEAD_RESERVE );
+        encode_id( array->data + SEEK_HEAD_RESERVE - slack, ID_VOID );
+        encode_size( array->data + SEEK_HEAD_RESERVE - slack + 1, slack - 2, 1 );
+        memset( array->data + SEEK_HEAD_RESERVE - slack + 2, 0, slack - 2 );
+    }
+
+    bool patched = patch( self, self->seek_head_position, array->data, array->len );
+    g_byte_array_free( array, TRUE );
+
+    if( !patched )
+        goto error;
+
+    uint8_t bytes[8];
+
+    encode_double( bytes, (double) duration );
+
+    if( !patch( self, self->duration_position, bytes, 8 ) )
+        goto error;
+
+    encode_size( bytes, get_position( self ) - self->segment_start, 8 );
+
+    if( !patch( self, self->segment_size_position, bytes, 8 ) || !flush_buffer( self ) )
+        goto error;
+
+    if( close( self->fd ) != 0 ) {
+        int error = errno;
+        free_writer( self );
+        errno = error;
+        return false;
+    }
+
+    free_writer( self );
+    return true;
+
+error:
+    {
+        int error = self->error;
+        matroska_writer_abort( self );
+        errno = error;
+    }
+
+    return false;
+}
+
+/*
+    Function: matroska_writer_abort
+    Closes the file as it stands, leaving it incomplete, and frees the writer.
+*/
+EXPORT void
+matroska_writer_abort( matroska_writer *self ) {
+    flush_buffer( self );
+    close( self->fd );
+    free_writer( self );
+}
@@ -0,0 +1,474 @@
+/*
+    This file is part of the Fluggo Media Library for high-quality
+    video and audio processing.
+
+    Copyright 2012 Brian J. Crowell <brian@fluggo.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "framework.h"
+
+#undef G_LOG_DOMAIN
+#define G_LOG_DOMAIN "fluggo.media.cprocess.readahead_file"
+
+// Blocks are aligned for the benefit of the disk
+#define BLOCK_ALIGNMENT     4096
+
+// After this many blocks read forward in a row, stop reading behind
+#define FORWARD_RUN         4
+
+typedef enum {
+    BLOCK_EMPTY,
+    BLOCK_LOADING,
+    BLOCK_READY
+} block_state;
+
+typedef struct {
+    int64_t index;
+    block_state state;
+
+    // Bytes in the block, or a negative errno if the read failed
+    int length;
+    uint8_t *data;
+} cache_block;
+
+struct readahead_file_t {
+    int fd, flags;
+    int64_t size;
+
+    int block_size, block_count;
+    cache_block *blocks;
+    void *memory;
+
+    // Reader's position, and which way it's headed
+    int64_t position, last_block;
+    int direction, forward_run;
+
+    // Block the reader is waiting on, or -1
+    int64_t wanted;
+
+    // Artificial delay on each block read, in nanoseconds, for testing
+    int64_t latency;
+
+    readahead_file_stats stats;
+
+    GMutex mutex;
+    GCond cond;
+    GThread *thread;
+    bool quit;
+};
+
+static cache_block *
+find_block( readahead_file *self, int64_t index ) {
+    for( int i = 0; i < self->block_count; i++ ) {
+        if( self->blocks[i].state != BLOCK_EMPTY && self->blocks[i].index == index )
+            return &self->blocks[i];
+    }
+
+    return NULL;
+}
+
+static bool
+block_in_file( readahead_file *self, int64_t index ) {
+    return index >= 0 && index * self->block_size < self->size;
+}
+
+/*
+    Function: next_block
+    Decides which block the thread should read next, or returns -1 if we
+    already have everything we want. Call with the mutex held.
+*/
+static int64_t
+next_block( readahead_file *self ) {
+    if( self->wanted >= 0 && !find_block( self, self->wanted ) )
+        return self->wanted;
+
+    const int64_t current = self->position / self->block_size;
+
+    // Leave a few blocks for what's just behind us
+    const int window = max( 1, (self->block_count * 3) / 4 );
+
+    for( int i = 0; i < window; i++ ) {
+        int64_t index;
+
+        if( self->direction > 0 ) {
+            index = current + i;
+        }
+        else {
+            // Going backwards, the demuxer still reads forward inside each
+            // jump, so fetch on both sides, favoring behind
+            index = (i & 1) ? current + (i + 1) / 2 : current - i / 2;
+        }
+
+        if( block_in_file( self, index ) && !find_block( self, index ) )
+            return index;
+    }
+
+    return -1;
+}
+
+/*
+    Function: pick_slot
+    Finds a slot to read the given block into, throwing out whatever is farthest
+    from the reader. Returns NULL if everything cached is closer than the new block
+    (so it's not worth reading). Call with the mutex held.
+*/
+static cache_block *
+pick_slot( readahead_file *self, int64_t index ) {
+    const int64_t current = self->position / self->block_size;
+    cache_block *victim = NULL;
+    int64_t victim_distance = -1;
+
+    for( int i = 0; i < self->block_count; i++ ) {
+        cache_block *block = &self->blocks[i];
+
+        if( block->state == BLOCK_EMPTY )
+            return block;
+
+        if( block->state == BLOCK_LOADING )
+            continue;
+
+        int64_t distance = llabs( block->index - current );
+
+        if( distance > victim_distance ) {
+            victim = block;
+            victim_distance = distance;
+        }
+    }
+
+    if( victim && index != self->wanted && victim_distance <= llabs( index - current ) )
+        return NULL;
+
+    return victim;
+}
+
+static int
+read_block( readahead_file *self, int64_t index, uint8_t *data ) {
+    int64_t offset = index * self->block_size;
+    int total = 0;
+
+    // Only this thread touches the file position, so there's no need for pread
+    if( lseek( self->fd, offset, SEEK_SET ) < 0 )
+        return -errno;
+
+    while( total < self->block_size ) {
+        ssize_t count = read( self->fd, data + total, self->block_size - total );
+
+        if( count < 0 ) {
+            if( errno == EINTR )
+                continue;
+
+            return -errno;
+        }
+
+        if( count == 0 )
+            break;
+
+        total += count;
+    }
+
+    if( self->flags & READAHEAD_FILE_NOCACHE )
+        posix_fadvise( self->fd, offset, total, POSIX_FADV_DONTNEED );
+
+    return total;
+}
+
+static gpointer
+readahead_thread( readahead_file *self ) {
+    g_mutex_lock( &self->mutex );
+
+    while( !self->quit ) {
+        int64_t index = next_block( self );
+        cache_block *block = (index >= 0) ? pick_slot( self, index ) : NULL;
+
+        if( !block ) {
+            g_cond_wait( &self->cond, &self->mutex );
+            continue;
+        }
+
+        block->index = index;
+        block->state = BLOCK_LOADING;
+        int64_t latency = self->latency;
+
+        g_mutex_unlock( &self->mutex );
+
+        if( latency > 0 )
+            g_usleep( latency / 1000 );
+
+        int length = read_block( self, index, block->data );
+
+        g_mutex_lock( &self->mutex );
+
+        block->length = length;
+        block->state = BLOCK_READY;
+
+        if( length >= 0 ) {
+            self->stats.blocks_read++;
+            self->stats.bytes_read += length;
+        }
+
+        g_cond_broadcast( &self->cond );
+    }
+
+    g_mutex_unlock( &self->mutex );
+    return NULL;
+}
+
+/*
+    Function: readahead_file_open
+    Opens a file for reading through a read-ahead cache.
+
+    path - File to open.
+    block_size - Size of each read, in bytes. This is rounded up to a multiple of 4096.
+    block_count - Number of blocks to cache. At least two.
+    flags - Zero or READAHEAD_FILE_NOCACHE.
+
+    Returns the file, or NULL with errno set if it couldn't be opened.
+*/
+EXPORT readahead_file *
+readahead_file_open( const char *path, int block_size, int block_count, int flags ) {
+    g_assert( block_size > 0 );
+    g_assert( block_count >= 2 );
+
+    int fd = open( path, O_RDONLY );
+
+    if( fd < 0 )
+        return NULL;
+
+    struct stat info;
+
+    if( fstat( fd, &info ) != 0 ) {
+        int error = errno;
+        close( fd );
+        errno = error;
+        return NULL;
+    }
+
+    block_size = (block_size + BLOCK_ALIGNMENT - 1) & ~(BLOCK_ALIGNMENT - 1);
+
+    void *memory;
+
+    if( posix_memalign( &memory, BLOCK_ALIGNMENT, (size_t) block_size * block_count ) != 0 ) {
+        close( fd );
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    // We do our own read-ahead; the kernel's would just double it up
+    posix_fadvise( fd, 0, 0, (flags & READAHEAD_FILE_NOCACHE) ? POSIX_FADV_RANDOM : POSIX_FADV_NORMAL );
+
+    readahead_file *self = g_slice_new0( readahead_file );
+
+    self->fd = fd;
+    self->flags = flags;
+    self->size = info.st_size;
+    self->block_size = block_size;
+    self->block_count = block_count;
+    self->memory = memory;
+    self->blocks = g_new0( cache_block, block_count );
+    self->direction = 1;
+    self->last_block = 0;
+    self->wanted = -1;
+
+    for( int i = 0; i < block_count; i++ )
+        self->blocks[i].data = (uint8_t *) memory + (size_t) i * block_size;
+
+    g_mutex_init( &self->mutex );
+    g_cond_init( &self->cond );
+
+    self->thread = g_thread_new( "readahead_file", (GThreadFunc) readahead_thread, self );
+
+    return self;
+}
+
+EXPORT void
+readahead_file_close( readahead_file *self ) {
+    if( !self )
+        return;
+
+    g_mutex_lock( &self->mutex );
+    self->quit = true;
+    g_cond_broadcast( &self->cond );
+    g_mutex_unlock( &self->mutex );
+
+    g_thread_join( self->thread );
+
+    g_mutex_clear( &self->mutex );
+    g_cond_clear( &self->cond );
+
+    close( self->fd );
+    free( self->memory );
+    g_free( self->blocks );
+    g_slice_free( readahead_file, self );
+}
+
+EXPORT int64_t
+readahead_file_get_size( readahead_file *self ) {
+    return self->size;
+}
+
+/*
+    Function: readahead_file_read
+    Reads from the current position, waiting for the thread if it hasn't
+    gotten to that part of the file yet.
+
+    Returns the number of bytes read, zero at the end of the file, or a negative
+    errno if the read failed.
+*/
+EXPORT int
+readahead_file_read( readahead_file *self, void *buffer, int size ) {
+    int total = 0;
+
+    g_mutex_lock( &self->mutex );
+
+    while( total < size && self->position < self->size ) {
+        int64_t index = self->position / self->block_size;
+        int offset = (int)(self->position % self->block_size);
+        cache_block *block = find_block( self, index );
+
+        if( block && block->state == BLOCK_READY ) {
+            self->stats.hits++;
+        }
+        else {
+            self->stats.misses++;
+            self->wanted = index;
+            g_cond_broadcast( &self->cond );
+
+            while( !(block = find_block( self, index )) || block->state != BLOCK_READY )
+                g_cond_wait( &self->cond, &self->mutex );
+
+            self->wanted = -1;
+        }
+
+        if( block->length < 0 ) {
+            int error = block->length;
+
+            // Let it try again next time
+            block->state = BLOCK_EMPTY;
+            g_mutex_unlock( &self->mutex );
+
+            return total ? total : error;
+        }
+
+        int count = min( size - total, block->length - offset );
+
+        if( count <= 0 )
+            break;
+
+        memcpy( (uint8_t *) buffer + total, block->data + offset, count );
+        total += count;
+        self->position += count;
+
+        // Moving on to the next block counts as going forward
+        int64_t new_block = self->position / self->block_size;
+
+        if( new_block != self->last_block ) {
+            if( new_block == self->last_block + 1 && ++self->forward_run >= FORWARD_RUN )
+                self->direction = 1;
+
+            self->last_block = new_block;
+        }
+
+        g_cond_broadcast( &self->cond );
+    }
+
+    g_mutex_unlock( &self->mutex );
+
+    return total;
+}
+
+/*
+    Function: readahead_file_seek
+    Moves the read position, like lseek. Seeking backwards tells the thread to
+    start reading behind the new position as well as ahead.
+
+    Returns the new position, or -1 if whence isn't valid or the position is negative.
+*/
+EXPORT int64_t
+readahead_file_seek( readahead_file *self, int64_t offset, int whence ) {
+    g_mutex_lock( &self->mutex );
+
+    int64_t position;
+
+    switch( whence ) {
+        case SEEK_SET:
+            position = offset;
+            break;
+
+        case SEEK_CUR:
+            position = self->position + offset;
+            break;
+
+        case SEEK_END:
+            position = self->size + offset;
+            break;
+
+        default:
+            g_mutex_unlock( &self->mutex );
+            return -1;
+    }
+
+    if( position < 0 ) {
+        g_mutex_unlock( &self->mutex );
+        return -1;
+    }
+
+    int64_t new_block = position / self->block_size;
+
+    if( new_block < self->last_block ) {
+        self->direction = -1;
+        self->forward_run = 0;
+    }
+    else if( new_block > self->last_block + 1 ) {
+        self->direction = 1;
+    }
+
+    self->position = position;
+    self->last_block = new_block;
+
+    g_cond_broadcast( &self->cond );
+    g_mutex_unlock( &self->mutex );
+
+    return position;
+}
+
+EXPORT void
+readahead_file_get_stats( readahead_file *self, readahead_file_stats *stats ) {
+    g_mutex_lock( &self->mutex );
+    *stats = self->stats;
+    g_mutex_unlock( &self->mutex );
+}
+
+/*
+    Function: readahead_file_set_latency
+    Adds an artificial delay to every block read, for testing how the cache
+    holds up against a slow disk.
+
+    latency - Delay in nanoseconds.
+*/
+EXPORT void
+readahead_file_set_latency( readahead_file *self, int64_t latency ) {
+    g_mutex_lock( &self->mutex );
+    self->latency = latency;
+    g_mutex_unlock( &self->mutex );
+}
+
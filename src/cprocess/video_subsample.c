@@ -73,117 +73,396 @@ coded_image_alloc0( const int *strides, const int *line_counts, int count ) {
 }
 
 
-typedef struct {
-    float cb, cr;
-} cbcr_f32;
+typedef float v4f __attribute__ ((vector_size (16)));
+typedef int32_t v4i __attribute__ ((vector_size (16)));
+
+static inline v4f
+v4f_splat( float x ) {
+    return (v4f) { x, x, x, x };
+}
 
-float
-studio_float_to_chroma8( float chroma ) {
-    return chroma * 224.0f + 128.0f;
+static inline v4f
+v4f_clamp( v4f x, v4f low, v4f high ) {
+    v4i mask = x < low;
+    x = (v4f)((mask & (v4i) low) | (~mask & (v4i) x));
+    mask = x > high;
+    return (v4f)((mask & (v4i) high) | (~mask & (v4i) x));
 }
 
-float
-studio_float_to_luma8( float luma ) {
-    return luma * 219.0f + 16.0f;
+static inline v4i
+v4f_to_v4i( v4f x ) {
+    v4i result;
+
+    for( int i = 0; i < 4; i++ )
+        result[i] = (int32_t) x[i];
+
+    return result;
 }
 
+// RGB->Rec. 709 YPbPr matrix in Poynton, p. 315:
+static const float rec709_matrix[3][3] = {
+    {  0.2126f,    0.7152f,    0.0722f   },
+    { -0.114572f, -0.385428f,  0.5f      },
+    {  0.5f,      -0.454153f, -0.045847f }
+};
+
 /*
-    Function: video_subsample_dv
-    Subsamples to planar standard-definition NTSC DV:
+    Table taking every linear half straight to a Rec. 709 gamma-encoded float,
+    so the transfer function and the conversion out of half are one lookup
+    (and the alpha channel is never touched).
+*/
+static const float *
+get_rec709_encode_table() {
+    static float *__table = NULL;
+    static gsize __init = 0;
 
-    720x480 YCbCr
-    4:1:1 subsampling, co-sited with left pixel
-    Rec 709 matrix
-    Rec 709 transfer function
+    if( g_once_init_enter( &__init ) ) {
+        half *h = g_malloc( sizeof(half) * HALF_COUNT );
+        __table = g_malloc( sizeof(float) * HALF_COUNT );
+
+        for( int i = 0; i < HALF_COUNT; i++ )
+            h[i] = (half) i;
+
+        video_transfer_linear_to_rec709( h, h, HALF_COUNT );
+        half_convert_to_float( __table, h, HALF_COUNT );
+        g_free( h );
+
+        g_once_init_leave( &__init, 1 );
+    }
+
+    return __table;
+}
+
+typedef struct {
+    v4f scale, offset, low, high;
+} quantizer;
+
+static void
+quantizer_init( quantizer *q, float scale, float offset, int bit_depth ) {
+    const float shift = (float)(1 << (bit_depth - 8));
+
+    // The half is there so truncation rounds to nearest; the lowest and highest
+    // codes are reserved for sync, so keep out of those
+    q->scale = v4f_splat( scale * shift );
+    q->offset = v4f_splat( offset * shift + 0.5f );
+    q->low = v4f_splat( shift );
+    q->high = v4f_splat( (float)((1 << bit_depth) - 1) - shift );
+}
+
+static inline void
+store_samples( void *line, int x, v4f value, const quantizer *q, int bit_depth, int count ) {
+    v4i code = v4f_to_v4i( v4f_clamp( value * q->scale + q->offset, q->low, q->high ) );
+
+    if( bit_depth == 8 ) {
+        for( int i = 0; i < count; i++ )
+            ((uint8_t *) line)[x + i] = (uint8_t) code[i];
+    }
+    else {
+        for( int i = 0; i < count; i++ )
+            ((uint16_t *) line)[x + i] = (uint16_t) code[i];
+    }
+}
+
+typedef struct {
+    const video_subsample_params *params;
+    int sub_x, chroma_width, padded_chroma_width;
+    quantizer luma_q, chroma_q;
+    fir_filter h_filter;
+    const float *encode;
+
+    // Scratch for one line of the frame; the full-resolution chroma
+    // lines have pad samples on either side so the filter can run off the edges
+    rgba_f16 *half_line;
+    float *cb_line, *cr_line;
+    int pad;
+} subsampler;
+
+static inline void *
+plane_line( void *const planes[3], const int strides[3], int plane, int line ) {
+    return (uint8_t *) planes[plane] + line * strides[plane];
+}
+
+/*
+    Converts one line of the frame, writing luma to luma_out and the horizontally
+    filtered (but not yet quantized) chroma to cb_out and cr_out, which each need
+    room for padded_chroma_width samples.
 */
-EXPORT coded_image *
-video_subsample_dv( rgba_frame_f16 *frame ) {
-    const int full_width = 720, full_height = 480;
+static void
+subsample_line( subsampler *sub, rgba_frame_f16 *frame, int line, void *luma_out, float *cb_out, float *cr_out ) {
+    const video_subsample_params *params = sub->params;
+    const int width = params->size.x, y = line + params->offset.y;
 
-    // RGB->Rec. 709 YPbPr matrix in Poynton, p. 315:
-    const float colorMatrix[3][3] = {
-        {  0.2126f,    0.7152f,    0.0722f   },
-        { -0.114572f, -0.385428f,  0.5f      },
-        {  0.5f,      -0.454153f, -0.045847f }
+    // Anything outside the current window is black
+    memset( sub->half_line, 0, sizeof(rgba_f16) * width );
+
+    if( y >= frame->current_window.min.y && y <= frame->current_window.max.y ) {
+        const int min_x = max( frame->current_window.min.x, params->offset.x ),
+            max_x = min( frame->current_window.max.x, params->offset.x + width - 1 );
+
+        if( min_x <= max_x ) {
+            memcpy( sub->half_line + (min_x - params->offset.x), video_get_pixel_f16( frame, min_x, y ),
+                sizeof(rgba_f16) * (max_x - min_x + 1) );
+        }
+    }
+
+    const v4f m[3][3] = {
+        { v4f_splat( rec709_matrix[0][0] ), v4f_splat( rec709_matrix[0][1] ), v4f_splat( rec709_matrix[0][2] ) },
+        { v4f_splat( rec709_matrix[1][0] ), v4f_splat( rec709_matrix[1][1] ), v4f_splat( rec709_matrix[1][2] ) },
+        { v4f_splat( rec709_matrix[2][0] ), v4f_splat( rec709_matrix[2][1] ), v4f_splat( rec709_matrix[2][2] ) },
     };
+    float *cb_line = sub->cb_line + sub->pad, *cr_line = sub->cr_line + sub->pad;
 
-    // Offset the frame so that line zero is part of the first field
-    const v2i picOffset = { 0, -1 };
+    for( int x = 0; x < width; x += 4 ) {
+        // Four pixels at a time, as planes; past the right edge, repeat the last pixel
+        const int count = min( 4, width - x );
+        v4f r, g, b;
 
-    // Set up subsample support
-    const int subX = 4;
-    const float subOffsetX = 0.0f;
+        for( int i = 0; i < 4; i++ ) {
+            const rgba_f16 *pixel = &sub->half_line[x + min( i, count - 1 )];
 
-    const int strides[3] = { full_width, full_width / subX, full_width / subX };
-    const int line_counts[3] = { full_height, full_height, full_height };
+            r[i] = sub->encode[pixel->r];
+            g[i] = sub->encode[pixel->g];
+            b[i] = sub->encode[pixel->b];
+        }
 
-    // Set up the current window
-    box2i window = {
-        { max( picOffset.x, frame->current_window.min.x ),
-          max( picOffset.y, frame->current_window.min.y ) },
-        { min( full_width + picOffset.x - 1, frame->current_window.max.x ),
-          min( full_height + picOffset.y - 1, frame->current_window.max.y ) }
-    };
-    int window_width = window.max.x - window.min.x + 1;
+        v4f luma = r * m[0][0] + g * m[0][1] + b * m[0][2],
+            cb = r * m[1][0] + g * m[1][1] + b * m[1][2],
+            cr = r * m[2][0] + g * m[2][1] + b * m[2][2];
 
-    coded_image *planar = coded_image_alloc0( strides, line_counts, 3 );
+        store_samples( luma_out, x, luma, &sub->luma_q, params->bit_depth, count );
+        memcpy( cb_line + x, &cb, sizeof(float) * count );
+        memcpy( cr_line + x, &cr, sizeof(float) * count );
+    }
+
+    // Extend the edges for the filter
+    for( int i = 1; i <= sub->pad; i++ ) {
+        cb_line[-i] = cb_line[0];
+        cr_line[-i] = cr_line[0];
+        cb_line[width - 1 + i] = cb_line[width - 1];
+        cr_line[width - 1 + i] = cr_line[width - 1];
+    }
+
+    const fir_filter *filter = &sub->h_filter;
+
+    for( int cx = 0; cx < sub->padded_chroma_width; cx += 4 ) {
+        v4f cb = v4f_splat( 0.0f ), cr = v4f_splat( 0.0f );
 
-    // BJC: What follows is the horizontal-subsample-only case
-    fir_filter triangleFilter = { NULL };
-    filter_createTriangle( 1.0f / (float) subX, subOffsetX, &triangleFilter );
-
-    // Temp rows aligned to the input window [window.min.x, window.max.x]
-    rgba_f32 *tempRow = g_slice_alloc( sizeof(rgba_f32) * window_width );
-    cbcr_f32 *tempChroma = g_slice_alloc( sizeof(cbcr_f32) * window_width );
-
-    // Turn into half RGB
-    for( int row = window.min.y - picOffset.y; row <= window.max.y - picOffset.y; row++ ) {
-        uint8_t *yrow = (uint8_t*) planar->data[0] + (row * planar->stride[0]);
-        uint8_t *cbrow = (uint8_t*) planar->data[1] + (row * planar->stride[1]);
-        uint8_t *crrow = (uint8_t*) planar->data[2] + (row * planar->stride[2]);
-
-        rgba_f16 *in = video_get_pixel_f16( frame, window.min.x, row + picOffset.y );
-
-        video_transfer_linear_to_rec709( &in->r, &in->r, (sizeof(rgba_f16) / sizeof(half)) * window_width );
-        rgba_f16_to_f32( tempRow, in, window_width );
-
-        for( int x = 0; x < window_width; x++ ) {
-            float y = studio_float_to_luma8(
-                tempRow[x].r * colorMatrix[0][0] +
-                tempRow[x].g * colorMatrix[0][1] +
-                tempRow[x].b * colorMatrix[0][2] );
-            tempChroma[x].cb =
-                tempRow[x].r * colorMatrix[1][0] +
-                tempRow[x].g * colorMatrix[1][1] +
-                tempRow[x].b * colorMatrix[1][2];
-            tempChroma[x].cr =
-                tempRow[x].r * colorMatrix[2][0] +
-                tempRow[x].g * colorMatrix[2][1] +
-                tempRow[x].b * colorMatrix[2][2];
-
-            yrow[x + window.min.x] = (uint8_t) y;
+        for( int tap = 0; tap < filter->width; tap++ ) {
+            const int sx = cx * sub->sub_x + tap - filter->center;
+            const v4f coeff = v4f_splat( filter->coeff[tap] );
+            v4f cb_in, cr_in;
+
+            for( int i = 0; i < 4; i++ ) {
+                cb_in[i] = cb_line[sx + i * sub->sub_x];
+                cr_in[i] = cr_line[sx + i * sub->sub_x];
+            }
+
+            cb += cb_in * coeff;
+            cr += cr_in * coeff;
         }
 
-        for( int tx = window.min.x / subX; tx <= window.max.x / subX; tx++ ) {
-            float cb = 0.0f, cr = 0.0f;
+        memcpy( cb_out + cx, &cb, sizeof(v4f) );
+        memcpy( cr_out + cx, &cr, sizeof(v4f) );
+    }
+}
 
-            for( int sx = max(window.min.x, tx * subX - triangleFilter.center);
-                sx <= min(window.max.x, tx * subX + (triangleFilter.width - triangleFilter.center - 1)); sx++ ) {
+static void
+store_chroma_line( subsampler *sub, void *out, const float *in ) {
+    for( int cx = 0; cx < sub->chroma_width; cx += 4 ) {
+        v4f value;
+        memcpy( &value, in + cx, sizeof(v4f) );
 
-                cb += tempChroma[sx - window.min.x].cb * triangleFilter.coeff[sx - tx * subX + triangleFilter.center];
-                cr += tempChroma[sx - window.min.x].cr * triangleFilter.coeff[sx - tx * subX + triangleFilter.center];
+        store_samples( out, cx, value, &sub->chroma_q, sub->params->bit_depth,
+            min( 4, sub->chroma_width - cx ) );
+    }
+}
+
+// Moves a filter tap back onto the picture, staying in the same field if step is two
+static inline int
+clamp_line( int line, int step, int height ) {
+    while( line < 0 )
+        line += step;
+
+    while( line >= height )
+        line -= step;
+
+    return line;
+}
+
+static void
+subsample_420( subsampler *sub, rgba_frame_f16 *frame, void *const planes[3], const int strides[3] ) {
+    const int height = sub->params->size.y, chroma_height = (height + 1) / 2;
+    const int step = (sub->params->interlaced && height >= 2) ? 2 : 1;
+    fir_filter v_filter[2] = { { NULL }, { NULL } };
+
+    if( step == 2 ) {
+        // Chroma lines alternate fields; within its field, each sits a quarter
+        // of the way down from its first luma line in the top field and three
+        // quarters in the bottom
+        filter_createTriangle( 0.5f, 0.25f, &v_filter[0] );
+        filter_createTriangle( 0.5f, 0.75f, &v_filter[1] );
+    }
+    else {
+        filter_createTriangle( 0.5f, 0.5f, &v_filter[0] );
+        filter_createTriangle( 0.5f, 0.5f, &v_filter[1] );
+    }
+
+    // Horizontally filtered chroma for the lines the vertical filter can still reach
+    const int ring_size = step * max( v_filter[0].width, v_filter[1].width ) + 4;
+    const int pcw = sub->padded_chroma_width;
+    float *ring_cb = g_new( float, ring_size * pcw ), *ring_cr = g_new( float, ring_size * pcw );
+    float *cb = g_new( float, pcw ), *cr = g_new( float, pcw );
+    int next_line = 0;
+
+    for( int cy = 0; cy < chroma_height; cy++ ) {
+        const int field = (step == 2) ? (cy & 1) : 0;
+        const int first_line = (step == 2) ? ((cy >> 1) * 4 + field) : (cy * 2);
+        const fir_filter *filter = &v_filter[field];
+
+        const int last_line = clamp_line( first_line + step * (filter->width - 1 - filter->center), step, height );
+
+        for( ; next_line <= last_line; next_line++ ) {
+            const int slot = (next_line % ring_size) * pcw;
+
+            subsample_line( sub, frame, next_line, plane_line( planes, strides, 0, next_line ),
+                ring_cb + slot, ring_cr + slot );
+        }
+
+        memset( cb, 0, sizeof(float) * pcw );
+        memset( cr, 0, sizeof(float) * pcw );
+
+        for( int tap = 0; tap < filter->width; tap++ ) {
+            const int line = clamp_line( first_line + step * (tap - filter->center), step, height );
+            const float *cb_in = ring_cb + (line % ring_size) * pcw, *cr_in = ring_cr + (line % ring_size) * pcw;
+            const v4f coeff = v4f_splat( filter->coeff[tap] );
+
+            for( int cx = 0; cx < pcw; cx += 4 ) {
+                v4f acc, in;
+
+                memcpy( &acc, cb + cx, sizeof(v4f) );
+                memcpy( &in, cb_in + cx, sizeof(v4f) );
+                acc += in * coeff;
+                memcpy( cb + cx, &acc, sizeof(v4f) );
+
+                memcpy( &acc, cr + cx, sizeof(v4f) );
+                memcpy( &in, cr_in + cx, sizeof(v4f) );
+                acc += in * coeff;
+                memcpy( cr + cx, &acc, sizeof(v4f) );
             }
+        }
+
+        store_chroma_line( sub, plane_line( planes, strides, 1, cy ), cb );
+        store_chroma_line( sub, plane_line( planes, strides, 2, cy ), cr );
+    }
+
+    // Any luma the chroma didn't need
+    for( ; next_line < height; next_line++ )
+        subsample_line( sub, frame, next_line, plane_line( planes, strides, 0, next_line ), cb, cr );
+
+    filter_free( &v_filter[0] );
+    filter_free( &v_filter[1] );
+    g_free( ring_cb );
+    g_free( ring_cr );
+    g_free( cb );
+    g_free( cr );
+}
+
+/*
+    Function: video_subsample_planar
+    Converts linear RGB to Rec. 709 gamma-encoded, studio-range planar YCbCr,
+    filtering the chroma with a triangle filter before subsampling it.
+*/
+EXPORT void
+video_subsample_planar( rgba_frame_f16 *frame, const video_subsample_params *params,
+        void *const planes[3], const int strides[3] ) {
+    g_assert(frame);
+    g_assert(params);
+    g_assert(planes);
+    g_assert(strides);
+    g_assert(params->bit_depth >= 8 && params->bit_depth <= 16);
+    g_assert(params->size.x > 0 && params->size.y > 0);
+
+    const int width = params->size.x, height = params->size.y;
+    subsampler sub = {
+        .params = params,
+        .sub_x = (params->chroma == VIDEO_CHROMA_411) ? 4 : 2,
+    };
 
-            cbrow[tx] = (uint8_t) studio_float_to_chroma8( cb );
-            crrow[tx] = (uint8_t) studio_float_to_chroma8( cr );
+    sub.chroma_width = (width + sub.sub_x - 1) / sub.sub_x;
+    sub.padded_chroma_width = (sub.chroma_width + 3) & ~3;
+
+    quantizer_init( &sub.luma_q, 219.0f, 16.0f, params->bit_depth );
+    quantizer_init( &sub.chroma_q, 224.0f, 128.0f, params->bit_depth );
+
+    filter_createTriangle( 1.0f / (float) sub.sub_x, 0.0f, &sub.h_filter );
+
+    // Enough to cover the filter on either side plus rounding up to four chroma samples
+    sub.pad = sub.h_filter.width + 4 * sub.sub_x;
+
+    sub.half_line = g_new( rgba_f16, width );
+    sub.encode = get_rec709_encode_table();
+    sub.cb_line = g_new( float, width + 2 * sub.pad );
+    sub.cr_line = g_new( float, width + 2 * sub.pad );
+
+    if( params->chroma == VIDEO_CHROMA_420 ) {
+        subsample_420( &sub, frame, planes, strides );
+    }
+    else {
+        float *cb = g_new( float, sub.padded_chroma_width ), *cr = g_new( float, sub.padded_chroma_width );
+
+        for( int line = 0; line < height; line++ ) {
+            subsample_line( &sub, frame, line, plane_line( planes, strides, 0, line ), cb, cr );
+            store_chroma_line( &sub, plane_line( planes, strides, 1, line ), cb );
+            store_chroma_line( &sub, plane_line( planes, strides, 2, line ), cr );
         }
+
+        g_free( cb );
+        g_free( cr );
     }
 
-    filter_free( &triangleFilter );
-    g_slice_free1( sizeof(rgba_f32) * window_width, tempRow );
-    g_slice_free1( sizeof(cbcr_f32) * window_width, tempChroma );
+    filter_free( &sub.h_filter );
+    g_free( sub.half_line );
+    g_free( sub.cb_line );
+    g_free( sub.cr_line );
+}
 
-    return planar;
+EXPORT coded_image *
+video_subsample_coded( rgba_frame_f16 *frame, const video_subsample_params *params ) {
+    const int sample_size = (params->bit_depth > 8) ? 2 : 1;
+    const int sub_x = (params->chroma == VIDEO_CHROMA_411) ? 4 : 2;
+    const int chroma_width = (params->size.x + sub_x - 1) / sub_x;
+    const int chroma_height = (params->chroma == VIDEO_CHROMA_420) ? (params->size.y + 1) / 2 : params->size.y;
+
+    const int strides[3] = { params->size.x * sample_size, chroma_width * sample_size, chroma_width * sample_size };
+    const int line_counts[3] = { params->size.y, chroma_height, chroma_height };
+
+    coded_image *image = coded_image_alloc( strides, line_counts, 3 );
+    video_subsample_planar( frame, params, image->data, image->stride );
+
+    return image;
+}
+
+/*
+    Function: video_subsample_dv
+    Subsamples to planar standard-definition NTSC DV:
+
+    720x480 YCbCr
+    4:1:1 subsampling, co-sited with left pixel
+    Rec 709 matrix
+    Rec 709 transfer function
+*/
+EXPORT coded_image *
+video_subsample_dv( rgba_frame_f16 *frame ) {
+    const video_subsample_params params = {
+        .chroma = VIDEO_CHROMA_411,
+        .bit_depth = 8,
+        .size = { 720, 480 },
+
+        // Offset the frame so that line zero is part of the first field
+        .offset = { 0, -1 },
+    };
+
+    return video_subsample_coded( frame, &params );
 }
 
 /*
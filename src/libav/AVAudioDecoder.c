@@ -31,6 +31,15 @@
 #define AV_SAMPLE_FMT_S32 SAMPLE_FMT_S32
 #define AV_SAMPLE_FMT_FLT SAMPLE_FMT_FLT
 #define AV_SAMPLE_FMT_DBL SAMPLE_FMT_DBL
+
+#define AV_CH_FRONT_LEFT        CH_FRONT_LEFT
+#define AV_CH_FRONT_RIGHT       CH_FRONT_RIGHT
+#define AV_CH_FRONT_CENTER      CH_FRONT_CENTER
+#define AV_CH_LOW_FREQUENCY     CH_LOW_FREQUENCY
+#define AV_CH_BACK_LEFT         CH_BACK_LEFT
+#define AV_CH_BACK_RIGHT        CH_BACK_RIGHT
+#define AV_CH_SIDE_LEFT         CH_SIDE_LEFT
+#define AV_CH_SIDE_RIGHT        CH_SIDE_RIGHT
 #endif
 
 #if LIBAVCODEC_VERSION_INT < AV_VERSION_INT(52, 23, 0)
@@ -42,6 +51,9 @@
 #define USE_DECODE4 1
 #endif
 
+#define DEFAULT_CACHE_SIZE      (INT64_C(32) * 1024 * 1024)
+#define CACHE_BLOCK_SIZE        4096
+
 typedef struct {
     int64_t timestamp;
     int64_t sample;
@@ -76,6 +88,12 @@ typedef struct {
     int64_t current_pts;
     bool current_pts_valid;
 
+    // Everything decoded so far, in all of the stream's channels, so
+    // scrubbing over the same spot doesn't decode it again
+    audio_block_cache *cache;
+    float *cache_buffer;
+    int cache_buffer_size;
+
     GMutex mutex;
 } py_obj_AVAudioDecoder;
 
@@ -92,16 +110,25 @@ AVAudioDecoder_init( py_obj_AVAudioDecoder *self, PyObject *args, PyObject *kw )
     self->trust_timestamps = false;
     self->max_sample_seen = INT32_MIN;
     self->current_pts_valid = false;
+    self->cache = NULL;
+    self->cache_buffer = NULL;
+    self->cache_buffer_size = 0;
 
     PyObject *source_obj;
     const char *codec_name;
     int channels;
+    long long cache_size = DEFAULT_CACHE_SIZE;
 
-    static char *kwlist[] = { "source", "codec", "channels", NULL };
+    static char *kwlist[] = { "source", "codec", "channels", "cache_size", NULL };
 
-    if( !PyArg_ParseTupleAndKeywords( args, kw, "Osi", kwlist, &source_obj, &codec_name, &channels ) )
+    if( !PyArg_ParseTupleAndKeywords( args, kw, "Osi|L", kwlist, &source_obj, &codec_name, &channels, &cache_size ) )
         return -1;
 
+    if( cache_size < 0 ) {
+        PyErr_SetString( PyExc_ValueError, "cache_size must not be negative." );
+        return -1;
+    }
+
     avcodec_register_all();
     AVCodec *codec = avcodec_find_decoder_by_name( codec_name );
 
@@ -149,6 +176,8 @@ AVAudioDecoder_init( py_obj_AVAudioDecoder *self, PyObject *args, PyObject *kw )
     self->context_open = true;
     g_mutex_init( &self->mutex );
 
+    self->cache = audio_block_cache_new( self->context.channels, CACHE_BLOCK_SIZE, cache_size );
+
     if( !self->trust_timestamps ) {
         self->timestamp_to_sample = g_sequence_new( (GDestroyNotify) destroy_tts );
     }
@@ -183,56 +212,193 @@ AVAudioDecoder_dealloc( py_obj_AVAudioDecoder *self ) {
         self->timestamp_to_sample = NULL;
     }
 
+    audio_block_cache_free( self->cache );
+    self->cache = NULL;
+
+    g_free( self->cache_buffer );
+    self->cache_buffer = NULL;
+
     py_codec_packet_take_source( NULL, &self->source );
     g_mutex_clear( &self->mutex );
 
     Py_TYPE(self)->tp_free( (PyObject*) self );
 }
 
-static void convert_samples( float *out, int out_channels, void *in, int in_channels, int offset, enum AVSampleFormat sample_fmt, int duration ) {
-    #define CONVERT(in_type, factor) \
-        for( int sample = 0; sample < duration; sample++ ) { \
-            for( int channel = 0; channel < out_channels; channel++ ) { \
-                out[out_channels * sample + channel] = \
-                    (channel < in_channels) ? (float)((in_type *) in)[in_channels * (offset + sample) + channel] * factor : 0.0f; \
-            } \
-        }
+/*
+    Function: get_sample_format
+    Translates a libav sample format to one of the AUDIO_SAMPLE_* formats.
+
+    Returns false if we don't know the format.
+*/
+static bool
+get_sample_format( enum AVSampleFormat sample_fmt, int *format, bool *planar ) {
+    *planar = false;
 
     switch( sample_fmt ) {
+#if LIBAVUTIL_VERSION_INT >= AV_VERSION_INT(51, 17, 0)
+        case AV_SAMPLE_FMT_U8P:
+            *planar = true;
+#endif
         case AV_SAMPLE_FMT_U8:
-            CONVERT(uint8_t, (1.0f / (float) INT8_MAX) - 1.0f)
-            return;
+            *format = AUDIO_SAMPLE_U8;
+            return true;
 
+#if LIBAVUTIL_VERSION_INT >= AV_VERSION_INT(51, 17, 0)
+        case AV_SAMPLE_FMT_S16P:
+            *planar = true;
+#endif
         case AV_SAMPLE_FMT_S16:
-            CONVERT(int16_t, (1.0f / (float) INT16_MAX))
-            return;
+            *format = AUDIO_SAMPLE_S16;
+            return true;
 
+#if LIBAVUTIL_VERSION_INT >= AV_VERSION_INT(51, 17, 0)
+        case AV_SAMPLE_FMT_S32P:
+            *planar = true;
+#endif
         case AV_SAMPLE_FMT_S32:
-            CONVERT(int32_t, (1.0f / (float) INT32_MAX))
-            return;
+            *format = AUDIO_SAMPLE_S32;
+            return true;
 
+#if LIBAVUTIL_VERSION_INT >= AV_VERSION_INT(51, 17, 0)
+        case AV_SAMPLE_FMT_FLTP:
+            *planar = true;
+#endif
         case AV_SAMPLE_FMT_FLT:
-            CONVERT(float, 1.0f)
-            return;
+            *format = AUDIO_SAMPLE_FLT;
+            return true;
 
+#if LIBAVUTIL_VERSION_INT >= AV_VERSION_INT(51, 17, 0)
+        case AV_SAMPLE_FMT_DBLP:
+            *planar = true;
+#endif
         case AV_SAMPLE_FMT_DBL:
-            CONVERT(double, 1.0f)
-            return;
+            *format = AUDIO_SAMPLE_DBL;
+            return true;
 
         default:
-            printf( "Unknown sample type.\n" );
-            return;
+            return false;
     }
 }
 
+/*
+    Our channels go left, right, center, LFE, left surround, right surround,
+    whatever order the stream has them in. For each output channel, these are
+    the speakers that can fill it, best first.
+*/
+static const uint64_t output_speakers[][2] = {
+    { AV_CH_FRONT_LEFT, 0 },
+    { AV_CH_FRONT_RIGHT, 0 },
+    { AV_CH_FRONT_CENTER, 0 },
+    { AV_CH_LOW_FREQUENCY, 0 },
+    { AV_CH_SIDE_LEFT, AV_CH_BACK_LEFT },
+    { AV_CH_SIDE_RIGHT, AV_CH_BACK_RIGHT },
+};
+
+/*
+    Function: get_channel_map
+    Works out which stream channel goes to each output channel from the
+    stream's channel layout. Output channels past the six above take the
+    stream's leftover channels in order.
+
+    Returns false if the layout is missing, doesn't match the channel count,
+    or isn't at least stereo; then channels should be taken in order.
+*/
+static bool
+get_channel_map( py_obj_AVAudioDecoder *self, int *map, int out_channels ) {
+    const uint64_t layout = (uint64_t) self->context.channel_layout;
+
+    if( !layout || __builtin_popcountll( layout ) != self->context.channels ||
+            (layout & (AV_CH_FRONT_LEFT | AV_CH_FRONT_RIGHT)) != (AV_CH_FRONT_LEFT | AV_CH_FRONT_RIGHT) )
+        return false;
+
+    uint64_t left = layout;
+
+    for( int c = 0; c < out_channels; c++ ) {
+        map[c] = -1;
+
+        if( c < (int) G_N_ELEMENTS(output_speakers) ) {
+            for( int i = 0; i < 2; i++ ) {
+                uint64_t speaker = output_speakers[c][i];
+
+                if( speaker & left ) {
+                    // Stream channels are in the order of the layout's bits
+                    map[c] = __builtin_popcountll( layout & (speaker - 1) );
+                    left &= ~speaker;
+                    break;
+                }
+            }
+        }
+        else if( left ) {
+            uint64_t speaker = left & -left;
+            map[c] = __builtin_popcountll( layout & (speaker - 1) );
+            left &= ~speaker;
+        }
+    }
+
+    return true;
+}
+
+/*
+    Function: convert_samples
+    Converts part of the last decoded frame straight into the output, which
+    has out_channels interleaved channels, putting the stream's speakers where
+    we expect them. Output channels the stream doesn't have are silent.
+*/
+static void
+convert_samples( py_obj_AVAudioDecoder *self, float *out, int out_channels, int offset, int duration ) {
+    int format;
+    bool planar;
+
+    if( !get_sample_format( self->context.sample_fmt, &format, &planar ) ) {
+        g_warning( "Unknown sample format %d.", (int) self->context.sample_fmt );
+        return;
+    }
+
+#if defined(USE_DECODE4)
+    // More than eight planes only fit in extended_data
+    const void *const *data = (const void *const *) self->input_frame.extended_data;
+#else
+    const void *const *data = (const void *const *) self->input_frame.data;
+#endif
+
+    int map[out_channels];
+
+    audio_convert_to_f32( out, out_channels, data, self->context.channels,
+        format, planar, get_channel_map( self, map, out_channels ) ? map : NULL,
+        offset, duration );
+}
+
+/*
+    Function: cache_decoded_frame
+    Puts the whole of the frame just decoded into the cache, not just the
+    part that was asked for. Call with the mutex held.
+*/
+static void
+cache_decoded_frame( py_obj_AVAudioDecoder *self, int64_t start_sample, int count ) {
+    if( audio_block_cache_get_max_size( self->cache ) == 0 )
+        return;
+
+    int size = count * self->context.channels;
+
+    if( size > self->cache_buffer_size ) {
+        g_free( self->cache_buffer );
+        self->cache_buffer = g_new( float, size );
+        self->cache_buffer_size = size;
+    }
+
+    convert_samples( self, self->cache_buffer, self->context.channels, 0, count );
+    audio_block_cache_put( self->cache, start_sample, count, self->cache_buffer );
+}
+
 #if !defined(USE_DECODE4)
 static int get_sample_count( int bytes, enum AVSampleFormat sample_fmt, int channels ) {
-    static int format_size[] = { 1, 2, 4, 4, 8 };
+    int format;
+    bool planar;
 
-    if( sample_fmt < 0 || sample_fmt > 4 )
-        sample_fmt = 1;
+    if( !get_sample_format( sample_fmt, &format, &planar ) )
+        format = AUDIO_SAMPLE_S16;
 
-    return bytes / (format_size[sample_fmt] * channels);
+    return bytes / (audio_sample_get_size( format ) * channels);
 }
 #endif
 
@@ -257,6 +423,12 @@ AVAudioDecoder_get_frame( py_obj_AVAudioDecoder *self, audio_frame *frame ) {
     frame->current_max_sample = -1;
     frame->current_min_sample = 0;
 
+    // Anything we've decoded before comes straight from the cache
+    if( audio_block_cache_get( self->cache, frame ) ) {
+        g_mutex_unlock( &self->mutex );
+        return;
+    }
+
     // Seek to the spot if we need to (and if we can)
     if( self->source.source.funcs->seek ) {
         do_seek = true;
@@ -296,7 +468,12 @@ AVAudioDecoder_get_frame( py_obj_AVAudioDecoder *self, audio_frame *frame ) {
                 return;
             }
 
+            // Without trusted timestamps, anything cached at a provisional
+            // start may be wrong after this
             self->current_pts_valid = false;
+
+            if( !self->trust_timestamps )
+                audio_block_cache_clear( self->cache );
         }
     }
 
@@ -314,9 +491,7 @@ AVAudioDecoder_get_frame( py_obj_AVAudioDecoder *self, audio_frame *frame ) {
             self->input_frame.pts + self->input_frame.nb_samples - 1,
             start_sample + duration - 1 );
 
-        convert_samples( out, frame->channels, self->input_frame.data[0],
-            self->context.channels, (start_sample - self->input_frame.pts),
-            self->context.sample_fmt, duration );
+        convert_samples( self, out, frame->channels, (start_sample - self->input_frame.pts), duration );
 
         frame->current_min_sample = start_sample;
         frame->current_max_sample = start_sample + duration - 1;
@@ -422,6 +597,8 @@ AVAudioDecoder_get_frame( py_obj_AVAudioDecoder *self, audio_frame *frame ) {
                 // We will use the PTS from the packet;
                 // the idea is that this will only really stick for the first
                 // packet, since on the next pass, we will override it.
+                // Blocks cached against the old timing can't be trusted now.
+                audio_block_cache_clear( self->cache );
             }
 
             g_debug( "Substituted start %"PRId64, packet_start );
@@ -460,6 +637,8 @@ AVAudioDecoder_get_frame( py_obj_AVAudioDecoder *self, audio_frame *frame ) {
         do_seek = false;
 
         self->input_frame.pts = packet_start;
+        cache_decoded_frame( self, packet_start, packet_duration );
+
         self->current_pts = packet_start + packet_duration;
         self->current_pts_valid = true;
         self->max_sample_seen = max(self->max_sample_seen, packet_start + packet_duration - 1);
@@ -469,9 +648,7 @@ AVAudioDecoder_get_frame( py_obj_AVAudioDecoder *self, audio_frame *frame ) {
         int duration = min(packet_start + packet_duration, frame->full_max_sample + 1) - start_sample;
         float *out = audio_get_sample( frame, start_sample, 0 );
 
-        convert_samples( out, frame->channels, self->input_frame.data[0],
-            self->context.channels, (start_sample - packet_start),
-            self->context.sample_fmt, duration );
+        convert_samples( self, out, frame->channels, (start_sample - packet_start), duration );
 
         if( first ) {
             frame->current_min_sample = packet_start;
@@ -509,8 +686,59 @@ AVAudioDecoder_getFuncs( py_obj_AVAudioDecoder *self, void *closure ) {
     return pySourceFuncs;
 }
 
+static PyObject *
+AVAudioDecoder_get_cache_size( py_obj_AVAudioDecoder *self, void *closure ) {
+    g_mutex_lock( &self->mutex );
+    int64_t result = audio_block_cache_get_max_size( self->cache );
+    g_mutex_unlock( &self->mutex );
+
+    return PyLong_FromLongLong( result );
+}
+
+static int
+AVAudioDecoder_set_cache_size( py_obj_AVAudioDecoder *self, PyObject *value, void *closure ) {
+    if( value == NULL ) {
+        PyErr_SetString( PyExc_TypeError, "Cannot delete the cache_size attribute." );
+        return -1;
+    }
+
+    long long cache_size = PyLong_AsLongLong( value );
+
+    if( cache_size == -1 && PyErr_Occurred() )
+        return -1;
+
+    if( cache_size < 0 ) {
+        PyErr_SetString( PyExc_ValueError, "cache_size must not be negative." );
+        return -1;
+    }
+
+    g_mutex_lock( &self->mutex );
+    audio_block_cache_set_max_size( self->cache, cache_size );
+    g_mutex_unlock( &self->mutex );
+
+    return 0;
+}
+
+static PyObject *
+AVAudioDecoder_get_cache_stats( py_obj_AVAudioDecoder *self, void *closure ) {
+    audio_block_cache_stats stats;
+
+    g_mutex_lock( &self->mutex );
+    audio_block_cache_get_stats( self->cache, &stats );
+    g_mutex_unlock( &self->mutex );
+
+    return Py_BuildValue( "{sLsLsL}",
+        "hits", (long long) stats.hits,
+        "misses", (long long) stats.misses,
+        "used", (long long) stats.used );
+}
+
 static PyGetSetDef AVAudioDecoder_getsetters[] = {
     { AUDIO_FRAME_SOURCE_FUNCS, (getter) AVAudioDecoder_getFuncs, NULL, "Audio frame source C API." },
+    { "cache_size", (getter) AVAudioDecoder_get_cache_size, (setter) AVAudioDecoder_set_cache_size,
+        "Most memory, in bytes, to spend on decoded samples. Zero turns off the cache." },
+    { "cache_stats", (getter) AVAudioDecoder_get_cache_stats, NULL,
+        "Dictionary of cache hits, misses, and bytes used." },
     { NULL }
 };
 
@@ -518,6 +746,13 @@ static PyMethodDef AVAudioDecoder_methods[] = {
     { NULL }
 };
 
+/*
+    AVAudioDecoder(source, codec, channels, cache_size=32MB)
+
+    Decodes audio packets with libavcodec. Decoded samples are kept in a cache
+    of up to cache_size bytes, so going back over audio that's already been
+    heard doesn't go back to the file.
+*/
 static PyTypeObject py_type_AVAudioDecoder = {
     PyVarObject_HEAD_INIT(NULL, 0)
     .tp_name = "fluggo.media.libav.AVAudioDecoder",
@@ -18,8 +18,14 @@
     along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <sys/stat.h>
 #include "pyframework.h"
 #include <libavformat/avformat.h>
+#include "packet_index.h"
+#include "readahead_io.h"
+
+#undef G_LOG_DOMAIN
+#define G_LOG_DOMAIN "fluggo.media.libav.AVDemuxer"
 
 // Support old Libav
 #if LIBAVCODEC_VERSION_INT < AV_VERSION_INT(52, 64, 0)
@@ -43,35 +49,61 @@ typedef struct {
     int stream;
     bool raw_timestamps;
     rational frame_duration;
+    packet_index *index;
+    readahead_io *io;
     GStaticMutex mutex;
+
+    // Packet read while checking an indexed seek, to hand out next
+    AVPacket pending;
+    bool has_pending;
 } py_obj_AVDemuxer;
 
+/*
+    Function: get_index_key
+    Makes a key for the packet index sidecar that changes when the file does.
+*/
+static gchar *
+get_index_key( const char *filename ) {
+    struct stat info;
+
+    if( stat( filename, &info ) != 0 )
+        return NULL;
+
+    return g_strdup_printf( "%" PRId64 ":%" PRId64, (int64_t) info.st_size, (int64_t) info.st_mtime );
+}
+
 static int
 AVDemuxer_init( py_obj_AVDemuxer *self, PyObject *args, PyObject *kw ) {
     int error;
     char *filename;
-    PyObject *raw_timestamp_obj = NULL;
+    PyObject *raw_timestamp_obj = NULL, *index_obj = NULL, *nocache_obj = NULL;
+    const char *index_path = NULL;
+    PY_LONG_LONG readahead = 0;
 
     // Zero all pointers (so we know later what needs deleting)
     self->context = NULL;
     self->codecContext = NULL;
     self->raw_timestamps = false;
+    self->index = NULL;
+    self->io = NULL;
+    self->has_pending = false;
 
-    static char *kwlist[] = { "filename", "stream", "raw_timestamps", NULL };
+    static char *kwlist[] = { "filename", "stream", "raw_timestamps", "index", "index_path",
+        "readahead", "readahead_nocache", NULL };
 
-    if( !PyArg_ParseTupleAndKeywords( args, kw, "si|O", kwlist, &filename, &self->stream, &raw_timestamp_obj ) )
+    if( !PyArg_ParseTupleAndKeywords( args, kw, "si|OOzLO", kwlist, &filename, &self->stream,
+            &raw_timestamp_obj, &index_obj, &index_path, &readahead, &nocache_obj ) )
         return -1;
 
     if( raw_timestamp_obj )
         self->raw_timestamps = (PyObject_IsTrue( raw_timestamp_obj ) == 1);
 
+    bool use_index = (index_path != NULL) || (index_obj && PyObject_IsTrue( index_obj ) == 1);
+    int readahead_flags = (nocache_obj && PyObject_IsTrue( nocache_obj ) == 1) ? READAHEAD_FILE_NOCACHE : 0;
+
     av_register_all();
 
-#if LIBAVFORMAT_VERSION_INT < AV_VERSION_INT(53, 2, 0)
-    if( (error = av_open_input_file( &self->context, filename, NULL, 0, NULL )) != 0 ) {
-#else
-    if( (error = avformat_open_input( &self->context, filename, NULL, NULL )) != 0 ) {
-#endif
+    if( (error = readahead_io_open_input( &self->context, &self->io, filename, readahead, readahead_flags )) != 0 ) {
         PyErr_Format( PyExc_Exception, "Could not open the file (%s).", g_strerror( -error ) );
         return -1;
     }
@@ -107,16 +139,51 @@ AVDemuxer_init( py_obj_AVDemuxer *self, PyObject *args, PyObject *kw ) {
         self->frame_duration.d = timeBase->num * sampleRate;
     }
 
+    if( use_index ) {
+        gchar *key = index_path ? get_index_key( filename ) : NULL;
+
+        if( key )
+            self->index = packet_index_load( index_path, key, self->context->nb_streams );
+
+        if( !self->index ) {
+            // First time we've seen this file; read through it once
+            Py_BEGIN_ALLOW_THREADS
+            self->index = packet_index_build( self->context );
+            Py_END_ALLOW_THREADS
+
+            if( key )
+                packet_index_save( self->index, index_path, key );
+        }
+
+        g_free( key );
+    }
+
     return 0;
 }
 
+static void
+drop_pending( py_obj_AVDemuxer *self ) {
+    if( self->has_pending ) {
+        av_free_packet( &self->pending );
+        self->has_pending = false;
+    }
+}
+
 static void
 AVDemuxer_dealloc( py_obj_AVDemuxer *self ) {
+    drop_pending( self );
+
+    packet_index_free( self->index );
+    self->index = NULL;
+
     if( self->context != NULL ) {
         av_close_input_file( self->context );
         self->context = NULL;
     }
 
+    readahead_io_close( self->io );
+    self->io = NULL;
+
     g_static_mutex_free( &self->mutex );
 
     Py_TYPE(self)->tp_free( (PyObject*) self );
@@ -131,11 +198,41 @@ AVDemuxer_seek( py_obj_AVDemuxer *self, int64_t frame ) {
     else
         timestamp = (frame * self->frame_duration.n) / self->frame_duration.d;
 
+    g_static_mutex_lock( &self->mutex );
+    drop_pending( self );
+
+    if( self->index ) {
+        // Go straight to the keyframe that starts the frame's GOP
+        const packet_index_entry *entry = packet_index_find_keyframe( self->index, self->stream, timestamp );
+
+        if( entry ) {
+            AVPacket first;
+
+            if( packet_index_seek_packet( self->context, self->stream, entry->pos, entry->dts, &first ) ) {
+                // The seek had to read a packet to check where it landed; keep it if it's ours
+                if( first.data && first.stream_index == self->stream && av_dup_packet( &first ) >= 0 ) {
+                    self->pending = first;
+                    self->has_pending = true;
+                }
+                else if( first.data ) {
+                    av_free_packet( &first );
+                }
+
+                g_static_mutex_unlock( &self->mutex );
+                return true;
+            }
+
+            g_warning( "Could not seek to indexed keyframe at %" PRId64 ", falling back.", entry->pos );
+        }
+    }
+
     if( av_seek_frame( self->context, self->stream, timestamp, AVSEEK_FLAG_ANY | AVSEEK_FLAG_BACKWARD ) < 0 ) {
-        printf( "Could not seek to frame %" PRId64 ".\n", frame );
+        g_static_mutex_unlock( &self->mutex );
+        g_warning( "Could not seek to frame %" PRId64 ".", frame );
         return false;
     }
 
+    g_static_mutex_unlock( &self->mutex );
     return true;
 }
 
@@ -169,7 +266,12 @@ AVDemuxer_get_next_packet( py_obj_AVDemuxer *self ) {
 
     g_static_mutex_lock( &self->mutex );
 
-    for( ;; ) {
+    if( self->has_pending ) {
+        packet->av_packet = self->pending;
+        self->has_pending = false;
+    }
+
+    while( !packet->av_packet.data ) {
         //printf( "Reading frame\n" );
         if( av_read_frame( self->context, &packet->av_packet ) < 0 ) {
             g_static_mutex_unlock( &self->mutex );
@@ -182,6 +284,7 @@ AVDemuxer_get_next_packet( py_obj_AVDemuxer *self ) {
             break;
 
         av_free_packet( &packet->av_packet );
+        packet->av_packet.data = NULL;
     }
 
     g_static_mutex_unlock( &self->mutex );
@@ -230,8 +333,35 @@ AVDemuxer_getFuncs( py_obj_AVDemuxer *self, void *closure ) {
     return pySourceFuncs;
 }
 
+static PyObject *
+AVDemuxer_get_indexed( py_obj_AVDemuxer *self, void *closure ) {
+    return PyBool_FromLong( self->index != NULL );
+}
+
+static PyObject *
+AVDemuxer_get_packet_count( py_obj_AVDemuxer *self, void *closure ) {
+    if( !self->index )
+        Py_RETURN_NONE;
+
+    return PyLong_FromLong( packet_index_get_count( self->index, self->stream ) );
+}
+
+static PyObject *
+AVDemuxer_get_readahead_stats( py_obj_AVDemuxer *self, void *closure ) {
+    if( !self->io )
+        Py_RETURN_NONE;
+
+    return readahead_io_get_stats( self->io );
+}
+
 static PyGetSetDef AVDemuxer_getsetters[] = {
     { CODEC_PACKET_SOURCE_FUNCS, (getter) AVDemuxer_getFuncs, NULL, "Codec packet source C API." },
+    { "indexed", (getter) AVDemuxer_get_indexed, NULL,
+        "True if the demuxer has a packet index to seek with." },
+    { "packet_count", (getter) AVDemuxer_get_packet_count, NULL,
+        "Number of packets in the stream, or None if there's no index." },
+    { "readahead_stats", (getter) AVDemuxer_get_readahead_stats, NULL,
+        "Dictionary of read-ahead cache hits, misses, blocks_read, and bytes_read, or None if read-ahead is off." },
     { NULL }
 };
 
@@ -239,6 +369,21 @@ static PyMethodDef AVDemuxer_methods[] = {
     { NULL }
 };
 
+/*
+    AVDemuxer(filename, stream, raw_timestamps=False, index=False, index_path=None,
+        readahead=0, readahead_nocache=False)
+
+    Reads packets for one stream of a container. If index is true, the whole
+    file is read once when it's opened to find every packet and keyframe, and
+    seeks go straight to the right keyframe after that. If index_path is given,
+    the index is saved there and loaded back on later opens, as long as the
+    file's size and modification time haven't changed.
+
+    If readahead is nonzero, that many bytes of the file are read ahead of the
+    demuxer by a background thread in large blocks, following the direction of
+    playback. readahead_nocache asks the kernel not to keep those blocks in its
+    own cache too, which helps when reading very large files once.
+*/
 static PyTypeObject py_type_AVDemuxer = {
     PyVarObject_HEAD_INIT(NULL, 0)
     .tp_name = "fluggo.media.libav.AVDemuxer",
@@ -241,8 +241,15 @@ AVMuxer_run( py_obj_AVMuxer *self, PyObject *args, PyObject *kw ) {
         // Get the first packet for each codec
         current->next_packet = current->source.source.funcs->getNextPacket( current->source.source.obj );
 
-        if( current->next_packet )
+        if( current->next_packet ) {
             current->next_dts = get_frame_time( &current->rate, current->next_packet->dts );
+        }
+        else if( py_codec_packet_source_failed() ) {
+            // The source has set its exception
+            PyEval_RestoreThread( _save );
+            avio_close( stream );
+            return NULL;
+        }
 
         current = current->next;
     }
@@ -312,8 +319,14 @@ AVMuxer_run( py_obj_AVMuxer *self, PyObject *args, PyObject *kw ) {
 
         next_stream->next_packet = next_stream->source.source.funcs->getNextPacket( next_stream->source.source.obj );
 
-        if( next_stream->next_packet )
+        if( next_stream->next_packet ) {
             next_stream->next_dts = get_frame_time( &next_stream->rate, next_stream->next_packet->dts );
+        }
+        else if( py_codec_packet_source_failed() ) {
+            PyEval_RestoreThread( _save );
+            avio_close( stream );
+            return NULL;
+        }
     }
 
     // Close format
@@ -0,0 +1,693 @@
+/*
+    This file is part of the Fluggo Media Library for high-quality
+    video and audio processing.
+
+    Copyright 2012 Brian J. Crowell <brian@fluggo.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "pyframework.h"
+#include <libavformat/avformat.h>
+#include "packet_index.h"
+#include "readahead_io.h"
+
+#undef G_LOG_DOMAIN
+#define G_LOG_DOMAIN "fluggo.media.libav.AVSharedDemuxer"
+
+// Support old Libav
+#if LIBAVCODEC_VERSION_INT < AV_VERSION_INT(52, 64, 0)
+#define AVMEDIA_TYPE_VIDEO      CODEC_TYPE_VIDEO
+#define AVMEDIA_TYPE_AUDIO      CODEC_TYPE_AUDIO
+#endif
+
+#if LIBAVCODEC_VERSION_INT < AV_VERSION_INT(52, 30, 0)
+#define AV_PKT_FLAG_KEY         PKT_FLAG_KEY
+#endif
+
+#define DEFAULT_QUEUE_LIMIT     128
+
+/*
+    One reader, many streams. Each stream has its own queue of packets
+    that have been read from the file but not handed out yet. Whichever stream
+    runs dry does the reading, and packets for the other streams go into their
+    queues, so an interleaved file only gets read once.
+
+    The tricky part is seeking. Every stream remembers the last packet it's
+    seen (by byte position, or by dts if the format doesn't give positions),
+    so when the file goes back over ground a stream has already covered, the
+    repeats are thrown out and it still sees every packet exactly once. If the
+    file jumps ahead of a stream instead, that stream has lost its place, and
+    it's marked for resync. When a resyncing stream runs out of queued
+    packets, it seeks the file back to the last packet it saw and picks up
+    from there. Seeks can land short of where they were asked to go, so
+    after each one, the first packet read says which streams were jumped.
+
+    A queue that gets too long (because nobody's reading that stream) is
+    cut back to its first packet and marked for resync the same way.
+*/
+
+typedef struct {
+    // Packets read but not handed out yet
+    GQueue queue;
+
+    // Number of stream objects reading this stream
+    int readers;
+
+    // Last packet handed out or queued
+    bool seen;
+    int64_t seen_pos, seen_dts;
+
+    // True if the file has moved on without us
+    bool resync;
+
+    rational frame_duration;
+    int64_t overflows;
+} shared_stream;
+
+typedef struct {
+    PyObject_HEAD
+
+    AVFormatContext *context;
+    readahead_io *io;
+    shared_stream *streams;
+    int stream_count, queue_limit;
+    bool raw_timestamps, eof;
+    GMutex mutex;
+} py_obj_AVSharedDemuxer;
+
+typedef struct {
+    PyObject_HEAD
+
+    py_obj_AVSharedDemuxer *demuxer;
+    int stream;
+} py_obj_AVSharedDemuxerStream;
+
+typedef struct __tag_my_packet {
+    codec_packet packet;
+    AVPacket av_packet;
+} my_packet;
+
+static void
+my_packet_free( my_packet *packet ) {
+    av_free_packet( &packet->av_packet );
+    g_slice_free( my_packet, packet );
+}
+
+static void
+clear_queue( shared_stream *stream ) {
+    my_packet *packet;
+
+    while( (packet = (my_packet*) g_queue_pop_head( &stream->queue )) )
+        my_packet_free( packet );
+}
+
+static int
+AVSharedDemuxer_init( py_obj_AVSharedDemuxer *self, PyObject *args, PyObject *kw ) {
+    int error;
+    char *filename;
+    PyObject *raw_timestamp_obj = NULL, *nocache_obj = NULL;
+    PY_LONG_LONG readahead = 0;
+
+    // Zero all pointers (so we know later what needs deleting)
+    self->context = NULL;
+    self->io = NULL;
+    self->streams = NULL;
+    self->stream_count = 0;
+    self->queue_limit = DEFAULT_QUEUE_LIMIT;
+    self->raw_timestamps = false;
+    self->eof = false;
+
+    static char *kwlist[] = { "filename", "raw_timestamps", "queue_limit", "readahead", "readahead_nocache", NULL };
+
+    if( !PyArg_ParseTupleAndKeywords( args, kw, "s|OiLO", kwlist, &filename, &raw_timestamp_obj, &self->queue_limit,
+            &readahead, &nocache_obj ) )
+        return -1;
+
+    if( raw_timestamp_obj )
+        self->raw_timestamps = (PyObject_IsTrue( raw_timestamp_obj ) == 1);
+
+    if( self->queue_limit < 1 ) {
+        PyErr_SetString( PyExc_ValueError, "queue_limit must be at least one." );
+        return -1;
+    }
+
+    int readahead_flags = (nocache_obj && PyObject_IsTrue( nocache_obj ) == 1) ? READAHEAD_FILE_NOCACHE : 0;
+
+    av_register_all();
+
+    if( (error = readahead_io_open_input( &self->context, &self->io, filename, readahead, readahead_flags )) != 0 ) {
+        PyErr_Format( PyExc_Exception, "Could not open the file (%s).", g_strerror( -error ) );
+        return -1;
+    }
+
+    if( (error = av_find_stream_info( self->context )) < 0 ) {
+        PyErr_Format( PyExc_Exception, "Could not find the stream info (%s).", g_strerror( -error ) );
+        return -1;
+    }
+
+    self->stream_count = self->context->nb_streams;
+    self->streams = g_new0( shared_stream, self->stream_count );
+
+    for( int i = 0; i < self->stream_count; i++ ) {
+        shared_stream *stream = &self->streams[i];
+        AVStream *av_stream = self->context->streams[i];
+        AVRational *timeBase = &av_stream->time_base;
+
+        g_queue_init( &stream->queue );
+
+        // Calculate the frame (sample) duration, same as AVDemuxer
+        if( av_stream->codec->codec_type == AVMEDIA_TYPE_VIDEO ) {
+            AVRational *frameRate = &av_stream->r_frame_rate;
+
+            stream->frame_duration.n = timeBase->den * frameRate->den;
+            stream->frame_duration.d = timeBase->num * frameRate->num;
+        }
+        else if( av_stream->codec->codec_type == AVMEDIA_TYPE_AUDIO ) {
+            stream->frame_duration.n = timeBase->den;
+            stream->frame_duration.d = timeBase->num * av_stream->codec->sample_rate;
+        }
+        else {
+            stream->frame_duration.n = 1;
+            stream->frame_duration.d = 1;
+        }
+    }
+
+    g_mutex_init( &self->mutex );
+
+    return 0;
+}
+
+static void
+AVSharedDemuxer_dealloc( py_obj_AVSharedDemuxer *self ) {
+    if( self->streams ) {
+        for( int i = 0; i < self->stream_count; i++ )
+            clear_queue( &self->streams[i] );
+
+        g_free( self->streams );
+        self->streams = NULL;
+
+        g_mutex_clear( &self->mutex );
+    }
+
+    if( self->context != NULL ) {
+        av_close_input_file( self->context );
+        self->context = NULL;
+    }
+
+    readahead_io_close( self->io );
+    self->io = NULL;
+
+    Py_TYPE(self)->tp_free( (PyObject*) self );
+}
+
+static bool
+already_seen( shared_stream *stream, const AVPacket *packet ) {
+    if( !stream->seen )
+        return false;
+
+    if( packet->pos >= 0 && stream->seen_pos >= 0 )
+        return packet->pos <= stream->seen_pos;
+
+    if( packet->dts != AV_NOPTS_VALUE && stream->seen_dts != AV_NOPTS_VALUE )
+        return packet->dts <= stream->seen_dts;
+
+    return false;
+}
+
+/*
+    Function: route_packet
+    Hands a packet read from the file to its stream. Call with the mutex held.
+
+    Returns the packet if it belongs to the given stream, NULL if it went somewhere
+    else.
+*/
+static my_packet *
+route_packet( py_obj_AVSharedDemuxer *self, my_packet *packet, int want_stream ) {
+    int index = packet->av_packet.stream_index;
+
+    if( index < 0 || index >= self->stream_count ) {
+        my_packet_free( packet );
+        return NULL;
+    }
+
+    shared_stream *stream = &self->streams[index];
+
+    // Nobody's listening, or it's a repeat, or the stream will re-read this part anyway
+    if( !stream->readers || (index != want_stream && stream->resync) || already_seen( stream, &packet->av_packet ) ) {
+        my_packet_free( packet );
+        return NULL;
+    }
+
+    stream->seen = true;
+    stream->seen_pos = packet->av_packet.pos;
+    stream->seen_dts = packet->av_packet.dts;
+
+    if( index == want_stream )
+        return packet;
+
+    // Make sure the packet survives the next av_read_frame
+    av_dup_packet( &packet->av_packet );
+    g_queue_push_tail( &stream->queue, packet );
+
+    if( (int) g_queue_get_length( &stream->queue ) > self->queue_limit ) {
+        // Nobody's reading this stream; keep the packet it'll want next and
+        // let it catch up from there later on its own
+        g_debug( "Queue for stream %d overflowed", index );
+
+        my_packet *first = (my_packet*) g_queue_pop_head( &stream->queue );
+
+        clear_queue( stream );
+        g_queue_push_head( &stream->queue, first );
+
+        stream->overflows++;
+        stream->resync = true;
+        stream->seen_pos = first->av_packet.pos;
+        stream->seen_dts = first->av_packet.dts;
+    }
+
+    return NULL;
+}
+
+/*
+    Function: read_packet
+    Reads the next packet from the file and routes it. Call with the mutex held.
+
+    Returns the packet if it belongs to the given stream, NULL if it went somewhere
+    else (check self->eof to see if there are no more).
+*/
+static my_packet *
+read_packet( py_obj_AVSharedDemuxer *self, int want_stream ) {
+    my_packet *packet = g_slice_new0( my_packet );
+    av_init_packet( &packet->av_packet );
+
+    if( av_read_frame( self->context, &packet->av_packet ) < 0 ) {
+        self->eof = true;
+        my_packet_free( packet );
+        return NULL;
+    }
+
+    return route_packet( self, packet, want_stream );
+}
+
+/*
+    Function: mark_skipped
+    Marks for resync every stream but the given one that the file just jumped
+    past. Call with the mutex held.
+
+    landed_pos - Byte position of the first packet after the jump, or
+        INT64_MAX if it isn't known.
+
+    A stream that has already seen the new spot will see repeats, which get
+    thrown out, so it can carry on. A stream that hasn't would miss packets.
+*/
+static void
+mark_skipped( py_obj_AVSharedDemuxer *self, int index, int64_t landed_pos ) {
+    for( int i = 0; i < self->stream_count; i++ ) {
+        shared_stream *other = &self->streams[i];
+
+        if( i == index || !other->readers )
+            continue;
+
+        if( !other->seen || other->seen_pos < 0 || other->seen_pos < landed_pos )
+            other->resync = true;
+    }
+}
+
+/*
+    Function: land_packet
+    Takes the first packet read after a seek, marks the streams the seek
+    skipped, and routes it. Call with the mutex held.
+
+    Returns the packet if it belongs to the given stream, NULL otherwise.
+*/
+static my_packet *
+land_packet( py_obj_AVSharedDemuxer *self, my_packet *packet, int want_stream ) {
+    if( !packet->av_packet.data ) {
+        self->eof = true;
+        my_packet_free( packet );
+        return NULL;
+    }
+
+    mark_skipped( self, want_stream, (packet->av_packet.pos >= 0) ? packet->av_packet.pos : INT64_MAX );
+    return route_packet( self, packet, want_stream );
+}
+
+/*
+    Function: resync_stream
+    Seeks the file back to where the stream left off. Call with the mutex held.
+
+    Returns the first packet after the seek if it belongs to the stream, NULL
+    if it went somewhere else.
+*/
+static my_packet *
+resync_stream( py_obj_AVSharedDemuxer *self, int index ) {
+    shared_stream *stream = &self->streams[index];
+    AVStream *av_stream = self->context->streams[index];
+
+    stream->resync = false;
+    self->eof = false;
+
+    if( !stream->seen ) {
+        // Never read anything, so start from the top; nobody else can have missed anything
+        int64_t start = (av_stream->start_time != AV_NOPTS_VALUE) ? av_stream->start_time : 0;
+        int error = av_seek_frame( self->context, index, start, AVSEEK_FLAG_BACKWARD );
+
+        if( error < 0 )
+            g_warning( "Could not resync stream %d (%s).", index, g_strerror( -error ) );
+
+        return NULL;
+    }
+
+    my_packet *packet = g_slice_new0( my_packet );
+
+    if( !packet_index_seek_packet( self->context, index, stream->seen_pos, stream->seen_dts, &packet->av_packet ) ) {
+        g_warning( "Could not resync stream %d.", index );
+        g_slice_free( my_packet, packet );
+        return NULL;
+    }
+
+    // The seek may have landed before the packet we asked for; the repeats
+    // get thrown out, but anyone who hasn't gotten as far as where it did
+    // land would miss packets
+    return land_packet( self, packet, index );
+}
+
+static codec_packet *
+convert_packet( py_obj_AVSharedDemuxer *self, shared_stream *stream, my_packet *packet ) {
+    packet->packet.data = packet->av_packet.data;
+    packet->packet.length = packet->av_packet.size;
+    packet->packet.dts = packet->av_packet.dts;
+    packet->packet.pts = packet->av_packet.pts;
+    packet->packet.duration = packet->av_packet.duration;
+    packet->packet.free_func = (GFreeFunc) my_packet_free;
+
+    if( packet->packet.pts == PACKET_TS_NONE )
+        packet->packet.pts = packet->packet.dts;
+
+    packet->packet.keyframe = (packet->av_packet.flags & AV_PKT_FLAG_KEY) ? true : false;
+
+    // Convert timestamps from raw to frames/samples
+    if( !self->raw_timestamps ) {
+        const rational *fd = &stream->frame_duration;
+
+        if( packet->packet.dts != PACKET_TS_NONE )
+            packet->packet.dts = (packet->av_packet.dts * fd->d + fd->n / 2) / fd->n;
+
+        if( packet->packet.pts != PACKET_TS_NONE )
+            packet->packet.pts = (packet->packet.pts * fd->d + fd->n / 2) / fd->n;
+
+        if( packet->packet.duration != 0 )
+            packet->packet.duration = (packet->av_packet.duration * fd->d + fd->n / 2) / fd->n;
+    }
+
+    return (codec_packet *) packet;
+}
+
+static codec_packet *
+AVSharedDemuxerStream_get_next_packet( py_obj_AVSharedDemuxerStream *self ) {
+    py_obj_AVSharedDemuxer *demuxer = self->demuxer;
+    shared_stream *stream = &demuxer->streams[self->stream];
+
+    g_mutex_lock( &demuxer->mutex );
+
+    my_packet *packet = (my_packet*) g_queue_pop_head( &stream->queue );
+
+    if( !packet && stream->resync )
+        packet = resync_stream( demuxer, self->stream );
+
+    while( !packet && !demuxer->eof )
+        packet = read_packet( demuxer, self->stream );
+
+    g_mutex_unlock( &demuxer->mutex );
+
+    if( !packet )
+        return NULL;
+
+    return convert_packet( demuxer, stream, packet );
+}
+
+static bool
+AVSharedDemuxerStream_seek( py_obj_AVSharedDemuxerStream *self, int64_t frame ) {
+    py_obj_AVSharedDemuxer *demuxer = self->demuxer;
+    shared_stream *stream = &demuxer->streams[self->stream];
+    int64_t timestamp;
+
+    if( demuxer->raw_timestamps )
+        timestamp = frame;
+    else
+        timestamp = (frame * stream->frame_duration.n) / stream->frame_duration.d;
+
+    g_mutex_lock( &demuxer->mutex );
+
+    if( av_seek_frame( demuxer->context, self->stream, timestamp, AVSEEK_FLAG_ANY | AVSEEK_FLAG_BACKWARD ) < 0 ) {
+        g_mutex_unlock( &demuxer->mutex );
+        g_warning( "Could not seek to frame %" PRId64 ".", frame );
+        return false;
+    }
+
+    demuxer->eof = false;
+
+    // We start fresh from here
+    clear_queue( stream );
+    stream->seen = false;
+    stream->resync = false;
+
+    // Everyone else keeps what they've got queued; only the ones the file
+    // jumped past have lost their place in it
+    my_packet *packet = g_slice_new0( my_packet );
+    av_init_packet( &packet->av_packet );
+
+    if( av_read_frame( demuxer->context, &packet->av_packet ) < 0 )
+        packet->av_packet.data = NULL;
+
+    packet = land_packet( demuxer, packet, self->stream );
+
+    // Find our first packet now, so that a resync by another stream can't
+    // make us forget where we seeked to
+    while( !packet && !demuxer->eof )
+        packet = read_packet( demuxer, self->stream );
+
+    if( packet )
+        g_queue_push_head( &stream->queue, packet );
+
+    g_mutex_unlock( &demuxer->mutex );
+    return true;
+}
+
+static int
+AVSharedDemuxerStream_get_header( py_obj_AVSharedDemuxerStream *self, void *buffer ) {
+    AVCodecContext *codec = self->demuxer->context->streams[self->stream]->codec;
+
+    if( !codec->extradata )
+        return 0;
+
+    if( !buffer )
+        return codec->extradata_size;
+
+    memcpy( buffer, codec->extradata, codec->extradata_size );
+    return 1;
+}
+
+static codec_packet_source_funcs source_funcs = {
+    .getHeader = (codec_getHeaderFunc) AVSharedDemuxerStream_get_header,
+    .getNextPacket = (codec_getNextPacketFunc) AVSharedDemuxerStream_get_next_packet,
+    .seek = (codec_seekFunc) AVSharedDemuxerStream_seek,
+};
+
+static PyObject *pySourceFuncs;
+
+static int
+AVSharedDemuxerStream_init( py_obj_AVSharedDemuxerStream *self, PyObject *args, PyObject *kw ) {
+    PyErr_SetString( PyExc_TypeError, "Use AVSharedDemuxer.stream() to get a stream." );
+    return -1;
+}
+
+static void
+AVSharedDemuxerStream_dealloc( py_obj_AVSharedDemuxerStream *self ) {
+    if( self->demuxer ) {
+        shared_stream *stream = &self->demuxer->streams[self->stream];
+
+        g_mutex_lock( &self->demuxer->mutex );
+
+        if( --stream->readers == 0 )
+            clear_queue( stream );
+
+        g_mutex_unlock( &self->demuxer->mutex );
+
+        Py_CLEAR( self->demuxer );
+    }
+
+    Py_TYPE(self)->tp_free( (PyObject*) self );
+}
+
+static PyObject *
+AVSharedDemuxerStream_getFuncs( py_obj_AVSharedDemuxerStream *self, void *closure ) {
+    Py_INCREF(pySourceFuncs);
+    return pySourceFuncs;
+}
+
+static PyObject *
+AVSharedDemuxerStream_get_index( py_obj_AVSharedDemuxerStream *self, void *closure ) {
+    return PyLong_FromLong( self->stream );
+}
+
+static PyObject *
+AVSharedDemuxerStream_get_queued( py_obj_AVSharedDemuxerStream *self, void *closure ) {
+    g_mutex_lock( &self->demuxer->mutex );
+    guint result = g_queue_get_length( &self->demuxer->streams[self->stream].queue );
+    g_mutex_unlock( &self->demuxer->mutex );
+
+    return PyLong_FromLong( result );
+}
+
+static PyObject *
+AVSharedDemuxerStream_get_overflows( py_obj_AVSharedDemuxerStream *self, void *closure ) {
+    g_mutex_lock( &self->demuxer->mutex );
+    int64_t result = self->demuxer->streams[self->stream].overflows;
+    g_mutex_unlock( &self->demuxer->mutex );
+
+    return PyLong_FromLongLong( result );
+}
+
+static PyGetSetDef AVSharedDemuxerStream_getsetters[] = {
+    { CODEC_PACKET_SOURCE_FUNCS, (getter) AVSharedDemuxerStream_getFuncs, NULL, "Codec packet source C API." },
+    { "index", (getter) AVSharedDemuxerStream_get_index, NULL, "Index of the stream in the container." },
+    { "queued", (getter) AVSharedDemuxerStream_get_queued, NULL, "Number of packets read ahead for this stream." },
+    { "overflows", (getter) AVSharedDemuxerStream_get_overflows, NULL,
+        "Number of times this stream's queue filled up and had to be thrown away." },
+    { NULL }
+};
+
+static PyTypeObject py_type_AVSharedDemuxerStream = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "fluggo.media.libav.AVSharedDemuxerStream",
+    .tp_basicsize = sizeof(py_obj_AVSharedDemuxerStream),
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_base = &py_type_CodecPacketSource,
+    .tp_new = PyType_GenericNew,
+    .tp_dealloc = (destructor) AVSharedDemuxerStream_dealloc,
+    .tp_init = (initproc) AVSharedDemuxerStream_init,
+    .tp_getset = AVSharedDemuxerStream_getsetters,
+};
+
+static PyObject *
+AVSharedDemuxer_stream( py_obj_AVSharedDemuxer *self, PyObject *args ) {
+    int index;
+
+    if( !PyArg_ParseTuple( args, "i", &index ) )
+        return NULL;
+
+    if( index < 0 || index >= self->stream_count ) {
+        PyErr_Format( PyExc_Exception, "The given stream number %i was not found in the file.", index );
+        return NULL;
+    }
+
+    py_obj_AVSharedDemuxerStream *stream = (py_obj_AVSharedDemuxerStream *)
+        py_type_AVSharedDemuxerStream.tp_alloc( &py_type_AVSharedDemuxerStream, 0 );
+
+    if( !stream )
+        return NULL;
+
+    Py_INCREF( self );
+    stream->demuxer = self;
+    stream->stream = index;
+
+    g_mutex_lock( &self->mutex );
+
+    if( self->streams[index].readers++ == 0 ) {
+        // This stream hasn't been listening; it'll need to catch up
+        shared_stream *shared = &self->streams[index];
+
+        shared->seen = false;
+        shared->resync = true;
+    }
+
+    g_mutex_unlock( &self->mutex );
+
+    return (PyObject *) stream;
+}
+
+static PyObject *
+AVSharedDemuxer_get_stream_count( py_obj_AVSharedDemuxer *self, void *closure ) {
+    return PyLong_FromLong( self->stream_count );
+}
+
+static PyObject *
+AVSharedDemuxer_get_queue_limit( py_obj_AVSharedDemuxer *self, void *closure ) {
+    return PyLong_FromLong( self->queue_limit );
+}
+
+static PyObject *
+AVSharedDemuxer_get_readahead_stats( py_obj_AVSharedDemuxer *self, void *closure ) {
+    if( !self->io )
+        Py_RETURN_NONE;
+
+    return readahead_io_get_stats( self->io );
+}
+
+static PyGetSetDef AVSharedDemuxer_getsetters[] = {
+    { "stream_count", (getter) AVSharedDemuxer_get_stream_count, NULL, "Number of streams in the container." },
+    { "queue_limit", (getter) AVSharedDemuxer_get_queue_limit, NULL,
+        "Most packets to hold for any one stream before giving up on it and letting it re-read." },
+    { "readahead_stats", (getter) AVSharedDemuxer_get_readahead_stats, NULL,
+        "Dictionary of read-ahead cache hits, misses, blocks_read, and bytes_read, or None if read-ahead is off." },
+    { NULL }
+};
+
+static PyMethodDef AVSharedDemuxer_methods[] = {
+    { "stream", (PyCFunction) AVSharedDemuxer_stream, METH_VARARGS,
+        "Gets a codec packet source for one of the container's streams.\n"
+        "\n"
+        "source = demuxer.stream(index)" },
+    { NULL }
+};
+
+/*
+    AVSharedDemuxer(filename, raw_timestamps=False, queue_limit=128, readahead=0, readahead_nocache=False)
+
+    Reads a container once for all of its streams. Get a packet source for each
+    stream you want with stream(index); packets for one stream that turn up
+    while reading another are queued until they're asked for. readahead and
+    readahead_nocache work as they do for AVDemuxer.
+*/
+static PyTypeObject py_type_AVSharedDemuxer = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "fluggo.media.libav.AVSharedDemuxer",
+    .tp_basicsize = sizeof(py_obj_AVSharedDemuxer),
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_new = PyType_GenericNew,
+    .tp_dealloc = (destructor) AVSharedDemuxer_dealloc,
+    .tp_init = (initproc) AVSharedDemuxer_init,
+    .tp_getset = AVSharedDemuxer_getsetters,
+    .tp_methods = AVSharedDemuxer_methods,
+};
+
+void init_AVSharedDemuxer( PyObject *module ) {
+    if( PyType_Ready( &py_type_AVSharedDemuxer ) < 0 )
+        return;
+
+    if( PyType_Ready( &py_type_AVSharedDemuxerStream ) < 0 )
+        return;
+
+    Py_INCREF( &py_type_AVSharedDemuxer );
+    PyModule_AddObject( module, "AVSharedDemuxer", (PyObject *) &py_type_AVSharedDemuxer );
+
+    Py_INCREF( &py_type_AVSharedDemuxerStream );
+    PyModule_AddObject( module, "AVSharedDemuxerStream", (PyObject *) &py_type_AVSharedDemuxerStream );
+
+    pySourceFuncs = PyCapsule_New( &source_funcs,
+        CODEC_PACKET_SOURCE_FUNCS, NULL );
+}
+
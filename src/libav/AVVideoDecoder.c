@@ -18,9 +18,18 @@
     along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <string.h>
 #include "pyframework.h"
 #include <libavformat/avformat.h>
 
+#undef G_LOG_DOMAIN
+#define G_LOG_DOMAIN "fluggo.media.libav.AVVideoDecoder"
+
+#if LIBAVCODEC_VERSION_INT < AV_VERSION_INT(52, 23, 0)
+// We need avcodec_decode_video2 to pass timestamps and drain the decoder
+#error Libavcodec is too old. Please use 52.23.0 or newer.
+#endif
+
 typedef struct __tag_my_coded_image {
     coded_image image;
     int ref_count;
@@ -114,21 +123,302 @@ typedef struct {
     AVCodecContext context;
     int64_t next_frame;
 
+    // Packet currently being fed to the decoder; a packet can hold more than one picture
+    codec_packet *last_packet;
+    AVPacket input_packet;
+
+    // True once the source has run out and we're pulling the pictures the codec held back
+    bool draining, drained;
+
+    // Throughput counters, in pictures and nanoseconds spent in the decoder
+    int64_t frames_decoded, decode_time;
+
+    // Recently decoded pictures by frame number, most recently used at the head of cache_lru
+    GHashTable *cache;
+    GQueue cache_lru;
+    int64_t cache_used, cache_size;
+    int64_t cache_hits, cache_misses, cache_waits, seeks;
+
+    // Frames a pooled decode is working on right now, so a second request for
+    // the same frame waits for the first instead of decoding it again
+    GHashTable *decoding;
+    GCond decoded_cond;
+
+    // Sorted frame numbers of the keyframes we've seen so far
+    GArray *keyframes;
+
+    // For intra-only codecs, extra codec contexts so pictures can decode in
+    // parallel; idle_contexts holds the ones not in use, including context.
+    // Null if there's only the one context.
+    AVCodecContext *pool;
+    int pool_size;
+    GAsyncQueue *idle_contexts;
+
     GMutex mutex;
 } py_obj_AVVideoDecoder;
 
+#define DEFAULT_CACHE_SIZE      (INT64_C(256) * 1024 * 1024)
+
+// Furthest we'll decode forward to reach a frame when we don't know where its GOP starts
+#define MAX_DECODE_AHEAD        120
+
+typedef struct {
+    int64_t frame;
+    coded_image *image;
+    int64_t size;
+    GList link;
+} cache_entry;
+
+static void
+cache_entry_free( cache_entry *entry ) {
+    entry->image->free_func( entry->image );
+    g_slice_free( cache_entry, entry );
+}
+
+static int64_t
+coded_image_get_size( coded_image *image ) {
+    int64_t size = 0;
+
+    for( int i = 0; i < CODED_IMAGE_MAX_PLANES; i++ ) {
+        if( image->data[i] )
+            size += (int64_t) image->stride[i] * image->line_count[i];
+    }
+
+    return size;
+}
+
+/*
+    Function: cache_trim
+    Drops the least recently used pictures until the cache fits in its budget.
+    Call with the mutex held.
+*/
+static void
+cache_trim( py_obj_AVVideoDecoder *self, int64_t size ) {
+    while( self->cache_used > size && !g_queue_is_empty( &self->cache_lru ) ) {
+        cache_entry *entry = (cache_entry*) g_queue_peek_tail_link( &self->cache_lru )->data;
+
+        g_queue_unlink( &self->cache_lru, &entry->link );
+        self->cache_used -= entry->size;
+
+        // The hash table frees the entry
+        g_hash_table_remove( self->cache, &entry->frame );
+    }
+}
+
+/*
+    Function: cache_lookup
+    Finds a cached picture and marks it most recently used. Call with the mutex held.
+
+    Returns the picture, or NULL if it isn't cached. The cache keeps its reference.
+*/
+static coded_image *
+cache_lookup( py_obj_AVVideoDecoder *self, int64_t frame ) {
+    cache_entry *entry = (cache_entry*) g_hash_table_lookup( self->cache, &frame );
+
+    if( !entry )
+        return NULL;
+
+    g_queue_unlink( &self->cache_lru, &entry->link );
+    g_queue_push_head_link( &self->cache_lru, &entry->link );
+
+    return entry->image;
+}
+
+/*
+    Function: cache_insert
+    Adds a freshly decoded picture to the cache, taking a new reference to it.
+    Call with the mutex held.
+*/
+static void
+cache_insert( py_obj_AVVideoDecoder *self, int64_t frame, my_coded_image *image ) {
+    if( self->cache_size <= 0 || g_hash_table_lookup( self->cache, &frame ) )
+        return;
+
+    cache_entry *entry = g_slice_new0( cache_entry );
+
+    g_atomic_int_inc( &image->ref_count );
+
+    entry->frame = frame;
+    entry->image = &image->image;
+    entry->size = coded_image_get_size( &image->image );
+    entry->link.data = entry;
+
+    g_hash_table_insert( self->cache, &entry->frame, entry );
+    g_queue_push_head_link( &self->cache_lru, &entry->link );
+    self->cache_used += entry->size;
+
+    cache_trim( self, self->cache_size );
+}
+
+/*
+    Function: keyframe_find
+    Returns the index of the first known keyframe after the given frame.
+*/
+static guint
+keyframe_find( py_obj_AVVideoDecoder *self, int64_t frame ) {
+    guint low = 0, high = self->keyframes->len;
+
+    while( low < high ) {
+        guint mid = (low + high) / 2;
+
+        if( g_array_index( self->keyframes, int64_t, mid ) <= frame )
+            low = mid + 1;
+        else
+            high = mid;
+    }
+
+    return low;
+}
+
+static void
+keyframe_add( py_obj_AVVideoDecoder *self, int64_t frame ) {
+    guint index = keyframe_find( self, frame );
+
+    if( index > 0 && g_array_index( self->keyframes, int64_t, index - 1 ) == frame )
+        return;
+
+    g_array_insert_val( self->keyframes, index, frame );
+}
+
+/*
+    Function: keyframe_before
+    Returns the last known keyframe at or before the given frame, or PACKET_TS_NONE
+    if we don't know of one.
+*/
+static int64_t
+keyframe_before( py_obj_AVVideoDecoder *self, int64_t frame ) {
+    guint index = keyframe_find( self, frame );
+
+    if( index == 0 )
+        return PACKET_TS_NONE;
+
+    return g_array_index( self->keyframes, int64_t, index - 1 );
+}
+
+static int
+parse_thread_type( const char *name ) {
+#if defined(FF_THREAD_FRAME)
+    if( name == NULL || !strcmp( name, "auto" ) )
+        return FF_THREAD_FRAME | FF_THREAD_SLICE;
+    else if( !strcmp( name, "frame" ) )
+        return FF_THREAD_FRAME;
+    else if( !strcmp( name, "slice" ) )
+        return FF_THREAD_SLICE;
+#else
+    if( name == NULL || !strcmp( name, "auto" ) || !strcmp( name, "frame" ) || !strcmp( name, "slice" ) )
+        return 0;
+#endif
+
+    return -1;
+}
+
+/*
+    Function: codec_is_intra_only
+    Returns true if every picture in the codec stands on its own, so that any
+    codec context can decode any packet in any order.
+*/
+static bool
+codec_is_intra_only( AVCodec *codec ) {
+    static const char *names[] = { "dvvideo", "mjpeg", NULL };
+
+    for( int i = 0; names[i]; i++ ) {
+        if( !strcmp( codec->name, names[i] ) )
+            return true;
+    }
+
+    return false;
+}
+
+static int
+open_codec_context( AVCodecContext *context, AVCodec *codec, int threads, int thread_type ) {
+    int error;
+
+#if LIBAVCODEC_VERSION_INT < AV_VERSION_INT(53, 14, 0)
+    // To Anton Khirnov: This version number was difficult to find, since it
+    // wasn't listed in APIchanges.
+    avcodec_get_context_defaults( context );
+#else
+    avcodec_get_context_defaults3( context, codec );
+#endif
+
+    // The buffer callbacks have to be in place before the codec starts its
+    // threads; they only touch atomic reference counts and the slice
+    // allocator, so the worker threads can call them directly
+    context->get_buffer = counted_get_buffer;
+    context->release_buffer = counted_release_buffer;
+
+#if defined(FF_THREAD_FRAME)
+    context->thread_count = threads;
+    context->thread_type = thread_type;
+    context->thread_safe_callbacks = 1;
+#endif
+
+#if LIBAVCODEC_VERSION_INT < AV_VERSION_INT(53, 6, 0)
+    if( (error = avcodec_open( context, codec )) != 0 )
+#else
+    if( (error = avcodec_open2( context, codec, NULL )) != 0 )
+#endif
+        return error;
+
+#if !defined(FF_THREAD_FRAME)
+    // Older libavcodec only knows slice threading, set up after opening
+    if( threads > 1 && avcodec_thread_init( context, threads ) != 0 )
+        g_warning( "Could not start %d decoding threads.", threads );
+#endif
+
+    return 0;
+}
+
 static int
 AVVideoDecoder_init( py_obj_AVVideoDecoder *self, PyObject *args, PyObject *kw ) {
     int error;
 
     // Zero all pointers (so we know later what needs deleting)
+    self->last_packet = NULL;
+    self->input_packet = (AVPacket) {0};
+    self->draining = false;
+    self->drained = false;
+    self->frames_decoded = 0;
+    self->decode_time = 0;
+    self->cache = NULL;
+    self->decoding = NULL;
+    self->keyframes = NULL;
+    self->pool = NULL;
+    self->pool_size = 0;
+    self->idle_contexts = NULL;
+
     PyObject *source_obj;
-    const char *codec_name;
+    const char *codec_name, *thread_type_name = NULL;
+    int threads = 0, decoders = 0;
+    long long cache_size = DEFAULT_CACHE_SIZE;
+
+    static char *kwlist[] = { "source", "codec", "threads", "thread_type", "cache_size", "decoders", NULL };
+
+    if( !PyArg_ParseTupleAndKeywords( args, kw, "Os|izLi", kwlist,
+            &source_obj, &codec_name, &threads, &thread_type_name, &cache_size, &decoders ) )
+        return -1;
+
+    if( threads < 0 ) {
+        PyErr_SetString( PyExc_ValueError, "threads must not be negative." );
+        return -1;
+    }
+
+    if( decoders < 0 ) {
+        PyErr_SetString( PyExc_ValueError, "decoders must not be negative." );
+        return -1;
+    }
+
+    if( cache_size < 0 ) {
+        PyErr_SetString( PyExc_ValueError, "cache_size must not be negative." );
+        return -1;
+    }
 
-    static char *kwlist[] = { "source", "codec", NULL };
+    int thread_type = parse_thread_type( thread_type_name );
 
-    if( !PyArg_ParseTupleAndKeywords( args, kw, "Os", kwlist, &source_obj, &codec_name ) )
+    if( thread_type < 0 ) {
+        PyErr_Format( PyExc_ValueError, "Unknown thread_type \"%s\". Use \"auto\", \"frame\", or \"slice\".", thread_type_name );
         return -1;
+    }
 
     avcodec_register_all();
     AVCodec *codec = avcodec_find_decoder_by_name( codec_name );
@@ -138,112 +428,433 @@ AVVideoDecoder_init( py_obj_AVVideoDecoder *self, PyObject *args, PyObject *kw )
         return -1;
     }
 
-    if( !py_codec_packet_take_source( source_obj, &self->source ) )
+    bool intra_only = codec_is_intra_only( codec );
+
+    // Zero decoders means one per processor for codecs that can use them
+    if( decoders == 0 )
+        decoders = intra_only ? g_get_num_processors() : 1;
+
+    if( decoders > 1 && !intra_only ) {
+        PyErr_Format( PyExc_ValueError, "The codec \"%s\" can't be split across decoders; "
+            "each picture depends on the ones before it.", codec_name );
         return -1;
+    }
 
-#if LIBAVCODEC_VERSION_INT < AV_VERSION_INT(53, 14, 0)
-    // To Anton Khirnov: This version number was difficult to find, since it
-    // wasn't listed in APIchanges.
-    avcodec_get_context_defaults( &self->context );
-#else
-    avcodec_get_context_defaults3( &self->context, codec );
-#endif
+    // Zero threads means one per processor; with a pool, the parallelism
+    // comes from the pool instead
+    if( threads == 0 )
+        threads = (decoders > 1) ? 1 : g_get_num_processors();
 
-#if LIBAVCODEC_VERSION_INT < AV_VERSION_INT(53, 6, 0)
-    if( (error = avcodec_open( &self->context, codec )) != 0 ) {
-#else
-    if( (error = avcodec_open2( &self->context, codec, NULL )) != 0 ) {
-#endif
+    if( !py_codec_packet_take_source( source_obj, &self->source ) )
+        return -1;
+
+    if( (error = open_codec_context( &self->context, codec, threads, thread_type )) != 0 ) {
         PyErr_Format( PyExc_Exception, "Could not open the codec (%s).", g_strerror( -error ) );
         py_codec_packet_take_source( NULL, &self->source );
         return -1;
     }
 
+    if( decoders > 1 ) {
+        self->pool = g_new0( AVCodecContext, decoders - 1 );
+        self->idle_contexts = g_async_queue_new();
+        g_async_queue_push( self->idle_contexts, &self->context );
+
+        for( int i = 0; i < decoders - 1; i++ ) {
+            if( open_codec_context( &self->pool[i], codec, threads, thread_type ) != 0 ) {
+                g_warning( "Could only open %d of %d decoders.", i + 1, decoders );
+                break;
+            }
+
+            self->pool_size++;
+            g_async_queue_push( self->idle_contexts, &self->pool[i] );
+        }
+    }
+
     g_mutex_init( &self->mutex );
+    g_cond_init( &self->decoded_cond );
 
     self->next_frame = 0;
-    self->context.get_buffer = counted_get_buffer;
-    self->context.release_buffer = counted_release_buffer;
+
+    self->cache = g_hash_table_new_full( g_int64_hash, g_int64_equal, NULL, (GDestroyNotify) cache_entry_free );
+    g_queue_init( &self->cache_lru );
+    self->cache_used = 0;
+    self->cache_size = cache_size;
+    self->cache_hits = 0;
+    self->cache_misses = 0;
+    self->cache_waits = 0;
+    self->seeks = 0;
+
+    self->decoding = g_hash_table_new( g_direct_hash, g_direct_equal );
+
+    self->keyframes = g_array_new( false, false, sizeof(int64_t) );
 
     return 0;
 }
 
+static void
+codec_packet_free( codec_packet **packet ) {
+    if( *packet && (*packet)->free_func ) {
+        (*packet)->free_func( *packet );
+        *packet = NULL;
+    }
+}
+
 static void
 AVVideoDecoder_dealloc( py_obj_AVVideoDecoder *self ) {
+    if( self->cache ) {
+        g_queue_init( &self->cache_lru );
+        g_hash_table_destroy( self->cache );
+        self->cache = NULL;
+    }
+
+    if( self->keyframes ) {
+        g_array_free( self->keyframes, true );
+        self->keyframes = NULL;
+    }
+
+    if( self->decoding ) {
+        g_hash_table_destroy( self->decoding );
+        self->decoding = NULL;
+    }
+
+    codec_packet_free( &self->last_packet );
     avcodec_close( &self->context );
 
+    for( int i = 0; i < self->pool_size; i++ )
+        avcodec_close( &self->pool[i] );
+
+    g_free( self->pool );
+    self->pool = NULL;
+    self->pool_size = 0;
+
+    if( self->idle_contexts ) {
+        g_async_queue_unref( self->idle_contexts );
+        self->idle_contexts = NULL;
+    }
+
     py_codec_packet_take_source( NULL, &self->source );
     g_mutex_clear( &self->mutex );
+    g_cond_clear( &self->decoded_cond );
 
     Py_TYPE(self)->tp_free( (PyObject*) self );
 }
 
+/*
+    Function: decode_next_picture
+    Feeds packets to the decoder until it hands back a picture.
+
+    With frame threading or B-frames, the codec holds pictures back, so
+    this may eat several packets before anything comes out, and once the
+    source runs dry it keeps feeding empty packets to get the rest. The
+    picture's frame number comes back through reordered_opaque, so it's
+    right even when the codec returns pictures in a different order than
+    the packets went in.
+
+    Returns true if av_frame holds a picture, false at the end of the stream.
+    Call with the mutex held.
+*/
+static bool
+decode_next_picture( py_obj_AVVideoDecoder *self, AVFrame *av_frame ) {
+    for( ;; ) {
+        if( self->drained )
+            return false;
+
+        // Fetch the next packet if we need to
+        if( !self->draining && self->input_packet.size <= 0 ) {
+            codec_packet_free( &self->last_packet );
+            self->input_packet = (AVPacket) {0};
+
+            self->last_packet = self->source.source.funcs->getNextPacket( self->source.source.obj );
+
+            if( self->last_packet ) {
+                if( self->last_packet->keyframe && self->last_packet->pts != PACKET_TS_NONE )
+                    keyframe_add( self, self->last_packet->pts );
+
+                self->input_packet = (AVPacket) {
+                    .pts = self->last_packet->pts,
+                    .dts = self->last_packet->dts,
+                    .data = self->last_packet->data,
+                    .size = self->last_packet->length,
+                    .flags = self->last_packet->keyframe ? AV_PKT_FLAG_KEY : 0 };
+            }
+            else {
+                // End of stream; start flushing out what the codec has left
+                self->draining = true;
+            }
+        }
+
+        AVPacket empty_packet = { .pts = AV_NOPTS_VALUE, .dts = AV_NOPTS_VALUE, .data = NULL, .size = 0 };
+        AVPacket *packet = self->draining ? &empty_packet : &self->input_packet;
+
+        self->context.reordered_opaque = packet->pts;
+        avcodec_get_frame_defaults( av_frame );
+
+        int got_picture = 0;
+        int64_t start_time = gettime();
+        int decoded = avcodec_decode_video2( &self->context, av_frame, &got_picture, packet );
+        self->decode_time += gettime() - start_time;
+
+        if( self->draining ) {
+            if( decoded < 0 || !got_picture ) {
+                self->drained = true;
+                return false;
+            }
+        }
+        else if( decoded < 0 ) {
+            g_warning( "Could not decode the video (%s), skipping packet.", g_strerror( -decoded ) );
+            self->input_packet.size = 0;
+        }
+        else if( decoded == 0 && !got_picture ) {
+            // The codec won't take any more of this packet
+            self->input_packet.size = 0;
+        }
+        else {
+            self->input_packet.data += decoded;
+            self->input_packet.size -= decoded;
+
+            // Anything after the first picture in the packet has no timestamp of its own
+            self->input_packet.pts = AV_NOPTS_VALUE;
+            self->input_packet.dts = AV_NOPTS_VALUE;
+        }
+
+        if( got_picture ) {
+            self->frames_decoded++;
+            return true;
+        }
+    }
+}
+
+/*
+    Function: finish_decoding
+    Lets anyone waiting on a pooled decode of the given frame go ahead.
+    Call with the mutex held.
+*/
+static void
+finish_decoding( py_obj_AVVideoDecoder *self, int frame ) {
+    g_hash_table_remove( self->decoding, GINT_TO_POINTER(frame) );
+    g_cond_broadcast( &self->decoded_cond );
+}
+
+/*
+    Function: get_frame_pooled
+    Gets a frame from an intra-only stream using the decoder pool.
+
+    Only reading the packet happens under the mutex. The decode itself runs
+    on whichever codec context is idle, so requests from several threads
+    decode side by side. If a frame is already being decoded, a request for
+    it waits for that decode and takes the picture from the cache.
+*/
 static coded_image *
-AVVideoDecoder_get_frame( py_obj_AVVideoDecoder *self, int frame, int quality ) {
+get_frame_pooled( py_obj_AVVideoDecoder *self, int frame ) {
     g_mutex_lock( &self->mutex );
 
+    for( ;; ) {
+        coded_image *cached = cache_lookup( self, frame );
+
+        if( cached ) {
+            self->cache_hits++;
+            g_atomic_int_inc( &((my_coded_image*) cached)->ref_count );
+
+            g_mutex_unlock( &self->mutex );
+            return cached;
+        }
+
+        if( !g_hash_table_lookup( self->decoding, GINT_TO_POINTER(frame) ) )
+            break;
+
+        // If the picture didn't make it into the cache (it's turned off, or
+        // the decode failed), we go on and decode it ourselves
+        self->cache_waits++;
+
+        while( g_hash_table_lookup( self->decoding, GINT_TO_POINTER(frame) ) )
+            g_cond_wait( &self->decoded_cond, &self->mutex );
+    }
+
+    self->cache_misses++;
+    g_hash_table_insert( self->decoding, GINT_TO_POINTER(frame), GINT_TO_POINTER(1) );
+
+    // Every packet is a keyframe, so there's no planning to do
     if( self->source.source.funcs->seek && frame != self->next_frame ) {
         if( !self->source.source.funcs->seek( self->source.source.obj, frame ) ) {
+            finish_decoding( self, frame );
+            g_mutex_unlock( &self->mutex );
+            return NULL;
+        }
+
+        self->seeks++;
+        self->next_frame = frame;
+    }
+
+    codec_packet *packet;
+    int64_t pts;
+
+    for( ;; ) {
+        packet = self->source.source.funcs->getNextPacket( self->source.source.obj );
+
+        if( !packet ) {
+            finish_decoding( self, frame );
             g_mutex_unlock( &self->mutex );
             return NULL;
         }
+
+        // Packets without a timestamp follow the one before
+        pts = (packet->pts == PACKET_TS_NONE) ? self->next_frame : packet->pts;
+        self->next_frame = pts + 1;
+
+        if( pts >= frame )
+            break;
+
+        codec_packet_free( &packet );
     }
 
-    self->next_frame = frame;
+    g_mutex_unlock( &self->mutex );
+
+    AVCodecContext *context = (AVCodecContext*) g_async_queue_pop( self->idle_contexts );
 
+    AVPacket av_packet = {
+        .pts = packet->pts,
+        .dts = packet->dts,
+        .data = packet->data,
+        .size = packet->length,
+        .flags = AV_PKT_FLAG_KEY };
     AVFrame av_frame;
     avcodec_get_frame_defaults( &av_frame );
 
-    // TODO: This won't work for any format in which the packets
-    // are not in presentation order
+    int got_picture = 0;
+    int64_t start_time = gettime();
+    int decoded = avcodec_decode_video2( context, &av_frame, &got_picture, &av_packet );
+    int64_t decode_time = gettime() - start_time;
 
-    // TODO: This also does not consider multiple frames in a single packet.
-    // See http://www.inb.uni-luebeck.de/~boehme/using_libavcodec.html for example.
+    my_coded_image *image = NULL;
 
-    // TODO: Handle when we get to the end of the stream (keep passing NULL)
+    // Take our reference before the context goes back; its next decode
+    // releases this picture
+    if( decoded >= 0 && got_picture ) {
+        image = (my_coded_image*) av_frame.opaque;
+        g_atomic_int_inc( &image->ref_count );
+    }
 
-    codec_packet *packet = NULL;
+    g_async_queue_push( self->idle_contexts, context );
+    codec_packet_free( &packet );
 
-    for( ;; ) {
-        if( packet && packet->free_func )
-            packet->free_func( packet );
+    if( !image ) {
+        g_warning( "Could not decode frame %" PRId64 " (%s).", pts,
+            decoded < 0 ? g_strerror( -decoded ) : "no picture" );
 
-        packet = self->source.source.funcs->getNextPacket( self->source.source.obj );
+        g_mutex_lock( &self->mutex );
+        finish_decoding( self, frame );
+        g_mutex_unlock( &self->mutex );
+        return NULL;
+    }
 
-        if( !packet ) {
-            g_mutex_unlock( &self->mutex );
-            return NULL;
+    g_mutex_lock( &self->mutex );
+    self->decode_time += decode_time;
+    self->frames_decoded++;
+    cache_insert( self, pts, image );
+    finish_decoding( self, frame );
+    g_mutex_unlock( &self->mutex );
+
+    if( pts != frame ) {
+        // The stream skips this frame; the picture we got belongs to a later
+        // one, and stays in the cache for when it's asked for
+        g_warning( "Frame %d isn't in the stream; the next packet is frame %" PRId64 ".", frame, pts );
+        my_coded_image_free( image );
+        return NULL;
+    }
+
+    return &image->image;
+}
+
+static coded_image *
+AVVideoDecoder_get_frame( py_obj_AVVideoDecoder *self, int frame, int quality ) {
+    if( self->idle_contexts )
+        return get_frame_pooled( self, frame );
+
+    g_mutex_lock( &self->mutex );
+
+    coded_image *cached = cache_lookup( self, frame );
+
+    if( cached ) {
+        self->cache_hits++;
+        g_atomic_int_inc( &((my_coded_image*) cached)->ref_count );
+
+        g_mutex_unlock( &self->mutex );
+        return cached;
+    }
+
+    self->cache_misses++;
+
+    // Plan the seek. Decoding forward from where we are is cheapest, unless
+    // we know of a keyframe between here and the target, in which case we can
+    // skip straight to it. Going backwards always means a seek, and if we know
+    // where the target's GOP starts, we seek exactly there. Every picture we
+    // pass on the way in goes into the cache, so stepping backwards through
+    // the same GOP afterwards won't decode it all over again.
+    if( self->source.source.funcs->seek ) {
+        int64_t keyframe = keyframe_before( self, frame );
+        int64_t target = frame;
+        bool do_seek = false;
+
+        if( frame < self->next_frame ) {
+            do_seek = true;
+
+            if( keyframe != PACKET_TS_NONE )
+                target = keyframe;
+        }
+        else if( frame > self->next_frame && keyframe != PACKET_TS_NONE && keyframe > self->next_frame ) {
+            do_seek = true;
+            target = keyframe;
+        }
+        else if( frame - self->next_frame > MAX_DECODE_AHEAD ) {
+            // We haven't been this far yet, so we don't know where the GOPs
+            // are; let the source find a good spot
+            do_seek = true;
         }
 
-        int got_picture;
+        if( do_seek ) {
+            g_debug( "Seeking to %" PRId64 " for frame %d (was at %" PRId64 ")", target, frame, self->next_frame );
 
-        //printf( "Decoding video\n" );
-#if LIBAVCODEC_VERSION_INT < AV_VERSION_INT(52, 23, 0)
-        avcodec_decode_video( &self->context, &av_frame, &got_picture, packet->data, packet->length );
-#else
-        AVPacket av_packet = {
-            .pts = AV_NOPTS_VALUE,
-            .dts = AV_NOPTS_VALUE,
-            .data = packet->data,
-            .size = packet->length };
+            if( !self->source.source.funcs->seek( self->source.source.obj, target ) ) {
+                g_mutex_unlock( &self->mutex );
+                return NULL;
+            }
 
-        avcodec_decode_video2( &self->context, &av_frame, &got_picture, &av_packet );
-#endif
+            self->seeks++;
 
-        if( !got_picture )
-            continue;
+            // Throw out whatever the codec was holding for the old position
+            avcodec_flush_buffers( &self->context );
+            codec_packet_free( &self->last_packet );
+            self->input_packet = (AVPacket) {0};
+            self->draining = false;
+            self->drained = false;
+            self->next_frame = target;
+        }
+    }
 
-        self->next_frame = packet->pts + 1;
+    AVFrame av_frame;
 
-        if( packet->pts < frame ) {
-            printf( "Too early (%" PRId64 " vs %d) (also %" PRId64 ")\n", packet->pts, frame, av_frame.pts );
-            continue;
+    for( ;; ) {
+        if( !decode_next_picture( self, &av_frame ) ) {
+            g_mutex_unlock( &self->mutex );
+            return NULL;
         }
 
-        if( packet && packet->free_func )
-            packet->free_func( packet );
+        // Pictures without a timestamp follow the one before
+        int64_t pts = (av_frame.reordered_opaque == AV_NOPTS_VALUE) ?
+            self->next_frame : av_frame.reordered_opaque;
+
+        self->next_frame = pts + 1;
 
         my_coded_image *image = (my_coded_image*) av_frame.opaque;
+
+        if( av_frame.key_frame )
+            keyframe_add( self, pts );
+
+        cache_insert( self, pts, image );
+
+        if( pts < frame )
+            continue;
+
         g_atomic_int_inc( &image->ref_count );
 
         g_mutex_unlock( &self->mutex );
@@ -264,8 +875,145 @@ AVVideoDecoder_getFuncs( py_obj_AVVideoDecoder *self, void *closure ) {
     return pySourceFuncs;
 }
 
+static PyObject *
+AVVideoDecoder_get_frames_decoded( py_obj_AVVideoDecoder *self, void *closure ) {
+    g_mutex_lock( &self->mutex );
+    int64_t result = self->frames_decoded;
+    g_mutex_unlock( &self->mutex );
+
+    return PyLong_FromLongLong( result );
+}
+
+static PyObject *
+AVVideoDecoder_get_decode_time( py_obj_AVVideoDecoder *self, void *closure ) {
+    g_mutex_lock( &self->mutex );
+    int64_t result = self->decode_time;
+    g_mutex_unlock( &self->mutex );
+
+    return PyFloat_FromDouble( (double) result / (double) NS_PER_SEC );
+}
+
+static PyObject *
+AVVideoDecoder_get_decode_rate( py_obj_AVVideoDecoder *self, void *closure ) {
+    g_mutex_lock( &self->mutex );
+    int64_t frames = self->frames_decoded, time = self->decode_time;
+    g_mutex_unlock( &self->mutex );
+
+    if( time <= 0 )
+        return PyFloat_FromDouble( 0.0 );
+
+    return PyFloat_FromDouble( (double) frames * (double) NS_PER_SEC / (double) time );
+}
+
+static PyObject *
+AVVideoDecoder_get_cache_size( py_obj_AVVideoDecoder *self, void *closure ) {
+    return PyLong_FromLongLong( self->cache_size );
+}
+
+static int
+AVVideoDecoder_set_cache_size( py_obj_AVVideoDecoder *self, PyObject *value, void *closure ) {
+    if( value == NULL ) {
+        PyErr_SetString( PyExc_TypeError, "Cannot delete the cache_size attribute." );
+        return -1;
+    }
+
+    long long cache_size = PyLong_AsLongLong( value );
+
+    if( cache_size == -1 && PyErr_Occurred() )
+        return -1;
+
+    if( cache_size < 0 ) {
+        PyErr_SetString( PyExc_ValueError, "cache_size must not be negative." );
+        return -1;
+    }
+
+    g_mutex_lock( &self->mutex );
+    self->cache_size = cache_size;
+    cache_trim( self, cache_size );
+    g_mutex_unlock( &self->mutex );
+
+    return 0;
+}
+
+static PyObject *
+AVVideoDecoder_get_cache_used( py_obj_AVVideoDecoder *self, void *closure ) {
+    g_mutex_lock( &self->mutex );
+    int64_t result = self->cache_used;
+    g_mutex_unlock( &self->mutex );
+
+    return PyLong_FromLongLong( result );
+}
+
+static PyObject *
+AVVideoDecoder_get_cache_hits( py_obj_AVVideoDecoder *self, void *closure ) {
+    g_mutex_lock( &self->mutex );
+    int64_t result = self->cache_hits;
+    g_mutex_unlock( &self->mutex );
+
+    return PyLong_FromLongLong( result );
+}
+
+static PyObject *
+AVVideoDecoder_get_cache_misses( py_obj_AVVideoDecoder *self, void *closure ) {
+    g_mutex_lock( &self->mutex );
+    int64_t result = self->cache_misses;
+    g_mutex_unlock( &self->mutex );
+
+    return PyLong_FromLongLong( result );
+}
+
+static PyObject *
+AVVideoDecoder_get_cache_waits( py_obj_AVVideoDecoder *self, void *closure ) {
+    g_mutex_lock( &self->mutex );
+    int64_t result = self->cache_waits;
+    g_mutex_unlock( &self->mutex );
+
+    return PyLong_FromLongLong( result );
+}
+
+static PyObject *
+AVVideoDecoder_get_seeks( py_obj_AVVideoDecoder *self, void *closure ) {
+    g_mutex_lock( &self->mutex );
+    int64_t result = self->seeks;
+    g_mutex_unlock( &self->mutex );
+
+    return PyLong_FromLongLong( result );
+}
+
+static PyObject *
+AVVideoDecoder_get_threads( py_obj_AVVideoDecoder *self, void *closure ) {
+    return PyLong_FromLong( self->context.thread_count );
+}
+
+static PyObject *
+AVVideoDecoder_get_decoders( py_obj_AVVideoDecoder *self, void *closure ) {
+    return PyLong_FromLong( self->pool_size + 1 );
+}
+
 static PyGetSetDef AVVideoDecoder_getsetters[] = {
     { CODED_IMAGE_SOURCE_FUNCS, (getter) AVVideoDecoder_getFuncs, NULL, "Coded image source C API." },
+    { "frames_decoded", (getter) AVVideoDecoder_get_frames_decoded, NULL,
+        "Number of pictures that have come out of the decoder." },
+    { "decode_time", (getter) AVVideoDecoder_get_decode_time, NULL,
+        "Total time spent in the decoder, in seconds." },
+    { "decode_rate", (getter) AVVideoDecoder_get_decode_rate, NULL,
+        "Average pictures decoded per second of decoder time." },
+    { "threads", (getter) AVVideoDecoder_get_threads, NULL,
+        "Number of threads the codec was asked to use." },
+    { "decoders", (getter) AVVideoDecoder_get_decoders, NULL,
+        "Number of codec contexts decoding pictures side by side." },
+    { "cache_size", (getter) AVVideoDecoder_get_cache_size, (setter) AVVideoDecoder_set_cache_size,
+        "Most memory, in bytes, to spend on recently decoded pictures. Zero turns off the cache." },
+    { "cache_used", (getter) AVVideoDecoder_get_cache_used, NULL,
+        "Memory, in bytes, taken up by cached pictures." },
+    { "cache_hits", (getter) AVVideoDecoder_get_cache_hits, NULL,
+        "Number of requests answered from the cache." },
+    { "cache_misses", (getter) AVVideoDecoder_get_cache_misses, NULL,
+        "Number of requests that had to go to the decoder." },
+    { "cache_waits", (getter) AVVideoDecoder_get_cache_waits, NULL,
+        "Number of requests that waited for another thread to decode the same frame." },
+    { "seeks", (getter) AVVideoDecoder_get_seeks, NULL,
+        "Number of times the decoder has seeked the source." },
     { NULL }
 };
 
@@ -273,6 +1021,23 @@ static PyMethodDef AVVideoDecoder_methods[] = {
     { NULL }
 };
 
+/*
+    AVVideoDecoder(source, codec, threads=0, thread_type='auto', cache_size=256MB, decoders=0)
+
+    Decodes video packets with libavcodec. threads is the number of decoding
+    threads, or zero for one per processor. thread_type picks between 'frame'
+    threading (decode several pictures at once, at the cost of some delay),
+    'slice' threading (split each picture up), or 'auto' to allow both.
+
+    Decoded pictures are kept in a cache of up to cache_size bytes, and the
+    decoder remembers where keyframes are, so stepping backwards through long
+    GOPs decodes each GOP only once.
+
+    For intra-only codecs such as dvvideo, decoders sets how many pictures can
+    be decoded at once when several threads ask for frames; zero means one per
+    processor. Each decoder then gets one thread unless threads says otherwise.
+    Other codecs only allow one decoder.
+*/
 static PyTypeObject py_type_AVVideoDecoder = {
     PyVarObject_HEAD_INIT(NULL, 0)
     .tp_name = "fluggo.media.libav.AVVideoDecoder",
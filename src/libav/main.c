@@ -28,7 +28,13 @@ PyObject *py_writeVideo( PyObject *self, PyObject *args, PyObject *kw );
 
 static PyMethodDef module_methods[] = {
     { "write_video", (PyCFunction) py_writeVideo, METH_VARARGS | METH_KEYWORDS,
-        "TBD" },
+        "Renders video and audio sources to a DV file.\n"
+        "\n"
+        "stats = write_video(filename, video_source=None, audio_source=None, start_time=0, end_time=5s, threads=0)\n"
+        "\n"
+        "Video frames are rendered on the given number of threads (zero for one per processor) "
+        "and encoded on another. Returns a dictionary with the number of frames and the "
+        "seconds spent rendering, converting, encoding, and muxing." },
     { NULL }
 };
 
@@ -36,6 +42,7 @@ void init_AVVideoDecoder( PyObject *module );
 void init_AVVideoEncoder( PyObject *module );
 void init_AVAudioDecoder( PyObject *module );
 void init_AVDemuxer( PyObject *module );
+void init_AVSharedDemuxer( PyObject *module );
 void init_AVMuxer( PyObject *module );
 void init_AVContainer( PyObject *module );
 
@@ -63,6 +70,7 @@ PyInit_libav() {
     init_AVVideoEncoder( m );
     init_AVAudioDecoder( m );
     init_AVDemuxer( m );
+    init_AVSharedDemuxer( m );
     init_AVMuxer( m );
     init_AVContainer( m );
 
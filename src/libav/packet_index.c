@@ -0,0 +1,347 @@
+/*
+    This file is part of the Fluggo Media Library for high-quality
+    video and audio processing.
+
+    Copyright 2012 Brian J. Crowell <brian@fluggo.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include "packet_index.h"
+
+#undef G_LOG_DOMAIN
+#define G_LOG_DOMAIN "fluggo.media.libav.packet_index"
+
+#define FILE_MAGIC          "FLGPKIDX"
+#define FILE_VERSION        1
+
+typedef struct {
+    int64_t time;
+    int index;
+} keyframe_entry;
+
+typedef struct {
+    // All of the stream's packets, in file order
+    GArray *entries;
+
+    // The keyframes, sorted by presentation time
+    GArray *keyframes;
+} stream_index;
+
+struct packet_index_t {
+    int stream_count;
+    stream_index *streams;
+};
+
+static packet_index *
+packet_index_new( int stream_count ) {
+    packet_index *self = g_slice_new0( packet_index );
+
+    self->stream_count = stream_count;
+    self->streams = g_new0( stream_index, stream_count );
+
+    for( int i = 0; i < stream_count; i++ ) {
+        self->streams[i].entries = g_array_new( false, false, sizeof(packet_index_entry) );
+        self->streams[i].keyframes = g_array_new( false, false, sizeof(keyframe_entry) );
+    }
+
+    return self;
+}
+
+void
+packet_index_free( packet_index *self ) {
+    if( !self )
+        return;
+
+    for( int i = 0; i < self->stream_count; i++ ) {
+        g_array_free( self->streams[i].entries, true );
+        g_array_free( self->streams[i].keyframes, true );
+    }
+
+    g_free( self->streams );
+    g_slice_free( packet_index, self );
+}
+
+static int64_t
+entry_get_time( const packet_index_entry *entry ) {
+    return (entry->pts != AV_NOPTS_VALUE) ? entry->pts : entry->dts;
+}
+
+G_GNUC_PURE static gint
+compare_keyframes( const keyframe_entry *a, const keyframe_entry *b ) {
+    if( a->time != b->time )
+        return (a->time < b->time) ? -1 : 1;
+
+    return a->index - b->index;
+}
+
+// Builds the keyframe lists once all the entries are in
+static void
+finish_index( packet_index *self ) {
+    for( int i = 0; i < self->stream_count; i++ ) {
+        stream_index *stream = &self->streams[i];
+
+        g_array_set_size( stream->keyframes, 0 );
+
+        for( guint j = 0; j < stream->entries->len; j++ ) {
+            const packet_index_entry *entry = &g_array_index( stream->entries, packet_index_entry, j );
+
+            if( !(entry->flags & PACKET_INDEX_KEYFRAME) )
+                continue;
+
+            keyframe_entry keyframe = { .time = entry_get_time( entry ), .index = (int) j };
+
+            if( keyframe.time != AV_NOPTS_VALUE )
+                g_array_append_val( stream->keyframes, keyframe );
+        }
+
+        g_array_sort( stream->keyframes, (GCompareFunc) compare_keyframes );
+    }
+}
+
+/*
+    Function: packet_index_seek_packet
+    Seeks the container back to a packet read from it before.
+
+    context - Container to seek.
+    stream - Stream the packet came from.
+    pos - The packet's byte offset, or -1 if it's not known.
+    dts - The packet's decode timestamp, in the stream's time base.
+    first - Receives the first packet read after the seek, which the caller
+        must free. Its data is NULL if the seek landed at the end of the file.
+
+    Seeking by bytes skips the demuxer's own seek code, and with it any
+    timestamp state the demuxer keeps (AVI, for one, counts frames to get its
+    timestamps). So after a byte seek, the first packet is checked against the
+    one asked for; if it doesn't match, this seeks by timestamp instead, which
+    can land on an earlier packet. Check first to see where it landed.
+
+    Returns true if successful.
+*/
+bool
+packet_index_seek_packet( AVFormatContext *context, int stream, int64_t pos, int64_t dts, AVPacket *first ) {
+    av_init_packet( first );
+    first->data = NULL;
+    first->size = 0;
+
+    if( pos >= 0 && av_seek_frame( context, stream, pos, AVSEEK_FLAG_BYTE ) >= 0 ) {
+        if( av_read_frame( context, first ) >= 0 ) {
+            if( first->stream_index == stream && first->pos == pos &&
+                    (dts == AV_NOPTS_VALUE || first->dts == dts) )
+                return true;
+
+            av_free_packet( first );
+            first->data = NULL;
+            first->size = 0;
+        }
+
+        g_debug( "Byte seek to %" PRId64 " in stream %d didn't land on the right packet.", pos, stream );
+    }
+
+    if( dts == AV_NOPTS_VALUE || av_seek_frame( context, stream, dts, AVSEEK_FLAG_BACKWARD ) < 0 )
+        return false;
+
+    if( av_read_frame( context, first ) < 0 ) {
+        first->data = NULL;
+        first->size = 0;
+    }
+
+    return true;
+}
+
+/*
+    Function: packet_index_build
+    Reads every packet in the container to build an index.
+
+    context - Open container, positioned at the start.
+
+    When it's done, the container is sought back to the first packet.
+*/
+packet_index *
+packet_index_build( AVFormatContext *context ) {
+    packet_index *self = packet_index_new( context->nb_streams );
+
+    AVPacket packet;
+    av_init_packet( &packet );
+
+    while( av_read_frame( context, &packet ) >= 0 ) {
+        if( packet.stream_index >= 0 && packet.stream_index < self->stream_count ) {
+            packet_index_entry entry = {
+                .pos = packet.pos,
+                .pts = packet.pts,
+                .dts = packet.dts,
+                .size = packet.size,
+                .flags = (packet.flags & AV_PKT_FLAG_KEY) ? PACKET_INDEX_KEYFRAME : 0 };
+
+            g_array_append_val( self->streams[packet.stream_index].entries, entry );
+        }
+
+        av_free_packet( &packet );
+    }
+
+    finish_index( self );
+
+    // Go back to the first packet in the file; seek by time, so the
+    // demuxer starts its timestamps over
+    const packet_index_entry *first = NULL;
+    int first_stream = -1;
+
+    for( int i = 0; i < self->stream_count; i++ ) {
+        if( self->streams[i].entries->len == 0 )
+            continue;
+
+        const packet_index_entry *entry = &g_array_index( self->streams[i].entries, packet_index_entry, 0 );
+
+        if( entry_get_time( entry ) != AV_NOPTS_VALUE && (!first || entry->pos < first->pos) ) {
+            first = entry;
+            first_stream = i;
+        }
+    }
+
+    if( first && av_seek_frame( context, first_stream, entry_get_time( first ), AVSEEK_FLAG_BACKWARD ) < 0 )
+        g_warning( "Could not return to the start of the file after indexing." );
+
+    return self;
+}
+
+int
+packet_index_get_count( packet_index *self, int stream ) {
+    g_assert( stream >= 0 && stream < self->stream_count );
+    return (int) self->streams[stream].entries->len;
+}
+
+const packet_index_entry *
+packet_index_get_entry( packet_index *self, int stream, int index ) {
+    g_assert( stream >= 0 && stream < self->stream_count );
+    g_assert( index >= 0 && index < (int) self->streams[stream].entries->len );
+
+    return &g_array_index( self->streams[stream].entries, packet_index_entry, index );
+}
+
+/*
+    Function: packet_index_find_keyframe
+    Finds the keyframe to start decoding from to reach the given time.
+
+    stream - Stream to search.
+    timestamp - Presentation time to reach, in the stream's time base.
+
+    Returns the last keyframe at or before the timestamp, the first keyframe if the
+    timestamp comes before all of them, or NULL if the stream has no keyframes.
+*/
+const packet_index_entry *
+packet_index_find_keyframe( packet_index *self, int stream, int64_t timestamp ) {
+    g_assert( stream >= 0 && stream < self->stream_count );
+
+    GArray *keyframes = self->streams[stream].keyframes;
+
+    if( keyframes->len == 0 )
+        return NULL;
+
+    guint low = 0, high = keyframes->len;
+
+    while( low < high ) {
+        guint mid = (low + high) / 2;
+
+        if( g_array_index( keyframes, keyframe_entry, mid ).time <= timestamp )
+            low = mid + 1;
+        else
+            high = mid;
+    }
+
+    const keyframe_entry *keyframe = &g_array_index( keyframes, keyframe_entry, (low == 0) ? 0 : low - 1 );
+
+    return &g_array_index( self->streams[stream].entries, packet_index_entry, keyframe->index );
+}
+
+/*
+    Function: packet_index_save
+    Writes the index to a sidecar file.
+
+    path - File to write. The index is written to a temporary file first, so a
+        crash won't leave a damaged index behind.
+    key - String identifying the container, such as its size and modification
+        time. packet_index_load won't use the file unless it gets the same key.
+
+    Returns true if successful.
+*/
+bool
+packet_index_save( packet_index *self, const char *path, const char *key ) {
+    const int32_t header[] = { self->stream_count };
+    FILE *file = cache_file_begin_write( path, FILE_MAGIC, FILE_VERSION, key, header, G_N_ELEMENTS(header) );
+
+    if( !file )
+        return false;
+
+    bool success = true;
+
+    for( int i = 0; success && i < self->stream_count; i++ ) {
+        GArray *entries = self->streams[i].entries;
+        const int32_t count = (int32_t) entries->len;
+
+        success = fwrite( &count, sizeof(count), 1, file ) == 1 &&
+            fwrite( entries->data, sizeof(packet_index_entry), count, file ) == (size_t) count;
+    }
+
+    return cache_file_end_write( file, path, success );
+}
+
+/*
+    Function: packet_index_load
+    Reads an index written by packet_index_save.
+
+    path - File to read.
+    key - Container identity the file must have been saved with.
+    stream_count - Number of streams the container has.
+
+    Returns the index, or NULL if the file is missing, damaged, or was made for
+    a different container. In that case, build a new one.
+*/
+packet_index *
+packet_index_load( const char *path, const char *key, int stream_count ) {
+    const int32_t header[] = { stream_count };
+    FILE *file = cache_file_open_read( path, FILE_MAGIC, FILE_VERSION, key, header, G_N_ELEMENTS(header) );
+
+    if( !file )
+        return NULL;
+
+    packet_index *self = packet_index_new( stream_count );
+
+    for( int i = 0; i < stream_count; i++ ) {
+        GArray *entries = self->streams[i].entries;
+        int32_t count;
+
+        if( fread( &count, sizeof(count), 1, file ) != 1 || count < 0 ) {
+            g_debug( "Packet index %s is truncated", path );
+            packet_index_free( self );
+            fclose( file );
+            return NULL;
+        }
+
+        g_array_set_size( entries, count );
+
+        if( fread( entries->data, sizeof(packet_index_entry), count, file ) != (size_t) count ) {
+            g_debug( "Packet index %s is truncated", path );
+            packet_index_free( self );
+            fclose( file );
+            return NULL;
+        }
+    }
+
+    fclose( file );
+
+    finish_index( self );
+    return self;
+}
+
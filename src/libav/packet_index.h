@@ -0,0 +1,60 @@
+/*
+    This file is part of the Fluggo Media Library for high-quality
+    video and audio processing.
+
+    Copyright 2012 Brian J. Crowell <brian@fluggo.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#if !defined(fluggo_packet_index)
+#define fluggo_packet_index
+
+#include "pyframework.h"
+#include <libavformat/avformat.h>
+
+/*
+    Packet indexes
+
+    A packet index lists every packet in a container, stream by stream, in the
+    order they're stored: byte offset, timestamps (in the stream's time base),
+    and whether it's a keyframe. It's built by reading the whole file once, which
+    is slow for a big file, so it can be saved to a sidecar file and loaded back
+    the next time the file is opened.
+
+    With the index, a demuxer can seek straight to the keyframe that starts the
+    GOP for a given timestamp, even in containers with poor seek tables.
+*/
+
+#define PACKET_INDEX_KEYFRAME   1
+
+typedef struct {
+    int64_t pos, pts, dts;
+    int32_t size, flags;
+} packet_index_entry;
+
+typedef struct packet_index_t packet_index;
+
+packet_index *packet_index_build( AVFormatContext *context );
+packet_index *packet_index_load( const char *path, const char *key, int stream_count );
+bool packet_index_save( packet_index *self, const char *path, const char *key );
+void packet_index_free( packet_index *self );
+
+int packet_index_get_count( packet_index *self, int stream );
+const packet_index_entry *packet_index_get_entry( packet_index *self, int stream, int index );
+const packet_index_entry *packet_index_find_keyframe( packet_index *self, int stream, int64_t timestamp );
+bool packet_index_seek_packet( AVFormatContext *context, int stream, int64_t pos, int64_t dts, AVPacket *first );
+
+#endif
+
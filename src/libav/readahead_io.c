@@ -0,0 +1,188 @@
+/*
+    This file is part of the Fluggo Media Library for high-quality
+    video and audio processing.
+
+    Copyright 2012 Brian J. Crowell <brian@fluggo.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include "readahead_io.h"
+
+#undef G_LOG_DOMAIN
+#define G_LOG_DOMAIN "fluggo.media.libav.readahead_io"
+
+// Each read from the disk is one block
+#define BLOCK_SIZE          (1024 * 1024)
+
+// Size of libav's own buffer in front of ours
+#define IO_BUFFER_SIZE      (64 * 1024)
+
+#if defined(HAVE_READAHEAD_IO)
+
+static int
+io_read( readahead_file *file, uint8_t *buffer, int size ) {
+    int result = readahead_file_read( file, buffer, size );
+
+#if defined(AVERROR_EOF)
+    if( result == 0 )
+        return AVERROR_EOF;
+#endif
+
+    return result;
+}
+
+static int64_t
+io_seek( readahead_file *file, int64_t offset, int whence ) {
+    if( whence & AVSEEK_SIZE )
+        return readahead_file_get_size( file );
+
+    return readahead_file_seek( file, offset, whence & ~AVSEEK_FORCE );
+}
+
+/*
+    Function: readahead_io_open
+    Opens a file for libav to read through a read-ahead cache.
+
+    filename - File to open.
+    cache_size - Bytes to read ahead. This is split into 1 MB reads.
+    flags - Zero or READAHEAD_FILE_NOCACHE.
+
+    Returns the new context, or NULL with errno set on failure.
+*/
+readahead_io *
+readahead_io_open( const char *filename, int64_t cache_size, int flags ) {
+    int block_count = (int) max( 2, cache_size / BLOCK_SIZE );
+    readahead_file *file = readahead_file_open( filename, BLOCK_SIZE, block_count, flags );
+
+    if( !file )
+        return NULL;
+
+    unsigned char *buffer = av_malloc( IO_BUFFER_SIZE );
+    AVIOContext *context = buffer ? avio_alloc_context( buffer, IO_BUFFER_SIZE, 0, file,
+        (int (*)(void *, uint8_t *, int)) io_read, NULL,
+        (int64_t (*)(void *, int64_t, int)) io_seek ) : NULL;
+
+    if( !context ) {
+        av_free( buffer );
+        readahead_file_close( file );
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    readahead_io *self = g_slice_new( readahead_io );
+    self->file = file;
+    self->context = context;
+
+    return self;
+}
+
+void
+readahead_io_close( readahead_io *self ) {
+    if( !self )
+        return;
+
+    // The buffer may have been replaced by libav since we allocated it
+    av_free( self->context->buffer );
+    av_free( self->context );
+    readahead_file_close( self->file );
+
+    g_slice_free( readahead_io, self );
+}
+
+/*
+    Function: readahead_io_get_stats
+    Returns the cache statistics as a Python dictionary.
+*/
+PyObject *
+readahead_io_get_stats( readahead_io *self ) {
+    readahead_file_stats stats;
+    readahead_file_get_stats( self->file, &stats );
+
+    return Py_BuildValue( "{sLsLsLsL}",
+        "hits", (long long) stats.hits,
+        "misses", (long long) stats.misses,
+        "blocks_read", (long long) stats.blocks_read,
+        "bytes_read", (long long) stats.bytes_read );
+}
+
+#else
+
+// Without custom I/O contexts, readahead_io_open_input never hands out a
+// readahead_io, so these only ever see NULL
+
+void
+readahead_io_close( readahead_io *self ) {
+}
+
+PyObject *
+readahead_io_get_stats( readahead_io *self ) {
+    Py_RETURN_NONE;
+}
+
+#endif
+
+/*
+    Function: readahead_io_open_input
+    Opens a container, reading through a read-ahead cache if cache_size is nonzero.
+
+    context - Receives the opened format context.
+    io - Receives the read-ahead context, or NULL if there isn't one. Close it
+        after closing the format context.
+
+    Returns zero on success or a negative error code, as avformat_open_input does.
+*/
+int
+readahead_io_open_input( AVFormatContext **context, readahead_io **io,
+        const char *filename, int64_t cache_size, int flags ) {
+    *io = NULL;
+
+#if defined(HAVE_READAHEAD_IO)
+    if( cache_size > 0 ) {
+        if( !(*io = readahead_io_open( filename, cache_size, flags )) )
+            return AVERROR(errno);
+
+        if( !(*context = avformat_alloc_context()) ) {
+            readahead_io_close( *io );
+            *io = NULL;
+            return AVERROR(ENOMEM);
+        }
+
+        (*context)->pb = (*io)->context;
+
+        int error = avformat_open_input( context, filename, NULL, NULL );
+
+        if( error != 0 ) {
+            // avformat_open_input has already freed the format context
+            readahead_io_close( *io );
+            *io = NULL;
+        }
+
+        return error;
+    }
+
+    return avformat_open_input( context, filename, NULL, NULL );
+#else
+    if( cache_size > 0 )
+        g_warning( "This version of libavformat can't take a custom I/O context; reading %s without read-ahead.", filename );
+
+#if LIBAVFORMAT_VERSION_INT < AV_VERSION_INT(53, 2, 0)
+    return av_open_input_file( context, filename, NULL, 0, NULL );
+#else
+    return avformat_open_input( context, filename, NULL, NULL );
+#endif
+#endif
+}
+
@@ -0,0 +1,52 @@
+/*
+    This file is part of the Fluggo Media Library for high-quality
+    video and audio processing.
+
+    Copyright 2012 Brian J. Crowell <brian@fluggo.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#if !defined(fluggo_readahead_io)
+#define fluggo_readahead_io
+
+#include "pyframework.h"
+#include <libavformat/avformat.h>
+
+/*
+    Read-ahead I/O
+
+    An AVIOContext that reads through a readahead_file, so libav's reads come
+    out of memory that a background thread filled. Put the context in an
+    AVFormatContext's pb before opening it, and close this after closing the
+    format; libav doesn't close I/O contexts it didn't open.
+*/
+
+#if LIBAVFORMAT_VERSION_INT >= AV_VERSION_INT(53, 2, 0)
+#define HAVE_READAHEAD_IO 1
+#endif
+
+typedef struct {
+    readahead_file *file;
+    AVIOContext *context;
+} readahead_io;
+
+readahead_io *readahead_io_open( const char *filename, int64_t cache_size, int flags );
+void readahead_io_close( readahead_io *self );
+PyObject *readahead_io_get_stats( readahead_io *self );
+int readahead_io_open_input( AVFormatContext **context, readahead_io **io,
+    const char *filename, int64_t cache_size, int flags );
+
+#endif
+
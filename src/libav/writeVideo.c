@@ -20,16 +20,9 @@
 
 #include "pyframework.h"
 #include <libavformat/avformat.h>
-#include <libswscale/swscale.h>
 #include <libavutil/avstring.h>
 #include <libavutil/mathematics.h>
 
-#define RAMP_SIZE    (1 << 16)
-
-// studio YUV
-// RGB -> YUV matrix
-// chromaticities
-
 // Support old Libav
 #if LIBAVCODEC_VERSION_INT < AV_VERSION_INT(52, 64, 0)
 #define AVMEDIA_TYPE_VIDEO      CODEC_TYPE_VIDEO
@@ -67,6 +60,237 @@
 #define AV_CH_LAYOUT_STEREO CH_LAYOUT_STEREO
 #endif
 
+// Frames each render thread can have in flight
+#define SLOTS_PER_THREAD    2
+
+/*
+    Export runs as a pipeline. Render threads each take the next frame,
+    render it, and convert it to the encoder's format in one of a ring of
+    slots. One encoder thread takes the slots in order and queues up the
+    packets, and the calling thread interleaves those with audio and writes
+    them. The ring and the packet queue are both bounded, so nothing runs
+    more than a few frames ahead of the muxer.
+*/
+
+typedef enum {
+    SLOT_FREE,
+    SLOT_RENDERING,
+    SLOT_READY
+} slot_state;
+
+typedef struct {
+    slot_state state;
+    int frame;
+    AVFrame picture;
+    uint8_t *buffer;
+} export_slot;
+
+typedef struct {
+    void *data;
+    int size;
+    int64_t pts;
+    bool key;
+} export_packet;
+
+typedef struct {
+    video_source *source;
+    AVCodecContext *codec;
+    video_subsample_params subsample;
+    box2i window;
+    v2i size;
+    int first_frame, last_frame;
+
+    GMutex mutex;
+    GCond cond;
+
+    // Protected by mutex
+    int next_frame;
+    export_slot *slots;
+    int slot_count;
+    GQueue packets;
+    bool cancel;
+    const char *error;
+
+    // Time spent in each stage, in nanoseconds; also protected by mutex
+    int64_t render_time, convert_time, encode_time, mux_time;
+} export_pipeline;
+
+static gpointer
+render_thread( export_pipeline *pipe ) {
+    rgba_frame_f16 input = { .full_window = pipe->window };
+    input.data = g_new( rgba_f16, pipe->size.x * pipe->size.y );
+
+    g_mutex_lock( &pipe->mutex );
+
+    while( !pipe->cancel && pipe->next_frame <= pipe->last_frame ) {
+        int frame = pipe->next_frame;
+        export_slot *slot = &pipe->slots[(frame - pipe->first_frame) % pipe->slot_count];
+
+        if( slot->state != SLOT_FREE ) {
+            // The encoder hasn't gotten this far yet
+            g_cond_wait( &pipe->cond, &pipe->mutex );
+            continue;
+        }
+
+        pipe->next_frame++;
+        slot->state = SLOT_RENDERING;
+        slot->frame = frame;
+
+        g_mutex_unlock( &pipe->mutex );
+
+        int64_t start_time = gettime();
+
+        input.current_window = input.full_window;
+        video_get_frame_f16( pipe->source, frame, &input );
+
+        int64_t render_time = gettime();
+
+        // Straight from linear half to the encoder's planes
+        video_subsample_planar( &input, &pipe->subsample,
+            (void *const *) slot->picture.data, slot->picture.linesize );
+
+        int64_t convert_time = gettime();
+
+        g_mutex_lock( &pipe->mutex );
+
+        pipe->render_time += render_time - start_time;
+        pipe->convert_time += convert_time - render_time;
+        slot->state = SLOT_READY;
+
+        g_cond_broadcast( &pipe->cond );
+    }
+
+    g_mutex_unlock( &pipe->mutex );
+
+    g_free( input.data );
+
+    return NULL;
+}
+
+static void
+export_packet_free( export_packet *packet ) {
+    g_free( packet->data );
+    g_slice_free( export_packet, packet );
+}
+
+static gpointer
+encode_thread( export_pipeline *pipe ) {
+    // Does anyone know a better formula for a bit bucket size than this?
+    int bitBucketSize = (pipe->size.x * pipe->size.y) * 6 + 200;
+    void *bitBucket = g_malloc( bitBucketSize );
+
+    // One packet (possibly empty) for each frame, and one more for the flush
+    for( int frame = pipe->first_frame; frame <= pipe->last_frame + 1; frame++ ) {
+        export_slot *slot = NULL;
+
+        if( frame <= pipe->last_frame ) {
+            slot = &pipe->slots[(frame - pipe->first_frame) % pipe->slot_count];
+
+            g_mutex_lock( &pipe->mutex );
+
+            while( !pipe->cancel && !(slot->state == SLOT_READY && slot->frame == frame) )
+                g_cond_wait( &pipe->cond, &pipe->mutex );
+
+            bool cancel = pipe->cancel;
+            g_mutex_unlock( &pipe->mutex );
+
+            if( cancel )
+                break;
+
+            slot->picture.interlaced_frame = 1;
+            slot->picture.top_field_first = 0;
+            slot->picture.pts = frame - pipe->first_frame;
+        }
+
+        int64_t start_time = gettime();
+        int result = avcodec_encode_video( pipe->codec,
+            bitBucket, bitBucketSize, slot ? &slot->picture : NULL );
+        int64_t encode_time = gettime() - start_time;
+
+        export_packet *packet = g_slice_new0( export_packet );
+        packet->pts = AV_NOPTS_VALUE;
+
+        if( result > 0 ) {
+            packet->data = g_memdup( bitBucket, result );
+            packet->size = result;
+            packet->pts = pipe->codec->coded_frame->pts;
+            packet->key = pipe->codec->coded_frame->key_frame;
+        }
+
+        g_mutex_lock( &pipe->mutex );
+
+        pipe->encode_time += encode_time;
+
+        if( slot )
+            slot->state = SLOT_FREE;
+
+        if( result < 0 ) {
+            pipe->error = "Video encoding failed.";
+            pipe->cancel = true;
+            g_cond_broadcast( &pipe->cond );
+            g_mutex_unlock( &pipe->mutex );
+
+            export_packet_free( packet );
+            break;
+        }
+
+        while( !pipe->cancel && g_queue_get_length( &pipe->packets ) >= pipe->slot_count )
+            g_cond_wait( &pipe->cond, &pipe->mutex );
+
+        g_queue_push_tail( &pipe->packets, packet );
+        g_cond_broadcast( &pipe->cond );
+        g_mutex_unlock( &pipe->mutex );
+    }
+
+    g_free( bitBucket );
+    return NULL;
+}
+
+// Returns the next video packet, or NULL if the pipeline has failed
+static export_packet *
+pop_video_packet( export_pipeline *pipe ) {
+    g_mutex_lock( &pipe->mutex );
+
+    while( !pipe->cancel && g_queue_is_empty( &pipe->packets ) )
+        g_cond_wait( &pipe->cond, &pipe->mutex );
+
+    export_packet *packet = pipe->cancel ? NULL : (export_packet*) g_queue_pop_head( &pipe->packets );
+
+    g_cond_broadcast( &pipe->cond );
+    g_mutex_unlock( &pipe->mutex );
+
+    return packet;
+}
+
+static const char *
+write_video_packet( export_pipeline *pipe, AVFormatContext *context, AVStream *video, export_packet *item ) {
+    if( !item->size )
+        return NULL;
+
+    AVPacket packet;
+    av_init_packet( &packet );
+
+    packet.stream_index = video->index;
+    packet.data = item->data;
+    packet.size = item->size;
+
+    if( item->pts != AV_NOPTS_VALUE )
+        packet.pts = av_rescale_q( item->pts, video->codec->time_base, video->time_base );
+
+    if( item->key )
+        packet.flags |= AV_PKT_FLAG_KEY;
+
+    int64_t start_time = gettime();
+    int result = av_interleaved_write_frame( context, &packet );
+    int64_t mux_time = gettime() - start_time;
+
+    g_mutex_lock( &pipe->mutex );
+    pipe->mux_time += mux_time;
+    g_mutex_unlock( &pipe->mutex );
+
+    return (result < 0) ? "Failed to write frame." : NULL;
+}
+
 PyObject *
 py_writeVideo( PyObject *self, PyObject *args, PyObject *kw ) {
     rational videoRate = { 30000, 1001 };
@@ -75,15 +299,23 @@ py_writeVideo( PyObject *self, PyObject *args, PyObject *kw ) {
     PyObject *videoSourceObj = NULL, *audioSourceObj = NULL;
     int64_t startTime = INT64_C(0), endTime = 5 * INT64_C(1000000000);
     char *filename = NULL;
-    int audioChannels = 2;
+    int audioChannels = 2, threads = 0;
     int result;
 
-    static char *kwlist[] = { "filename", "video_source", "audio_source", "start_time", "end_time", NULL };
+    static char *kwlist[] = { "filename", "video_source", "audio_source", "start_time", "end_time", "threads", NULL };
 
-    if( !PyArg_ParseTupleAndKeywords( args, kw, "s|OOII", kwlist,
-            &filename, &videoSourceObj, &audioSourceObj, &startTime, &endTime ) )
+    if( !PyArg_ParseTupleAndKeywords( args, kw, "s|OOLLi", kwlist,
+            &filename, &videoSourceObj, &audioSourceObj, &startTime, &endTime, &threads ) )
         return NULL;
 
+    if( threads < 0 ) {
+        PyErr_SetString( PyExc_ValueError, "threads must not be negative." );
+        return NULL;
+    }
+
+    if( threads == 0 )
+        threads = g_get_num_processors();
+
     v2i frameSize;
     box2i_get_size( &dataWindow, &frameSize );
 
@@ -95,29 +327,8 @@ py_writeVideo( PyObject *self, PyObject *args, PyObject *kw ) {
     if( !py_audio_take_source( audioSourceObj, &audioSource ) )
         return NULL;
 
-    // Do a simple gamma ramp for now
-    uint8_t *ramp = g_slice_alloc( RAMP_SIZE );
-    float *tempRampF = g_slice_alloc( RAMP_SIZE * sizeof(float) );
-    half *tempRampH = g_slice_alloc( RAMP_SIZE * sizeof(half) );
-
-    if( !ramp )
-        return PyErr_NoMemory();
-
-    for( int i = 0; i < RAMP_SIZE; i++ )
-        tempRampH[i] = (half) i;
-
-    half_convert_to_float( tempRampF, tempRampH, RAMP_SIZE );
-    g_slice_free1( RAMP_SIZE * sizeof(half), tempRampH );
-
-    for( int i = 0; i < RAMP_SIZE; i++ ) {
-        ramp[i] = (uint8_t) min( 255, max( 0,
-            (int)(powf( clampf(tempRampF[i], 0.0f, 1.0f), 0.45f ) * 255.0f) ) );
-    }
-
-    g_slice_free1( RAMP_SIZE * sizeof(float), tempRampF );
-
-    // Does anyone know a better formula for a bit bucket size than this?
-    // TODO: Make sure this is big enough for audio, too
+    // The video bit bucket belongs to the encoder thread; this one's for audio
+    // TODO: Make sure this is big enough for audio
     int bitBucketSize = (frameSize.x * frameSize.y) * 6 + 200;
     void *bitBucket = g_malloc( bitBucketSize );
 
@@ -241,13 +452,6 @@ py_writeVideo( PyObject *self, PyObject *args, PyObject *kw ) {
 
     /// context->preload = 0.5seconds (needed in some formats)
 
-    struct SwsContext *scaler;
-
-    scaler = sws_getContext(
-        frameSize.x, frameSize.y, PIX_FMT_RGBA,
-        frameSize.x, frameSize.y, video->codec->pix_fmt, SWS_FAST_BILINEAR,
-        NULL, NULL, NULL );
-
     // Write header
 #if LIBAVFORMAT_VERSION_INT < AV_VERSION_INT(53, 2, 0)
     if( av_write_header( context ) < 0 ) {
@@ -258,38 +462,6 @@ py_writeVideo( PyObject *self, PyObject *args, PyObject *kw ) {
         return NULL;
     }
 
-    rgba_frame_f16 inputFrame;
-    AVFrame interFrame, outputFrame;
-    uint8_t *interBuffer = NULL, *outputBuffer = NULL;
-    int interBufferSize = 0, outputBufferSize = 0;
-
-    if( videoSource ) {
-        inputFrame.full_window = dataWindow;
-        inputFrame.data = (rgba_f16*) g_slice_alloc( frameSize.x * frameSize.y * sizeof(rgba_f16) );
-
-        avcodec_get_frame_defaults( &interFrame );
-        avcodec_get_frame_defaults( &outputFrame );
-
-        interBufferSize = avpicture_get_size(
-            PIX_FMT_RGBA, frameSize.x, frameSize.y );
-
-        outputBufferSize = avpicture_get_size(
-            video->codec->pix_fmt, frameSize.x, frameSize.y );
-
-        if( (interBuffer = (uint8_t*) g_slice_alloc( interBufferSize )) == NULL ) {
-            return PyErr_NoMemory();
-        }
-
-        if( (outputBuffer = (uint8_t*) g_slice_alloc( outputBufferSize )) == NULL ) {
-            return PyErr_NoMemory();
-        }
-
-        avpicture_fill( (AVPicture *) &interFrame, interBuffer,
-            PIX_FMT_RGBA, frameSize.x, frameSize.y );
-        avpicture_fill( (AVPicture *) &outputFrame, outputBuffer,
-            video->codec->pix_fmt, frameSize.x, frameSize.y );
-    }
-
     audio_frame audioInputFrame;
     void *outSampleBuf = NULL;
     int outSampleBufSize = 0, sampleCount = 0;
@@ -308,79 +480,87 @@ py_writeVideo( PyObject *self, PyObject *args, PyObject *kw ) {
 
     int nextVideoFrame = get_time_frame( &videoRate, startTime );
     int nextAudioSample = get_time_frame( &audioRate, startTime );
-    int startVideoFrame = nextVideoFrame;
 
     int64_t time = startTime,
         nextVideoTime = get_frame_time( &videoRate, nextVideoFrame ),
         nextAudioTime = get_frame_time( &audioRate, nextAudioSample );
 
-    while( time <= endTime ) {
-        AVPacket packet;
-        av_init_packet( &packet );
+    // Start up the video pipeline
+    export_pipeline pipe = {
+        .source = videoSource,
+        .subsample = {
+            .chroma = VIDEO_CHROMA_411,
+            .bit_depth = 8,
+            .interlaced = true,
+            .size = frameSize,
+            .offset = dataWindow.min,
+        },
+        .window = dataWindow,
+        .size = frameSize,
+        .first_frame = nextVideoFrame,
+        .next_frame = nextVideoFrame,
+    };
+
+    GThread **renderThreads = NULL, *encodeThread = NULL;
+
+    g_mutex_init( &pipe.mutex );
+    g_cond_init( &pipe.cond );
+    g_queue_init( &pipe.packets );
 
-        if( time == nextVideoTime ) {
-            //printf( "video #%d\n", nextVideoFrame );
-            packet.stream_index = video->index;
+    if( videoSource ) {
+        pipe.codec = video->codec;
 
-            inputFrame.current_window = inputFrame.full_window;
-            video_get_frame_f16( videoSource, nextVideoFrame, &inputFrame );
+        // Find the last frame that starts by endTime
+        pipe.last_frame = nextVideoFrame - 1;
 
-            // Transcode to RGBA
-            for( int y = 0; y < frameSize.y; y++ ) {
-                rgba_u8 *targetData = (rgba_u8*) &interFrame.data[0][y * interFrame.linesize[0]];
-                rgba_f16 *sourceData = video_get_pixel_f16( &inputFrame, inputFrame.full_window.min.x, inputFrame.full_window.min.y + y );
+        while( get_frame_time( &videoRate, pipe.last_frame + 1 ) <= endTime )
+            pipe.last_frame++;
 
-                for( int x = 0; x < frameSize.x; x++ ) {
-                    targetData[x].r = ramp[sourceData[x].r];
-                    targetData[x].g = ramp[sourceData[x].g];
-                    targetData[x].b = ramp[sourceData[x].b];
-                    targetData[x].a = ramp[sourceData[x].a];
-                }
+        pipe.slot_count = threads * SLOTS_PER_THREAD;
+        pipe.slots = g_new0( export_slot, pipe.slot_count );
 
-//                printf( "RGBA: %d, %d, %d, %d", (int) targetData[0].r,
-//                    (int) targetData[0].g, (int) targetData[0].b, (int) targetData[0].a );
-            }
+        int outputBufferSize = avpicture_get_size(
+            video->codec->pix_fmt, frameSize.x, frameSize.y );
 
-            // Use swscale to make it YUV 4:1:1
-#if LIBSWSCALE_VERSION_INT < AV_VERSION_INT(0, 9, 0)
-            sws_scale( scaler, interFrame.data, interFrame.linesize,
-                0, frameSize.y, outputFrame.data, outputFrame.linesize );
-#else
-            sws_scale( scaler, (const uint8_t * const*) interFrame.data, interFrame.linesize,
-                0, frameSize.y, outputFrame.data, outputFrame.linesize );
-#endif
+        for( int i = 0; i < pipe.slot_count; i++ ) {
+            pipe.slots[i].buffer = g_malloc( outputBufferSize );
 
-            // Write to file
-            outputFrame.interlaced_frame = 1;
-            outputFrame.top_field_first = 0;
-            outputFrame.pts = nextVideoFrame - startVideoFrame;
+            avcodec_get_frame_defaults( &pipe.slots[i].picture );
+            avpicture_fill( (AVPicture *) &pipe.slots[i].picture, pipe.slots[i].buffer,
+                video->codec->pix_fmt, frameSize.x, frameSize.y );
+        }
 
-            result = avcodec_encode_video( video->codec,
-                bitBucket, bitBucketSize, &outputFrame );
+        renderThreads = g_new0( GThread*, threads );
 
-            if( result < 0 ) {
-                PyErr_SetString( PyExc_Exception, "Video encoding failed." );
-                return NULL;
-            }
+        for( int i = 0; i < threads; i++ )
+            renderThreads[i] = g_thread_new( "writeVideo render thread", (GThreadFunc) render_thread, &pipe );
 
-            if( result > 0 ) {
-                packet.data = bitBucket;
-                packet.size = result;
+        encodeThread = g_thread_new( "writeVideo encode thread", (GThreadFunc) encode_thread, &pipe );
+    }
 
-                if( video->codec->coded_frame->pts != AV_NOPTS_VALUE ) {
-                    packet.pts = av_rescale_q( video->codec->coded_frame->pts,
-                        video->codec->time_base, video->time_base );
-                }
+    const char *error = NULL;
 
-                if( video->codec->coded_frame->key_frame )
-                    packet.flags |= AV_PKT_FLAG_KEY;
+    // Render threads may need the GIL to reach Python sources
+    Py_BEGIN_ALLOW_THREADS
 
-                if( av_interleaved_write_frame( context, &packet ) < 0 ) {
-                    PyErr_SetString( PyExc_Exception, "Failed to write frame." );
-                    return NULL;
-                }
+    while( time <= endTime ) {
+        AVPacket packet;
+        av_init_packet( &packet );
+
+        if( time == nextVideoTime && videoSource ) {
+            export_packet *item = pop_video_packet( &pipe );
+
+            if( !item ) {
+                error = pipe.error;
+                break;
             }
 
+            error = write_video_packet( &pipe, context, video, item );
+            export_packet_free( item );
+
+            if( error )
+                break;
+
             nextVideoFrame++;
             nextVideoTime = get_frame_time( &videoRate, nextVideoFrame );
         }
@@ -421,8 +601,8 @@ py_writeVideo( PyObject *self, PyObject *args, PyObject *kw ) {
                 bitBucket, bufSize, outSampleBuf );
 
             if( result < 0 ) {
-                PyErr_SetString( PyExc_Exception, "Video encoding failed." );
-                return NULL;
+                error = "Audio encoding failed.";
+                break;
             }
 
             if( result > 0 ) {
@@ -442,8 +622,8 @@ py_writeVideo( PyObject *self, PyObject *args, PyObject *kw ) {
                     packet.flags |= AV_PKT_FLAG_KEY;
 
                 if( av_interleaved_write_frame( context, &packet ) < 0 ) {
-                    PyErr_SetString( PyExc_Exception, "Failed to write frame." );
-                    return NULL;
+                    error = "Failed to write frame.";
+                    break;
                 }
             }
 
@@ -462,35 +642,51 @@ py_writeVideo( PyObject *self, PyObject *args, PyObject *kw ) {
     }
 
     // Flush video
-    if( videoSource ) {
-        result = avcodec_encode_video( video->codec, bitBucket, bitBucketSize, NULL );
+    if( videoSource && !error ) {
+        export_packet *item = pop_video_packet( &pipe );
 
-        if( result < 0 ) {
-            PyErr_SetString( PyExc_Exception, "Video encoding failed." );
-            return NULL;
+        if( item ) {
+            error = write_video_packet( &pipe, context, video, item );
+            export_packet_free( item );
+        }
+        else {
+            error = pipe.error;
         }
+    }
 
-        if( result > 0 ) {
-            AVPacket packet;
-            av_init_packet( &packet );
-            packet.data = bitBucket;
-            packet.size = result;
-
-            if( video->codec->coded_frame->pts != AV_NOPTS_VALUE ) {
-                packet.pts = av_rescale_q( video->codec->coded_frame->pts,
-                    video->codec->time_base, video->time_base );
-            }
+    // Stop the pipeline; on success, the threads have already run out of work
+    if( videoSource ) {
+        g_mutex_lock( &pipe.mutex );
+        pipe.cancel = true;
+        g_cond_broadcast( &pipe.cond );
+        g_mutex_unlock( &pipe.mutex );
 
-            if( video->codec->coded_frame->key_frame )
-                packet.flags |= AV_PKT_FLAG_KEY;
+        for( int i = 0; i < threads; i++ )
+            g_thread_join( renderThreads[i] );
 
-            if( av_interleaved_write_frame( context, &packet ) < 0 ) {
-                PyErr_SetString( PyExc_Exception, "Failed to write frame." );
-                return NULL;
-            }
-        }
+        g_thread_join( encodeThread );
+    }
+
+    Py_END_ALLOW_THREADS
+
+    g_free( renderThreads );
+    g_queue_foreach( &pipe.packets, (GFunc) export_packet_free, NULL );
+    g_queue_clear( &pipe.packets );
+    g_mutex_clear( &pipe.mutex );
+    g_cond_clear( &pipe.cond );
+
+    for( int i = 0; i < pipe.slot_count; i++ )
+        g_free( pipe.slots[i].buffer );
+
+    g_free( pipe.slots );
+
+    if( error ) {
+        PyErr_SetString( PyExc_Exception, error );
+        return NULL;
     }
 
+    int frameCount = videoSource ? pipe.last_frame - pipe.first_frame + 1 : 0;
+
     // Close format
     av_write_trailer( context );
 
@@ -501,13 +697,8 @@ py_writeVideo( PyObject *self, PyObject *args, PyObject *kw ) {
     py_video_take_source( NULL, &videoSource );
     py_audio_take_source( NULL, &audioSource );
 
-    if( videoSource ) {
+    if( video ) {
         avcodec_close( video->codec );
-        g_slice_free1( RAMP_SIZE, ramp );
-        g_slice_free1( frameSize.x * frameSize.y * sizeof(rgba_f16), inputFrame.data );
-        g_slice_free1( interBufferSize, interBuffer );
-        g_slice_free1( outputBufferSize, outputBuffer );
-        sws_freeContext( scaler );
         av_free( video );
     }
 
@@ -520,6 +711,14 @@ py_writeVideo( PyObject *self, PyObject *args, PyObject *kw ) {
 
     av_free( context );
 
-    Py_RETURN_NONE;
+    const double nanoseconds = 1.0e9;
+
+    return Py_BuildValue( "{sisisdsdsdsd}",
+        "frames", frameCount,
+        "threads", threads,
+        "render_time", pipe.render_time / nanoseconds,
+        "convert_time", pipe.convert_time / nanoseconds,
+        "encode_time", pipe.encode_time / nanoseconds,
+        "mux_time", pipe.mux_time / nanoseconds );
 }
 
@@ -24,6 +24,9 @@
 #undef G_LOG_DOMAIN
 #define G_LOG_DOMAIN "fluggo.media.libdv.DVAudioDecoder"
 
+#define DEFAULT_CACHE_SIZE      (INT64_C(32) * 1024 * 1024)
+#define CACHE_BLOCK_SIZE        4096
+
 typedef struct {
     // Timestamp on input packet, which will be in video frames
     int64_t timestamp;
@@ -58,6 +61,9 @@ typedef struct {
     int64_t current_pts;
     bool current_pts_valid;
 
+    // Decoded samples in all four channels
+    audio_block_cache *cache;
+
     GMutex mutex;
 } py_obj_DVAudioDecoder;
 
@@ -70,13 +76,20 @@ DVAudioDecoder_init( py_obj_DVAudioDecoder *self, PyObject *args, PyObject *kw )
     self->max_sample_seen = INT32_MIN;
     self->current_pts_valid = false;
     self->input_frame = (audio_frame) { NULL };
+    self->cache = NULL;
 
     PyObject *source_obj;
+    long long cache_size = DEFAULT_CACHE_SIZE;
+
+    static char *kwlist[] = { "source", "cache_size", NULL };
 
-    static char *kwlist[] = { "source", NULL };
+    if( !PyArg_ParseTupleAndKeywords( args, kw, "O|L", kwlist, &source_obj, &cache_size ) )
+        return -1;
 
-    if( !PyArg_ParseTupleAndKeywords( args, kw, "O", kwlist, &source_obj ) )
+    if( cache_size < 0 ) {
+        PyErr_SetString( PyExc_ValueError, "cache_size must not be negative." );
         return -1;
+    }
 
     if( !py_codec_packet_take_source( source_obj, &self->source ) )
         return -1;
@@ -91,6 +104,7 @@ DVAudioDecoder_init( py_obj_DVAudioDecoder *self, PyObject *args, PyObject *kw )
     // This is like trust_timestamps = false in the libav decoder,
     // except that timestamps on DV audio are near useless anyways
     self->timestamp_to_sample = g_sequence_new( (GDestroyNotify) destroy_tts );
+    self->cache = audio_block_cache_new( 4, CACHE_BLOCK_SIZE, cache_size );
 
     return 0;
 }
@@ -110,6 +124,9 @@ DVAudioDecoder_dealloc( py_obj_DVAudioDecoder *self ) {
         self->timestamp_to_sample = NULL;
     }
 
+    audio_block_cache_free( self->cache );
+    self->cache = NULL;
+
     py_codec_packet_take_source( NULL, &self->source );
     g_mutex_clear( &self->mutex );
 
@@ -148,6 +165,12 @@ DVAudioDecoder_get_frame( py_obj_DVAudioDecoder *self, audio_frame *frame ) {
     frame->current_max_sample = -1;
     frame->current_min_sample = 0;
 
+    // Anything we've decoded before comes straight from the cache
+    if( audio_block_cache_get( self->cache, frame ) ) {
+        g_mutex_unlock( &self->mutex );
+        return;
+    }
+
     // Seek to the spot if we need to (and if we can)
     if( self->source.source.funcs->seek ) {
         do_seek = true;
@@ -222,7 +245,9 @@ DVAudioDecoder_get_frame( py_obj_DVAudioDecoder *self, audio_frame *frame ) {
                 return;
             }
 
+            // Anything cached at a provisional start may be wrong after this
             self->current_pts_valid = false;
+            audio_block_cache_clear( self->cache );
         }
     }
 
@@ -310,6 +335,7 @@ DVAudioDecoder_get_frame( py_obj_DVAudioDecoder *self, audio_frame *frame ) {
         if( !dv_decode_full_audio( self->decoder, (uint8_t *) packet->data, bufptrs ) ) {
             g_warning( "Could not decode the audio at frame %"PRId64, packet->pts );
             self->current_pts_valid = false;
+            audio_block_cache_clear( self->cache );
 
             int64_t target_sample = dv_system_50_fields( self->decoder ) ?
                 (packet->pts * dv_get_frequency( self->decoder ) / 25) :
@@ -364,6 +390,8 @@ DVAudioDecoder_get_frame( py_obj_DVAudioDecoder *self, audio_frame *frame ) {
                 // We will use the PTS from the packet;
                 // the idea is that this will only really stick for the first
                 // packet, since on the next pass, we will override it.
+                // Blocks cached against the old timing can't be trusted now.
+                audio_block_cache_clear( self->cache );
 
                 // We do have to try to turn it into a sample number, though
                 // We assume that the frequency does not change throughout the file;
@@ -418,6 +446,8 @@ DVAudioDecoder_get_frame( py_obj_DVAudioDecoder *self, audio_frame *frame ) {
             }
         }
 
+        audio_block_cache_put( self->cache, packet_start, packet_duration, self->out_audio_buffers );
+
         self->current_pts = packet_start + packet_duration;
         self->current_pts_valid = true;
         self->max_sample_seen = max(self->max_sample_seen, packet_start + packet_duration - 1);
@@ -455,8 +485,59 @@ DVAudioDecoder_getFuncs( py_obj_DVAudioDecoder *self, void *closure ) {
     return pySourceFuncs;
 }
 
+static PyObject *
+DVAudioDecoder_get_cache_size( py_obj_DVAudioDecoder *self, void *closure ) {
+    g_mutex_lock( &self->mutex );
+    int64_t result = audio_block_cache_get_max_size( self->cache );
+    g_mutex_unlock( &self->mutex );
+
+    return PyLong_FromLongLong( result );
+}
+
+static int
+DVAudioDecoder_set_cache_size( py_obj_DVAudioDecoder *self, PyObject *value, void *closure ) {
+    if( value == NULL ) {
+        PyErr_SetString( PyExc_TypeError, "Cannot delete the cache_size attribute." );
+        return -1;
+    }
+
+    long long cache_size = PyLong_AsLongLong( value );
+
+    if( cache_size == -1 && PyErr_Occurred() )
+        return -1;
+
+    if( cache_size < 0 ) {
+        PyErr_SetString( PyExc_ValueError, "cache_size must not be negative." );
+        return -1;
+    }
+
+    g_mutex_lock( &self->mutex );
+    audio_block_cache_set_max_size( self->cache, cache_size );
+    g_mutex_unlock( &self->mutex );
+
+    return 0;
+}
+
+static PyObject *
+DVAudioDecoder_get_cache_stats( py_obj_DVAudioDecoder *self, void *closure ) {
+    audio_block_cache_stats stats;
+
+    g_mutex_lock( &self->mutex );
+    audio_block_cache_get_stats( self->cache, &stats );
+    g_mutex_unlock( &self->mutex );
+
+    return Py_BuildValue( "{sLsLsL}",
+        "hits", (long long) stats.hits,
+        "misses", (long long) stats.misses,
+        "used", (long long) stats.used );
+}
+
 static PyGetSetDef DVAudioDecoder_getsetters[] = {
     { AUDIO_FRAME_SOURCE_FUNCS, (getter) DVAudioDecoder_getFuncs, NULL, "Audio frame source C API." },
+    { "cache_size", (getter) DVAudioDecoder_get_cache_size, (setter) DVAudioDecoder_set_cache_size,
+        "Most memory, in bytes, to spend on decoded samples. Zero turns off the cache." },
+    { "cache_stats", (getter) DVAudioDecoder_get_cache_stats, NULL,
+        "Dictionary of cache hits, misses, and bytes used." },
     { NULL }
 };
 
@@ -464,6 +545,12 @@ static PyMethodDef DVAudioDecoder_methods[] = {
     { NULL }
 };
 
+/*
+    DVAudioDecoder(source, cache_size=32MB)
+
+    Decodes the audio in DV frames with libdv. Decoded samples are kept in a
+    cache of up to cache_size bytes, as in AVAudioDecoder.
+*/
 static PyTypeObject py_type_DVAudioDecoder = {
     PyVarObject_HEAD_INIT(NULL, 0)
     .tp_name = "fluggo.media.libdv.DVAudioDecoder",
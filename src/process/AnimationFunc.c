@@ -18,18 +18,38 @@
     along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <string.h>
 #include "pyframework.h"
 
 #define POINT_HOLD      0
 #define POINT_LINEAR    1
 #define POINT_MAX       1
 
+/*
+    Segments are the points compiled down for evaluation: from each segment's
+    frame until the next one's, the value is values + slope * (frame - segment frame).
+    Holds and the last point have zero slope.
+*/
+typedef struct {
+    double frame;
+    double values[4], slope[4];
+} anim_segment;
+
+typedef struct {
+    volatile gint refs;
+    int count;
+    anim_segment segments[];
+} anim_table;
+
 typedef struct {
     PyObject_HEAD
 
+    // The points, in order; protected by lock
     GSequence *sequence;
     GRWLock lock;
-    GSequenceIter *iter;
+
+    // Compiled from sequence on every edit; take a reference under the read lock
+    anim_table *table;
 } py_obj_AnimationFunc;
 
 typedef struct {
@@ -53,6 +73,59 @@ cmpx( py_obj_AnimationPoint *a, py_obj_AnimationPoint *b, gpointer user_data ) {
     return -1;
 }
 
+static void
+anim_table_unref( anim_table *table ) {
+    if( table && g_atomic_int_dec_and_test( &table->refs ) )
+        g_free( table );
+}
+
+/*
+    Function: compile_table
+    Builds a new segment table from the points and swaps it in. Readers
+    holding the old table keep using it until they let it go.
+    Call with the write lock held; unref the returned old table after
+    releasing the lock.
+*/
+static anim_table *
+compile_table( py_obj_AnimationFunc *self ) {
+    int count = g_sequence_get_length( self->sequence );
+    anim_table *table = g_malloc( sizeof(anim_table) + sizeof(anim_segment) * count );
+
+    table->refs = 1;
+    table->count = count;
+
+    GSequenceIter *iter = g_sequence_get_begin_iter( self->sequence );
+
+    for( int i = 0; i < count; i++ ) {
+        py_obj_AnimationPoint *point = (py_obj_AnimationPoint *) g_sequence_get( iter );
+        anim_segment *segment = &table->segments[i];
+
+        iter = g_sequence_iter_next( iter );
+
+        py_obj_AnimationPoint *next = g_sequence_iter_is_end( iter ) ? NULL :
+            (py_obj_AnimationPoint *) g_sequence_get( iter );
+
+        segment->frame = point->frame;
+
+        for( int j = 0; j < 4; j++ ) {
+            segment->values[j] = point->values[j];
+            segment->slope[j] = 0.0;
+        }
+
+        if( next && point->type == POINT_LINEAR && next->frame > point->frame ) {
+            double distance = next->frame - point->frame;
+
+            for( int j = 0; j < 4; j++ )
+                segment->slope[j] = (next->values[j] - point->values[j]) / distance;
+        }
+    }
+
+    anim_table *old = self->table;
+    self->table = table;
+
+    return old;
+}
+
 static bool
 parse_value_obj( double result[4], PyObject *source ) {
     result[0] = 0.0;
@@ -141,7 +214,10 @@ AnimationPoint_set_frame( py_obj_AnimationPoint *self, PyObject *value, void *cl
     if( self->iter ) {
         g_rw_lock_writer_lock( &self->owner->lock );
         g_sequence_sort_changed( self->iter, (GCompareDataFunc) cmpx, NULL );
+        anim_table *old = compile_table( self->owner );
         g_rw_lock_writer_unlock( &self->owner->lock );
+
+        anim_table_unref( old );
     }
 
     return 0;
@@ -194,7 +270,7 @@ static int
 AnimationFunc_init( py_obj_AnimationFunc *self, PyObject *args, PyObject *kwds ) {
     self->sequence = g_sequence_new( NULL );
     g_rw_lock_init( &self->lock );
-    self->iter = g_sequence_get_begin_iter( self->sequence );
+    compile_table( self );
 
     return 0;
 }
@@ -215,6 +291,7 @@ AnimationFunc_dealloc( py_obj_AnimationFunc *self ) {
 
     g_sequence_free( self->sequence );
     g_rw_lock_clear( &self->lock );
+    anim_table_unref( self->table );
 
     Py_TYPE(self)->tp_free( (PyObject*) self );
 }
@@ -270,6 +347,7 @@ AnimationFunc_get_item( py_obj_AnimationFunc *self, Py_ssize_t i ) {
     GSequenceIter *iter = g_sequence_get_iter_at_pos( self->sequence, i );
 
     if( g_sequence_iter_is_end( iter ) ) {
+        g_rw_lock_reader_unlock( &self->lock );
         PyErr_SetString( PyExc_IndexError, "Index was out of range." );
         return NULL;
     }
@@ -313,8 +391,11 @@ AnimationFunc_add( py_obj_AnimationFunc *self, PyObject *args, PyObject *kw ) {
 
     g_rw_lock_writer_lock( &self->lock );
     item->iter = g_sequence_insert_sorted( self->sequence, item, (GCompareDataFunc) cmpx, NULL );
+    anim_table *old = compile_table( self );
     g_rw_lock_writer_unlock( &self->lock );
 
+    anim_table_unref( old );
+
     Py_INCREF(item);
     return item;
 }
@@ -331,8 +412,12 @@ AnimationFunc_remove( py_obj_AnimationFunc *self, PyObject *args ) {
 
     g_rw_lock_writer_lock( &self->lock );
     g_sequence_remove( item->iter );
+    item->iter = NULL;
+    anim_table *old = compile_table( self );
     g_rw_lock_writer_unlock( &self->lock );
 
+    anim_table_unref( old );
+
     Py_CLEAR(item->owner);
     Py_CLEAR(item);
 
@@ -362,100 +447,66 @@ EXPORT PyTypeObject py_type_AnimationFunc = {
     .tp_as_sequence = &AnimationFunc_sequence,
 };
 
-static void
-get_points( py_obj_AnimationFunc *self, double frame, py_obj_AnimationPoint **left, py_obj_AnimationPoint **right ) {
-    // Put ourselves in a reasonable position to search
-    if( g_sequence_iter_is_end( self->iter ) ) {
-        if( g_sequence_iter_is_begin( self->iter ) ) {
-            *left = NULL;
-            *right = NULL;
-            return;
-        }
-
-        self->iter = g_sequence_iter_prev( self->iter );
-    }
-
-    for( ;; ) {
-        *left = (py_obj_AnimationPoint *) g_sequence_get( self->iter );
+/*
+    Function: find_segment
+    Finds the last segment starting at or before the given frame, or -1 if
+    the frame comes before all of them. Starts by looking at the given guess
+    and the one after it, since frames usually come in order.
+*/
+static int
+find_segment( const anim_table *table, double frame, int guess ) {
+    const anim_segment *segments = table->segments;
 
-        if( frame < (*left)->frame ) {
-            // Move backwards
-            if( g_sequence_iter_is_begin( self->iter ) ) {
-                *right = *left;
-                *left = NULL;
-                return;
-            }
+    if( guess >= 0 && guess < table->count && segments[guess].frame <= frame ) {
+        if( guess + 1 == table->count || frame < segments[guess + 1].frame )
+            return guess;
 
-            self->iter = g_sequence_iter_prev( self->iter );
-            continue;
-        }
+        if( guess + 2 == table->count || frame < segments[guess + 2].frame )
+            return guess + 1;
+    }
 
-        GSequenceIter *next = g_sequence_iter_next( self->iter );
+    int low = 0, high = table->count;
 
-        if( g_sequence_iter_is_end( next ) ) {
-            *right = NULL;
-            return;
-        }
-        else {
-            *right = g_sequence_get( next );
+    // Find the first segment after the frame
+    while( low < high ) {
+        int mid = low + (high - low) / 2;
 
-            if( frame >= (*right)->frame ) {
-                self->iter = next;
-                continue;
-            }
-
-            return;
-        }
+        if( segments[mid].frame <= frame )
+            low = mid + 1;
+        else
+            high = mid;
     }
+
+    return low - 1;
 }
 
 static void
-AnimationFunc_get_values( py_obj_AnimationFunc *self, int count, double *frames, double (*result)[4] ) {
+AnimationFunc_get_values( py_obj_AnimationFunc *self, ssize_t count, double *frames, double (*result)[4] ) {
     g_rw_lock_reader_lock( &self->lock );
+    anim_table *table = self->table;
+    g_atomic_int_inc( &table->refs );
+    g_rw_lock_reader_unlock( &self->lock );
 
-    for( int i = 0; i < count; i++ ) {
-        py_obj_AnimationPoint *left, *right;
+    if( table->count == 0 ) {
+        memset( result, 0, sizeof(double) * 4 * count );
+        anim_table_unref( table );
+        return;
+    }
 
-        get_points( self, frames[i], &left, &right );
+    int index = 0;
 
-        if( !left ) {
-            if( !right ) {
-                result[i][0] = 0.0;
-                result[i][1] = 0.0;
-                result[i][2] = 0.0;
-                result[i][3] = 0.0;
-                continue;
-            }
+    for( ssize_t i = 0; i < count; i++ ) {
+        index = find_segment( table, frames[i], index );
 
-            // Take the right-hand values
-            for( int j = 0; j < 4; j++ )
-                result[i][j] = right->values[j];
-        }
-        else if( !right || left->type == POINT_HOLD ) {
-            // Take the left-hand values
-            for( int j = 0; j < 4; j++ )
-                result[i][j] = left->values[j];
-        }
-        else if( left->type == POINT_LINEAR ) {
-            // Lerp from left to right
-            double distance = right->frame - left->frame;
-
-            for( int j = 0; j < 4; j++ ) {
-                result[i][j] = (right->values[j] * (frames[i] - left->frame) +
-                    left->values[j] * (right->frame - frames[i])) / distance;
-            }
+        // Before the first point, take its values
+        const anim_segment *segment = &table->segments[index < 0 ? 0 : index];
+        const double offset = index < 0 ? 0.0 : frames[i] - segment->frame;
 
-            continue;
-        }
-        else {
-            result[i][0] = 0.0;
-            result[i][1] = 0.0;
-            result[i][2] = 0.0;
-            result[i][3] = 0.0;
-        }
+        for( int j = 0; j < 4; j++ )
+            result[i][j] = segment->values[j] + segment->slope[j] * offset;
     }
 
-    g_rw_lock_reader_unlock( &self->lock );
+    anim_table_unref( table );
 }
 
 static FrameFunctionFuncs AnimationFunc_sourceFuncs = {
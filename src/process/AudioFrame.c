@@ -22,19 +22,100 @@
 
 static PyObject *pysource_funcs;
 
+typedef struct {
+    audio_frame frame;
+
+    // The buffer this frame wraps, if it doesn't own its data
+    Py_buffer wrapped;
+} frame_priv;
+
 #define PRIV(obj)        ((audio_frame*)(((void *) obj) + py_type_AudioSource.tp_basicsize))
+#define WRAPPED(obj)     (&((frame_priv*)(((void *) obj) + py_type_AudioSource.tp_basicsize))->wrapped)
 
 static void
 AudioFrame_get_frame( PyObject *self, audio_frame *frame ) {
     audio_copy_frame( frame, PRIV(self), 0 );
 }
 
+static int
+AudioFrame_init( PyObject *self, PyObject *args, PyObject *kw ) {
+    PyObject *buffer_obj;
+    int full_min_sample, full_max_sample, channels;
+    int current_min_sample = INT_MIN, current_max_sample = INT_MIN;
+
+    static char *kwlist[] = { "buffer", "full_min_sample", "full_max_sample", "channels",
+        "current_min_sample", "current_max_sample", NULL };
+
+    if( !PyArg_ParseTupleAndKeywords( args, kw, "Oiii|ii", kwlist,
+            &buffer_obj, &full_min_sample, &full_max_sample, &channels,
+            &current_min_sample, &current_max_sample ) )
+        return -1;
+
+    if( PRIV(self)->data ) {
+        PyErr_SetString( PyExc_Exception, "The frame already has its data." );
+        return -1;
+    }
+
+    if( full_max_sample < full_min_sample ) {
+        PyErr_SetString( PyExc_ValueError, "full_max_sample was less than full_min_sample." );
+        return -1;
+    }
+
+    if( channels < 1 ) {
+        PyErr_SetString( PyExc_ValueError, "channels must be at least one." );
+        return -1;
+    }
+
+    if( current_min_sample == INT_MIN )
+        current_min_sample = full_min_sample;
+
+    if( current_max_sample == INT_MIN )
+        current_max_sample = full_max_sample;
+
+    if( current_min_sample <= current_max_sample &&
+            (current_min_sample < full_min_sample || current_max_sample > full_max_sample) ) {
+        PyErr_SetString( PyExc_ValueError, "The current samples must be inside the full samples." );
+        return -1;
+    }
+
+    if( !py_wrap_buffer( buffer_obj, WRAPPED(self),
+            sizeof(float) * ((Py_ssize_t) full_max_sample - full_min_sample + 1) * channels, sizeof(float) ) )
+        return -1;
+
+    PRIV(self)->data = WRAPPED(self)->buf;
+    PRIV(self)->channels = channels;
+    PRIV(self)->full_min_sample = full_min_sample;
+    PRIV(self)->full_max_sample = full_max_sample;
+    PRIV(self)->current_min_sample = current_min_sample;
+    PRIV(self)->current_max_sample = current_max_sample;
+
+    return 0;
+}
+
 static void
 AudioFrame_dealloc( PyObject *self ) {
-    PyMem_Free( PRIV(self)->data );
+    if( WRAPPED(self)->obj )
+        PyBuffer_Release( WRAPPED(self) );
+    else
+        PyMem_Free( PRIV(self)->data );
+
     self->ob_type->tp_free( self );
 }
 
+static int
+AudioFrame_get_buffer( PyObject *self, Py_buffer *view, int flags ) {
+    const Py_ssize_t shape[2] = {
+        PRIV(self)->full_max_sample - PRIV(self)->full_min_sample + 1, PRIV(self)->channels };
+
+    return py_get_array_buffer( self, view, flags, PRIV(self)->data,
+        WRAPPED(self)->obj && WRAPPED(self)->readonly, "f", sizeof(float), 2, shape );
+}
+
+static PyBufferProcs AudioFrame_buffer = {
+    .bf_getbuffer = (getbufferproc) AudioFrame_get_buffer,
+    .bf_releasebuffer = (releasebufferproc) py_release_array_buffer,
+};
+
 static AudioFrameSourceFuncs source_funcs = {
     .getFrame = (audio_getFrameFunc) AudioFrame_get_frame,
 };
@@ -125,16 +206,28 @@ static PyMethodDef AudioFrame_methods[] = {
     { NULL }
 };
 
+/*
+    AudioFrame(buffer, full_min_sample, full_max_sample, channels,
+        current_min_sample=full_min_sample, current_max_sample=full_max_sample)
+
+    A frame of float samples, interleaved by channel. Made from Python, it wraps
+    buffer in place, without copying; buffer has to hold every channel of every
+    sample from full_min_sample to full_max_sample, and the frame is only writable
+    if buffer is. Every frame exports its samples with the buffer protocol as an
+    array of shape (samples, channels) covering the full samples.
+*/
 static PyTypeObject py_type_AudioFrame = {
     PyVarObject_HEAD_INIT(NULL, 0)
     .tp_name = "fluggo.media.process.AudioFrame",    // tp_name
     .tp_flags = Py_TPFLAGS_DEFAULT,
     .tp_new = PyType_GenericNew,
     .tp_base = &py_type_AudioSource,
+    .tp_init = (initproc) AudioFrame_init,
     .tp_dealloc = (destructor) AudioFrame_dealloc,
     .tp_getset = AudioFrame_getsetters,
     .tp_methods = AudioFrame_methods,
-    .tp_as_sequence = &AudioFrame_sequence
+    .tp_as_sequence = &AudioFrame_sequence,
+    .tp_as_buffer = &AudioFrame_buffer,
 };
 
 /*
@@ -193,7 +286,7 @@ py_AudioFrame_new( int min_sample, int max_sample, int channels, audio_frame **f
 }
 
 void init_AudioFrame( PyObject *module ) {
-    py_type_AudioFrame.tp_basicsize = py_type_AudioSource.tp_basicsize + sizeof(audio_frame);
+    py_type_AudioFrame.tp_basicsize = py_type_AudioSource.tp_basicsize + sizeof(frame_priv);
 
     if( PyType_Ready( &py_type_AudioFrame ) < 0 )
         return;
@@ -0,0 +1,317 @@
+/*
+    This file is part of the Fluggo Media Library for high-quality
+    video and audio processing.
+
+    Copyright 2012 Brian J. Crowell <brian@fluggo.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <math.h>
+#include "pyframework.h"
+
+typedef struct {
+    PyObject_HEAD
+
+    AudioSourceHolder source;
+    audio_peak_index *index;
+    gchar *cache_path, *key;
+
+    GThread *thread;
+    GMutex mutex;
+    GCond cond;
+    bool done;
+    volatile gint cancel;
+} py_obj_AudioPeakIndex;
+
+static gpointer
+_build_thread( py_obj_AudioPeakIndex *self ) {
+    if( audio_peak_index_build( self->index, &self->source.source, &self->cancel ) && self->cache_path )
+        audio_peak_index_save( self->index, self->cache_path, self->key );
+
+    g_mutex_lock( &self->mutex );
+    self->done = true;
+    g_cond_broadcast( &self->cond );
+    g_mutex_unlock( &self->mutex );
+
+    return NULL;
+}
+
+static int
+AudioPeakIndex_init( py_obj_AudioPeakIndex *self, PyObject *args, PyObject *kw ) {
+    PyObject *source;
+    int min_sample, max_sample, channels = 2;
+    const char *cache_path = NULL, *key = NULL;
+
+    static char *kwlist[] = { "source", "min_sample", "max_sample", "channels", "cache_path", "key", NULL };
+
+    if( !PyArg_ParseTupleAndKeywords( args, kw, "Oii|izz", kwlist,
+            &source, &min_sample, &max_sample, &channels, &cache_path, &key ) )
+        return -1;
+
+    if( channels < 1 ) {
+        PyErr_SetString( PyExc_ValueError, "channels must be at least one." );
+        return -1;
+    }
+
+    if( max_sample < min_sample ) {
+        PyErr_SetString( PyExc_ValueError, "max_sample must not be less than min_sample." );
+        return -1;
+    }
+
+    if( (cache_path == NULL) != (key == NULL) ) {
+        PyErr_SetString( PyExc_ValueError, "cache_path and key must be given together." );
+        return -1;
+    }
+
+    if( !py_audio_take_source( source, &self->source ) )
+        return -1;
+
+    g_mutex_init( &self->mutex );
+    g_cond_init( &self->cond );
+
+    if( cache_path ) {
+        self->cache_path = g_strdup( cache_path );
+        self->key = g_strdup( key );
+
+        // If the sidecar matches, there's nothing to read
+        self->index = audio_peak_index_load( cache_path, key, channels, min_sample, max_sample );
+
+        if( self->index ) {
+            self->done = true;
+            return 0;
+        }
+    }
+
+    self->index = audio_peak_index_new( channels, min_sample, max_sample );
+    self->thread = g_thread_new( "AudioPeakIndex build thread", (GThreadFunc) _build_thread, self );
+
+    return 0;
+}
+
+static void
+AudioPeakIndex_dealloc( py_obj_AudioPeakIndex *self ) {
+    if( self->thread ) {
+        g_atomic_int_set( &self->cancel, 1 );
+
+        // The source might need the GIL to finish its current read
+        Py_BEGIN_ALLOW_THREADS
+        g_thread_join( self->thread );
+        Py_END_ALLOW_THREADS
+
+        self->thread = NULL;
+    }
+
+    py_audio_take_source( NULL, &self->source );
+
+    audio_peak_index_free( self->index );
+    self->index = NULL;
+
+    g_free( self->cache_path );
+    g_free( self->key );
+    self->cache_path = NULL;
+    self->key = NULL;
+
+    g_mutex_clear( &self->mutex );
+    g_cond_clear( &self->cond );
+
+    Py_TYPE(self)->tp_free( (PyObject*) self );
+}
+
+static PyObject *
+AudioPeakIndex_query( py_obj_AudioPeakIndex *self, PyObject *args, PyObject *kw ) {
+    int min_sample, max_sample, pixels;
+    PyObject *channel_obj = Py_None;
+
+    static char *kwlist[] = { "min_sample", "max_sample", "pixels", "channel", NULL };
+
+    if( !PyArg_ParseTupleAndKeywords( args, kw, "iii|O", kwlist,
+            &min_sample, &max_sample, &pixels, &channel_obj ) )
+        return NULL;
+
+    const int channels = audio_peak_index_get_channels( self->index );
+    int channel = -1;
+
+    if( channel_obj != Py_None ) {
+        channel = (int) PyLong_AsLong( channel_obj );
+
+        if( channel == -1 && PyErr_Occurred() )
+            return NULL;
+
+        if( channel < 0 || channel >= channels ) {
+            PyErr_Format( PyExc_ValueError, "channel must be between 0 and %d.", channels - 1 );
+            return NULL;
+        }
+    }
+
+    if( pixels < 0 ) {
+        PyErr_SetString( PyExc_ValueError, "pixels must not be negative." );
+        return NULL;
+    }
+
+    audio_peak *peaks = g_new( audio_peak, pixels * channels );
+    audio_peak_index_query( self->index, min_sample, max_sample, pixels, peaks );
+
+    PyObject *result = PyList_New( pixels );
+
+    if( !result ) {
+        g_free( peaks );
+        return NULL;
+    }
+
+    for( int pixel = 0; pixel < pixels; pixel++ ) {
+        audio_peak peak;
+
+        if( channel != -1 ) {
+            peak = peaks[pixel * channels + channel];
+        }
+        else {
+            // Fold all the channels together
+            float sum_squares = 0.0f;
+
+            peak.min = 0.0f;
+            peak.max = 0.0f;
+
+            for( int ch = 0; ch < channels; ch++ ) {
+                const audio_peak *src = &peaks[pixel * channels + ch];
+
+                peak.min = (ch == 0) ? src->min : minf( peak.min, src->min );
+                peak.max = (ch == 0) ? src->max : maxf( peak.max, src->max );
+                sum_squares += src->rms * src->rms;
+            }
+
+            peak.rms = sqrtf( sum_squares / channels );
+        }
+
+        PyObject *tuple = Py_BuildValue( "(fff)", peak.min, peak.max, peak.rms );
+
+        if( !tuple ) {
+            Py_DECREF(result);
+            g_free( peaks );
+            return NULL;
+        }
+
+        PyList_SET_ITEM( result, pixel, tuple );
+    }
+
+    g_free( peaks );
+    return result;
+}
+
+static PyObject *
+AudioPeakIndex_wait( py_obj_AudioPeakIndex *self, PyObject *args, PyObject *kw ) {
+    PyObject *timeout_obj = Py_None;
+
+    static char *kwlist[] = { "timeout", NULL };
+
+    if( !PyArg_ParseTupleAndKeywords( args, kw, "|O", kwlist, &timeout_obj ) )
+        return NULL;
+
+    double timeout = -1.0;
+
+    if( timeout_obj != Py_None ) {
+        timeout = PyFloat_AsDouble( timeout_obj );
+
+        if( timeout == -1.0 && PyErr_Occurred() )
+            return NULL;
+    }
+
+    bool done;
+
+    Py_BEGIN_ALLOW_THREADS
+    gint64 end_time = g_get_monotonic_time() + (gint64)(timeout * G_TIME_SPAN_SECOND);
+
+    g_mutex_lock( &self->mutex );
+
+    while( !self->done ) {
+        if( timeout < 0.0 )
+            g_cond_wait( &self->cond, &self->mutex );
+        else if( !g_cond_wait_until( &self->cond, &self->mutex, end_time ) )
+            break;
+    }
+
+    done = self->done;
+    g_mutex_unlock( &self->mutex );
+    Py_END_ALLOW_THREADS
+
+    return PyBool_FromLong( done );
+}
+
+static PyObject *
+AudioPeakIndex_get_progress( py_obj_AudioPeakIndex *self, void *closure ) {
+    return PyFloat_FromDouble( audio_peak_index_get_progress( self->index ) );
+}
+
+static PyObject *
+AudioPeakIndex_get_complete( py_obj_AudioPeakIndex *self, void *closure ) {
+    return PyBool_FromLong( audio_peak_index_is_complete( self->index ) );
+}
+
+static PyObject *
+AudioPeakIndex_get_channels( py_obj_AudioPeakIndex *self, void *closure ) {
+    return PyLong_FromLong( audio_peak_index_get_channels( self->index ) );
+}
+
+static PyGetSetDef AudioPeakIndex_getsetters[] = {
+    { "progress", (getter) AudioPeakIndex_get_progress, NULL,
+        "Fraction of the source read so far, from 0.0 to 1.0." },
+    { "complete", (getter) AudioPeakIndex_get_complete, NULL,
+        "True once the whole source has been indexed." },
+    { "channels", (getter) AudioPeakIndex_get_channels, NULL,
+        "Number of channels in the index." },
+    { NULL }
+};
+
+static PyMethodDef AudioPeakIndex_methods[] = {
+    { "query", (PyCFunction) AudioPeakIndex_query, METH_VARARGS | METH_KEYWORDS,
+        "Gets peaks for drawing the samples from min_sample to max_sample across the given number of pixels.\n"
+        "\n"
+        "[(min, max, rms), ...] = index.query(min_sample, max_sample, pixels, channel=None)\n"
+        "\n"
+        "If channel is None, all channels are combined. Parts not yet indexed come back as silence." },
+    { "wait", (PyCFunction) AudioPeakIndex_wait, METH_VARARGS | METH_KEYWORDS,
+        "Waits for the index to finish building. Returns True if it's done.\n"
+        "\n"
+        "done = index.wait(timeout=None)" },
+    { NULL }
+};
+
+/*
+    AudioPeakIndex(source, min_sample, max_sample, channels=2, cache_path=None, key=None)
+
+    Waveform peaks for an audio source, built in the background. If cache_path is
+    given, the index is saved there when it's finished, and loaded from there instead
+    of reading the source if the file was saved with the same key. Choose a key that
+    changes when the source does, such as its file name, size, and modification time.
+*/
+static PyTypeObject py_type_AudioPeakIndex = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "fluggo.media.process.AudioPeakIndex",
+    .tp_basicsize = sizeof(py_obj_AudioPeakIndex),
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_new = PyType_GenericNew,
+    .tp_dealloc = (destructor) AudioPeakIndex_dealloc,
+    .tp_init = (initproc) AudioPeakIndex_init,
+    .tp_getset = AudioPeakIndex_getsetters,
+    .tp_methods = AudioPeakIndex_methods,
+};
+
+void init_AudioPeakIndex( PyObject *module ) {
+    if( PyType_Ready( &py_type_AudioPeakIndex ) < 0 )
+        return;
+
+    Py_INCREF( (PyObject*) &py_type_AudioPeakIndex );
+    PyModule_AddObject( module, "AudioPeakIndex", (PyObject *) &py_type_AudioPeakIndex );
+}
+
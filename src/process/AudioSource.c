@@ -45,7 +45,9 @@ py_audio_get_frame( PyObject *self, PyObject *args, PyObject *kw ) {
         return NULL;
     }
 
+    Py_BEGIN_ALLOW_THREADS
     audio_get_frame( &source.source, frame );
+    Py_END_ALLOW_THREADS
 
     if( !py_audio_take_source( NULL, &source ) ) {
         Py_DECREF(result);
@@ -0,0 +1,240 @@
+/*
+    This file is part of the Fluggo Media Library for high-quality
+    video and audio processing.
+
+    Copyright 2012 Brian J. Crowell <brian@fluggo.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "pyframework.h"
+
+#undef G_LOG_DOMAIN
+#define G_LOG_DOMAIN "fluggo.media.process.CodecPacketSequence"
+
+typedef struct {
+    CodecPacketSourceHolder source;
+
+    // Where to seek the source before reading, unless seek is false
+    int64_t offset, length;
+    bool seek;
+} packet_range;
+
+typedef struct {
+    PyObject_HEAD
+
+    packet_range *ranges;
+    int range_count, current_range;
+    int64_t range_position, next_frame, frame_count;
+    bool failed;
+} py_obj_CodecPacketSequence;
+
+static int
+CodecPacketSequence_init( py_obj_CodecPacketSequence *self, PyObject *args, PyObject *kw ) {
+    PyObject *ranges_obj;
+
+    static char *kwlist[] = { "ranges", NULL };
+
+    if( !PyArg_ParseTupleAndKeywords( args, kw, "O", kwlist, &ranges_obj ) )
+        return -1;
+
+    PyObject *ranges = PySequence_Fast( ranges_obj, "ranges must be a sequence." );
+
+    if( !ranges )
+        return -1;
+
+    Py_ssize_t count = PySequence_Fast_GET_SIZE( ranges );
+
+    self->ranges = g_new0( packet_range, count );
+    self->range_count = (int) count;
+
+    for( Py_ssize_t i = 0; i < count; i++ ) {
+        packet_range *range = &self->ranges[i];
+        PyObject *source_obj, *offset_obj;
+        long long length;
+
+        if( !PyArg_ParseTuple( PySequence_Fast_GET_ITEM( ranges, i ), "OOL", &source_obj, &offset_obj, &length ) ) {
+            Py_DECREF(ranges);
+            return -1;
+        }
+
+        if( length < 0 ) {
+            PyErr_SetString( PyExc_ValueError, "A range's length must not be negative." );
+            Py_DECREF(ranges);
+            return -1;
+        }
+
+        if( !py_codec_packet_take_source( source_obj, &range->source ) ) {
+            Py_DECREF(ranges);
+            return -1;
+        }
+
+        if( !range->source.source.funcs || !range->source.source.funcs->getNextPacket ) {
+            PyErr_SetString( PyExc_Exception, "One of the sources can't produce packets." );
+            Py_DECREF(ranges);
+            return -1;
+        }
+
+        if( offset_obj != Py_None ) {
+            if( !range->source.source.funcs->seek ) {
+                PyErr_SetString( PyExc_Exception, "A range with an offset needs a source that can seek." );
+                Py_DECREF(ranges);
+                return -1;
+            }
+
+            range->offset = PyLong_AsLongLong( offset_obj );
+
+            if( range->offset == -1 && PyErr_Occurred() ) {
+                Py_DECREF(ranges);
+                return -1;
+            }
+
+            range->seek = true;
+        }
+
+        range->length = length;
+        self->frame_count += length;
+    }
+
+    Py_DECREF(ranges);
+    return 0;
+}
+
+static void
+CodecPacketSequence_dealloc( py_obj_CodecPacketSequence *self ) {
+    for( int i = 0; i < self->range_count; i++ )
+        py_codec_packet_take_source( NULL, &self->ranges[i].source );
+
+    g_free( self->ranges );
+    self->ranges = NULL;
+
+    Py_TYPE(self)->tp_free( (PyObject*) self );
+}
+
+static codec_packet *
+CodecPacketSequence_get_next_packet( py_obj_CodecPacketSequence *self ) {
+    // A hole in the stream would shift every frame after it, so once
+    // a range goes wrong, the whole sequence has failed
+    if( self->failed ) {
+        py_codec_packet_set_error( PyExc_Exception, "The sequence has already failed." );
+        return NULL;
+    }
+
+    while( self->current_range < self->range_count ) {
+        packet_range *range = &self->ranges[self->current_range];
+
+        if( self->range_position == range->length ) {
+            self->current_range++;
+            self->range_position = 0;
+            continue;
+        }
+
+        if( self->range_position == 0 && range->seek &&
+                !range->source.source.funcs->seek( range->source.source.obj, range->offset ) ) {
+            py_codec_packet_set_error( PyExc_Exception, "Could not seek to frame %lld for range %d.",
+                (long long) range->offset, self->current_range );
+            self->failed = true;
+            return NULL;
+        }
+
+        codec_packet *packet = range->source.source.funcs->getNextPacket( range->source.source.obj );
+
+        if( !packet ) {
+            // If the source failed, its exception stands
+            py_codec_packet_set_error( PyExc_Exception, "Range %d ended %lld packets early.",
+                self->current_range, (long long) (range->length - self->range_position) );
+            self->failed = true;
+            return NULL;
+        }
+
+        packet->pts = self->next_frame;
+        packet->dts = self->next_frame;
+        packet->duration = 1;
+
+        self->next_frame++;
+        self->range_position++;
+
+        return packet;
+    }
+
+    return NULL;
+}
+
+static codec_packet_source_funcs source_funcs = {
+    .getNextPacket = (codec_getNextPacketFunc) CodecPacketSequence_get_next_packet,
+};
+
+static PyObject *pySourceFuncs;
+
+static PyObject *
+CodecPacketSequence_getFuncs( py_obj_CodecPacketSequence *self, void *closure ) {
+    Py_INCREF(pySourceFuncs);
+    return pySourceFuncs;
+}
+
+static PyObject *
+CodecPacketSequence_get_progress( py_obj_CodecPacketSequence *self, void *closure ) {
+    return PyLong_FromLongLong( self->next_frame );
+}
+
+static PyObject *
+CodecPacketSequence_get_progress_count( py_obj_CodecPacketSequence *self, void *closure ) {
+    return PyLong_FromLongLong( self->frame_count );
+}
+
+static PyGetSetDef CodecPacketSequence_getsetters[] = {
+    { CODEC_PACKET_SOURCE_FUNCS, (getter) CodecPacketSequence_getFuncs, NULL, "Codec packet source C API." },
+    { "progress", (getter) CodecPacketSequence_get_progress, NULL, "Frames handed out so far, from zero to progress_count." },
+    { "progress_count", (getter) CodecPacketSequence_get_progress_count, NULL, "Number of frames in all ranges. Compare to progress." },
+    { NULL }
+};
+
+/*
+    CodecPacketSequence(ranges)
+
+    Hands out the packets of several codec packet sources one after another, as
+    one stream. Each range is a tuple (source, offset, length): the source is
+    seeked to frame offset, or read from wherever it is if offset is None, and
+    length packets are taken from it.
+
+    Every packet is taken to be one whole frame, as in DV and other intra-only
+    formats, so timestamps are rewritten to count frames from zero across all
+    ranges. This is what lets untouched stretches of a source be copied
+    straight into an export next to stretches that had to be encoded again.
+
+    If a range can't be seeked, or runs out of packets before its length, the
+    sequence fails with an exception rather than leave a hole in the stream.
+*/
+static PyTypeObject py_type_CodecPacketSequence = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "fluggo.media.process.CodecPacketSequence",
+    .tp_basicsize = sizeof(py_obj_CodecPacketSequence),
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_base = &py_type_CodecPacketSource,
+    .tp_new = PyType_GenericNew,
+    .tp_dealloc = (destructor) CodecPacketSequence_dealloc,
+    .tp_init = (initproc) CodecPacketSequence_init,
+    .tp_getset = CodecPacketSequence_getsetters,
+};
+
+void init_CodecPacketSequence( PyObject *module ) {
+    if( PyType_Ready( &py_type_CodecPacketSequence ) < 0 )
+        return;
+
+    Py_INCREF( &py_type_CodecPacketSequence );
+    PyModule_AddObject( module, "CodecPacketSequence", (PyObject *) &py_type_CodecPacketSequence );
+
+    pySourceFuncs = PyCapsule_New( &source_funcs, CODEC_PACKET_SOURCE_FUNCS, NULL );
+}
+
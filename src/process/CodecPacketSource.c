@@ -47,6 +47,47 @@ py_codec_packet_take_source( PyObject *source, CodecPacketSourceHolder *holder )
     return true;
 }
 
+/*
+    Function: py_codec_packet_source_failed
+    After getNextPacket returns NULL, tells whether the source failed or just
+    ran out of packets.
+
+    The source's exception is left set. Call this without the GIL, from a
+    thread with its own Python thread state, such as one that let go of the
+    GIL with Py_BEGIN_ALLOW_THREADS; otherwise the exception goes away with
+    the temporary thread state the source used to set it.
+*/
+EXPORT bool
+py_codec_packet_source_failed() {
+    PyGILState_STATE gstate = PyGILState_Ensure();
+    bool failed = (PyErr_Occurred() != NULL);
+    PyGILState_Release( gstate );
+
+    return failed;
+}
+
+/*
+    Function: py_codec_packet_set_error
+    Sets a Python exception for a getNextPacket that's about to return NULL
+    because it failed. Call without the GIL.
+
+    If an exception is already set, say by the source this one reads from,
+    it's left alone, since it's closer to the cause.
+*/
+EXPORT void
+py_codec_packet_set_error( PyObject *type, const char *format, ... ) {
+    PyGILState_STATE gstate = PyGILState_Ensure();
+
+    if( !PyErr_Occurred() ) {
+        va_list args;
+        va_start( args, format );
+        PyErr_FormatV( type, format, args );
+        va_end( args );
+    }
+
+    PyGILState_Release( gstate );
+}
+
 static PyObject *
 CodecPacketSource_get_header( PyObject *self, PyObject *args ) {
     CodecPacketSourceHolder holder = { { NULL } };
@@ -60,7 +101,11 @@ CodecPacketSource_get_header( PyObject *self, PyObject *args ) {
         return NULL;
     }
 
-    int header_size = holder.source.funcs->getHeader( holder.source.obj, NULL );
+    int header_size;
+
+    Py_BEGIN_ALLOW_THREADS
+    header_size = holder.source.funcs->getHeader( holder.source.obj, NULL );
+    Py_END_ALLOW_THREADS
 
     if( !header_size ) {
         py_codec_packet_take_source( NULL, &holder );
@@ -74,10 +119,17 @@ CodecPacketSource_get_header( PyObject *self, PyObject *args ) {
         return PyErr_NoMemory();
     }
 
-    if( !holder.source.funcs->getHeader( holder.source.obj, buffer ) ) {
+    int got_header;
+
+    Py_BEGIN_ALLOW_THREADS
+    got_header = holder.source.funcs->getHeader( holder.source.obj, buffer );
+    Py_END_ALLOW_THREADS
+
+    if( !got_header ) {
         PyMem_Free( buffer );
         py_codec_packet_take_source( NULL, &holder );
         PyErr_SetString( PyExc_Exception, "Couldn't retrieve the header." );
+        return NULL;
     }
 
     py_codec_packet_take_source( NULL, &holder );
@@ -101,11 +153,21 @@ CodecPacketSource_get_next_packet( PyObject *self, PyObject *args ) {
         return NULL;
     }
 
-    codec_packet *packet = holder.source.funcs->getNextPacket( holder.source.obj );
+    codec_packet *packet;
+
+    Py_BEGIN_ALLOW_THREADS
+    packet = holder.source.funcs->getNextPacket( holder.source.obj );
+    Py_END_ALLOW_THREADS
+
     py_codec_packet_take_source( NULL, &holder );
 
-    if( !packet )
+    if( !packet ) {
+        // The source failed, rather than ran out
+        if( PyErr_Occurred() )
+            return NULL;
+
         Py_RETURN_NONE;
+    }
 
     PyObject *data = PyBytes_FromStringAndSize( packet->data, packet->length );
     int64_t pts = packet->pts;
@@ -173,7 +235,11 @@ CodecPacketSource_seek( PyObject *self, PyObject *args ) {
         return NULL;
     }
 
-    bool result = holder.source.funcs->seek( holder.source.obj, frame );
+    bool result;
+
+    Py_BEGIN_ALLOW_THREADS
+    result = holder.source.funcs->seek( holder.source.obj, frame );
+    Py_END_ALLOW_THREADS
     py_codec_packet_take_source( NULL, &holder );
 
     if( !result ) {
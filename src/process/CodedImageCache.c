@@ -0,0 +1,421 @@
+/*
+    This file is part of the Fluggo Media Library for high-quality
+    video and audio processing.
+
+    Copyright 2012 Brian J. Crowell <brian@fluggo.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "pyframework.h"
+
+#undef G_LOG_DOMAIN
+#define G_LOG_DOMAIN "fluggo.media.process.CodedImageCache"
+
+#define DEFAULT_CACHE_SIZE      (INT64_C(128) * 1024 * 1024)
+
+typedef struct {
+    // What we hand out; its free_func drops the caller's reference, so this must come first
+    coded_image shared;
+
+    int frame, quality;
+    coded_image *image;
+    int64_t size;
+
+    // One reference for the table, one for each caller holding the image
+    volatile gint refs;
+
+    // True while the first thread to ask for the frame is still pulling it;
+    // detached once it's been dropped from the table
+    bool loading, detached;
+
+    GList link;
+    bool listed;
+} cache_entry;
+
+typedef struct {
+    PyObject_HEAD
+
+    CodedImageSourceHolder source;
+    GRWLock rwlock;
+
+    GMutex mutex;
+    GCond cond;
+    GHashTable *entries;
+    GQueue lru;
+    int64_t used, cache_size;
+    int64_t hits, misses, waits;
+} py_obj_CodedImageCache;
+
+static guint
+entry_hash( const cache_entry *entry ) {
+    return (guint) entry->frame * 31u + (guint) entry->quality;
+}
+
+static gboolean
+entry_equal( const cache_entry *a, const cache_entry *b ) {
+    return a->frame == b->frame && a->quality == b->quality;
+}
+
+// Callers can hold on to an image long after the cache (or its owner)
+// has let go of it, so the count is atomic and releasing never takes a lock.
+static void
+entry_unref( cache_entry *entry ) {
+    if( !g_atomic_int_dec_and_test( &entry->refs ) )
+        return;
+
+    if( entry->image && entry->image->free_func )
+        entry->image->free_func( entry->image );
+
+    g_slice_free( cache_entry, entry );
+}
+
+/*
+    Function: entry_remove
+    Drops an entry from the table and the LRU list. Callers still holding
+    its image keep it alive. Call with the mutex held.
+*/
+static void
+entry_remove( py_obj_CodedImageCache *self, cache_entry *entry ) {
+    if( entry->detached )
+        return;
+
+    g_hash_table_remove( self->entries, entry );
+    entry->detached = true;
+
+    if( entry->listed ) {
+        g_queue_unlink( &self->lru, &entry->link );
+        entry->listed = false;
+        self->used -= entry->size;
+    }
+
+    entry_unref( entry );
+}
+
+// Call with the mutex held
+static void
+cache_trim( py_obj_CodedImageCache *self, int64_t size ) {
+    while( self->used > size && !g_queue_is_empty( &self->lru ) )
+        entry_remove( self, (cache_entry*) g_queue_peek_tail_link( &self->lru )->data );
+}
+
+static void
+remove_all( py_obj_CodedImageCache *self ) {
+    g_mutex_lock( &self->mutex );
+
+    GList *list = g_hash_table_get_keys( self->entries );
+
+    for( GList *item = list; item; item = item->next )
+        entry_remove( self, (cache_entry*) item->data );
+
+    g_mutex_unlock( &self->mutex );
+    g_list_free( list );
+}
+
+static coded_image *
+CodedImageCache_getFrame( py_obj_CodedImageCache *self, int frame_index, int quality_hint ) {
+    cache_entry key = { .frame = frame_index, .quality = quality_hint ? quality_hint : 10 };
+
+    g_rw_lock_reader_lock( &self->rwlock );
+
+    if( self->source.source.obj == NULL ) {
+        g_rw_lock_reader_unlock( &self->rwlock );
+        return NULL;
+    }
+
+    g_mutex_lock( &self->mutex );
+
+    cache_entry *entry = (cache_entry*) g_hash_table_lookup( self->entries, &key );
+
+    if( entry ) {
+        g_atomic_int_inc( &entry->refs );
+
+        if( entry->loading ) {
+            self->waits++;
+
+            while( entry->loading )
+                g_cond_wait( &self->cond, &self->mutex );
+        }
+        else {
+            self->hits++;
+        }
+
+        if( entry->listed ) {
+            g_queue_unlink( &self->lru, &entry->link );
+            g_queue_push_head_link( &self->lru, &entry->link );
+        }
+
+        g_mutex_unlock( &self->mutex );
+        g_rw_lock_reader_unlock( &self->rwlock );
+
+        // The pull we waited on may have come up empty
+        if( !entry->image ) {
+            entry_unref( entry );
+            return NULL;
+        }
+
+        return &entry->shared;
+    }
+
+    self->misses++;
+
+    entry = g_slice_dup( cache_entry, &key );
+    entry->shared.free_func = (GFreeFunc) entry_unref;
+    entry->refs = 2;
+    entry->loading = true;
+    entry->link.data = entry;
+    g_hash_table_insert( self->entries, entry, entry );
+
+    g_mutex_unlock( &self->mutex );
+
+    coded_image *image = self->source.source.funcs->getFrame( self->source.source.obj, frame_index, quality_hint );
+
+    if( image ) {
+        for( int i = 0; i < CODED_IMAGE_MAX_PLANES; i++ ) {
+            entry->shared.data[i] = image->data[i];
+            entry->shared.stride[i] = image->stride[i];
+            entry->shared.line_count[i] = image->line_count[i];
+
+            if( image->data[i] )
+                entry->size += (int64_t) image->stride[i] * image->line_count[i];
+        }
+    }
+
+    g_mutex_lock( &self->mutex );
+
+    entry->image = image;
+    entry->loading = false;
+
+    if( !image ) {
+        // Don't remember failures; the next caller should get to try again
+        entry_remove( self, entry );
+    }
+    else if( !entry->detached ) {
+        // Someone may have thrown the cache out while we were pulling
+        g_queue_push_head_link( &self->lru, &entry->link );
+        entry->listed = true;
+        self->used += entry->size;
+
+        cache_trim( self, self->cache_size );
+    }
+
+    g_cond_broadcast( &self->cond );
+    g_mutex_unlock( &self->mutex );
+    g_rw_lock_reader_unlock( &self->rwlock );
+
+    if( !image ) {
+        entry_unref( entry );
+        return NULL;
+    }
+
+    return &entry->shared;
+}
+
+static int
+CodedImageCache_init( py_obj_CodedImageCache *self, PyObject *args, PyObject *kw ) {
+    PyObject *source_obj;
+    long long cache_size = DEFAULT_CACHE_SIZE;
+
+    static char *kwlist[] = { "source", "cache_size", NULL };
+
+    if( !PyArg_ParseTupleAndKeywords( args, kw, "O|L", kwlist, &source_obj, &cache_size ) )
+        return -1;
+
+    if( cache_size < 0 ) {
+        PyErr_SetString( PyExc_ValueError, "cache_size must not be negative." );
+        return -1;
+    }
+
+    if( !py_coded_image_take_source( source_obj, &self->source ) )
+        return -1;
+
+    g_rw_lock_init( &self->rwlock );
+    g_mutex_init( &self->mutex );
+    g_cond_init( &self->cond );
+
+    self->entries = g_hash_table_new( (GHashFunc) entry_hash, (GEqualFunc) entry_equal );
+    g_queue_init( &self->lru );
+    self->used = 0;
+    self->cache_size = cache_size;
+    self->hits = 0;
+    self->misses = 0;
+    self->waits = 0;
+
+    return 0;
+}
+
+static void
+CodedImageCache_dealloc( py_obj_CodedImageCache *self ) {
+    if( self->entries ) {
+        remove_all( self );
+        g_hash_table_destroy( self->entries );
+        self->entries = NULL;
+
+        g_rw_lock_clear( &self->rwlock );
+        g_mutex_clear( &self->mutex );
+        g_cond_clear( &self->cond );
+    }
+
+    py_coded_image_take_source( NULL, &self->source );
+    Py_TYPE(self)->tp_free( (PyObject*) self );
+}
+
+static PyObject *
+CodedImageCache_source( py_obj_CodedImageCache *self ) {
+    if( self->source.source.obj == NULL )
+        Py_RETURN_NONE;
+
+    Py_INCREF((PyObject *) self->source.source.obj);
+    return (PyObject *) self->source.source.obj;
+}
+
+static PyObject *
+CodedImageCache_set_source( py_obj_CodedImageCache *self, PyObject *args ) {
+    PyObject *source_obj;
+
+    if( !PyArg_ParseTuple( args, "O", &source_obj ) )
+        return NULL;
+
+    g_rw_lock_writer_lock( &self->rwlock );
+
+    if( !py_coded_image_take_source( source_obj, &self->source ) ) {
+        g_rw_lock_writer_unlock( &self->rwlock );
+        return NULL;
+    }
+
+    // Everything we have came from the old source
+    remove_all( self );
+
+    g_rw_lock_writer_unlock( &self->rwlock );
+
+    Py_RETURN_NONE;
+}
+
+static PyObject *
+CodedImageCache_invalidate( py_obj_CodedImageCache *self ) {
+    remove_all( self );
+    Py_RETURN_NONE;
+}
+
+static PyObject *
+CodedImageCache_get_cache_size( py_obj_CodedImageCache *self, void *closure ) {
+    return PyLong_FromLongLong( self->cache_size );
+}
+
+static int
+CodedImageCache_set_cache_size( py_obj_CodedImageCache *self, PyObject *value, void *closure ) {
+    if( value == NULL ) {
+        PyErr_SetString( PyExc_TypeError, "Cannot delete the cache_size attribute." );
+        return -1;
+    }
+
+    long long cache_size = PyLong_AsLongLong( value );
+
+    if( cache_size == -1 && PyErr_Occurred() )
+        return -1;
+
+    if( cache_size < 0 ) {
+        PyErr_SetString( PyExc_ValueError, "cache_size must not be negative." );
+        return -1;
+    }
+
+    g_mutex_lock( &self->mutex );
+    self->cache_size = cache_size;
+    cache_trim( self, cache_size );
+    g_mutex_unlock( &self->mutex );
+
+    return 0;
+}
+
+static PyObject *
+CodedImageCache_get_cache_stats( py_obj_CodedImageCache *self, void *closure ) {
+    g_mutex_lock( &self->mutex );
+    int64_t hits = self->hits, misses = self->misses, waits = self->waits, used = self->used;
+    int count = (int) g_queue_get_length( &self->lru );
+    g_mutex_unlock( &self->mutex );
+
+    return Py_BuildValue( "{sLsLsLsLsi}",
+        "hits", (long long) hits,
+        "misses", (long long) misses,
+        "waits", (long long) waits,
+        "used", (long long) used,
+        "frames", count );
+}
+
+static coded_image_source_funcs source_funcs = {
+    .getFrame = (coded_image_getFrameFunc) CodedImageCache_getFrame,
+};
+
+static PyObject *py_source_funcs;
+
+static PyObject *
+CodedImageCache_get_funcs( PyObject *self, void *closure ) {
+    Py_INCREF(py_source_funcs);
+    return py_source_funcs;
+}
+
+static PyGetSetDef CodedImageCache_getsetters[] = {
+    { CODED_IMAGE_SOURCE_FUNCS, (getter) CodedImageCache_get_funcs, NULL, "Coded image source C API." },
+    { "cache_size", (getter) CodedImageCache_get_cache_size, (setter) CodedImageCache_set_cache_size,
+        "Most memory, in bytes, to spend on cached images. Zero turns off the cache." },
+    { "cache_stats", (getter) CodedImageCache_get_cache_stats, NULL,
+        "Dictionary of hits, misses, waits (requests that joined another thread's pull), "
+        "and the images and bytes this cache is holding." },
+    { NULL }
+};
+
+static PyMethodDef CodedImageCache_methods[] = {
+    { "source", (PyCFunction) CodedImageCache_source, METH_NOARGS,
+        "Gets the coded image source." },
+    { "set_source", (PyCFunction) CodedImageCache_set_source, METH_VARARGS,
+        "Sets the coded image source, throwing out everything cached from the old one." },
+    { "invalidate", (PyCFunction) CodedImageCache_invalidate, METH_NOARGS,
+        "Throws out every cached image, for when the source has changed underneath." },
+    { NULL }
+};
+
+/*
+    CodedImageCache(source, cache_size=128MB)
+
+    Keeps coded images from the source by frame number and quality, so
+    everything reading the same frame (the software and GL reconstruction
+    paths, thumbnails, exports) decodes it once. Images are held in their
+    coded form, which for subsampled YCbCr is a fraction of the size of the
+    reconstructed frame. Callers share the cached image and release it with
+    its free_func as usual; the least recently used images are dropped once
+    the cache goes over cache_size.
+*/
+static PyTypeObject py_type_CodedImageCache = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "fluggo.media.process.CodedImageCache",
+    .tp_basicsize = sizeof(py_obj_CodedImageCache),
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_base = &py_type_CodedImageSource,
+    .tp_new = PyType_GenericNew,
+    .tp_dealloc = (destructor) CodedImageCache_dealloc,
+    .tp_init = (initproc) CodedImageCache_init,
+    .tp_getset = CodedImageCache_getsetters,
+    .tp_methods = CodedImageCache_methods,
+};
+
+void init_CodedImageCache( PyObject *module ) {
+    if( PyType_Ready( &py_type_CodedImageCache ) < 0 )
+        return;
+
+    Py_INCREF( (PyObject*) &py_type_CodedImageCache );
+    PyModule_AddObject( module, "CodedImageCache", (PyObject *) &py_type_CodedImageCache );
+
+    py_source_funcs = PyCapsule_New( &source_funcs, CODED_IMAGE_SOURCE_FUNCS, NULL );
+}
+
@@ -61,7 +61,12 @@ CodedImageSource_get_frame( PyObject *self, PyObject *args ) {
     if( !py_coded_image_take_source( self, &holder ) )
         return NULL;
 
-    coded_image *image = holder.source.funcs->getFrame( holder.source.obj, frame, 0 );
+    coded_image *image;
+
+    Py_BEGIN_ALLOW_THREADS
+    image = holder.source.funcs->getFrame( holder.source.obj, frame, 0 );
+    Py_END_ALLOW_THREADS
+
     py_coded_image_take_source( NULL, &holder );
 
     if( !image )
@@ -115,15 +120,11 @@ destroy_image( coded_image *image ) {
     g_free( image );
 }
 
+// Needs the GIL
 static coded_image *
-CodedImageSource_get_frame_from_python( PyObject *self, int frame, int quality ) {
-    PyGILState_STATE gstate;
-    gstate = PyGILState_Ensure();
-
+get_frame_from_python( PyObject *self, int frame ) {
     PyObject *result_obj = PyObject_CallMethod( (PyObject *) self, "get_frame", "i", frame );
 
-    PyGILState_Release( gstate );
-
     if( !result_obj ) {
         PyErr_Print();
         return NULL;
@@ -133,6 +134,7 @@ CodedImageSource_get_frame_from_python( PyObject *self, int frame, int quality )
 
     if( plane_count == -1 ) {
         PyErr_Print();
+        Py_CLEAR(result_obj);
         return NULL;
     }
 
@@ -219,6 +221,17 @@ CodedImageSource_get_frame_from_python( PyObject *self, int frame, int quality )
         Py_CLEAR(data_obj);
     }
 
+    Py_CLEAR(result_obj);
+    return image;
+}
+
+static coded_image *
+CodedImageSource_get_frame_from_python( PyObject *self, int frame, int quality ) {
+    // Pulls can come from any thread, with or without the GIL
+    PyGILState_STATE gstate = PyGILState_Ensure();
+    coded_image *image = get_frame_from_python( self, frame );
+    PyGILState_Release( gstate );
+
     return image;
 }
 
@@ -0,0 +1,910 @@
+/*
+    This file is part of the Fluggo Media Library for high-quality
+    video and audio processing.
+
+    Copyright 2012 Brian J. Crowell <brian@fluggo.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <math.h>
+#include <string.h>
+#include "pyframework.h"
+
+#undef G_LOG_DOMAIN
+#define G_LOG_DOMAIN "fluggo.media.process.ExpressionFunc"
+
+// Frames evaluated per pass through the program
+#define BATCH_SIZE      64
+
+// Deepest the evaluation stack can get; plenty for anything typed by hand
+#define MAX_DEPTH       32
+
+// Deepest the parser will nest parentheses and calls
+#define MAX_NESTING     64
+
+typedef enum {
+    OP_CONST,
+    OP_FRAME,
+    OP_INPUT,
+    OP_INPUT_AT,
+    OP_NEG,
+    OP_ADD,
+    OP_SUB,
+    OP_MUL,
+    OP_DIV,
+    OP_MOD,
+    OP_POW,
+    OP_MIN,
+    OP_MAX,
+    OP_CLAMP,
+    OP_LERP,
+    OP_SMOOTHSTEP,
+    OP_ABS,
+    OP_FLOOR,
+    OP_CEIL,
+    OP_SQRT,
+    OP_SIN,
+    OP_COS,
+    OP_EXP,
+    OP_LOG,
+    OP_EASE_IN,
+    OP_EASE_OUT,
+    OP_EASE_IN_OUT,
+} expr_op;
+
+typedef struct {
+    expr_op op;
+
+    // Input and component for OP_INPUT and OP_INPUT_AT
+    int input, component;
+
+    // Value for OP_CONST
+    double value;
+} expr_instr;
+
+typedef struct {
+    expr_instr *code;
+    int length, max_depth;
+} expr_program;
+
+typedef struct {
+    PyObject_HEAD
+
+    expr_program programs[4];
+    FrameFunctionHolder *inputs;
+    int input_count;
+
+    // Render threads read the programs and inputs without a lock,
+    // so they can only be set up once
+    bool initialized;
+} py_obj_ExpressionFunc;
+
+typedef struct {
+    const char *name;
+    expr_op op;
+    int arg_count;
+} expr_builtin;
+
+static const expr_builtin builtins[] = {
+    { "min", OP_MIN, 2 },
+    { "max", OP_MAX, 2 },
+    { "clamp", OP_CLAMP, 3 },
+    { "lerp", OP_LERP, 3 },
+    { "smoothstep", OP_SMOOTHSTEP, 3 },
+    { "abs", OP_ABS, 1 },
+    { "floor", OP_FLOOR, 1 },
+    { "ceil", OP_CEIL, 1 },
+    { "sqrt", OP_SQRT, 1 },
+    { "sin", OP_SIN, 1 },
+    { "cos", OP_COS, 1 },
+    { "exp", OP_EXP, 1 },
+    { "log", OP_LOG, 1 },
+    { "ease_in", OP_EASE_IN, 1 },
+    { "ease_out", OP_EASE_OUT, 1 },
+    { "ease_in_out", OP_EASE_IN_OUT, 1 },
+};
+
+/************* Parser *********/
+
+typedef struct {
+    const char *text, *pos;
+    GArray *code;
+    int depth, max_depth, nesting;
+
+    // Borrowed from the caller: a list of input names, in input order
+    PyObject *input_names;
+} expr_parser;
+
+static bool parse_expr( expr_parser *parser );
+
+static bool
+parse_error( expr_parser *parser, const char *message ) {
+    PyErr_Format( PyExc_ValueError, "%s at position %d in expression \"%s\".",
+        message, (int)(parser->pos - parser->text), parser->text );
+    return false;
+}
+
+static void
+skip_space( expr_parser *parser ) {
+    while( g_ascii_isspace( *parser->pos ) )
+        parser->pos++;
+}
+
+static bool
+accept( expr_parser *parser, const char *token ) {
+    skip_space( parser );
+
+    size_t length = strlen( token );
+
+    if( strncmp( parser->pos, token, length ) != 0 )
+        return false;
+
+    parser->pos += length;
+    return true;
+}
+
+/*
+    Function: emit
+    Adds an instruction, tracking how deep the stack gets. stack_change is how
+    many values the instruction leaves on the stack minus how many it takes off.
+*/
+static bool
+emit( expr_parser *parser, expr_instr instr, int stack_change ) {
+    parser->depth += stack_change;
+
+    if( parser->depth > MAX_DEPTH )
+        return parse_error( parser, "Expression is too complicated" );
+
+    if( parser->depth > parser->max_depth )
+        parser->max_depth = parser->depth;
+
+    g_array_append_val( parser->code, instr );
+    return true;
+}
+
+static int
+find_input( expr_parser *parser, const char *name ) {
+    if( !parser->input_names )
+        return -1;
+
+    Py_ssize_t count = PyList_GET_SIZE( parser->input_names );
+
+    for( Py_ssize_t i = 0; i < count; i++ ) {
+        if( PyUnicode_CompareWithASCIIString( PyList_GET_ITEM( parser->input_names, i ), name ) == 0 )
+            return (int) i;
+    }
+
+    return -1;
+}
+
+// Returns the component after a dot, 0 if there's no dot, or -1 on error
+static int
+parse_component( expr_parser *parser ) {
+    static const char components[] = "xyzwrgba";
+
+    if( !accept( parser, "." ) )
+        return 0;
+
+    skip_space( parser );
+
+    const char c = parser->pos[0], next = parser->pos[1];
+    const char *found = c ? strchr( components, c ) : NULL;
+
+    if( !found || g_ascii_isalnum( next ) || next == '_' ) {
+        parse_error( parser, "Expected a component (x, y, z, w or r, g, b, a)" );
+        return -1;
+    }
+
+    parser->pos++;
+    return (int)(found - components) % 4;
+}
+
+static bool
+parse_call_args( expr_parser *parser, int count ) {
+    for( int i = 0; i < count; i++ ) {
+        if( i != 0 && !accept( parser, "," ) )
+            return parse_error( parser, "Expected a comma" );
+
+        if( !parse_expr( parser ) )
+            return false;
+    }
+
+    if( !accept( parser, ")" ) )
+        return parse_error( parser, "Expected a closing parenthesis" );
+
+    return true;
+}
+
+static bool
+parse_identifier( expr_parser *parser ) {
+    const char *start = parser->pos;
+
+    while( g_ascii_isalnum( *parser->pos ) || *parser->pos == '_' )
+        parser->pos++;
+
+    char *name = g_strndup( start, parser->pos - start );
+    bool result;
+
+    if( !strcmp( name, "frame" ) ) {
+        result = emit( parser, (expr_instr) { .op = OP_FRAME }, 1 );
+    }
+    else if( !strcmp( name, "pi" ) ) {
+        result = emit( parser, (expr_instr) { .op = OP_CONST, .value = G_PI }, 1 );
+    }
+    else {
+        int input = find_input( parser, name );
+
+        if( input != -1 ) {
+            // Either the input at this frame or at the frame in parentheses
+            bool at = accept( parser, "(" );
+            int component = 0;
+
+            result = !at || parse_call_args( parser, 1 );
+
+            if( result )
+                component = parse_component( parser );
+
+            result = result && component != -1 && emit( parser,
+                (expr_instr) { .op = at ? OP_INPUT_AT : OP_INPUT, .input = input, .component = component },
+                at ? 0 : 1 );
+        }
+        else {
+            const expr_builtin *builtin = NULL;
+
+            for( int i = 0; i < G_N_ELEMENTS(builtins); i++ ) {
+                if( !strcmp( name, builtins[i].name ) ) {
+                    builtin = &builtins[i];
+                    break;
+                }
+            }
+
+            if( !builtin ) {
+                parser->pos = start;
+                PyErr_Format( PyExc_ValueError, "Unknown name \"%s\" in expression \"%s\".", name, parser->text );
+                g_free( name );
+                return false;
+            }
+
+            if( !accept( parser, "(" ) ) {
+                g_free( name );
+                return parse_error( parser, "Expected an opening parenthesis" );
+            }
+
+            result = parse_call_args( parser, builtin->arg_count ) &&
+                emit( parser, (expr_instr) { .op = builtin->op }, 1 - builtin->arg_count );
+        }
+    }
+
+    g_free( name );
+    return result;
+}
+
+static bool
+parse_primary( expr_parser *parser ) {
+    skip_space( parser );
+
+    if( ++parser->nesting > MAX_NESTING )
+        return parse_error( parser, "Expression is nested too deeply" );
+
+    bool result;
+    const char c = *parser->pos;
+
+    if( g_ascii_isdigit( c ) || c == '.' ) {
+        char *end;
+        double value = g_ascii_strtod( parser->pos, &end );
+
+        if( end == parser->pos )
+            return parse_error( parser, "Expected a number" );
+
+        parser->pos = end;
+        result = emit( parser, (expr_instr) { .op = OP_CONST, .value = value }, 1 );
+    }
+    else if( g_ascii_isalpha( c ) || c == '_' ) {
+        result = parse_identifier( parser );
+    }
+    else if( accept( parser, "(" ) ) {
+        result = parse_expr( parser );
+
+        if( result && !accept( parser, ")" ) )
+            result = parse_error( parser, "Expected a closing parenthesis" );
+    }
+    else {
+        result = parse_error( parser, "Expected a number, name, or parenthesis" );
+    }
+
+    parser->nesting--;
+    return result;
+}
+
+static bool parse_unary( expr_parser *parser );
+
+static bool
+parse_power( expr_parser *parser ) {
+    if( !parse_primary( parser ) )
+        return false;
+
+    // Right-associative, and binds tighter than unary minus on its left
+    if( accept( parser, "**" ) || accept( parser, "^" ) ) {
+        return parse_unary( parser ) &&
+            emit( parser, (expr_instr) { .op = OP_POW }, -1 );
+    }
+
+    return true;
+}
+
+static bool
+parse_unary( expr_parser *parser ) {
+    if( accept( parser, "-" ) ) {
+        if( ++parser->nesting > MAX_NESTING )
+            return parse_error( parser, "Expression is nested too deeply" );
+
+        bool result = parse_unary( parser ) && emit( parser, (expr_instr) { .op = OP_NEG }, 0 );
+        parser->nesting--;
+
+        return result;
+    }
+
+    if( accept( parser, "+" ) )
+        return parse_unary( parser );
+
+    return parse_power( parser );
+}
+
+static bool
+parse_term( expr_parser *parser ) {
+    if( !parse_unary( parser ) )
+        return false;
+
+    for( ;; ) {
+        expr_op op;
+
+        // Make sure "**" isn't taken as "*"
+        skip_space( parser );
+
+        if( parser->pos[0] == '*' && parser->pos[1] != '*' )
+            op = OP_MUL;
+        else if( parser->pos[0] == '/' )
+            op = OP_DIV;
+        else if( parser->pos[0] == '%' )
+            op = OP_MOD;
+        else
+            return true;
+
+        parser->pos++;
+
+        if( !parse_unary( parser ) || !emit( parser, (expr_instr) { .op = op }, -1 ) )
+            return false;
+    }
+}
+
+static bool
+parse_expr( expr_parser *parser ) {
+    if( !parse_term( parser ) )
+        return false;
+
+    for( ;; ) {
+        expr_op op;
+
+        if( accept( parser, "+" ) )
+            op = OP_ADD;
+        else if( accept( parser, "-" ) )
+            op = OP_SUB;
+        else
+            return true;
+
+        if( !parse_term( parser ) || !emit( parser, (expr_instr) { .op = op }, -1 ) )
+            return false;
+    }
+}
+
+/*
+    Function: compile_program
+    Compiles an expression into a program, reporting any errors as a ValueError.
+    input_names is a list of the names the expression can use for inputs.
+*/
+static bool
+compile_program( expr_program *program, const char *text, PyObject *input_names ) {
+    expr_parser parser = {
+        .text = text,
+        .pos = text,
+        .code = g_array_new( FALSE, FALSE, sizeof(expr_instr) ),
+        .input_names = input_names,
+    };
+
+    bool result = parse_expr( &parser );
+    skip_space( &parser );
+
+    if( result && *parser.pos )
+        result = parse_error( &parser, "Unexpected character" );
+
+    if( !result ) {
+        g_array_free( parser.code, TRUE );
+        return false;
+    }
+
+    program->length = parser.code->len;
+    program->max_depth = parser.max_depth;
+    program->code = (expr_instr *) g_array_free( parser.code, FALSE );
+
+    return true;
+}
+
+/************* Evaluation *********/
+
+static inline double
+clampd( double value, double min, double max ) {
+    return value < min ? min : (value > max ? max : value);
+}
+
+/*
+    Function: run_program
+    Runs a program over up to BATCH_SIZE frames. Each instruction works
+    across the whole batch before the next one starts, so the loops are
+    short, flat, and easy for the compiler to vectorize.
+*/
+static void
+run_program( py_obj_ExpressionFunc *self, const expr_program *program, int count, double *frames, double *out ) {
+    double stack[MAX_DEPTH][BATCH_SIZE];
+    double input_values[BATCH_SIZE][4];
+    int top = -1, arg_count;
+
+    for( int pc = 0; pc < program->length; pc++ ) {
+        const expr_instr *instr = &program->code[pc];
+
+        switch( instr->op ) {
+            case OP_CONST:
+                top++;
+
+                for( int i = 0; i < count; i++ )
+                    stack[top][i] = instr->value;
+
+                continue;
+
+            case OP_FRAME:
+                top++;
+                memcpy( stack[top], frames, sizeof(double) * count );
+                continue;
+
+            case OP_INPUT:
+                top++;
+                framefunc_get_values( &self->inputs[instr->input], count, frames, input_values );
+
+                for( int i = 0; i < count; i++ )
+                    stack[top][i] = input_values[i][instr->component];
+
+                continue;
+
+            case OP_INPUT_AT:
+                framefunc_get_values( &self->inputs[instr->input], count, stack[top], input_values );
+
+                for( int i = 0; i < count; i++ )
+                    stack[top][i] = input_values[i][instr->component];
+
+                continue;
+
+            // Everything else takes its arguments off the top of the stack,
+            // leaving the result where the first one was
+            case OP_ADD: case OP_SUB: case OP_MUL: case OP_DIV:
+            case OP_MOD: case OP_POW: case OP_MIN: case OP_MAX:
+                arg_count = 2;
+                break;
+
+            case OP_CLAMP: case OP_LERP: case OP_SMOOTHSTEP:
+                arg_count = 3;
+                break;
+
+            default:
+                arg_count = 1;
+                break;
+        }
+
+        top -= arg_count - 1;
+
+        // Only point at the stack slots this instruction actually has
+        double *a = stack[top];
+        double *b = (arg_count > 1) ? stack[top + 1] : NULL;
+        double *c = (arg_count > 2) ? stack[top + 2] : NULL;
+
+        switch( instr->op ) {
+            case OP_NEG:
+                for( int i = 0; i < count; i++ )
+                    a[i] = -a[i];
+                break;
+
+            case OP_ADD:
+                for( int i = 0; i < count; i++ )
+                    a[i] += b[i];
+                break;
+
+            case OP_SUB:
+                for( int i = 0; i < count; i++ )
+                    a[i] -= b[i];
+                break;
+
+            case OP_MUL:
+                for( int i = 0; i < count; i++ )
+                    a[i] *= b[i];
+                break;
+
+            case OP_DIV:
+                for( int i = 0; i < count; i++ )
+                    a[i] /= b[i];
+                break;
+
+            case OP_MOD:
+                for( int i = 0; i < count; i++ )
+                    a[i] = fmod( a[i], b[i] );
+                break;
+
+            case OP_POW:
+                for( int i = 0; i < count; i++ )
+                    a[i] = pow( a[i], b[i] );
+                break;
+
+            case OP_MIN:
+                for( int i = 0; i < count; i++ )
+                    a[i] = b[i] < a[i] ? b[i] : a[i];
+                break;
+
+            case OP_MAX:
+                for( int i = 0; i < count; i++ )
+                    a[i] = b[i] > a[i] ? b[i] : a[i];
+                break;
+
+            case OP_CLAMP:
+                for( int i = 0; i < count; i++ )
+                    a[i] = clampd( a[i], b[i], c[i] );
+                break;
+
+            case OP_LERP:
+                for( int i = 0; i < count; i++ )
+                    a[i] = a[i] + (b[i] - a[i]) * c[i];
+                break;
+
+            case OP_SMOOTHSTEP:
+                for( int i = 0; i < count; i++ ) {
+                    double t = clampd( (c[i] - a[i]) / (b[i] - a[i]), 0.0, 1.0 );
+                    a[i] = t * t * (3.0 - 2.0 * t);
+                }
+                break;
+
+            case OP_ABS:
+                for( int i = 0; i < count; i++ )
+                    a[i] = fabs( a[i] );
+                break;
+
+            case OP_FLOOR:
+                for( int i = 0; i < count; i++ )
+                    a[i] = floor( a[i] );
+                break;
+
+            case OP_CEIL:
+                for( int i = 0; i < count; i++ )
+                    a[i] = ceil( a[i] );
+                break;
+
+            case OP_SQRT:
+                for( int i = 0; i < count; i++ )
+                    a[i] = sqrt( a[i] );
+                break;
+
+            case OP_SIN:
+                for( int i = 0; i < count; i++ )
+                    a[i] = sin( a[i] );
+                break;
+
+            case OP_COS:
+                for( int i = 0; i < count; i++ )
+                    a[i] = cos( a[i] );
+                break;
+
+            case OP_EXP:
+                for( int i = 0; i < count; i++ )
+                    a[i] = exp( a[i] );
+                break;
+
+            case OP_LOG:
+                for( int i = 0; i < count; i++ )
+                    a[i] = log( a[i] );
+                break;
+
+            // The easing curves take t from 0 to 1 and clamp outside that
+            case OP_EASE_IN:
+                for( int i = 0; i < count; i++ ) {
+                    double t = clampd( a[i], 0.0, 1.0 );
+                    a[i] = t * t;
+                }
+                break;
+
+            case OP_EASE_OUT:
+                for( int i = 0; i < count; i++ ) {
+                    double t = clampd( a[i], 0.0, 1.0 );
+                    a[i] = t * (2.0 - t);
+                }
+                break;
+
+            case OP_EASE_IN_OUT:
+                for( int i = 0; i < count; i++ ) {
+                    double t = clampd( a[i], 0.0, 1.0 );
+                    a[i] = t * t * (3.0 - 2.0 * t);
+                }
+                break;
+
+            default:
+                g_assert_not_reached();
+        }
+    }
+
+    memcpy( out, stack[0], sizeof(double) * count );
+}
+
+static void
+ExpressionFunc_get_values( py_obj_ExpressionFunc *self, ssize_t count, double *frames, double (*out_values)[4] ) {
+    double result[BATCH_SIZE];
+
+    for( ssize_t start = 0; start < count; start += BATCH_SIZE ) {
+        int batch = (int) MIN(count - start, BATCH_SIZE);
+
+        for( int j = 0; j < 4; j++ ) {
+            if( !self->programs[j].code ) {
+                for( int i = 0; i < batch; i++ )
+                    out_values[start + i][j] = 0.0;
+
+                continue;
+            }
+
+            run_program( self, &self->programs[j], batch, frames + start, result );
+
+            for( int i = 0; i < batch; i++ )
+                out_values[start + i][j] = result[i];
+        }
+    }
+}
+
+/************* Python type *********/
+
+static void
+clear_programs( py_obj_ExpressionFunc *self ) {
+    for( int j = 0; j < 4; j++ ) {
+        g_free( self->programs[j].code );
+        self->programs[j].code = NULL;
+    }
+
+    for( int i = 0; i < self->input_count; i++ )
+        py_framefunc_take_source( NULL, &self->inputs[i] );
+
+    g_free( self->inputs );
+    self->inputs = NULL;
+    self->input_count = 0;
+}
+
+// Names have to look like identifiers and can't hide the built-in names
+static bool
+is_input_name_valid( PyObject *name ) {
+    PyObject *bytes = PyUnicode_AsUTF8String( name );
+
+    if( !bytes ) {
+        PyErr_Clear();
+        return false;
+    }
+
+    const char *text = PyBytes_AS_STRING( bytes );
+    bool valid = (g_ascii_isalpha( text[0] ) || text[0] == '_') &&
+        strcmp( text, "frame" ) && strcmp( text, "pi" );
+
+    for( const char *c = text; valid && *c; c++ )
+        valid = g_ascii_isalnum( *c ) || *c == '_';
+
+    for( int i = 0; valid && i < G_N_ELEMENTS(builtins); i++ )
+        valid = strcmp( text, builtins[i].name ) != 0;
+
+    Py_DECREF(bytes);
+    return valid;
+}
+
+static PyTypeObject py_type_ExpressionFunc;
+
+// True if func is target or takes it as an input, directly or not
+static bool
+refers_to( PyObject *func, PyObject *target ) {
+    if( func == target )
+        return true;
+
+    if( !PyObject_TypeCheck( func, &py_type_ExpressionFunc ) )
+        return false;
+
+    py_obj_ExpressionFunc *expr = (py_obj_ExpressionFunc *) func;
+
+    for( int i = 0; i < expr->input_count; i++ ) {
+        if( expr->inputs[i].source && refers_to( expr->inputs[i].source, target ) )
+            return true;
+    }
+
+    return false;
+}
+
+static int
+ExpressionFunc_init( py_obj_ExpressionFunc *self, PyObject *args, PyObject *kw ) {
+    PyObject *expr_obj, *inputs_obj = NULL;
+
+    static char *kwlist[] = { "expression", "inputs", NULL };
+
+    if( !PyArg_ParseTupleAndKeywords( args, kw, "O|O!", kwlist, &expr_obj, &PyDict_Type, &inputs_obj ) )
+        return -1;
+
+    if( self->initialized ) {
+        PyErr_SetString( PyExc_Exception, "The function has already been set up." );
+        return -1;
+    }
+
+    self->initialized = true;
+
+    // Take the inputs first, so the expressions can refer to them
+    PyObject *input_names = NULL;
+
+    if( inputs_obj ) {
+        input_names = PyDict_Keys( inputs_obj );
+
+        if( !input_names )
+            return -1;
+
+        self->input_count = (int) PyList_GET_SIZE( input_names );
+        self->inputs = g_new0( FrameFunctionHolder, self->input_count );
+
+        for( int i = 0; i < self->input_count; i++ ) {
+            PyObject *name = PyList_GET_ITEM( input_names, i );
+
+            if( !PyUnicode_Check( name ) ) {
+                PyErr_SetString( PyExc_TypeError, "Input names must be strings." );
+                Py_DECREF(input_names);
+                clear_programs( self );
+                return -1;
+            }
+
+            if( !is_input_name_valid( name ) ) {
+                PyErr_Format( PyExc_ValueError, "\"%U\" can't be used as an input name.", name );
+                Py_DECREF(input_names);
+                clear_programs( self );
+                return -1;
+            }
+
+            PyObject *input = PyDict_GetItem( inputs_obj, name );
+
+            if( refers_to( input, (PyObject *) self ) ) {
+                PyErr_Format( PyExc_ValueError, "Input \"%U\" refers back to this function.", name );
+                Py_DECREF(input_names);
+                clear_programs( self );
+                return -1;
+            }
+
+            if( !py_framefunc_take_source( input, &self->inputs[i] ) ) {
+                Py_DECREF(input_names);
+                clear_programs( self );
+                return -1;
+            }
+        }
+    }
+
+    // Either one expression or a tuple of up to four, one for each component
+    PyObject *exprs = PyTuple_Check( expr_obj ) ? expr_obj : PyTuple_Pack( 1, expr_obj );
+
+    if( !exprs ) {
+        Py_XDECREF(input_names);
+        clear_programs( self );
+        return -1;
+    }
+
+    Py_ssize_t expr_count = PyTuple_GET_SIZE( exprs );
+    bool ok = true;
+
+    if( expr_count < 1 || expr_count > 4 ) {
+        PyErr_SetString( PyExc_ValueError, "Give between one and four expressions." );
+        ok = false;
+    }
+
+    for( Py_ssize_t j = 0; ok && j < expr_count; j++ ) {
+        PyObject *item = PyTuple_GET_ITEM( exprs, j );
+
+        if( item == Py_None )
+            continue;
+
+        PyObject *bytes = PyUnicode_AsUTF8String( item );
+
+        if( !bytes ) {
+            ok = false;
+            break;
+        }
+
+        ok = compile_program( &self->programs[j], PyBytes_AS_STRING( bytes ), input_names );
+        Py_DECREF(bytes);
+    }
+
+    if( exprs != expr_obj )
+        Py_DECREF(exprs);
+
+    Py_XDECREF(input_names);
+
+    if( !ok ) {
+        clear_programs( self );
+        return -1;
+    }
+
+    return 0;
+}
+
+static void
+ExpressionFunc_dealloc( py_obj_ExpressionFunc *self ) {
+    clear_programs( self );
+    Py_TYPE(self)->tp_free( (PyObject*) self );
+}
+
+static FrameFunctionFuncs ExpressionFunc_sourceFuncs = {
+    0,
+    .get_values = (framefunc_get_values_func) ExpressionFunc_get_values,
+};
+
+static PyObject *ExpressionFunc_pysourceFuncs;
+
+static PyObject *
+ExpressionFunc_get_funcs( PyObject *self, void *closure ) {
+    Py_INCREF(ExpressionFunc_pysourceFuncs);
+    return ExpressionFunc_pysourceFuncs;
+}
+
+static PyGetSetDef ExpressionFunc_getsetters[] = {
+    { FRAME_FUNCTION_FUNCS, (getter) ExpressionFunc_get_funcs, NULL, "Frame function C API." },
+    { NULL }
+};
+
+/*
+    ExpressionFunc(expression, inputs=None)
+
+    A frame function computed from an expression, such as "clamp(frame / 30, 0, 1)".
+    Give a tuple of up to four expressions (or None) for the components of the
+    result. The expressions are compiled once, when the function is created,
+    and evaluated in C without the GIL, so render threads can use them freely.
+
+    Expressions can use numbers, "frame", "pi", + - * / % ** and parentheses,
+    and min, max, clamp(x, lo, hi), lerp(a, b, t), smoothstep(lo, hi, x), abs,
+    floor, ceil, sqrt, sin, cos, exp, log, ease_in, ease_out, and ease_in_out.
+
+    inputs is a dictionary of other frame functions (or constants) by name. In
+    the expression, "name" is an input's first component at the current frame,
+    "name(expr)" is its value at another frame, and "name.y" or "name(expr).y"
+    picks out another component (x, y, z, w or r, g, b, a).
+*/
+static PyTypeObject py_type_ExpressionFunc = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "fluggo.media.process.ExpressionFunc",
+    .tp_basicsize = sizeof(py_obj_ExpressionFunc),
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_base = &py_type_FrameFunction,
+    .tp_new = PyType_GenericNew,
+    .tp_dealloc = (destructor) ExpressionFunc_dealloc,
+    .tp_init = (initproc) ExpressionFunc_init,
+    .tp_getset = ExpressionFunc_getsetters,
+};
+
+void init_ExpressionFunc( PyObject *module ) {
+    if( PyType_Ready( &py_type_ExpressionFunc ) < 0 )
+        return;
+
+    Py_INCREF( (PyObject*) &py_type_ExpressionFunc );
+    PyModule_AddObject( module, "ExpressionFunc", (PyObject *) &py_type_ExpressionFunc );
+
+    ExpressionFunc_pysourceFuncs = PyCapsule_New( &ExpressionFunc_sourceFuncs,
+        FRAME_FUNCTION_FUNCS, NULL );
+}
+
@@ -0,0 +1,557 @@
+/*
+    This file is part of the Fluggo Media Library for high-quality
+    video and audio processing.
+
+    Copyright 2012 Brian J. Crowell <brian@fluggo.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "pyframework.h"
+
+#undef G_LOG_DOMAIN
+#define G_LOG_DOMAIN "fluggo.media.process.MatroskaMuxer"
+
+typedef struct __track_t {
+    CodecPacketSourceHolder source;
+    matroska_track_params params;
+    int number;
+
+    // Packet timestamps to timecodes: timecode = time * num / den
+    int64_t num, den;
+
+    // Written ahead of the first packet, if any
+    void *prefix;
+    int prefix_size;
+
+    codec_packet *next_packet;
+    int64_t next_timecode;
+
+    struct __track_t *next;
+} track_t;
+
+typedef struct {
+    PyObject_HEAD
+
+    char *filename, *doc_type, *writing_app, *title;
+    int64_t timecode_scale;
+    track_t *track_list;
+    PyObject *tags;
+    volatile bool quit;
+} py_obj_MatroskaMuxer;
+
+static int
+MatroskaMuxer_init( py_obj_MatroskaMuxer *self, PyObject *args, PyObject *kw ) {
+    const char *filename, *writing_app = "Fluggo Media Library", *title = NULL, *doc_type = "matroska";
+    long long timecode_scale = 1000000;
+
+    static char *kwlist[] = { "filename", "writing_app", "title", "doc_type", "timecode_scale", NULL };
+
+    if( !PyArg_ParseTupleAndKeywords( args, kw, "s|szsL", kwlist,
+            &filename, &writing_app, &title, &doc_type, &timecode_scale ) )
+        return -1;
+
+    if( strcmp( doc_type, "matroska" ) && strcmp( doc_type, "webm" ) ) {
+        PyErr_SetString( PyExc_ValueError, "doc_type must be \"matroska\" or \"webm\"." );
+        return -1;
+    }
+
+    if( timecode_scale < 1 ) {
+        PyErr_SetString( PyExc_ValueError, "timecode_scale must be positive." );
+        return -1;
+    }
+
+    self->filename = g_strdup( filename );
+    self->doc_type = g_strdup( doc_type );
+    self->writing_app = g_strdup( writing_app );
+    self->title = g_strdup( title );
+    self->timecode_scale = timecode_scale;
+    self->tags = PyList_New( 0 );
+
+    return self->tags ? 0 : -1;
+}
+
+static void
+track_free( track_t *track ) {
+    py_codec_packet_take_source( NULL, &track->source );
+
+    if( track->next_packet && track->next_packet->free_func )
+        track->next_packet->free_func( track->next_packet );
+
+    g_free( (char *) track->params.codec_id );
+    g_free( (void *) track->params.codec_private );
+    g_free( track->prefix );
+    g_slice_free( track_t, track );
+}
+
+static void
+MatroskaMuxer_dealloc( py_obj_MatroskaMuxer *self ) {
+    while( self->track_list ) {
+        track_t *current = self->track_list;
+        self->track_list = current->next;
+        track_free( current );
+    }
+
+    g_free( self->filename );
+    g_free( self->doc_type );
+    g_free( self->writing_app );
+    g_free( self->title );
+    Py_CLEAR( self->tags );
+
+    Py_TYPE(self)->tp_free( (PyObject*) self );
+}
+
+static void
+track_append( track_t **list, track_t *next ) {
+    int number = 1;
+
+    while( *list ) {
+        list = &(*list)->next;
+        number++;
+    }
+
+    next->number = number;
+    *list = next;
+}
+
+static int64_t
+gcd( int64_t a, int64_t b ) {
+    while( b ) {
+        int64_t t = a % b;
+        a = b;
+        b = t;
+    }
+
+    return a;
+}
+
+/*
+    Sets up the parts of a track every type has in common. rate is the number
+    of packet time units per second.
+*/
+static track_t *
+track_new( py_obj_MatroskaMuxer *self, PyObject *source_obj, const char *codec_id,
+        const rational *rate, PyObject *codec_private_obj, PyObject *prefix_obj ) {
+    int count = 0;
+
+    for( track_t *track = self->track_list; track; track = track->next )
+        count++;
+
+    if( count >= MATROSKA_MAX_TRACKS ) {
+        PyErr_Format( PyExc_ValueError, "A Matroska file can't have more than %d tracks.", MATROSKA_MAX_TRACKS );
+        return NULL;
+    }
+
+    if( rate->n < 1 || rate->d < 1 ) {
+        PyErr_SetString( PyExc_ValueError, "The rate must be positive." );
+        return NULL;
+    }
+
+    track_t *track = g_slice_new0( track_t );
+
+    if( !py_codec_packet_take_source( source_obj, &track->source ) ) {
+        g_slice_free( track_t, track );
+        return NULL;
+    }
+
+    track->params.codec_id = g_strdup( codec_id );
+
+    const int64_t num = INT64_C(1000000000) * rate->d, den = (int64_t) rate->n * self->timecode_scale;
+    const int64_t divisor = gcd( num, den );
+
+    track->num = num / divisor;
+    track->den = den / divisor;
+
+    if( codec_private_obj && codec_private_obj != Py_None ) {
+        Py_buffer buffer;
+
+        if( PyObject_GetBuffer( codec_private_obj, &buffer, PyBUF_SIMPLE ) < 0 ) {
+            track_free( track );
+            return NULL;
+        }
+
+        track->params.codec_private = g_memdup( buffer.buf, buffer.len );
+        track->params.codec_private_size = buffer.len;
+        PyBuffer_Release( &buffer );
+    }
+    else if( track->source.source.funcs->getHeader ) {
+        // Take the codec's own header
+        codec_getHeaderFunc get_header = track->source.source.funcs->getHeader;
+        int size = get_header( track->source.source.obj, NULL );
+
+        if( size > 0 ) {
+            void *header = g_malloc( size );
+
+            if( !get_header( track->source.source.obj, header ) ) {
+                g_free( header );
+                track_free( track );
+                PyErr_SetString( PyExc_Exception, "Couldn't retrieve the header from the source." );
+                return NULL;
+            }
+
+            track->params.codec_private = header;
+            track->params.codec_private_size = size;
+        }
+    }
+
+    if( prefix_obj && prefix_obj != Py_None ) {
+        Py_buffer buffer;
+
+        if( PyObject_GetBuffer( prefix_obj, &buffer, PyBUF_SIMPLE ) < 0 ) {
+            track_free( track );
+            return NULL;
+        }
+
+        track->prefix = g_memdup( buffer.buf, buffer.len );
+        track->prefix_size = buffer.len;
+        PyBuffer_Release( &buffer );
+    }
+
+    return track;
+}
+
+static PyObject *
+MatroskaMuxer_add_video_track( py_obj_MatroskaMuxer *self, PyObject *args, PyObject *kw ) {
+    PyObject *source_obj, *frame_rate_obj, *frame_size_obj, *sample_aspect_ratio_obj = NULL;
+    PyObject *interlaced_obj = NULL, *codec_private_obj = NULL, *prefix_obj = NULL;
+    const char *codec_id;
+
+    static char *kwlist[] = { "source", "codec_id", "frame_rate", "frame_size", "sample_aspect_ratio",
+        "interlaced", "codec_private", "prefix", NULL };
+
+    if( !PyArg_ParseTupleAndKeywords( args, kw, "OsOO|OOOO", kwlist, &source_obj, &codec_id,
+            &frame_rate_obj, &frame_size_obj, &sample_aspect_ratio_obj, &interlaced_obj,
+            &codec_private_obj, &prefix_obj ) )
+        return NULL;
+
+    rational frame_rate, sample_aspect_ratio = { 1, 1 };
+    v2i frame_size;
+
+    if( !py_parse_rational( frame_rate_obj, &frame_rate ) )
+        return NULL;
+
+    if( !py_parse_v2i( frame_size_obj, &frame_size ) )
+        return NULL;
+
+    if( sample_aspect_ratio_obj && !py_parse_rational( sample_aspect_ratio_obj, &sample_aspect_ratio ) )
+        return NULL;
+
+    if( sample_aspect_ratio.n < 1 || sample_aspect_ratio.d < 1 ) {
+        PyErr_SetString( PyExc_ValueError, "sample_aspect_ratio must be positive." );
+        return NULL;
+    }
+
+    track_t *track = track_new( self, source_obj, codec_id, &frame_rate, codec_private_obj, prefix_obj );
+
+    if( !track )
+        return NULL;
+
+    track->params.type = MATROSKA_TRACK_VIDEO;
+    track->params.default_duration = (INT64_C(1000000000) * frame_rate.d + frame_rate.n / 2) / frame_rate.n;
+    track->params.pixel_size = frame_size;
+    track->params.display_size = (v2i) {
+        ((int64_t) frame_size.x * sample_aspect_ratio.n + sample_aspect_ratio.d / 2) / sample_aspect_ratio.d,
+        frame_size.y };
+    track->params.interlaced = interlaced_obj && (PyObject_IsTrue( interlaced_obj ) == 1);
+
+    track_append( &self->track_list, track );
+
+    Py_RETURN_NONE;
+}
+
+static PyObject *
+MatroskaMuxer_add_audio_track( py_obj_MatroskaMuxer *self, PyObject *args, PyObject *kw ) {
+    PyObject *source_obj, *codec_private_obj = NULL;
+    const char *codec_id;
+    int sample_rate, channels, bit_depth = 0;
+
+    static char *kwlist[] = { "source", "codec_id", "sample_rate", "channels", "bit_depth", "codec_private", NULL };
+
+    if( !PyArg_ParseTupleAndKeywords( args, kw, "Osii|iO", kwlist, &source_obj, &codec_id,
+            &sample_rate, &channels, &bit_depth, &codec_private_obj ) )
+        return NULL;
+
+    if( channels < 1 ) {
+        PyErr_SetString( PyExc_ValueError, "channels must be at least one." );
+        return NULL;
+    }
+
+    const rational rate = { sample_rate, 1 };
+    track_t *track = track_new( self, source_obj, codec_id, &rate, codec_private_obj, NULL );
+
+    if( !track )
+        return NULL;
+
+    track->params.type = MATROSKA_TRACK_AUDIO;
+    track->params.sample_rate = sample_rate;
+    track->params.channels = channels;
+    track->params.bit_depth = bit_depth;
+
+    track_append( &self->track_list, track );
+
+    Py_RETURN_NONE;
+}
+
+static PyObject *
+MatroskaMuxer_add_tag( py_obj_MatroskaMuxer *self, PyObject *args, PyObject *kw ) {
+    const char *name, *value, *target_type = NULL;
+    int target_type_value = 50;
+
+    static char *kwlist[] = { "name", "value", "target_type_value", "target_type", NULL };
+
+    if( !PyArg_ParseTupleAndKeywords( args, kw, "ss|iz", kwlist, &name, &value, &target_type_value, &target_type ) )
+        return NULL;
+
+    PyObject *tag = Py_BuildValue( "ssiz", name, value, target_type_value, target_type );
+
+    if( !tag )
+        return NULL;
+
+    int result = PyList_Append( self->tags, tag );
+    Py_DECREF(tag);
+
+    if( result < 0 )
+        return NULL;
+
+    Py_RETURN_NONE;
+}
+
+static int64_t
+get_timecode( const track_t *track, int64_t time ) {
+    // Round to the nearest, but keep rounding the same on both sides of zero
+    const int64_t scaled = time * track->num + track->den / 2;
+    return (scaled >= 0) ? scaled / track->den : -((track->den - 1 - scaled) / track->den);
+}
+
+// Returns false if the source failed, rather than ran out
+static bool
+fetch_packet( track_t *track ) {
+    track->next_packet = track->source.source.funcs->getNextPacket( track->source.source.obj );
+
+    if( !track->next_packet )
+        return !py_codec_packet_source_failed();
+
+    codec_packet *packet = track->next_packet;
+    track->next_timecode = get_timecode( track, (packet->dts != PACKET_TS_NONE) ? packet->dts : packet->pts );
+
+    return true;
+}
+
+static PyObject *
+MatroskaMuxer_run( py_obj_MatroskaMuxer *self, PyObject *args, PyObject *kw ) {
+    self->quit = false;
+
+    if( !self->track_list ) {
+        PyErr_SetString( PyExc_Exception, "There are no tracks to write." );
+        return NULL;
+    }
+
+    matroska_writer *writer = matroska_writer_open( self->filename, self->doc_type, self->timecode_scale );
+
+    if( !writer ) {
+        PyErr_SetFromErrnoWithFilename( PyExc_IOError, self->filename );
+        return NULL;
+    }
+
+    for( track_t *track = self->track_list; track; track = track->next )
+        matroska_writer_add_track( writer, &track->params );
+
+    for( Py_ssize_t i = 0; i < PyList_GET_SIZE( self->tags ); i++ ) {
+        const char *name, *value, *target_type;
+        int target_type_value;
+
+        if( !PyArg_ParseTuple( PyList_GET_ITEM( self->tags, i ), "ssiz", &name, &value, &target_type_value, &target_type ) ) {
+            matroska_writer_abort( writer );
+            return NULL;
+        }
+
+        matroska_writer_add_tag( writer, target_type_value, target_type, name, value );
+    }
+
+    bool success = false, source_failed = false, canceled = false;
+    int64_t duration = 0;
+
+    Py_BEGIN_ALLOW_THREADS
+
+    if( !matroska_writer_write_header( writer, self->writing_app, self->title ) )
+        goto error;
+
+    for( track_t *track = self->track_list; track; track = track->next ) {
+        if( !fetch_packet( track ) ) {
+            source_failed = true;
+            goto error;
+        }
+    }
+
+    while( !self->quit ) {
+        // Interleave by decode time
+        track_t *next = NULL;
+
+        for( track_t *track = self->track_list; track; track = track->next ) {
+            if( track->next_packet && (!next || track->next_timecode < next->next_timecode) )
+                next = track;
+        }
+
+        if( !next )
+            break;
+
+        codec_packet *packet = next->next_packet;
+        bool written;
+
+        if( next->prefix ) {
+            // Only ever once, so the copy doesn't hurt
+            const int length = next->prefix_size + packet->length;
+            uint8_t *data = g_malloc( length );
+
+            memcpy( data, next->prefix, next->prefix_size );
+            memcpy( data + next->prefix_size, packet->data, packet->length );
+
+            written = matroska_writer_write_block( writer, next->number, get_timecode( next, packet->pts ),
+                data, length, packet->keyframe, packet->discardable );
+
+            g_free( data );
+            g_free( next->prefix );
+            next->prefix = NULL;
+        }
+        else {
+            written = matroska_writer_write_block( writer, next->number, get_timecode( next, packet->pts ),
+                packet->data, packet->length, packet->keyframe, packet->discardable );
+        }
+
+        if( !written )
+            goto error;
+
+        const int64_t end = get_timecode( next, packet->pts + (packet->duration ? packet->duration : 1) );
+
+        if( end > duration )
+            duration = end;
+
+        if( packet->free_func )
+            packet->free_func( packet );
+
+        if( !fetch_packet( next ) ) {
+            source_failed = true;
+            goto error;
+        }
+    }
+
+    if( self->quit ) {
+        // Don't finish a file that's missing the end; it would look whole
+        canceled = true;
+        goto error;
+    }
+
+    success = matroska_writer_close( writer, duration );
+    writer = NULL;
+
+error:
+    if( writer ) {
+        int error = errno;
+        matroska_writer_abort( writer );
+        errno = error;
+    }
+
+    Py_END_ALLOW_THREADS
+
+    if( !success ) {
+        // A source that failed has already set its exception
+        if( canceled )
+            PyErr_SetString( PyExc_Exception, "The run was canceled." );
+        else if( !source_failed )
+            PyErr_SetFromErrnoWithFilename( PyExc_IOError, self->filename );
+
+        return NULL;
+    }
+
+    Py_RETURN_NONE;
+}
+
+static PyObject *
+MatroskaMuxer_cancel( py_obj_MatroskaMuxer *self, PyObject *args, PyObject *kw ) {
+    self->quit = true;
+    Py_RETURN_NONE;
+}
+
+static PyMethodDef MatroskaMuxer_methods[] = {
+    { "add_video_track", (PyCFunction) MatroskaMuxer_add_video_track, METH_VARARGS | METH_KEYWORDS,
+        "Add a video track to the output.\n"
+        "\n"
+        "muxer.add_video_track(source, codec_id, frame_rate, frame_size, sample_aspect_ratio=1,\n"
+        "    interlaced=False, codec_private=None, prefix=None)\n"
+        "\n"
+        "source - A codec packet source, with timestamps in frames.\n"
+        "codec_id - The Matroska codec ID, such as 'V_MPEG4/ISO/AVC'.\n"
+        "frame_rate - The video frame rate as a rational.\n"
+        "frame_size - A v2i value with the size of the frame.\n"
+        "sample_aspect_ratio - The sample aspect ratio as a rational.\n"
+        "interlaced - True if the video is interlaced.\n"
+        "codec_private - Codec setup data in the form the codec ID calls for. The default\n"
+        "    is the source's header.\n"
+        "prefix - Data to put ahead of the first packet, such as an SEI." },
+    { "add_audio_track", (PyCFunction) MatroskaMuxer_add_audio_track, METH_VARARGS | METH_KEYWORDS,
+        "Add an audio track to the output.\n"
+        "\n"
+        "muxer.add_audio_track(source, codec_id, sample_rate, channels, bit_depth=0, codec_private=None)\n"
+        "\n"
+        "source - A codec packet source, with timestamps in samples.\n"
+        "codec_id - The Matroska codec ID, such as 'A_AAC'.\n"
+        "sample_rate - The sample rate in Hz.\n"
+        "channels - Number of channels.\n"
+        "bit_depth - Bits per sample, or zero if that doesn't apply to the codec.\n"
+        "codec_private - Codec setup data. The default is the source's header." },
+    { "add_tag", (PyCFunction) MatroskaMuxer_add_tag, METH_VARARGS | METH_KEYWORDS,
+        "Add a simple tag to the output.\n"
+        "\n"
+        "muxer.add_tag(name, value, target_type_value=50, target_type=None)\n"
+        "\n"
+        "name - Tag name, such as 'TITLE' or 'DESCRIPTION'.\n"
+        "value - Tag value as a string.\n"
+        "target_type_value - Level the tag applies to; 50 is a movie or album.\n"
+        "target_type - Name of the level, such as 'MOVIE', or None." },
+    { "run", (PyCFunction) MatroskaMuxer_run, METH_NOARGS,
+        "Run the muxer and write the complete file. Raises an exception if the\n"
+        "write fails, a source fails, or the run is canceled." },
+    { "cancel", (PyCFunction) MatroskaMuxer_cancel, METH_NOARGS,
+        "Cancel a current run() call. The file is left incomplete, and run() raises." },
+    { NULL }
+};
+
+/*
+    MatroskaMuxer(filename, writing_app='Fluggo Media Library', title=None, doc_type='matroska', timecode_scale=1000000)
+
+    Writes codec packet sources to a Matroska or WebM file entirely in C. Add the
+    tracks and tags, then call run(), which pulls every packet from the sources,
+    interleaves them by decode time, and writes the file with cues for the video
+    keyframes. timecode_scale is the length of a timecode unit in nanoseconds;
+    the default of a millisecond is enough for video, but audio-only files may
+    want something finer.
+*/
+static PyTypeObject py_type_MatroskaMuxer = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "fluggo.media.process.MatroskaMuxer",
+    .tp_basicsize = sizeof(py_obj_MatroskaMuxer),
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_new = PyType_GenericNew,
+    .tp_dealloc = (destructor) MatroskaMuxer_dealloc,
+    .tp_init = (initproc) MatroskaMuxer_init,
+    .tp_methods = MatroskaMuxer_methods
+};
+
+void init_MatroskaMuxer( PyObject *module ) {
+    if( PyType_Ready( &py_type_MatroskaMuxer ) < 0 )
+        return;
+
+    Py_INCREF( &py_type_MatroskaMuxer );
+    PyModule_AddObject( module, "MatroskaMuxer", (PyObject *) &py_type_MatroskaMuxer );
+}
@@ -0,0 +1,336 @@
+/*
+    This file is part of the Fluggo Media Library for high-quality
+    video and audio processing.
+
+    Copyright 2012 Brian J. Crowell <brian@fluggo.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "pyframework.h"
+
+#undef G_LOG_DOMAIN
+#define G_LOG_DOMAIN "fluggo.media.process.RawDVSource"
+
+// Frame sizes for standard-definition DV
+#define DV_FRAME_SIZE_525_60    120000
+#define DV_FRAME_SIZE_625_50    144000
+
+// Header DIF block: section type in the top three bits of the first byte,
+// and the DSF flag (set for 625/50) in the top bit of the fourth
+#define DV_DIF_BLOCK_SIZE       80
+#define DV_DSF_FLAG             0x80
+
+#define DEFAULT_READAHEAD       30
+
+/*
+    The file is mapped once and shared by every packet we hand out, so the
+    packets point right into the mapping. The last one out unmaps it.
+*/
+typedef struct {
+    void *data;
+    size_t length;
+    int ref_count;
+} dv_mapping;
+
+typedef struct {
+    codec_packet packet;
+    dv_mapping *mapping;
+} dv_packet;
+
+static void
+dv_mapping_unref( dv_mapping *mapping ) {
+    if( g_atomic_int_dec_and_test( &mapping->ref_count ) ) {
+        munmap( mapping->data, mapping->length );
+        g_slice_free( dv_mapping, mapping );
+    }
+}
+
+static void
+dv_packet_free( dv_packet *packet ) {
+    dv_mapping_unref( packet->mapping );
+    g_slice_free( dv_packet, packet );
+}
+
+typedef struct {
+    PyObject_HEAD
+
+    dv_mapping *mapping;
+    int frame_size, readahead;
+    int64_t frame_count, next_frame;
+
+    // Direction we're playing (1 forward, -1 backward), and the
+    // frames we've already asked the kernel to read in
+    int direction;
+    int64_t advised_min, advised_max;
+    long page_size;
+
+    GMutex mutex;
+} py_obj_RawDVSource;
+
+static int
+RawDVSource_init( py_obj_RawDVSource *self, PyObject *args, PyObject *kw ) {
+    const char *filename;
+    int frame_size = 0, readahead = DEFAULT_READAHEAD;
+
+    // Zero all pointers (so we know later what needs deleting)
+    self->mapping = NULL;
+
+    static char *kwlist[] = { "filename", "frame_size", "readahead", NULL };
+
+    if( !PyArg_ParseTupleAndKeywords( args, kw, "s|ii", kwlist, &filename, &frame_size, &readahead ) )
+        return -1;
+
+    if( frame_size < 0 || (frame_size > 0 && frame_size < DV_DIF_BLOCK_SIZE) ) {
+        PyErr_SetString( PyExc_ValueError, "frame_size is too small to be a DV frame." );
+        return -1;
+    }
+
+    if( readahead < 0 ) {
+        PyErr_SetString( PyExc_ValueError, "readahead must not be negative." );
+        return -1;
+    }
+
+    int fd = open( filename, O_RDONLY );
+
+    if( fd < 0 ) {
+        PyErr_SetFromErrnoWithFilename( PyExc_IOError, filename );
+        return -1;
+    }
+
+    struct stat info;
+
+    if( fstat( fd, &info ) != 0 ) {
+        PyErr_SetFromErrnoWithFilename( PyExc_IOError, filename );
+        close( fd );
+        return -1;
+    }
+
+    if( info.st_size < DV_DIF_BLOCK_SIZE ) {
+        PyErr_Format( PyExc_Exception, "The file \"%s\" is too short to be raw DV.", filename );
+        close( fd );
+        return -1;
+    }
+
+    void *data = mmap( NULL, info.st_size, PROT_READ, MAP_SHARED, fd, 0 );
+
+    // The mapping keeps the file open for us
+    close( fd );
+
+    if( data == MAP_FAILED ) {
+        PyErr_SetFromErrnoWithFilename( PyExc_IOError, filename );
+        return -1;
+    }
+
+    const uint8_t *header = (const uint8_t *) data;
+
+    if( (header[0] >> 5) != 0 ) {
+        PyErr_Format( PyExc_Exception, "The file \"%s\" doesn't start with a DV header block.", filename );
+        munmap( data, info.st_size );
+        return -1;
+    }
+
+    if( frame_size == 0 )
+        frame_size = (header[3] & DV_DSF_FLAG) ? DV_FRAME_SIZE_625_50 : DV_FRAME_SIZE_525_60;
+
+    self->mapping = g_slice_new( dv_mapping );
+    self->mapping->data = data;
+    self->mapping->length = info.st_size;
+    self->mapping->ref_count = 1;
+
+    self->frame_size = frame_size;
+    self->frame_count = info.st_size / frame_size;
+    self->readahead = readahead;
+    self->next_frame = 0;
+    self->direction = 1;
+    self->advised_min = 0;
+    self->advised_max = -1;
+    self->page_size = sysconf( _SC_PAGESIZE );
+
+    g_mutex_init( &self->mutex );
+
+    return 0;
+}
+
+static void
+RawDVSource_dealloc( py_obj_RawDVSource *self ) {
+    if( self->mapping ) {
+        dv_mapping_unref( self->mapping );
+        self->mapping = NULL;
+
+        g_mutex_clear( &self->mutex );
+    }
+
+    Py_TYPE(self)->tp_free( (PyObject*) self );
+}
+
+/*
+    Function: advise
+    Asks the kernel to start reading the frames we're about to want, in the direction
+    we're playing. Call with the mutex held.
+*/
+static void
+advise( py_obj_RawDVSource *self, int64_t frame ) {
+    if( self->readahead == 0 )
+        return;
+
+    // Only ask again when we're halfway through what we asked for last time
+    int64_t min_frame, max_frame;
+
+    if( self->direction > 0 ) {
+        if( frame >= self->advised_min && frame + self->readahead / 2 <= self->advised_max )
+            return;
+
+        min_frame = frame;
+        max_frame = min( frame + self->readahead, self->frame_count - 1 );
+    }
+    else {
+        if( frame <= self->advised_max && frame - self->readahead / 2 >= self->advised_min )
+            return;
+
+        min_frame = max( frame - self->readahead, 0 );
+        max_frame = frame;
+    }
+
+    if( max_frame < min_frame )
+        return;
+
+    // posix_madvise wants a page-aligned start
+    size_t start = (size_t) min_frame * self->frame_size;
+    size_t end = (size_t)(max_frame + 1) * self->frame_size;
+
+    start -= start % self->page_size;
+
+    if( posix_madvise( (uint8_t *) self->mapping->data + start, end - start, POSIX_MADV_WILLNEED ) != 0 )
+        g_debug( "posix_madvise failed for frames %" PRId64 "-%" PRId64, min_frame, max_frame );
+
+    self->advised_min = min_frame;
+    self->advised_max = max_frame;
+}
+
+static codec_packet *
+RawDVSource_get_next_packet( py_obj_RawDVSource *self ) {
+    g_mutex_lock( &self->mutex );
+
+    if( self->next_frame < 0 || self->next_frame >= self->frame_count ) {
+        g_mutex_unlock( &self->mutex );
+        return NULL;
+    }
+
+    int64_t frame = self->next_frame++;
+    advise( self, frame );
+
+    g_mutex_unlock( &self->mutex );
+
+    dv_packet *packet = g_slice_new0( dv_packet );
+
+    g_atomic_int_inc( &self->mapping->ref_count );
+    packet->mapping = self->mapping;
+
+    packet->packet.data = (uint8_t *) self->mapping->data + frame * self->frame_size;
+    packet->packet.length = self->frame_size;
+    packet->packet.pts = frame;
+    packet->packet.dts = frame;
+    packet->packet.duration = 1;
+    packet->packet.keyframe = true;
+    packet->packet.discardable = false;
+    packet->packet.free_func = (GFreeFunc) dv_packet_free;
+
+    return (codec_packet *) packet;
+}
+
+static bool
+RawDVSource_seek( py_obj_RawDVSource *self, int64_t frame ) {
+    if( frame < 0 || frame > self->frame_count )
+        return false;
+
+    g_mutex_lock( &self->mutex );
+
+    // Stepping backwards (seek to N, read, seek to N-1, ...) shows up as seeks behind the last frame read
+    self->direction = (frame < self->next_frame - 1) ? -1 : 1;
+    self->next_frame = frame;
+
+    g_mutex_unlock( &self->mutex );
+
+    return true;
+}
+
+static codec_packet_source_funcs source_funcs = {
+    .getNextPacket = (codec_getNextPacketFunc) RawDVSource_get_next_packet,
+    .seek = (codec_seekFunc) RawDVSource_seek,
+};
+
+static PyObject *pySourceFuncs;
+
+static PyObject *
+RawDVSource_getFuncs( py_obj_RawDVSource *self, void *closure ) {
+    Py_INCREF(pySourceFuncs);
+    return pySourceFuncs;
+}
+
+static PyObject *
+RawDVSource_get_frame_count( py_obj_RawDVSource *self, void *closure ) {
+    return PyLong_FromLongLong( self->frame_count );
+}
+
+static PyObject *
+RawDVSource_get_frame_size( py_obj_RawDVSource *self, void *closure ) {
+    return PyLong_FromLong( self->frame_size );
+}
+
+static PyGetSetDef RawDVSource_getsetters[] = {
+    { CODEC_PACKET_SOURCE_FUNCS, (getter) RawDVSource_getFuncs, NULL, "Codec packet source C API." },
+    { "frame_count", (getter) RawDVSource_get_frame_count, NULL, "Number of whole frames in the file." },
+    { "frame_size", (getter) RawDVSource_get_frame_size, NULL, "Size of each frame in bytes." },
+    { NULL }
+};
+
+/*
+    RawDVSource(filename, frame_size=0, readahead=30)
+
+    Codec packet source for raw DV files (.dv, not wrapped in another container).
+    DV frames are all the same size, so frame N is found by arithmetic, and the
+    packets point straight into a memory mapping of the file. The frame size is
+    taken from the file's first header block (120,000 bytes for 525/60, 144,000
+    for 625/50) unless you give a nonzero one. readahead is how many frames ahead (or behind,
+    when stepping backwards) to ask the kernel to read in.
+*/
+static PyTypeObject py_type_RawDVSource = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "fluggo.media.process.RawDVSource",
+    .tp_basicsize = sizeof(py_obj_RawDVSource),
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_base = &py_type_CodecPacketSource,
+    .tp_new = PyType_GenericNew,
+    .tp_dealloc = (destructor) RawDVSource_dealloc,
+    .tp_init = (initproc) RawDVSource_init,
+    .tp_getset = RawDVSource_getsetters,
+};
+
+void init_RawDVSource( PyObject *module ) {
+    if( PyType_Ready( &py_type_RawDVSource ) < 0 )
+        return;
+
+    Py_INCREF( (PyObject*) &py_type_RawDVSource );
+    PyModule_AddObject( module, "RawDVSource", (PyObject *) &py_type_RawDVSource );
+
+    pySourceFuncs = PyCapsule_New( &source_funcs,
+        CODEC_PACKET_SOURCE_FUNCS, NULL );
+}
+
@@ -22,19 +22,96 @@
 
 static PyObject *pysource_funcs;
 
+typedef struct {
+    rgba_frame_f16 frame;
+
+    // The buffer this frame wraps, if it doesn't own its data
+    Py_buffer wrapped;
+} frame_priv;
+
 #define PRIV(obj)        ((rgba_frame_f16*)(((void *) obj) + py_type_VideoSource.tp_basicsize))
+#define WRAPPED(obj)     (&((frame_priv*)(((void *) obj) + py_type_VideoSource.tp_basicsize))->wrapped)
 
 static void
 RgbaFrameF16_getFrame_f16( PyObject *self, int frame_index, rgba_frame_f16 *frame ) {
     video_copy_frame_f16( frame, PRIV(self) );
 }
 
+static int
+RgbaFrameF16_init( PyObject *self, PyObject *args, PyObject *kw ) {
+    PyObject *buffer_obj, *full_window_obj, *current_window_obj = NULL;
+    box2i full_window, current_window;
+
+    static char *kwlist[] = { "buffer", "full_window", "current_window", NULL };
+
+    if( !PyArg_ParseTupleAndKeywords( args, kw, "OO|O", kwlist,
+            &buffer_obj, &full_window_obj, &current_window_obj ) )
+        return -1;
+
+    if( PRIV(self)->data ) {
+        PyErr_SetString( PyExc_Exception, "The frame already has its data." );
+        return -1;
+    }
+
+    if( !py_parse_box2i( full_window_obj, &full_window ) )
+        return -1;
+
+    current_window = full_window;
+
+    if( current_window_obj && !py_parse_box2i( current_window_obj, &current_window ) )
+        return -1;
+
+    if( box2i_is_empty( &full_window ) ) {
+        PyErr_SetString( PyExc_ValueError, "full_window must not be empty." );
+        return -1;
+    }
+
+    if( !box2i_is_empty( &current_window ) &&
+            (current_window.min.x < full_window.min.x || current_window.min.y < full_window.min.y ||
+             current_window.max.x > full_window.max.x || current_window.max.y > full_window.max.y) ) {
+        PyErr_SetString( PyExc_ValueError, "current_window must be inside full_window." );
+        return -1;
+    }
+
+    v2i size;
+    box2i_get_size( &full_window, &size );
+
+    if( !py_wrap_buffer( buffer_obj, WRAPPED(self), sizeof(rgba_f16) * size.x * size.y, sizeof(half) ) )
+        return -1;
+
+    PRIV(self)->data = WRAPPED(self)->buf;
+    PRIV(self)->full_window = full_window;
+    PRIV(self)->current_window = current_window;
+
+    return 0;
+}
+
 static void
 RgbaFrameF16_dealloc( PyObject *self ) {
-    PyMem_Free( PRIV(self)->data );
+    if( WRAPPED(self)->obj )
+        PyBuffer_Release( WRAPPED(self) );
+    else
+        PyMem_Free( PRIV(self)->data );
+
     self->ob_type->tp_free( self );
 }
 
+static int
+RgbaFrameF16_get_buffer( PyObject *self, Py_buffer *view, int flags ) {
+    v2i size;
+    box2i_get_size( &PRIV(self)->full_window, &size );
+
+    const Py_ssize_t shape[3] = { size.y, size.x, 4 };
+
+    return py_get_array_buffer( self, view, flags, PRIV(self)->data,
+        WRAPPED(self)->obj && WRAPPED(self)->readonly, "e", sizeof(half), 3, shape );
+}
+
+static PyBufferProcs RgbaFrameF16_buffer = {
+    .bf_getbuffer = (getbufferproc) RgbaFrameF16_get_buffer,
+    .bf_releasebuffer = (releasebufferproc) py_release_array_buffer,
+};
+
 static video_frame_source_funcs source_funcs = {
     .get_frame = (video_get_frame_func) RgbaFrameF16_getFrame_f16,
 };
@@ -156,16 +233,27 @@ static PyMethodDef RgbaFrameF16_methods[] = {
     { NULL }
 };
 
+/*
+    RgbaFrameF16(buffer, full_window, current_window=full_window)
+
+    A frame of half-float RGBA pixels. Made from Python, it wraps buffer in place,
+    without copying; buffer has to hold the pixels of full_window row by row, and
+    the frame is only writable if buffer is. Every frame exports its pixels with
+    the buffer protocol as an array of shape (height, width, 4) covering
+    full_window, so numpy.asarray(frame) reads them without a copy.
+*/
 static PyTypeObject py_type_RgbaFrameF16 = {
     PyVarObject_HEAD_INIT(NULL, 0)
     .tp_name = "fluggo.media.process.RgbaFrameF16",
     .tp_flags = Py_TPFLAGS_DEFAULT,
     .tp_new = PyType_GenericNew,
     .tp_base = &py_type_VideoSource,
+    .tp_init = (initproc) RgbaFrameF16_init,
     .tp_dealloc = (destructor) RgbaFrameF16_dealloc,
     .tp_getset = RgbaFrameF16_getsetters,
     .tp_methods = RgbaFrameF16_methods,
-    .tp_as_sequence = &RgbaFrameF16_sequence
+    .tp_as_sequence = &RgbaFrameF16_sequence,
+    .tp_as_buffer = &RgbaFrameF16_buffer,
 };
 
 /*
@@ -244,12 +332,17 @@ py_get_frame_f16( PyObject *self, PyObject *args, PyObject *kw ) {
         return NULL;
     }
 
-    if( force_gl && PyObject_IsTrue( force_gl ) ) {
+    bool use_gl = force_gl && PyObject_IsTrue( force_gl );
+
+    // Nothing else can see the frame yet, and sources take the GIL themselves if they need it
+    Py_BEGIN_ALLOW_THREADS
+    if( use_gl ) {
         video_get_frame_f16_gl( source, frame_index, PRIV(result) );
     }
     else {
         video_get_frame_f16( source, frame_index, PRIV(result) );
     }
+    Py_END_ALLOW_THREADS
 
     if( !py_video_take_source( NULL, &source ) ) {
         Py_DECREF(result);
@@ -260,7 +353,7 @@ py_get_frame_f16( PyObject *self, PyObject *args, PyObject *kw ) {
 }
 
 void init_RgbaFrameF16( PyObject *module ) {
-    py_type_RgbaFrameF16.tp_basicsize = py_type_VideoSource.tp_basicsize + sizeof(rgba_frame_f16);
+    py_type_RgbaFrameF16.tp_basicsize = py_type_VideoSource.tp_basicsize + sizeof(frame_priv);
 
     if( PyType_Ready( &py_type_RgbaFrameF16 ) < 0 )
         return;
@@ -0,0 +1,555 @@
+/*
+    This file is part of the Fluggo Media Library for high-quality
+    video and audio processing.
+
+    Copyright 2012 Brian J. Crowell <brian@fluggo.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "pyframework.h"
+
+#undef G_LOG_DOMAIN
+#define G_LOG_DOMAIN "fluggo.media.process.SegmentedEncoder"
+
+/*
+    Each segment is encoded start to finish by its own encoder, so it starts on
+    a keyframe and depends on nothing before it. The segments' packets are
+    handed out in order, with timestamps moved from the segment's own start
+    to the start of the whole range.
+
+    Encoders are created by calling back into Python, and released the same
+    way, so only the thread calling getNextPacket does either. Workers only
+    pull packets.
+
+    Packets from a segment wait in that segment's queue until every segment
+    before it has been handed out. A worker stops pulling once its queue holds
+    max_queued packets and picks up again as the queue drains, so at most two
+    segments per worker times max_queued packets are ever held at once.
+
+    If an encoder can't be created, or one fails partway, the exception is
+    kept, and getNextPacket raises it from then on instead of handing out a
+    stream with a hole in it.
+*/
+
+typedef struct {
+    int first_frame, last_frame;
+
+    // Owned by the getNextPacket thread; the worker just borrows source
+    CodecPacketSourceHolder encoder;
+
+    // Protected by the mutex
+    GQueue packets;
+    bool done;
+} segment;
+
+typedef struct {
+    PyObject_HEAD
+
+    PyObject *factory;
+    int start_frame, end_frame, segment_size, worker_count, max_queued;
+    int next_segment_frame;
+    void *header;
+    int header_size;
+
+    GThread **workers;
+    GMutex mutex;
+    GCond cond;
+
+    // Protected by the mutex: segments waiting for a worker, and every segment
+    // not yet handed out in full, in order
+    GQueue pending, active;
+    bool cancel, failed;
+
+    // Set once failed is, under the GIL
+    PyObject *error_type, *error_value, *error_traceback;
+} py_obj_SegmentedEncoder;
+
+/*
+    Keeps the exception that's set as the reason the stream failed, unless
+    there already is one. Needs the GIL.
+*/
+static void
+set_failed( py_obj_SegmentedEncoder *self ) {
+    g_mutex_lock( &self->mutex );
+
+    if( self->failed ) {
+        PyErr_Clear();
+    }
+    else {
+        PyErr_Fetch( &self->error_type, &self->error_value, &self->error_traceback );
+        self->failed = true;
+    }
+
+    g_cond_broadcast( &self->cond );
+    g_mutex_unlock( &self->mutex );
+}
+
+static gpointer
+worker_thread( py_obj_SegmentedEncoder *self ) {
+    // Keep a Python thread state for as long as we run, so that an exception
+    // an encoder sets is still there when we go to look for it
+    PyGILState_STATE gstate = PyGILState_Ensure();
+    PyThreadState *thread_state = PyEval_SaveThread();
+
+    g_mutex_lock( &self->mutex );
+
+    for( ;; ) {
+        if( self->cancel )
+            break;
+
+        segment *seg = g_queue_pop_head( &self->pending );
+
+        if( !seg ) {
+            g_cond_wait( &self->cond, &self->mutex );
+            continue;
+        }
+
+        g_mutex_unlock( &self->mutex );
+
+        const int64_t offset = seg->first_frame - self->start_frame;
+        codec_packet *packet;
+
+        while( (packet = seg->encoder.source.funcs->getNextPacket( seg->encoder.source.obj )) ) {
+            if( packet->pts != PACKET_TS_NONE )
+                packet->pts += offset;
+
+            if( packet->dts != PACKET_TS_NONE )
+                packet->dts += offset;
+
+            g_mutex_lock( &self->mutex );
+
+            // Don't run too far ahead of the segments before this one
+            while( !self->cancel && (int) g_queue_get_length( &seg->packets ) >= self->max_queued )
+                g_cond_wait( &self->cond, &self->mutex );
+
+            g_queue_push_tail( &seg->packets, packet );
+            g_cond_broadcast( &self->cond );
+
+            bool cancel = self->cancel;
+            g_mutex_unlock( &self->mutex );
+
+            if( cancel )
+                break;
+        }
+
+        if( !packet && py_codec_packet_source_failed() ) {
+            PyEval_RestoreThread( thread_state );
+            set_failed( self );
+            thread_state = PyEval_SaveThread();
+        }
+
+        g_mutex_lock( &self->mutex );
+        seg->done = true;
+        g_cond_broadcast( &self->cond );
+    }
+
+    g_mutex_unlock( &self->mutex );
+
+    PyEval_RestoreThread( thread_state );
+    PyGILState_Release( gstate );
+    return NULL;
+}
+
+static void
+free_packets( GQueue *packets ) {
+    codec_packet *packet;
+
+    while( (packet = g_queue_pop_head( packets )) ) {
+        if( packet->free_func )
+            packet->free_func( packet );
+    }
+}
+
+// Needs the GIL
+static void
+segment_free( segment *seg ) {
+    py_codec_packet_take_source( NULL, &seg->encoder );
+    free_packets( &seg->packets );
+    g_slice_free( segment, seg );
+}
+
+// Needs the GIL
+static segment *
+create_segment( py_obj_SegmentedEncoder *self ) {
+    segment *seg = g_slice_new0( segment );
+
+    seg->first_frame = self->next_segment_frame;
+    seg->last_frame = min( self->end_frame, seg->first_frame + self->segment_size - 1 );
+    g_queue_init( &seg->packets );
+
+    PyObject *encoder = PyObject_CallFunction( self->factory, "ii", seg->first_frame, seg->last_frame );
+
+    if( !encoder ) {
+        g_slice_free( segment, seg );
+        return NULL;
+    }
+
+    bool taken = py_codec_packet_take_source( encoder, &seg->encoder );
+    Py_DECREF(encoder);
+
+    if( !taken ) {
+        g_slice_free( segment, seg );
+        return NULL;
+    }
+
+    if( !seg->encoder.source.funcs->getNextPacket ) {
+        PyErr_SetString( PyExc_Exception, "The factory returned a source that can't produce packets." );
+        segment_free( seg );
+        return NULL;
+    }
+
+    self->next_segment_frame = seg->last_frame + 1;
+    return seg;
+}
+
+// Needs the GIL
+static void
+queue_segment( py_obj_SegmentedEncoder *self, segment *seg ) {
+    g_mutex_lock( &self->mutex );
+    g_queue_push_tail( &self->active, seg );
+    g_queue_push_tail( &self->pending, seg );
+    g_cond_broadcast( &self->cond );
+    g_mutex_unlock( &self->mutex );
+}
+
+/*
+    Releases the encoders of segments that are done (their packets stay queued),
+    then starts more segments, keeping up to two per worker queued or running.
+    Needs the GIL.
+*/
+static void
+refill_segments( py_obj_SegmentedEncoder *self ) {
+    GQueue finished = G_QUEUE_INIT;
+    int queued = 0;
+
+    g_mutex_lock( &self->mutex );
+
+    for( GList *link = self->active.head; link; link = link->next ) {
+        segment *seg = link->data;
+
+        if( seg->done && seg->encoder.source.obj )
+            g_queue_push_tail( &finished, seg );
+
+        queued++;
+    }
+
+    g_mutex_unlock( &self->mutex );
+
+    // Done segments belong to no one but us now
+    for( GList *link = finished.head; link; link = link->next )
+        py_codec_packet_take_source( NULL, &((segment *) link->data)->encoder );
+
+    g_queue_clear( &finished );
+
+    for( ; queued < self->worker_count * 2 && self->next_segment_frame <= self->end_frame; queued++ ) {
+        segment *seg = create_segment( self );
+
+        if( !seg ) {
+            set_failed( self );
+            self->next_segment_frame = self->end_frame + 1;
+            break;
+        }
+
+        queue_segment( self, seg );
+    }
+}
+
+static void
+stop_workers( py_obj_SegmentedEncoder *self ) {
+    if( !self->workers )
+        return;
+
+    g_mutex_lock( &self->mutex );
+    self->cancel = true;
+    g_cond_broadcast( &self->cond );
+    g_mutex_unlock( &self->mutex );
+
+    // Encoders might need the GIL to get their frames
+    Py_BEGIN_ALLOW_THREADS
+    for( int i = 0; i < self->worker_count; i++ )
+        g_thread_join( self->workers[i] );
+    Py_END_ALLOW_THREADS
+
+    g_free( self->workers );
+    self->workers = NULL;
+
+    segment *seg;
+
+    while( (seg = g_queue_pop_head( &self->active )) )
+        segment_free( seg );
+
+    g_queue_clear( &self->pending );
+}
+
+static int
+SegmentedEncoder_init( py_obj_SegmentedEncoder *self, PyObject *args, PyObject *kw ) {
+    PyObject *factory;
+    int segment_size = 250, workers = 0, max_queued = 0;
+
+    static char *kwlist[] = { "factory", "start_frame", "end_frame", "segment_size", "workers",
+        "max_queued", NULL };
+
+    if( !PyArg_ParseTupleAndKeywords( args, kw, "Oii|iii", kwlist,
+            &factory, &self->start_frame, &self->end_frame, &segment_size, &workers, &max_queued ) )
+        return -1;
+
+    if( !PyCallable_Check( factory ) ) {
+        PyErr_SetString( PyExc_TypeError, "factory must be callable." );
+        return -1;
+    }
+
+    if( self->end_frame < self->start_frame ) {
+        PyErr_SetString( PyExc_ValueError, "end_frame must not be less than start_frame." );
+        return -1;
+    }
+
+    if( segment_size < 1 ) {
+        PyErr_SetString( PyExc_ValueError, "segment_size must be at least one." );
+        return -1;
+    }
+
+    if( workers < 0 ) {
+        PyErr_SetString( PyExc_ValueError, "workers must not be negative." );
+        return -1;
+    }
+
+    if( max_queued < 0 ) {
+        PyErr_SetString( PyExc_ValueError, "max_queued must not be negative." );
+        return -1;
+    }
+
+    Py_INCREF(factory);
+    self->factory = factory;
+    self->segment_size = segment_size;
+    self->worker_count = workers ? workers : (int) g_get_num_processors();
+    self->max_queued = max_queued ? max_queued : segment_size;
+    self->next_segment_frame = self->start_frame;
+
+    g_mutex_init( &self->mutex );
+    g_cond_init( &self->cond );
+    g_queue_init( &self->pending );
+    g_queue_init( &self->active );
+
+    // The first encoder has to exist now to answer for the stream header;
+    // every segment's encoder is set up the same, so its header stands for all
+    segment *first = create_segment( self );
+
+    if( !first ) {
+        g_mutex_clear( &self->mutex );
+        g_cond_clear( &self->cond );
+        return -1;
+    }
+
+    codec_getHeaderFunc get_header = first->encoder.source.funcs->getHeader;
+
+    if( get_header && (self->header_size = get_header( first->encoder.source.obj, NULL )) > 0 ) {
+        self->header = g_malloc( self->header_size );
+
+        if( !get_header( first->encoder.source.obj, self->header ) ) {
+            segment_free( first );
+            g_mutex_clear( &self->mutex );
+            g_cond_clear( &self->cond );
+            PyErr_SetString( PyExc_Exception, "Couldn't retrieve the header." );
+            return -1;
+        }
+    }
+
+    self->workers = g_new0( GThread*, self->worker_count );
+
+    for( int i = 0; i < self->worker_count; i++ )
+        self->workers[i] = g_thread_new( "SegmentedEncoder worker", (GThreadFunc) worker_thread, self );
+
+    queue_segment( self, first );
+
+    return 0;
+}
+
+static void
+SegmentedEncoder_dealloc( py_obj_SegmentedEncoder *self ) {
+    if( self->workers ) {
+        stop_workers( self );
+        g_mutex_clear( &self->mutex );
+        g_cond_clear( &self->cond );
+    }
+
+    Py_CLEAR( self->error_type );
+    Py_CLEAR( self->error_value );
+    Py_CLEAR( self->error_traceback );
+    Py_CLEAR( self->factory );
+    g_free( self->header );
+    self->header = NULL;
+
+    Py_TYPE(self)->tp_free( (PyObject*) self );
+}
+
+static int
+SegmentedEncoder_get_header( py_obj_SegmentedEncoder *self, void *buffer ) {
+    if( !self->header )
+        return 0;
+
+    if( !buffer )
+        return self->header_size;
+
+    memcpy( buffer, self->header, self->header_size );
+    return 1;
+}
+
+static codec_packet *
+SegmentedEncoder_get_next_packet( py_obj_SegmentedEncoder *self ) {
+    // We may or may not be called with the GIL, but we need it to create and
+    // release encoders, and must not hold it while waiting on the workers
+    PyGILState_STATE gstate = PyGILState_Ensure();
+    codec_packet *packet = NULL;
+
+    for( ;; ) {
+        segment *finished = NULL;
+        bool failed;
+
+        refill_segments( self );
+
+        Py_BEGIN_ALLOW_THREADS
+        g_mutex_lock( &self->mutex );
+
+        for( ;; ) {
+            segment *seg = g_queue_peek_head( &self->active );
+
+            if( !seg || self->failed )
+                break;
+
+            if( (packet = g_queue_pop_head( &seg->packets )) ) {
+                // Its worker might be waiting for room
+                g_cond_broadcast( &self->cond );
+                break;
+            }
+
+            if( seg->done ) {
+                finished = g_queue_pop_head( &self->active );
+                break;
+            }
+
+            g_cond_wait( &self->cond, &self->mutex );
+        }
+
+        failed = self->failed;
+        g_mutex_unlock( &self->mutex );
+        Py_END_ALLOW_THREADS
+
+        if( failed ) {
+            if( packet && packet->free_func )
+                packet->free_func( packet );
+
+            if( finished )
+                segment_free( finished );
+
+            // Hand back the reason, and keep it for any calls after this one
+            Py_XINCREF( self->error_type );
+            Py_XINCREF( self->error_value );
+            Py_XINCREF( self->error_traceback );
+            PyErr_Restore( self->error_type, self->error_value, self->error_traceback );
+
+            packet = NULL;
+            break;
+        }
+
+        if( !finished )
+            break;
+
+        segment_free( finished );
+    }
+
+    PyGILState_Release( gstate );
+    return packet;
+}
+
+static codec_packet_source_funcs source_funcs = {
+    .getHeader = (codec_getHeaderFunc) SegmentedEncoder_get_header,
+    .getNextPacket = (codec_getNextPacketFunc) SegmentedEncoder_get_next_packet,
+};
+
+static PyObject *pySourceFuncs;
+
+static PyObject *
+SegmentedEncoder_getFuncs( py_obj_SegmentedEncoder *self, void *closure ) {
+    Py_INCREF(pySourceFuncs);
+    return pySourceFuncs;
+}
+
+static PyObject *
+SegmentedEncoder_get_progress( py_obj_SegmentedEncoder *self, void *closure ) {
+    // Frames in segments that have been handed out completely
+    int progress = 0;
+
+    g_mutex_lock( &self->mutex );
+    segment *seg = g_queue_peek_head( &self->active );
+    progress = (seg ? seg->first_frame : self->next_segment_frame) - self->start_frame;
+    g_mutex_unlock( &self->mutex );
+
+    return PyLong_FromLong( progress );
+}
+
+static PyObject *
+SegmentedEncoder_get_progress_count( py_obj_SegmentedEncoder *self, void *closure ) {
+    return PyLong_FromLong( self->end_frame - self->start_frame + 1 );
+}
+
+static PyGetSetDef SegmentedEncoder_getsetters[] = {
+    { CODEC_PACKET_SOURCE_FUNCS, (getter) SegmentedEncoder_getFuncs, NULL, "Codec packet source C API." },
+    { "progress", (getter) SegmentedEncoder_get_progress, NULL, "Encoder progress, from zero to progress_count." },
+    { "progress_count", (getter) SegmentedEncoder_get_progress_count, NULL, "Number of items to complete. Compare to progress." },
+    { NULL }
+};
+
+/*
+    SegmentedEncoder(factory, start_frame, end_frame, segment_size=250, workers=0, max_queued=0)
+
+    Encodes start_frame through end_frame as segments of segment_size frames on
+    workers threads at once (zero means one per processor), and hands out the
+    packets as one stream. factory(first_frame, last_frame) is called for each
+    segment and should return a new codec packet source, such as an
+    X264VideoEncoder or AVVideoEncoder, for just those frames, with timestamps
+    counting from zero at first_frame. Every encoder must be set up the same way.
+
+    Each segment starts with a keyframe, so for the keyframe cadence of a single
+    encode, make segment_size a multiple of the encoder's keyframe interval. Give
+    each encoder few threads of its own; the segments are the parallelism.
+
+    Packets for later segments are held until the ones before them are handed
+    out, up to max_queued per segment (zero means segment_size). Up to two
+    segments per worker are in flight, so that bounds the packets held in
+    memory. A smaller max_queued saves memory but leaves workers waiting on
+    the segment being handed out.
+*/
+static PyTypeObject py_type_SegmentedEncoder = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "fluggo.media.process.SegmentedEncoder",
+    .tp_basicsize = sizeof(py_obj_SegmentedEncoder),
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_base = &py_type_CodecPacketSource,
+    .tp_new = PyType_GenericNew,
+    .tp_dealloc = (destructor) SegmentedEncoder_dealloc,
+    .tp_init = (initproc) SegmentedEncoder_init,
+    .tp_getset = SegmentedEncoder_getsetters,
+};
+
+void init_SegmentedEncoder( PyObject *module ) {
+    if( PyType_Ready( &py_type_SegmentedEncoder ) < 0 )
+        return;
+
+    Py_INCREF( &py_type_SegmentedEncoder );
+    PyModule_AddObject( module, "SegmentedEncoder", (PyObject *) &py_type_SegmentedEncoder );
+
+    pySourceFuncs = PyCapsule_New( &source_funcs, CODEC_PACKET_SOURCE_FUNCS, NULL );
+}
+
@@ -0,0 +1,155 @@
+/*
+    This file is part of the Fluggo Media Library for high-quality
+    video and audio processing.
+
+    Copyright 2012 Brian J. Crowell <brian@fluggo.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "pyframework.h"
+
+typedef struct {
+    PyObject_HEAD
+
+    video_source *source;
+    video_subsample_params params;
+} py_obj_SubsampleFilter;
+
+static int
+SubsampleFilter_init( py_obj_SubsampleFilter *self, PyObject *args, PyObject *kw ) {
+    PyObject *source_obj, *size_obj, *offset_obj = NULL, *interlaced_obj = NULL;
+    const char *chroma = "4:2:0";
+    int bit_depth = 8;
+
+    static char *kwlist[] = { "source", "size", "chroma", "bit_depth", "interlaced", "offset", NULL };
+
+    if( !PyArg_ParseTupleAndKeywords( args, kw, "OO|siOO", kwlist,
+            &source_obj, &size_obj, &chroma, &bit_depth, &interlaced_obj, &offset_obj ) )
+        return -1;
+
+    if( !strcmp( chroma, "4:1:1" ) )
+        self->params.chroma = VIDEO_CHROMA_411;
+    else if( !strcmp( chroma, "4:2:0" ) )
+        self->params.chroma = VIDEO_CHROMA_420;
+    else if( !strcmp( chroma, "4:2:2" ) )
+        self->params.chroma = VIDEO_CHROMA_422;
+    else {
+        PyErr_Format( PyExc_ValueError, "Unknown chroma subsampling \"%s\"; expected 4:1:1, 4:2:0, or 4:2:2.", chroma );
+        return -1;
+    }
+
+    if( bit_depth < 8 || bit_depth > 16 ) {
+        PyErr_SetString( PyExc_ValueError, "bit_depth must be between 8 and 16." );
+        return -1;
+    }
+
+    self->params.bit_depth = bit_depth;
+
+    if( !py_parse_v2i( size_obj, &self->params.size ) )
+        return -1;
+
+    if( self->params.size.x < 1 || self->params.size.y < 1 ) {
+        PyErr_SetString( PyExc_ValueError, "size must be at least one pixel in each direction." );
+        return -1;
+    }
+
+    if( offset_obj && !py_parse_v2i( offset_obj, &self->params.offset ) )
+        return -1;
+
+    self->params.interlaced = interlaced_obj && (PyObject_IsTrue( interlaced_obj ) == 1);
+
+    if( !py_video_take_source( source_obj, &self->source ) )
+        return -1;
+
+    return 0;
+}
+
+static void
+SubsampleFilter_dealloc( py_obj_SubsampleFilter *self ) {
+    py_video_take_source( NULL, &self->source );
+    Py_TYPE(self)->tp_free( (PyObject*) self );
+}
+
+static coded_image *
+SubsampleFilter_get_frame( py_obj_SubsampleFilter *self, int frame, int quality ) {
+    const v2i size = self->params.size;
+    rgba_frame_f16 temp_frame = {
+        .full_window = { self->params.offset,
+            { self->params.offset.x + size.x - 1, self->params.offset.y + size.y - 1 } },
+    };
+
+    temp_frame.data = g_slice_alloc( sizeof(rgba_f16) * size.y * size.x );
+
+    video_get_frame_f16( self->source, frame, &temp_frame );
+    coded_image *result = video_subsample_coded( &temp_frame, &self->params );
+
+    g_slice_free1( sizeof(rgba_f16) * size.y * size.x, temp_frame.data );
+
+    return result;
+}
+
+static coded_image_source_funcs source_funcs = {
+    .getFrame = (coded_image_getFrameFunc) SubsampleFilter_get_frame,
+};
+
+static PyObject *pySourceFuncs;
+
+static PyObject *
+SubsampleFilter_getFuncs( py_obj_SubsampleFilter *self, void *closure ) {
+    Py_INCREF(pySourceFuncs);
+    return pySourceFuncs;
+}
+
+static PyGetSetDef SubsampleFilter_getsetters[] = {
+    { CODED_IMAGE_SOURCE_FUNCS, (getter) SubsampleFilter_getFuncs, NULL, "Coded image source C API." },
+    { NULL }
+};
+
+static PyMethodDef SubsampleFilter_methods[] = {
+    { NULL }
+};
+
+/*
+    SubsampleFilter(source, size, chroma='4:2:0', bit_depth=8, interlaced=False, offset=(0, 0))
+
+    Converts a video source to Rec. 709 studio-range planar YCbCr on the CPU, ready for
+    AVVideoEncoder or X264VideoEncoder. chroma is one of '4:1:1', '4:2:0', or '4:2:2';
+    bit depths above 8 give two bytes per sample. offset is the point in the source
+    that becomes the top-left pixel. For 4:2:0, interlaced filters the chroma within
+    each field.
+*/
+static PyTypeObject py_type_SubsampleFilter = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "fluggo.media.process.SubsampleFilter",
+    .tp_basicsize = sizeof(py_obj_SubsampleFilter),
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_base = &py_type_CodedImageSource,
+    .tp_new = PyType_GenericNew,
+    .tp_dealloc = (destructor) SubsampleFilter_dealloc,
+    .tp_init = (initproc) SubsampleFilter_init,
+    .tp_getset = SubsampleFilter_getsetters,
+    .tp_methods = SubsampleFilter_methods
+};
+
+void init_SubsampleFilter( PyObject *module ) {
+    if( PyType_Ready( &py_type_SubsampleFilter ) < 0 )
+        return;
+
+    Py_INCREF( &py_type_SubsampleFilter );
+    PyModule_AddObject( module, "SubsampleFilter", (PyObject *) &py_type_SubsampleFilter );
+
+    pySourceFuncs = PyCapsule_New( &source_funcs, CODED_IMAGE_SOURCE_FUNCS, NULL );
+}
+
@@ -0,0 +1,476 @@
+/*
+    This file is part of the Fluggo Media Library for high-quality
+    video and audio processing.
+
+    Copyright 2012 Brian J. Crowell <brian@fluggo.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <string.h>
+#include "pyframework.h"
+
+#undef G_LOG_DOMAIN
+#define G_LOG_DOMAIN "fluggo.media.process.VideoFrameCache"
+
+#define DEFAULT_BUDGET      (INT64_C(512) * 1024 * 1024)
+
+static PyObject *pysourceFuncs;
+
+typedef struct __tag_py_obj_VideoFrameCache py_obj_VideoFrameCache;
+
+typedef struct {
+    // Key
+    py_obj_VideoFrameCache *owner;
+    int frame;
+    box2i window;
+    bool f32;
+
+    // Frame data for the whole window, of which current_window is valid
+    void *data;
+    box2i current_window;
+    int64_t size;
+
+    // One reference for the owner's table, one for each reader copying out
+    int refs;
+
+    // True while the first thread to ask for the frame is still pulling it;
+    // detached once it's been dropped from the owner's table
+    bool loading, detached;
+
+    GList link;
+    bool listed;
+} cache_entry;
+
+struct __tag_py_obj_VideoFrameCache {
+    PyObject_HEAD
+
+    video_source *source;
+    GRWLock rwlock;
+
+    // Protected by cache_mutex
+    GHashTable *entries;
+    int64_t hits, misses, waits, used;
+};
+
+// Every cache shares one budget, since what matters is how much memory
+// all of them take together, not how it's split up. One lock covers all of
+// them; it's only held to look things up, never while pulling or copying.
+static GMutex cache_mutex;
+static GCond cache_cond;
+static GQueue cache_lru = G_QUEUE_INIT;
+static int64_t cache_used = 0, cache_budget = DEFAULT_BUDGET;
+
+static guint
+entry_hash( const cache_entry *entry ) {
+    return (guint) entry->frame * 31u + (guint) entry->window.min.x * 7u + (guint) entry->window.min.y * 13u +
+        (guint) entry->window.max.x * 17u + (guint) entry->window.max.y * 19u + (entry->f32 ? 1u : 0u);
+}
+
+static gboolean
+entry_equal( const cache_entry *a, const cache_entry *b ) {
+    return a->frame == b->frame && a->f32 == b->f32 &&
+        a->window.min.x == b->window.min.x && a->window.min.y == b->window.min.y &&
+        a->window.max.x == b->window.max.x && a->window.max.y == b->window.max.y;
+}
+
+// Call with cache_mutex held
+static void
+entry_unref( cache_entry *entry ) {
+    if( --entry->refs > 0 )
+        return;
+
+    g_free( entry->data );
+    g_slice_free( cache_entry, entry );
+}
+
+/*
+    Function: entry_remove
+    Drops an entry from its owner and the LRU list. Readers still copying
+    from it keep it alive until they're done. Call with cache_mutex held.
+*/
+static void
+entry_remove( cache_entry *entry ) {
+    if( entry->detached )
+        return;
+
+    g_hash_table_remove( entry->owner->entries, entry );
+    entry->detached = true;
+
+    if( entry->listed ) {
+        g_queue_unlink( &cache_lru, &entry->link );
+        entry->listed = false;
+
+        cache_used -= entry->size;
+        entry->owner->used -= entry->size;
+    }
+
+    entry_unref( entry );
+}
+
+// Call with cache_mutex held
+static void
+cache_trim( int64_t size ) {
+    while( cache_used > size && !g_queue_is_empty( &cache_lru ) )
+        entry_remove( (cache_entry*) g_queue_peek_tail_link( &cache_lru )->data );
+}
+
+static void
+remove_all( py_obj_VideoFrameCache *self ) {
+    g_mutex_lock( &cache_mutex );
+
+    GList *list = g_hash_table_get_keys( self->entries );
+
+    for( GList *item = list; item; item = item->next )
+        entry_remove( (cache_entry*) item->data );
+
+    g_mutex_unlock( &cache_mutex );
+    g_list_free( list );
+}
+
+/*
+    Function: acquire_entry
+    Gets the cached frame for the given key, pulling it from the source if it
+    isn't there. If another thread is already pulling the same frame, waits
+    for that one instead of pulling it twice.
+
+    Returns the entry with a reference for the caller; release it with
+    release_entry. Call with the read lock held.
+*/
+static cache_entry *
+acquire_entry( py_obj_VideoFrameCache *self, int frame_index, const box2i *window, bool f32 ) {
+    cache_entry key = { .frame = frame_index, .window = *window, .f32 = f32 };
+
+    g_mutex_lock( &cache_mutex );
+
+    cache_entry *entry = (cache_entry*) g_hash_table_lookup( self->entries, &key );
+
+    if( entry ) {
+        entry->refs++;
+
+        if( entry->loading ) {
+            self->waits++;
+
+            while( entry->loading )
+                g_cond_wait( &cache_cond, &cache_mutex );
+        }
+        else {
+            self->hits++;
+        }
+
+        if( entry->listed ) {
+            g_queue_unlink( &cache_lru, &entry->link );
+            g_queue_push_head_link( &cache_lru, &entry->link );
+        }
+
+        g_mutex_unlock( &cache_mutex );
+        return entry;
+    }
+
+    self->misses++;
+
+    entry = g_slice_dup( cache_entry, &key );
+    entry->owner = self;
+    entry->refs = 2;
+    entry->loading = true;
+    entry->link.data = entry;
+    g_hash_table_insert( self->entries, entry, entry );
+
+    g_mutex_unlock( &cache_mutex );
+
+    v2i size;
+    box2i_get_size( window, &size );
+    entry->size = (int64_t)(f32 ? sizeof(rgba_f32) : sizeof(rgba_f16)) * size.x * size.y;
+    entry->data = g_malloc( entry->size );
+
+    if( f32 ) {
+        rgba_frame_f32 pulled = { .data = entry->data, .full_window = *window, .current_window = *window };
+        video_get_frame_f32( self->source, frame_index, &pulled );
+        entry->current_window = pulled.current_window;
+    }
+    else {
+        rgba_frame_f16 pulled = { .data = entry->data, .full_window = *window, .current_window = *window };
+        video_get_frame_f16( self->source, frame_index, &pulled );
+        entry->current_window = pulled.current_window;
+    }
+
+    g_mutex_lock( &cache_mutex );
+
+    entry->loading = false;
+
+    // Someone may have thrown the cache out while we were pulling
+    if( !entry->detached ) {
+        g_queue_push_head_link( &cache_lru, &entry->link );
+        entry->listed = true;
+
+        cache_used += entry->size;
+        self->used += entry->size;
+
+        cache_trim( cache_budget );
+    }
+
+    g_cond_broadcast( &cache_cond );
+    g_mutex_unlock( &cache_mutex );
+
+    return entry;
+}
+
+static void
+release_entry( cache_entry *entry ) {
+    g_mutex_lock( &cache_mutex );
+    entry_unref( entry );
+    g_mutex_unlock( &cache_mutex );
+}
+
+static void
+copy_frame_f32( rgba_frame_f32 *out, rgba_frame_f32 *in ) {
+    box2i inner;
+    box2i_intersect( &inner, &out->full_window, &in->current_window );
+    out->current_window = inner;
+
+    if( box2i_is_empty( &inner ) )
+        return;
+
+    int width = inner.max.x - inner.min.x + 1;
+
+    for( int y = inner.min.y; y <= inner.max.y; y++ ) {
+        memcpy( video_get_pixel_f32( out, inner.min.x, y ),
+            video_get_pixel_f32( in, inner.min.x, y ), sizeof(rgba_f32) * width );
+    }
+}
+
+static int
+VideoFrameCache_init( py_obj_VideoFrameCache *self, PyObject *args, PyObject *kwds ) {
+    PyObject *source;
+
+    static char *kwlist[] = { "source", NULL };
+
+    if( !PyArg_ParseTupleAndKeywords( args, kwds, "O", kwlist, &source ) )
+        return -1;
+
+    if( !py_video_take_source( source, &self->source ) )
+        return -1;
+
+    g_rw_lock_init( &self->rwlock );
+
+    self->entries = g_hash_table_new( (GHashFunc) entry_hash, (GEqualFunc) entry_equal );
+    self->hits = 0;
+    self->misses = 0;
+    self->waits = 0;
+    self->used = 0;
+
+    return 0;
+}
+
+static void
+VideoFrameCache_getFrame( py_obj_VideoFrameCache *self, int frame_index, rgba_frame_f16 *frame ) {
+    g_rw_lock_reader_lock( &self->rwlock );
+
+    cache_entry *entry = acquire_entry( self, frame_index, &frame->full_window, false );
+    rgba_frame_f16 cached = { .data = entry->data, .full_window = entry->window, .current_window = entry->current_window };
+
+    video_copy_frame_f16( frame, &cached );
+    release_entry( entry );
+
+    g_rw_lock_reader_unlock( &self->rwlock );
+}
+
+static void
+VideoFrameCache_getFrame32( py_obj_VideoFrameCache *self, int frame_index, rgba_frame_f32 *frame ) {
+    g_rw_lock_reader_lock( &self->rwlock );
+
+    cache_entry *entry = acquire_entry( self, frame_index, &frame->full_window, true );
+    rgba_frame_f32 cached = { .data = entry->data, .full_window = entry->window, .current_window = entry->current_window };
+
+    copy_frame_f32( frame, &cached );
+    release_entry( entry );
+
+    g_rw_lock_reader_unlock( &self->rwlock );
+}
+
+static void
+VideoFrameCache_getFrameGL( py_obj_VideoFrameCache *self, int frame_index, rgba_frame_gl *frame ) {
+    // Textures live on the card, and the card has its own limits; pass these through
+    g_rw_lock_reader_lock( &self->rwlock );
+    video_get_frame_gl( self->source, frame_index, frame );
+    g_rw_lock_reader_unlock( &self->rwlock );
+}
+
+static void
+VideoFrameCache_dealloc( py_obj_VideoFrameCache *self ) {
+    // See the note in VideoPassThroughFilter_dealloc on why there's no locking here
+    if( self->entries ) {
+        remove_all( self );
+        g_hash_table_destroy( self->entries );
+        self->entries = NULL;
+    }
+
+    py_video_take_source( NULL, &self->source );
+    g_rw_lock_clear( &self->rwlock );
+
+    Py_TYPE(self)->tp_free( (PyObject*) self );
+}
+
+static PyObject *
+VideoFrameCache_getSource( py_obj_VideoFrameCache *self ) {
+    if( self->source == NULL )
+        Py_RETURN_NONE;
+
+    Py_INCREF((PyObject *) self->source->obj);
+    return (PyObject *) self->source->obj;
+}
+
+static PyObject *
+VideoFrameCache_setSource( py_obj_VideoFrameCache *self, PyObject *args, void *closure ) {
+    PyObject *source;
+
+    if( !PyArg_ParseTuple( args, "O", &source ) )
+        return NULL;
+
+    g_rw_lock_writer_lock( &self->rwlock );
+
+    if( !py_video_take_source( source, &self->source ) ) {
+        g_rw_lock_writer_unlock( &self->rwlock );
+        return NULL;
+    }
+
+    // Everything we have came from the old source
+    remove_all( self );
+
+    g_rw_lock_writer_unlock( &self->rwlock );
+
+    Py_RETURN_NONE;
+}
+
+static PyObject *
+VideoFrameCache_invalidate( py_obj_VideoFrameCache *self ) {
+    remove_all( self );
+    Py_RETURN_NONE;
+}
+
+static PyObject *
+VideoFrameCache_set_global_budget( PyObject *cls, PyObject *args ) {
+    long long budget;
+
+    if( !PyArg_ParseTuple( args, "L", &budget ) )
+        return NULL;
+
+    if( budget < 0 ) {
+        PyErr_SetString( PyExc_ValueError, "The budget must not be negative." );
+        return NULL;
+    }
+
+    g_mutex_lock( &cache_mutex );
+    cache_budget = budget;
+    cache_trim( cache_budget );
+    g_mutex_unlock( &cache_mutex );
+
+    Py_RETURN_NONE;
+}
+
+static PyObject *
+VideoFrameCache_global_stats( PyObject *cls ) {
+    g_mutex_lock( &cache_mutex );
+    int64_t budget = cache_budget, used = cache_used;
+    g_mutex_unlock( &cache_mutex );
+
+    return Py_BuildValue( "{sLsL}",
+        "budget", (long long) budget,
+        "used", (long long) used );
+}
+
+static PyObject *
+VideoFrameCache_get_cache_stats( py_obj_VideoFrameCache *self, void *closure ) {
+    g_mutex_lock( &cache_mutex );
+    int64_t hits = self->hits, misses = self->misses, waits = self->waits, used = self->used;
+    int count = (int) g_hash_table_size( self->entries );
+    g_mutex_unlock( &cache_mutex );
+
+    return Py_BuildValue( "{sLsLsLsLsi}",
+        "hits", (long long) hits,
+        "misses", (long long) misses,
+        "waits", (long long) waits,
+        "used", (long long) used,
+        "frames", count );
+}
+
+static video_frame_source_funcs sourceFuncs = {
+    .get_frame = (video_get_frame_func) VideoFrameCache_getFrame,
+    .get_frame_32 = (video_get_frame_32_func) VideoFrameCache_getFrame32,
+    .get_frame_gl = (video_get_frame_gl_func) VideoFrameCache_getFrameGL
+};
+
+static PyObject *
+VideoFrameCache_getFuncs( py_obj_VideoFrameCache *self, void *closure ) {
+    Py_INCREF(pysourceFuncs);
+    return pysourceFuncs;
+}
+
+static PyGetSetDef VideoFrameCache_getsetters[] = {
+    { VIDEO_FRAME_SOURCE_FUNCS, (getter) VideoFrameCache_getFuncs, NULL, "Video frame source C API." },
+    { "cache_stats", (getter) VideoFrameCache_get_cache_stats, NULL,
+        "Dictionary of hits, misses, waits (requests that joined another thread's pull), "
+        "and the frames and bytes this cache is holding." },
+    { NULL }
+};
+
+static PyMethodDef VideoFrameCache_methods[] = {
+    { "source", (PyCFunction) VideoFrameCache_getSource, METH_NOARGS,
+        "Gets the video source." },
+    { "set_source", (PyCFunction) VideoFrameCache_setSource, METH_VARARGS,
+        "Sets the video source, throwing out everything cached from the old one." },
+    { "invalidate", (PyCFunction) VideoFrameCache_invalidate, METH_NOARGS,
+        "Throws out every cached frame, for when the source has changed underneath." },
+    { "set_global_budget", (PyCFunction) VideoFrameCache_set_global_budget, METH_VARARGS | METH_STATIC,
+        "Sets the most memory, in bytes, that all frame caches together may hold.\n"
+        "\n"
+        "VideoFrameCache.set_global_budget(size)" },
+    { "global_stats", (PyCFunction) VideoFrameCache_global_stats, METH_NOARGS | METH_STATIC,
+        "Gets a dictionary of the shared budget and how many bytes of it are in use." },
+    { NULL }
+};
+
+/*
+    VideoFrameCache(source)
+
+    Keeps frames from the source by frame number and window, so asking for the
+    same frame again (say, while looping a few seconds) copies it out of
+    memory instead of rendering it. All caches share one budget, 512 MB to
+    start with, and drop the least recently used frames from any of them to
+    stay under it. Requests for a frame another thread is already rendering
+    wait for that one instead of rendering it again.
+*/
+static PyTypeObject py_type_VideoFrameCache = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "fluggo.media.process.VideoFrameCache",
+    .tp_basicsize = sizeof(py_obj_VideoFrameCache),
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_base = &py_type_VideoSource,
+    .tp_new = PyType_GenericNew,
+    .tp_dealloc = (destructor) VideoFrameCache_dealloc,
+    .tp_init = (initproc) VideoFrameCache_init,
+    .tp_getset = VideoFrameCache_getsetters,
+    .tp_methods = VideoFrameCache_methods,
+};
+
+void init_VideoFrameCache( PyObject *module ) {
+    if( PyType_Ready( &py_type_VideoFrameCache ) < 0 )
+        return;
+
+    Py_INCREF( (PyObject*) &py_type_VideoFrameCache );
+    PyModule_AddObject( module, "VideoFrameCache", (PyObject *) &py_type_VideoFrameCache );
+
+    pysourceFuncs = PyCapsule_New( &sourceFuncs, VIDEO_FRAME_SOURCE_FUNCS, NULL );
+}
+
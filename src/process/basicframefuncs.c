@@ -347,6 +347,19 @@ framefunc_get_rgba_f32( rgba_f32 *result, FrameFunctionHolder *holder, double fr
     }
 }
 
+EXPORT void
+framefunc_get_values( FrameFunctionHolder *holder, ssize_t count, double *frames, double (*result)[4] ) {
+    if( holder->funcs && holder->funcs->get_values ) {
+        holder->funcs->get_values( holder->source, count, frames, result );
+    }
+    else {
+        for( ssize_t i = 0; i < count; i++ ) {
+            for( int j = 0; j < 4; j++ )
+                result[i][j] = holder->constant[j];
+        }
+    }
+}
+
 EXPORT void
 framefunc_init( FrameFunctionHolder *holder, double c0, double c1, double c2, double c3 ) {
     holder->source = NULL;
@@ -0,0 +1,142 @@
+/*
+    This file is part of the Fluggo Media Library for high-quality
+    video and audio processing.
+
+    Copyright 2012 Brian J. Crowell <brian@fluggo.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "pyframework.h"
+
+/*
+    Function: py_get_array_buffer
+        Fills in a buffer view over a C-contiguous array, for use as a type's
+        bf_getbuffer. Pair with <py_release_array_buffer>. If the consumer
+        doesn't ask for the shape, the view is plain bytes.
+
+    Parameters:
+        exporter - The object that owns the data.
+        view - The view to fill in.
+        flags - The flags the consumer asked for.
+        data - The first element of the array.
+        readonly - True if the consumer can't write to the array.
+        format - The struct module format of one element, such as "f".
+        itemsize - The size of one element in bytes.
+        ndim - The number of dimensions in the array.
+        shape - The size of each dimension, with the last varying fastest.
+
+    Returns:
+        Zero if successful, or -1 on an error (an exception will be set).
+*/
+int
+py_get_array_buffer( PyObject *exporter, Py_buffer *view, int flags, void *data, bool readonly,
+        const char *format, Py_ssize_t itemsize, int ndim, const Py_ssize_t *shape ) {
+    view->obj = NULL;
+
+    if( readonly && (flags & PyBUF_WRITABLE) == PyBUF_WRITABLE ) {
+        PyErr_SetString( PyExc_BufferError, "This object's data is read-only." );
+        return -1;
+    }
+
+    Py_ssize_t length = itemsize;
+
+    for( int i = 0; i < ndim; i++ )
+        length *= shape[i];
+
+    // Shape and strides live together in internal until the view is released
+    Py_ssize_t *dims = NULL;
+
+    if( (flags & PyBUF_ND) == PyBUF_ND ) {
+        dims = PyMem_Malloc( sizeof(Py_ssize_t) * ndim * 2 );
+
+        if( !dims ) {
+            PyErr_NoMemory();
+            return -1;
+        }
+
+        Py_ssize_t stride = itemsize;
+
+        for( int i = ndim - 1; i >= 0; i-- ) {
+            dims[i] = shape[i];
+            dims[ndim + i] = stride;
+            stride *= shape[i];
+        }
+    }
+
+    Py_INCREF(exporter);
+    view->obj = exporter;
+    view->buf = data;
+    view->len = length;
+    view->readonly = readonly ? 1 : 0;
+    // Without a shape, the consumer sees plain bytes
+    view->itemsize = dims ? itemsize : 1;
+    view->format = ((flags & PyBUF_FORMAT) == PyBUF_FORMAT) ? (dims ? (char *) format : "B") : NULL;
+    view->ndim = dims ? ndim : 1;
+    view->shape = dims;
+    view->strides = (dims && (flags & PyBUF_STRIDES) == PyBUF_STRIDES) ? dims + ndim : NULL;
+    view->suboffsets = NULL;
+    view->internal = dims;
+
+    return 0;
+}
+
+/*
+    Function: py_release_array_buffer
+        Frees what <py_get_array_buffer> allocated for a view, for use as a type's
+        bf_releasebuffer.
+*/
+void
+py_release_array_buffer( PyObject *exporter, Py_buffer *view ) {
+    PyMem_Free( view->internal );
+    view->internal = NULL;
+}
+
+/*
+    Function: py_wrap_buffer
+        Gets a C-contiguous buffer from an object so that its memory can be used
+        in place. The buffer is writable if the object allows it.
+
+    Parameters:
+        obj - The object to get the buffer from.
+        view - The view to fill in. Release it with PyBuffer_Release when done.
+        length - The number of bytes the buffer needs to have.
+        alignment - The alignment the start of the buffer needs to have.
+
+    Returns:
+        True if successful, or false on an error (an exception will be set).
+*/
+bool
+py_wrap_buffer( PyObject *obj, Py_buffer *view, Py_ssize_t length, Py_ssize_t alignment ) {
+    if( PyObject_GetBuffer( obj, view, PyBUF_C_CONTIGUOUS | PyBUF_WRITABLE ) < 0 ) {
+        PyErr_Clear();
+
+        if( PyObject_GetBuffer( obj, view, PyBUF_C_CONTIGUOUS ) < 0 )
+            return false;
+    }
+
+    if( view->len < length ) {
+        PyErr_Format( PyExc_ValueError, "The buffer has %zd bytes, but %zd are needed.", view->len, length );
+        PyBuffer_Release( view );
+        return false;
+    }
+
+    if( (uintptr_t) view->buf % alignment ) {
+        PyErr_Format( PyExc_ValueError, "The buffer needs to be aligned to %zd bytes.", alignment );
+        PyBuffer_Release( view );
+        return false;
+    }
+
+    return true;
+}
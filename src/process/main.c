@@ -153,10 +153,14 @@ py_timeGetFrame( PyObject *self, PyObject *args, PyObject *kw ) {
         return NULL;
     }
 
-    int64_t startTime = gettime();
+    int64_t startTime, endTime;
+
+    Py_BEGIN_ALLOW_THREADS
+    startTime = gettime();
     for( int i = minFrame; i <= maxFrame; i++ )
         video_get_frame_f16( source, i, &frame );
-    int64_t endTime = gettime();
+    endTime = gettime();
+    Py_END_ALLOW_THREADS
 
     PyMem_Free( frame.data );
 
@@ -332,15 +336,23 @@ bool init_basetypes( PyObject *module );
 void init_AudioSource( PyObject *module );
 void init_VideoSource( PyObject *module );
 void init_CodecPacketSource( PyObject *module );
+void init_RawDVSource( PyObject *module );
+void init_SegmentedEncoder( PyObject *module );
+void init_MatroskaMuxer( PyObject *module );
+void init_CodecPacketSequence( PyObject *module );
 void init_CodedImageSource( PyObject *module );
+void init_CodedImageCache( PyObject *module );
 void init_DVReconstructionFilter( PyObject *module );
 void init_DVSubsampleFilter( PyObject *module );
+void init_SubsampleFilter( PyObject *module );
 void init_Pulldown23RemovalFilter( PyObject *module );
 void init_SystemPresentationClock( PyObject *module );
 void init_AudioPassThroughFilter( PyObject *module );
+void init_AudioPeakIndex( PyObject *module );
 void init_VideoSequence( PyObject *module );
 void init_VideoMixFilter( PyObject *module );
 void init_VideoPassThroughFilter( PyObject *module );
+void init_VideoFrameCache( PyObject *module );
 void init_SolidColorVideoSource( PyObject *module );
 void init_EmptyVideoSource( PyObject *module );
 void init_basicframefuncs( PyObject *module );
@@ -352,6 +364,7 @@ void init_RgbaFrameF32( PyObject *module );
 void init_VideoScaler( PyObject *module );
 void init_VideoPullQueue( PyObject *module );
 void init_AnimationFunc( PyObject *module );
+void init_ExpressionFunc( PyObject *module );
 void init_FrameFuncPassThroughFilter( PyObject *module );
 void init_VideoGainOffsetFilter( PyObject *module );
 void init_MPEG2SubsampleFilter( PyObject *module );
@@ -380,15 +393,23 @@ PyInit_process() {
     init_AudioSource( m );
     init_VideoSource( m );
     init_CodecPacketSource( m );
+    init_RawDVSource( m );
+    init_SegmentedEncoder( m );
+    init_MatroskaMuxer( m );
+    init_CodecPacketSequence( m );
     init_CodedImageSource( m );
+    init_CodedImageCache( m );
     init_DVReconstructionFilter( m );
     init_DVSubsampleFilter( m );
+    init_SubsampleFilter( m );
     init_Pulldown23RemovalFilter( m );
     init_SystemPresentationClock( m );
     init_VideoSequence( m );
     init_VideoMixFilter( m );
     init_AudioPassThroughFilter( m );
+    init_AudioPeakIndex( m );
     init_VideoPassThroughFilter( m );
+    init_VideoFrameCache( m );
     init_SolidColorVideoSource( m );
     init_EmptyVideoSource( m );
     init_basicframefuncs( m );
@@ -400,6 +421,7 @@ PyInit_process() {
     init_VideoScaler( m );
     init_VideoPullQueue( m );
     init_AnimationFunc( m );
+    init_ExpressionFunc( m );
     init_FrameFuncPassThroughFilter( m );
     init_VideoGainOffsetFilter( m );
     init_MPEG2SubsampleFilter( m );
@@ -0,0 +1,178 @@
+/*
+    This file is part of the Fluggo Media Library for high-quality
+    video and audio processing.
+
+    Copyright 2012 Brian J. Crowell <brian@fluggo.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "framework.h"
+
+#define BLOCK_SIZE  64
+#define MB          (INT64_C(1024) * 1024)
+
+// Stereo ramp where channel c of sample s is s * 2 + c
+static void
+put_ramp( audio_block_cache *cache, int start, int count ) {
+    float *data = g_new( float, count * 2 );
+
+    for( int i = 0; i < count; i++ ) {
+        data[i * 2] = (float)((start + i) * 2);
+        data[i * 2 + 1] = (float)((start + i) * 2 + 1);
+    }
+
+    audio_block_cache_put( cache, start, count, data );
+    g_free( data );
+}
+
+static bool
+get_range( audio_block_cache *cache, int min_sample, int max_sample, int channels, float *data ) {
+    audio_frame frame = {
+        .data = data,
+        .channels = channels,
+        .full_min_sample = min_sample,
+        .full_max_sample = max_sample,
+        .current_min_sample = 0,
+        .current_max_sample = -1 };
+
+    bool result = audio_block_cache_get( cache, &frame );
+
+    if( result ) {
+        g_assert_cmpint( frame.current_min_sample, ==, min_sample );
+        g_assert_cmpint( frame.current_max_sample, ==, max_sample );
+    }
+    else {
+        g_assert_cmpint( frame.current_max_sample, ==, -1 );
+    }
+
+    return result;
+}
+
+static void
+test_cache_round_trip() {
+    audio_block_cache *cache = audio_block_cache_new( 2, BLOCK_SIZE, MB );
+    float out[230 * 2];
+
+    // Packets that don't line up with the blocks, starting below zero
+    put_ramp( cache, -30, 100 );
+    put_ramp( cache, 70, 130 );
+
+    g_assert( get_range( cache, -30, 199, 2, out ) );
+
+    for( int i = 0; i < 230 * 2; i++ )
+        g_assert_cmpfloat( out[i], ==, (float)(-60 + i) );
+
+    g_assert( get_range( cache, 10, 20, 2, out ) );
+    g_assert_cmpfloat( out[0], ==, 20.0f );
+
+    audio_block_cache_stats stats;
+    audio_block_cache_get_stats( cache, &stats );
+    g_assert_cmpint( stats.hits, ==, 2 );
+    g_assert_cmpint( stats.misses, ==, 0 );
+
+    audio_block_cache_free( cache );
+}
+
+static void
+test_cache_miss() {
+    audio_block_cache *cache = audio_block_cache_new( 2, BLOCK_SIZE, MB );
+    float out[200 * 2];
+
+    put_ramp( cache, 0, 100 );
+    put_ramp( cache, 120, 80 );
+
+    // The gap at 100-119 spoils anything across it
+    g_assert( !get_range( cache, 50, 150, 2, out ) );
+    g_assert( !get_range( cache, 100, 100, 2, out ) );
+    g_assert( get_range( cache, 120, 199, 2, out ) );
+
+    // Block 64-127 only keeps the newest run
+    g_assert( get_range( cache, 0, 63, 2, out ) );
+    g_assert( !get_range( cache, 0, 99, 2, out ) );
+
+    // Filling in the gaps joins the runs
+    put_ramp( cache, 100, 20 );
+    put_ramp( cache, 0, 100 );
+    g_assert( get_range( cache, 0, 199, 2, out ) );
+
+    audio_block_cache_stats stats;
+    audio_block_cache_get_stats( cache, &stats );
+    g_assert_cmpint( stats.hits, ==, 3 );
+    g_assert_cmpint( stats.misses, ==, 3 );
+
+    audio_block_cache_free( cache );
+}
+
+static void
+test_cache_channels() {
+    audio_block_cache *cache = audio_block_cache_new( 2, BLOCK_SIZE, MB );
+    float out[10 * 3];
+
+    put_ramp( cache, 0, 10 );
+
+    // Extra channels come back silent
+    g_assert( get_range( cache, 0, 9, 3, out ) );
+
+    for( int i = 0; i < 10; i++ ) {
+        g_assert_cmpfloat( out[i * 3], ==, (float)(i * 2) );
+        g_assert_cmpfloat( out[i * 3 + 1], ==, (float)(i * 2 + 1) );
+        g_assert_cmpfloat( out[i * 3 + 2], ==, 0.0f );
+    }
+
+    // Missing ones are dropped
+    g_assert( get_range( cache, 0, 9, 1, out ) );
+
+    for( int i = 0; i < 10; i++ )
+        g_assert_cmpfloat( out[i], ==, (float)(i * 2) );
+
+    audio_block_cache_free( cache );
+}
+
+static void
+test_cache_eviction() {
+    const int64_t block_bytes = sizeof(float) * 2 * BLOCK_SIZE;
+    audio_block_cache *cache = audio_block_cache_new( 2, BLOCK_SIZE, block_bytes * 4 );
+    float out[BLOCK_SIZE * 2];
+
+    for( int i = 0; i < 4; i++ )
+        put_ramp( cache, i * BLOCK_SIZE, BLOCK_SIZE );
+
+    // Touch the first block so the second is the oldest
+    g_assert( get_range( cache, 0, BLOCK_SIZE - 1, 2, out ) );
+
+    put_ramp( cache, 4 * BLOCK_SIZE, BLOCK_SIZE );
+
+    audio_block_cache_stats stats;
+    audio_block_cache_get_stats( cache, &stats );
+    g_assert_cmpint( stats.used, ==, block_bytes * 4 );
+
+    g_assert( get_range( cache, 0, BLOCK_SIZE - 1, 2, out ) );
+    g_assert( !get_range( cache, BLOCK_SIZE, BLOCK_SIZE * 2 - 1, 2, out ) );
+    g_assert( get_range( cache, BLOCK_SIZE * 4, BLOCK_SIZE * 5 - 1, 2, out ) );
+
+    audio_block_cache_set_max_size( cache, 0 );
+    audio_block_cache_get_stats( cache, &stats );
+    g_assert_cmpint( stats.used, ==, 0 );
+
+    audio_block_cache_free( cache );
+}
+
+void
+test_setup_audio_cache() {
+    g_test_add_func( "/audio/cache/round_trip", test_cache_round_trip );
+    g_test_add_func( "/audio/cache/miss", test_cache_miss );
+    g_test_add_func( "/audio/cache/channels", test_cache_channels );
+    g_test_add_func( "/audio/cache/eviction", test_cache_eviction );
+}
@@ -0,0 +1,225 @@
+/*
+    This file is part of the Fluggo Media Library for high-quality
+    video and audio processing.
+
+    Copyright 2012 Brian J. Crowell <brian@fluggo.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <math.h>
+#include "framework.h"
+
+// Odd length so both the vector and scalar paths get exercised
+#define SAMPLE_COUNT 4099
+
+static float input[SAMPLE_COUNT];
+
+static void
+setup_input() {
+    for( int i = 0; i < SAMPLE_COUNT; i++ )
+        input[i] = (float) i / (SAMPLE_COUNT - 1) * 2.5f - 1.25f;
+}
+
+static void
+test_convert_s16() {
+    static int16_t out[SAMPLE_COUNT];
+    setup_input();
+
+    audio_convert_f32_to_s16( out, input, SAMPLE_COUNT, NULL );
+
+    for( int i = 0; i < SAMPLE_COUNT; i++ ) {
+        float expected = clampf( floorf( input[i] * 32768.0f + 0.5f ), -32768.0f, 32767.0f );
+        g_assert_cmpint( out[i], ==, (int) expected );
+    }
+}
+
+static void
+test_convert_s16_dither() {
+    static int16_t out[SAMPLE_COUNT];
+    audio_dither dither;
+    setup_input();
+
+    audio_dither_init( &dither, 42 );
+    audio_convert_f32_to_s16( out, input, SAMPLE_COUNT, &dither );
+
+    double error_sum = 0.0;
+
+    for( int i = 0; i < SAMPLE_COUNT; i++ ) {
+        float exact = clampf( input[i] * 32768.0f, -32768.0f, 32767.0f );
+
+        // TPDF dither never moves a sample more than one step off
+        g_assert_cmpfloat( fabsf( (float) out[i] - exact ), <=, 1.5f );
+        error_sum += (double) out[i] - exact;
+    }
+
+    // ...and doesn't add a DC offset
+    g_assert_cmpfloat( fabs( error_sum / SAMPLE_COUNT ), <, 0.1 );
+}
+
+static void
+test_convert_s32() {
+    static int32_t out[SAMPLE_COUNT];
+    setup_input();
+
+    audio_convert_f32_to_s32( out, input, SAMPLE_COUNT );
+
+    for( int i = 0; i < SAMPLE_COUNT; i++ ) {
+        double expected = fmin( fmax( input[i] * 2147483648.0, -2147483648.0 ), 2147483647.0 );
+        g_assert_cmpfloat( fabs( (double) out[i] - expected ), <, 256.0 );
+    }
+
+    g_assert_cmpint( out[0], ==, INT32_MIN );
+    g_assert_cmpint( out[SAMPLE_COUNT - 1], >, INT32_MAX - 256 );
+}
+
+static void
+test_convert_to_f32_run() {
+    static int16_t in[SAMPLE_COUNT * 2];
+    static float out[SAMPLE_COUNT * 2];
+    const void *planes[1] = { in };
+
+    for( int i = 0; i < SAMPLE_COUNT * 2; i++ )
+        in[i] = (int16_t)(i * 16 - 32768);
+
+    // Skip the first three frames
+    audio_convert_to_f32( out, 2, planes, 2, AUDIO_SAMPLE_S16, false, NULL, 3, SAMPLE_COUNT - 3 );
+
+    for( int i = 0; i < (SAMPLE_COUNT - 3) * 2; i++ )
+        g_assert_cmpfloat( out[i], ==, (float) in[i + 6] / 32768.0f );
+
+    g_assert_cmpfloat( out[0], >=, -1.0f );
+}
+
+static void
+test_convert_to_f32_formats() {
+    const uint8_t u8[] = { 0, 128, 255 };
+    const int32_t s32[] = { INT32_MIN, 0, 1 << 30 };
+    const double dbl[] = { -0.5, 0.0, 0.25 };
+    const void *planes[1];
+    float out[3];
+
+    planes[0] = u8;
+    audio_convert_to_f32( out, 1, planes, 1, AUDIO_SAMPLE_U8, false, NULL, 0, 3 );
+    g_assert_cmpfloat( out[0], ==, -1.0f );
+    g_assert_cmpfloat( out[1], ==, 0.0f );
+    g_assert_cmpfloat( out[2], ==, 127.0f / 128.0f );
+
+    planes[0] = s32;
+    audio_convert_to_f32( out, 1, planes, 1, AUDIO_SAMPLE_S32, false, NULL, 0, 3 );
+    g_assert_cmpfloat( out[0], ==, -1.0f );
+    g_assert_cmpfloat( out[1], ==, 0.0f );
+    g_assert_cmpfloat( out[2], ==, 0.5f );
+
+    planes[0] = dbl;
+    audio_convert_to_f32( out, 1, planes, 1, AUDIO_SAMPLE_DBL, false, NULL, 0, 3 );
+    g_assert_cmpfloat( out[0], ==, -0.5f );
+    g_assert_cmpfloat( out[2], ==, 0.25f );
+
+    g_assert_cmpint( audio_sample_get_size( AUDIO_SAMPLE_DBL ), ==, 8 );
+    g_assert_cmpint( audio_sample_get_size( 99 ), ==, 0 );
+}
+
+static void
+test_convert_to_f32_planar() {
+    static float left[SAMPLE_COUNT], right[SAMPLE_COUNT];
+    static float out[SAMPLE_COUNT * 3];
+    const void *planes[2] = { left, right };
+    setup_input();
+
+    for( int i = 0; i < SAMPLE_COUNT; i++ ) {
+        left[i] = input[i];
+        right[i] = -input[i];
+    }
+
+    // Interleave the channels and add a silent third
+    audio_convert_to_f32( out, 3, planes, 2, AUDIO_SAMPLE_FLT, true, NULL, 0, SAMPLE_COUNT );
+
+    for( int i = 0; i < SAMPLE_COUNT; i++ ) {
+        g_assert_cmpfloat( out[i * 3], ==, left[i] );
+        g_assert_cmpfloat( out[i * 3 + 1], ==, right[i] );
+        g_assert_cmpfloat( out[i * 3 + 2], ==, 0.0f );
+    }
+}
+
+static void
+test_convert_to_f32_remap() {
+    static int16_t in[SAMPLE_COUNT * 6];
+    static float out[SAMPLE_COUNT * 2];
+    const void *planes[1] = { in };
+
+    for( int i = 0; i < SAMPLE_COUNT * 6; i++ )
+        in[i] = (int16_t) i;
+
+    // Keep the first pair of six interleaved channels
+    audio_convert_to_f32( out, 2, planes, 6, AUDIO_SAMPLE_S16, false, NULL, 1, SAMPLE_COUNT - 1 );
+
+    for( int i = 0; i < SAMPLE_COUNT - 1; i++ ) {
+        g_assert_cmpfloat( out[i * 2], ==, (float) in[(i + 1) * 6] / 32768.0f );
+        g_assert_cmpfloat( out[i * 2 + 1], ==, (float) in[(i + 1) * 6 + 1] / 32768.0f );
+    }
+}
+
+static void
+test_convert_to_f32_channel_map() {
+    static int16_t in[SAMPLE_COUNT * 3];
+    static float left[SAMPLE_COUNT], right[SAMPLE_COUNT];
+    static float out[SAMPLE_COUNT * 4];
+    const void *planes[2] = { in, NULL };
+
+    for( int i = 0; i < SAMPLE_COUNT * 3; i++ )
+        in[i] = (int16_t) i;
+
+    // Swap the first two, drop the third, and leave a silent gap
+    const int map[4] = { 1, 0, -1, 7 };
+    audio_convert_to_f32( out, 4, planes, 3, AUDIO_SAMPLE_S16, false, map, 0, SAMPLE_COUNT );
+
+    for( int i = 0; i < SAMPLE_COUNT; i++ ) {
+        g_assert_cmpfloat( out[i * 4], ==, (float) in[i * 3 + 1] / 32768.0f );
+        g_assert_cmpfloat( out[i * 4 + 1], ==, (float) in[i * 3] / 32768.0f );
+        g_assert_cmpfloat( out[i * 4 + 2], ==, 0.0f );
+        g_assert_cmpfloat( out[i * 4 + 3], ==, 0.0f );
+    }
+
+    // Same channels as the output, but out of order, so no straight run
+    setup_input();
+
+    for( int i = 0; i < SAMPLE_COUNT; i++ ) {
+        left[i] = input[i];
+        right[i] = -input[i];
+    }
+
+    planes[0] = left;
+    planes[1] = right;
+
+    const int swap[2] = { 1, 0 };
+    audio_convert_to_f32( out, 2, planes, 2, AUDIO_SAMPLE_FLT, true, swap, 0, SAMPLE_COUNT );
+
+    for( int i = 0; i < SAMPLE_COUNT; i++ ) {
+        g_assert_cmpfloat( out[i * 2], ==, right[i] );
+        g_assert_cmpfloat( out[i * 2 + 1], ==, left[i] );
+    }
+}
+
+void
+test_setup_audio_convert() {
+    g_test_add_func( "/audio/convert/s16", test_convert_s16 );
+    g_test_add_func( "/audio/convert/s16_dither", test_convert_s16_dither );
+    g_test_add_func( "/audio/convert/s32", test_convert_s32 );
+    g_test_add_func( "/audio/convert/to_f32_run", test_convert_to_f32_run );
+    g_test_add_func( "/audio/convert/to_f32_formats", test_convert_to_f32_formats );
+    g_test_add_func( "/audio/convert/to_f32_planar", test_convert_to_f32_planar );
+    g_test_add_func( "/audio/convert/to_f32_remap", test_convert_to_f32_remap );
+    g_test_add_func( "/audio/convert/to_f32_channel_map", test_convert_to_f32_channel_map );
+}
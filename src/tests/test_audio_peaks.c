@@ -0,0 +1,144 @@
+/*
+    This file is part of the Fluggo Media Library for high-quality
+    video and audio processing.
+
+    Copyright 2012 Brian J. Crowell <brian@fluggo.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <math.h>
+#include <stdio.h>
+#include "framework.h"
+
+#define SOURCE_LENGTH 100000
+
+static float source_data[SOURCE_LENGTH * 2];
+
+// Left channel is a slow sine at half scale, right is a ramp from -1 to 1
+static audio_frame source_frame = {
+    .data = source_data,
+    .full_min_sample = 0, .full_max_sample = SOURCE_LENGTH - 1,
+    .current_min_sample = 0, .current_max_sample = SOURCE_LENGTH - 1,
+    .channels = 2,
+};
+
+static void
+setup_source() {
+    for( int i = 0; i < SOURCE_LENGTH; i++ ) {
+        source_data[i * 2] = 0.5f * sinf( (float) i * (float)(2.0 * G_PI / 1000.0) );
+        source_data[i * 2 + 1] = (float) i / (SOURCE_LENGTH - 1) * 2.0f - 1.0f;
+    }
+}
+
+static audio_peak_index *
+build_index() {
+    setup_source();
+
+    audio_source source = AUDIO_FRAME_AS_SOURCE( &source_frame );
+
+    // Extends past the end of the source on purpose
+    audio_peak_index *index = audio_peak_index_new( 2, 0, SOURCE_LENGTH + 999 );
+
+    g_assert( audio_peak_index_build( index, &source, NULL ) );
+    g_assert( audio_peak_index_is_complete( index ) );
+    g_assert_cmpfloat( audio_peak_index_get_progress( index ), ==, 1.0 );
+
+    return index;
+}
+
+static void
+check_overview( audio_peak_index *index ) {
+    audio_peak peaks[2];
+
+    // The whole thing in one pixel
+    audio_peak_index_query( index, 0, SOURCE_LENGTH - 1, 1, peaks );
+
+    g_assert_cmpfloat( fabsf( peaks[0].min + 0.5f ), <, 0.001f );
+    g_assert_cmpfloat( fabsf( peaks[0].max - 0.5f ), <, 0.001f );
+    g_assert_cmpfloat( fabsf( peaks[0].rms - 0.3536f ), <, 0.01f );
+    g_assert_cmpfloat( fabsf( peaks[1].min + 1.0f ), <, 0.001f );
+    g_assert_cmpfloat( fabsf( peaks[1].max - 1.0f ), <, 0.001f );
+}
+
+static void
+test_peaks_levels() {
+    audio_peak_index *index = build_index();
+    check_overview( index );
+
+    // Zoomed in: each pixel should bracket the ramp over its own samples
+    audio_peak peaks[100 * 2];
+    audio_peak_index_query( index, 51200, 51200 + 256 * 100 - 1, 100, peaks );
+
+    for( int pixel = 0; pixel < 100; pixel++ ) {
+        float first = source_data[(51200 + pixel * 256) * 2 + 1];
+        float last = source_data[(51200 + pixel * 256 + 255) * 2 + 1];
+
+        g_assert_cmpfloat( fabsf( peaks[pixel * 2 + 1].min - first ), <, 0.001f );
+        g_assert_cmpfloat( fabsf( peaks[pixel * 2 + 1].max - last ), <, 0.001f );
+    }
+
+    audio_peak_index_free( index );
+}
+
+static void
+test_peaks_outside() {
+    audio_peak_index *index = build_index();
+    audio_peak peaks[4 * 2];
+
+    // Before the index, and after the source ran out
+    audio_peak_index_query( index, -4000, -1, 4, peaks );
+
+    for( int i = 0; i < 8; i++ )
+        g_assert_cmpfloat( peaks[i].max, ==, 0.0f );
+
+    audio_peak_index_query( index, SOURCE_LENGTH + 200, SOURCE_LENGTH + 999, 4, peaks );
+
+    for( int i = 0; i < 8; i++ ) {
+        g_assert_cmpfloat( peaks[i].min, ==, 0.0f );
+        g_assert_cmpfloat( peaks[i].max, ==, 0.0f );
+    }
+
+    audio_peak_index_free( index );
+}
+
+static void
+test_peaks_save_load() {
+    audio_peak_index *index = build_index();
+    gchar *path = g_build_filename( g_get_tmp_dir(), "fluggo-test-peaks", NULL );
+
+    g_assert( audio_peak_index_save( index, path, "source-a" ) );
+    audio_peak_index_free( index );
+
+    // Wrong key or layout means build again
+    g_assert( audio_peak_index_load( path, "source-b", 2, 0, SOURCE_LENGTH + 999 ) == NULL );
+    g_assert( audio_peak_index_load( path, "source-a", 1, 0, SOURCE_LENGTH + 999 ) == NULL );
+    g_assert( audio_peak_index_load( path, "source-a", 2, 0, SOURCE_LENGTH ) == NULL );
+
+    index = audio_peak_index_load( path, "source-a", 2, 0, SOURCE_LENGTH + 999 );
+    g_assert( index != NULL );
+    g_assert( audio_peak_index_is_complete( index ) );
+    check_overview( index );
+
+    audio_peak_index_free( index );
+    remove( path );
+    g_free( path );
+}
+
+void
+test_setup_audio_peaks() {
+    g_test_add_func( "/audio/peaks/levels", test_peaks_levels );
+    g_test_add_func( "/audio/peaks/outside", test_peaks_outside );
+    g_test_add_func( "/audio/peaks/save_load", test_peaks_save_load );
+}
@@ -0,0 +1,186 @@
+/*
+    This file is part of the Fluggo Media Library for high-quality
+    video and audio processing.
+
+    Copyright 2012 Brian J. Crowell <brian@fluggo.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <math.h>
+#include "framework.h"
+
+#define RAMP_LENGTH 4096
+
+static float ramp_data[RAMP_LENGTH * 2];
+static float dc_data[RAMP_LENGTH];
+
+static audio_frame ramp_frame = {
+    .data = ramp_data,
+    .full_min_sample = 0, .full_max_sample = RAMP_LENGTH - 1,
+    .current_min_sample = 0, .current_max_sample = RAMP_LENGTH - 1,
+    .channels = 2,
+};
+
+static audio_frame dc_frame = {
+    .data = dc_data,
+    .full_min_sample = 0, .full_max_sample = RAMP_LENGTH - 1,
+    .current_min_sample = 0, .current_max_sample = RAMP_LENGTH - 1,
+    .channels = 1,
+};
+
+static void
+setup_data() {
+    for( int i = 0; i < RAMP_LENGTH; i++ ) {
+        ramp_data[i * 2] = (float) i;
+        ramp_data[i * 2 + 1] = (float) -i;
+        dc_data[i] = 1.0f;
+    }
+}
+
+static void
+test_resample_identity() {
+    setup_data();
+
+    audio_source source = AUDIO_FRAME_AS_SOURCE( &ramp_frame );
+    audio_resampler *resampler = audio_resampler_new( AUDIO_RESAMPLE_QUALITY_BEST );
+    float out[200];
+
+    audio_resampler_set_position( resampler, 100.0 );
+    audio_resampler_render( resampler, &source, out, 2, 100 );
+
+    for( int i = 0; i < 100; i++ ) {
+        g_assert_cmpfloat( out[i * 2], ==, (float)(100 + i) );
+        g_assert_cmpfloat( out[i * 2 + 1], ==, (float) -(100 + i) );
+    }
+
+    g_assert_cmpfloat( audio_resampler_get_position( resampler ), ==, 200.0 );
+
+    audio_resampler_free( resampler );
+}
+
+static void
+test_resample_reverse() {
+    setup_data();
+
+    audio_source source = AUDIO_FRAME_AS_SOURCE( &ramp_frame );
+
+    for( int quality = 0; quality < AUDIO_RESAMPLE_QUALITY_COUNT; quality++ ) {
+        audio_resampler *resampler = audio_resampler_new( quality );
+        float out[200];
+
+        audio_resampler_set_position( resampler, 1000.0 );
+        audio_resampler_set_rate( resampler, -1.0, false );
+        audio_resampler_render( resampler, &source, out, 2, 100 );
+
+        // Integer positions land on the kernel's zero crossings, so this is exact
+        for( int i = 0; i < 100; i++ ) {
+            g_assert_cmpfloat( fabsf( out[i * 2] - (float)(1000 - i) ), <, 0.001f );
+            g_assert_cmpfloat( fabsf( out[i * 2 + 1] + (float)(1000 - i) ), <, 0.001f );
+        }
+
+        g_assert_cmpfloat( audio_resampler_get_position( resampler ), ==, 900.0 );
+
+        audio_resampler_free( resampler );
+    }
+}
+
+static void
+test_resample_fractional_dc() {
+    setup_data();
+
+    audio_source source = AUDIO_FRAME_AS_SOURCE( &dc_frame );
+
+    for( int quality = 0; quality < AUDIO_RESAMPLE_QUALITY_COUNT; quality++ ) {
+        audio_resampler *resampler = audio_resampler_new( quality );
+        float out[100];
+
+        audio_resampler_set_position( resampler, 1000.5 );
+        audio_resampler_set_rate( resampler, 0.37, false );
+        audio_resampler_render( resampler, &source, out, 1, 100 );
+
+        for( int i = 0; i < 100; i++ )
+            g_assert_cmpfloat( fabsf( out[i] - 1.0f ), <, 0.01f );
+
+        audio_resampler_free( resampler );
+    }
+}
+
+static void
+test_resample_fast_dc() {
+    setup_data();
+
+    audio_source source = AUDIO_FRAME_AS_SOURCE( &dc_frame );
+
+    for( int quality = 0; quality < AUDIO_RESAMPLE_QUALITY_COUNT; quality++ ) {
+        audio_resampler *resampler = audio_resampler_new( quality );
+        float out[100];
+
+        // The widened kernel should still have unity gain at DC
+        audio_resampler_set_position( resampler, 1000.25 );
+        audio_resampler_set_rate( resampler, -3.0, false );
+        audio_resampler_render( resampler, &source, out, 1, 100 );
+
+        for( int i = 0; i < 100; i++ )
+            g_assert_cmpfloat( fabsf( out[i] - 1.0f ), <, 0.01f );
+
+        audio_resampler_free( resampler );
+    }
+}
+
+static void
+test_resample_ramp_rate() {
+    setup_data();
+
+    audio_source source = AUDIO_FRAME_AS_SOURCE( &dc_frame );
+    audio_resampler *resampler = audio_resampler_new( AUDIO_RESAMPLE_QUALITY_LOW );
+    float out[100];
+
+    audio_resampler_set_rate( resampler, 2.0, true );
+    audio_resampler_render( resampler, &source, out, 1, 100 );
+
+    // Rate climbs from 1 to 2 over the block: 100 + (1 + 2 + ... + 100) / 100
+    g_assert_cmpfloat( fabs( audio_resampler_get_position( resampler ) - 150.5 ), <, 0.0001 );
+    g_assert_cmpfloat( audio_resampler_get_rate( resampler ), ==, 2.0 );
+
+    audio_resampler_free( resampler );
+}
+
+static void
+test_resample_silence_outside_source() {
+    setup_data();
+
+    audio_source source = AUDIO_FRAME_AS_SOURCE( &dc_frame );
+    audio_resampler *resampler = audio_resampler_new( AUDIO_RESAMPLE_QUALITY_MEDIUM );
+    float out[100];
+
+    audio_resampler_set_position( resampler, -500.5 );
+    audio_resampler_set_rate( resampler, 1.0, false );
+    audio_resampler_render( resampler, &source, out, 1, 100 );
+
+    for( int i = 0; i < 100; i++ )
+        g_assert_cmpfloat( out[i], ==, 0.0f );
+
+    audio_resampler_free( resampler );
+}
+
+void
+test_setup_audio_resample() {
+    g_test_add_func( "/audio/resample/identity", test_resample_identity );
+    g_test_add_func( "/audio/resample/reverse", test_resample_reverse );
+    g_test_add_func( "/audio/resample/fractional_dc", test_resample_fractional_dc );
+    g_test_add_func( "/audio/resample/fast_dc", test_resample_fast_dc );
+    g_test_add_func( "/audio/resample/ramp_rate", test_resample_ramp_rate );
+    g_test_add_func( "/audio/resample/silence_outside_source", test_resample_silence_outside_source );
+}
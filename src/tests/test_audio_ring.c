@@ -0,0 +1,154 @@
+/*
+    This file is part of the Fluggo Media Library for high-quality
+    video and audio processing.
+
+    Copyright 2012 Brian J. Crowell <brian@fluggo.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "framework.h"
+
+#define STRESS_COUNT    1000000
+
+static void
+test_ring_capacity() {
+    audio_ring *ring = audio_ring_new( 1000 );
+
+    g_assert_cmpint( audio_ring_get_capacity( ring ), ==, 1024 );
+    g_assert_cmpint( audio_ring_get_fill( ring ), ==, 0 );
+
+    audio_ring_free( ring );
+}
+
+static void
+test_ring_wraparound() {
+    audio_ring *ring = audio_ring_new( 16 );
+    float in[400], out[16];
+    int written = 0, read = 0;
+
+    for( int i = 0; i < 400; i++ )
+        in[i] = (float) i;
+
+    // Push the counts around the ring many times at odd strides
+    while( read < 400 ) {
+        int count = min( 12, 400 - written );
+        int fill = audio_ring_get_fill( ring );
+        int result = audio_ring_write( ring, in + written, count );
+
+        // Can't overfill
+        g_assert_cmpint( result, ==, min( count, 16 - fill ) );
+        written += result;
+
+        result = audio_ring_read( ring, out, 7 );
+        g_assert_cmpint( result, ==, min( 7, written - read ) );
+
+        for( int i = 0; i < result; i++ )
+            g_assert_cmpfloat( out[i], ==, (float)(read + i) );
+
+        read += result;
+        g_assert_cmpint( audio_ring_get_fill( ring ), ==, written - read );
+    }
+
+    audio_ring_free( ring );
+}
+
+static void
+test_ring_discard() {
+    audio_ring *ring = audio_ring_new( 16 );
+    float data[8] = { 0.0f };
+
+    audio_ring_write( ring, data, 8 );
+    audio_ring_discard( ring );
+
+    g_assert_cmpint( audio_ring_get_fill( ring ), ==, 0 );
+    g_assert_cmpint( audio_ring_read( ring, data, 8 ), ==, 0 );
+
+    audio_ring_free( ring );
+}
+
+static void
+test_ring_peek() {
+    audio_ring *ring = audio_ring_new( 16 );
+    float data[12];
+    int count;
+
+    for( int i = 0; i < 12; i++ )
+        data[i] = (float) i;
+
+    audio_ring_write( ring, data, 12 );
+    audio_ring_read( ring, data, 10 );
+    audio_ring_write( ring, data, 10 );
+
+    // Twelve waiting, but only six before the end of the ring
+    const float *ptr = audio_ring_peek( ring, &count );
+    g_assert_cmpint( count, ==, 6 );
+    g_assert_cmpfloat( ptr[0], ==, 10.0f );
+
+    audio_ring_advance( ring, 6 );
+    ptr = audio_ring_peek( ring, &count );
+    g_assert_cmpint( count, ==, 6 );
+    g_assert_cmpfloat( ptr[0], ==, 4.0f );
+
+    audio_ring_advance( ring, 6 );
+    g_assert_cmpint( audio_ring_get_fill( ring ), ==, 0 );
+
+    audio_ring_free( ring );
+}
+
+static gpointer
+stress_producer( audio_ring *ring ) {
+    float data[37];
+    int next = 0;
+
+    while( next < STRESS_COUNT ) {
+        int count = min( 37, STRESS_COUNT - next );
+
+        for( int i = 0; i < count; i++ )
+            data[i] = (float)(next + i);
+
+        next += audio_ring_write( ring, data, count );
+    }
+
+    return NULL;
+}
+
+static void
+test_ring_threaded() {
+    audio_ring *ring = audio_ring_new( 256 );
+    GThread *thread = g_thread_new( "audio_ring producer", (GThreadFunc) stress_producer, ring );
+    float data[53];
+    int next = 0;
+
+    while( next < STRESS_COUNT ) {
+        int count = audio_ring_read( ring, data, 53 );
+
+        for( int i = 0; i < count; i++ )
+            g_assert_cmpfloat( data[i], ==, (float)(next + i) );
+
+        next += count;
+    }
+
+    g_thread_join( thread );
+    audio_ring_free( ring );
+}
+
+void
+test_setup_audio_ring() {
+    g_test_add_func( "/audio/ring/capacity", test_ring_capacity );
+    g_test_add_func( "/audio/ring/wraparound", test_ring_wraparound );
+    g_test_add_func( "/audio/ring/discard", test_ring_discard );
+    g_test_add_func( "/audio/ring/peek", test_ring_peek );
+    g_test_add_func( "/audio/ring/threaded", test_ring_threaded );
+}
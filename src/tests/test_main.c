@@ -21,12 +21,28 @@
 #include <glib.h>
 
 void test_setup_audio_mix();
+void test_setup_audio_resample();
+void test_setup_audio_ring();
+void test_setup_audio_convert();
+void test_setup_audio_peaks();
+void test_setup_readahead_file();
+void test_setup_audio_cache();
+void test_setup_video_subsample();
+void test_setup_matroska_writer();
 
 int
 main( int argc, char *argv[]) {
     g_test_init( &argc, &argv, NULL );
 
     test_setup_audio_mix();
+    test_setup_audio_resample();
+    test_setup_audio_ring();
+    test_setup_audio_convert();
+    test_setup_audio_peaks();
+    test_setup_readahead_file();
+    test_setup_audio_cache();
+    test_setup_video_subsample();
+    test_setup_matroska_writer();
 
     return g_test_run();
 }
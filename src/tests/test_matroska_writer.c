@@ -0,0 +1,232 @@
+/*
+    This file is part of the Fluggo Media Library for high-quality
+    video and audio processing.
+
+    Copyright 2012 Brian J. Crowell <brian@fluggo.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "framework.h"
+
+// Bigger than the writer's buffer, so the cluster has left it before it's closed
+#define BIG_BLOCK_SIZE      (3 * 1024 * 1024)
+
+typedef struct {
+    const uint8_t *data;
+    int64_t size;
+} file_data;
+
+// Reads an element header at *position, leaving *position at the body
+static uint32_t
+read_element( const file_data *file, int64_t *position, int64_t *size ) {
+    const uint8_t *p = file->data + *position;
+    int id_length = 1, size_length = 1;
+
+    while( !(p[0] & (0x80 >> (id_length - 1))) )
+        id_length++;
+
+    uint32_t id = 0;
+
+    for( int i = 0; i < id_length; i++ )
+        id = (id << 8) | p[i];
+
+    p += id_length;
+
+    while( !(p[0] & (0x80 >> (size_length - 1))) )
+        size_length++;
+
+    *size = p[0] & (0xFF >> size_length);
+
+    for( int i = 1; i < size_length; i++ )
+        *size = (*size << 8) | p[i];
+
+    *position += id_length + size_length;
+    return id;
+}
+
+static uint64_t
+read_uint( const file_data *file, int64_t position, int64_t size ) {
+    uint64_t value = 0;
+
+    for( int i = 0; i < size; i++ )
+        value = (value << 8) | file->data[position + i];
+
+    return value;
+}
+
+// Finds the first child with the given ID, and returns the position of its body
+static int64_t
+find_child( const file_data *file, int64_t position, int64_t end, uint32_t want, int64_t *size ) {
+    while( position < end ) {
+        uint32_t id = read_element( file, &position, size );
+
+        if( id == want )
+            return position;
+
+        position += *size;
+    }
+
+    return -1;
+}
+
+static file_data
+load_file( const char *path ) {
+    file_data file;
+    gsize size;
+
+    g_assert( g_file_get_contents( path, (gchar **) &file.data, &size, NULL ) );
+    file.size = size;
+
+    return file;
+}
+
+static void
+test_matroska_structure() {
+    char *path;
+    int fd = g_file_open_tmp( "fluggo_matroska_XXXXXX", &path, NULL );
+    g_assert( fd >= 0 );
+    close( fd );
+
+    matroska_writer *writer = matroska_writer_open( path, "matroska", 1000000 );
+    g_assert( writer );
+
+    const uint8_t codec_private[3] = { 1, 2, 3 };
+    matroska_track_params video = { .type = MATROSKA_TRACK_VIDEO, .codec_id = "V_MS/VFW/FOURCC",
+        .pixel_size = { 720, 480 }, .interlaced = true, .default_duration = 33366667,
+        .codec_private = codec_private, .codec_private_size = 3 };
+    matroska_track_params audio = { .type = MATROSKA_TRACK_AUDIO, .codec_id = "A_PCM/INT/LIT",
+        .sample_rate = 48000.0, .channels = 2, .bit_depth = 16 };
+
+    g_assert_cmpint( matroska_writer_add_track( writer, &video ), ==, 1 );
+    g_assert_cmpint( matroska_writer_add_track( writer, &audio ), ==, 2 );
+    matroska_writer_add_tag( writer, 50, "MOVIE", "TITLE", "Test" );
+
+    g_assert( matroska_writer_write_header( writer, "test_matroska_writer", NULL ) );
+
+    uint8_t *big = g_malloc0( BIG_BLOCK_SIZE );
+    uint8_t small[100] = { 0 };
+
+    // Keyframes two seconds apart, so each should start a cluster
+    g_assert( matroska_writer_write_block( writer, 1, 0, big, BIG_BLOCK_SIZE, true, false ) );
+    g_assert( matroska_writer_write_block( writer, 2, 0, small, sizeof(small), true, false ) );
+    g_assert( matroska_writer_write_block( writer, 1, 33, small, sizeof(small), false, true ) );
+    g_assert( matroska_writer_write_block( writer, 1, 2000, small, sizeof(small), true, false ) );
+
+    // Too far for a block's 16-bit timecode
+    g_assert( matroska_writer_write_block( writer, 2, 40000, small, sizeof(small), true, false ) );
+
+    g_assert( matroska_writer_close( writer, 40021 ) );
+    g_free( big );
+
+    file_data file = load_file( path );
+    int64_t position = 0, size;
+
+    g_assert_cmphex( read_element( &file, &position, &size ), ==, 0x1A45DFA3 );
+    int64_t doc_type = find_child( &file, position, position + size, 0x4282, &size );
+    g_assert( doc_type >= 0 );
+    g_assert( !memcmp( file.data + doc_type, "matroska", size ) );
+
+    position = 0;
+    read_element( &file, &position, &size );
+    position += size;
+
+    g_assert_cmphex( read_element( &file, &position, &size ), ==, 0x18538067 );
+    const int64_t segment_start = position;
+    g_assert_cmpint( segment_start + size, ==, file.size );
+
+    // Every seek entry should land on the element it names
+    int64_t seek_head = find_child( &file, segment_start, file.size, 0x114D9B74, &size );
+    const int64_t seek_head_end = seek_head + size;
+    int seek_count = 0;
+
+    g_assert_cmpint( seek_head, >=, 0 );
+
+    for( int64_t seek = seek_head; seek < seek_head_end; seek += size ) {
+        g_assert_cmphex( read_element( &file, &seek, &size ), ==, 0x4DBB );
+
+        int64_t child_size;
+        int64_t id_position = find_child( &file, seek, seek + size, 0x53AB, &child_size );
+        uint32_t id = (uint32_t) read_uint( &file, id_position, child_size );
+        int64_t target_position = find_child( &file, seek, seek + size, 0x53AC, &child_size );
+        int64_t target = segment_start + read_uint( &file, target_position, child_size );
+
+        g_assert_cmphex( read_element( &file, &target, &child_size ), ==, id );
+        seek_count++;
+    }
+
+    g_assert_cmpint( seek_count, ==, 4 );
+
+    int64_t info = find_child( &file, segment_start, file.size, 0x1549A966, &size );
+    int64_t duration = find_child( &file, info, info + size, 0x4489, &size );
+    uint64_t bits = read_uint( &file, duration, 8 );
+    double duration_value;
+    memcpy( &duration_value, &bits, 8 );
+    g_assert_cmpfloat( duration_value, ==, 40021.0 );
+
+    // Clusters at 0, 2000, and 40000, and cues for the two video keyframes
+    int64_t cluster_positions[3];
+    int cluster_count = 0;
+    int64_t cues = -1, cues_size = 0;
+
+    for( position = seek_head_end; position < file.size; position += size ) {
+        int64_t start = position;
+        uint32_t id = read_element( &file, &position, &size );
+
+        if( id == 0x1F43B675 ) {
+            static const int64_t timecodes[3] = { 0, 2000, 40000 };
+            int64_t timecode_size;
+            int64_t timecode = find_child( &file, position, position + size, 0xE7, &timecode_size );
+
+            g_assert_cmpint( cluster_count, <, 3 );
+            g_assert_cmpint( read_uint( &file, timecode, timecode_size ), ==, timecodes[cluster_count] );
+            cluster_positions[cluster_count++] = start - segment_start;
+        }
+        else if( id == 0x1C53BB6B ) {
+            cues = position;
+            cues_size = size;
+        }
+    }
+
+    g_assert_cmpint( cluster_count, ==, 3 );
+    g_assert_cmpint( cues, >=, 0 );
+
+    int cue_count = 0;
+
+    for( position = cues; position < cues + cues_size; position += size ) {
+        g_assert_cmphex( read_element( &file, &position, &size ), ==, 0xBB );
+
+        int64_t child_size;
+        int64_t track_positions = find_child( &file, position, position + size, 0xB7, &child_size );
+        int64_t cluster = find_child( &file, track_positions, track_positions + child_size, 0xF1, &child_size );
+
+        g_assert_cmpint( read_uint( &file, cluster, child_size ), ==, cluster_positions[cue_count] );
+        cue_count++;
+    }
+
+    g_assert_cmpint( cue_count, ==, 2 );
+
+    g_free( (gpointer) file.data );
+    remove( path );
+    g_free( path );
+}
+
+void
+test_setup_matroska_writer() {
+    g_test_add_func( "/matroska_writer/structure", test_matroska_structure );
+}
@@ -0,0 +1,140 @@
+/*
+    This file is part of the Fluggo Media Library for high-quality
+    video and audio processing.
+
+    Copyright 2012 Brian J. Crowell <brian@fluggo.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "framework.h"
+
+#define BLOCK_SIZE      4096
+#define FILE_SIZE       (BLOCK_SIZE * 20 + 1000)
+
+static char *
+make_file() {
+    char *path;
+    int fd = g_file_open_tmp( "fluggo_readahead_XXXXXX", &path, NULL );
+
+    g_assert( fd >= 0 );
+
+    for( int i = 0; i < FILE_SIZE; i++ ) {
+        uint8_t byte = (uint8_t)(i * 7 + i / 251);
+        g_assert( write( fd, &byte, 1 ) == 1 );
+    }
+
+    close( fd );
+    return path;
+}
+
+static void
+check_bytes( const uint8_t *data, int64_t position, int count ) {
+    for( int i = 0; i < count; i++ ) {
+        int64_t j = position + i;
+        g_assert_cmpint( data[i], ==, (uint8_t)(j * 7 + j / 251) );
+    }
+}
+
+static void
+test_readahead_sequential() {
+    char *path = make_file();
+    readahead_file *file = readahead_file_open( path, BLOCK_SIZE, 8, 0 );
+    uint8_t buffer[3000];
+    int64_t position = 0;
+    int count;
+
+    g_assert( file );
+    g_assert_cmpint( readahead_file_get_size( file ), ==, FILE_SIZE );
+
+    // Odd-sized reads straddle the block boundaries
+    while( (count = readahead_file_read( file, buffer, sizeof(buffer) )) > 0 ) {
+        check_bytes( buffer, position, count );
+        position += count;
+    }
+
+    g_assert_cmpint( count, ==, 0 );
+    g_assert_cmpint( position, ==, FILE_SIZE );
+
+    readahead_file_stats stats;
+    readahead_file_get_stats( file, &stats );
+    g_assert_cmpint( stats.bytes_read, >=, FILE_SIZE );
+
+    readahead_file_close( file );
+    remove( path );
+    g_free( path );
+}
+
+static void
+test_readahead_seek() {
+    char *path = make_file();
+    readahead_file *file = readahead_file_open( path, BLOCK_SIZE, 4, READAHEAD_FILE_NOCACHE );
+    uint8_t buffer[500];
+
+    // Walk backwards through the file
+    for( int64_t position = FILE_SIZE - 500; position >= 0; position -= 2000 ) {
+        g_assert_cmpint( readahead_file_seek( file, position, SEEK_SET ), ==, position );
+        g_assert_cmpint( readahead_file_read( file, buffer, 500 ), ==, 500 );
+        check_bytes( buffer, position, 500 );
+    }
+
+    g_assert_cmpint( readahead_file_seek( file, -10, SEEK_END ), ==, FILE_SIZE - 10 );
+    g_assert_cmpint( readahead_file_read( file, buffer, 500 ), ==, 10 );
+    check_bytes( buffer, FILE_SIZE - 10, 10 );
+
+    g_assert_cmpint( readahead_file_seek( file, -1, SEEK_SET ), ==, -1 );
+
+    readahead_file_close( file );
+    remove( path );
+    g_free( path );
+}
+
+static void
+test_readahead_latency() {
+    char *path = make_file();
+    readahead_file *file = readahead_file_open( path, BLOCK_SIZE, 8, 0 );
+    uint8_t buffer[BLOCK_SIZE];
+    int64_t position = 0;
+    int count;
+
+    // Each block takes 2 ms to read; if we take longer than that to use
+    // each block, the thread should stay ahead of us
+    readahead_file_set_latency( file, INT64_C(2000000) );
+
+    while( (count = readahead_file_read( file, buffer, sizeof(buffer) )) > 0 ) {
+        check_bytes( buffer, position, count );
+        position += count;
+        g_usleep( 5000 );
+    }
+
+    readahead_file_stats stats;
+    readahead_file_get_stats( file, &stats );
+
+    g_assert_cmpint( stats.hits, >, stats.misses );
+
+    readahead_file_close( file );
+    remove( path );
+    g_free( path );
+}
+
+void
+test_setup_readahead_file() {
+    g_test_add_func( "/readahead_file/sequential", test_readahead_sequential );
+    g_test_add_func( "/readahead_file/seek", test_readahead_seek );
+    g_test_add_func( "/readahead_file/latency", test_readahead_latency );
+}
+
@@ -0,0 +1,163 @@
+/*
+    This file is part of the Fluggo Media Library for high-quality
+    video and audio processing.
+
+    Copyright 2012 Brian J. Crowell <brian@fluggo.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "framework.h"
+#include "half.h"
+
+// Odd width so the kernel's tail handling gets exercised
+#define WIDTH 37
+#define HEIGHT 12
+
+static rgba_frame_f16 frame;
+static rgba_f16 frame_data[WIDTH * HEIGHT];
+
+static void
+set_pixel( int x, int y, float r, float g, float b ) {
+    const float color[4] = { r, g, b, 1.0f };
+    half_convert_from_float( &frame_data[y * WIDTH + x].r, color, 4 );
+}
+
+static void
+fill_frame( float r, float g, float b ) {
+    const box2i window = { { 0, 0 }, { WIDTH - 1, HEIGHT - 1 } };
+
+    frame.data = frame_data;
+    frame.full_window = window;
+    frame.current_window = window;
+
+    for( int y = 0; y < HEIGHT; y++ ) {
+        for( int x = 0; x < WIDTH; x++ )
+            set_pixel( x, y, r, g, b );
+    }
+}
+
+static void
+test_subsample_flat() {
+    const video_chroma_format formats[3] = { VIDEO_CHROMA_411, VIDEO_CHROMA_420, VIDEO_CHROMA_422 };
+
+    // Pure red: Y = 0.2126, Cb = -0.114572, Cr = 0.5
+    fill_frame( 1.0f, 0.0f, 0.0f );
+
+    for( int i = 0; i < 3; i++ ) {
+        video_subsample_params params = { .chroma = formats[i], .bit_depth = 8, .size = { WIDTH, HEIGHT } };
+        coded_image *image = video_subsample_coded( &frame, &params );
+
+        for( int y = 0; y < image->line_count[0]; y++ ) {
+            for( int x = 0; x < WIDTH; x++ )
+                g_assert_cmpint( ((uint8_t *) image->data[0])[y * image->stride[0] + x], ==, 63 );
+        }
+
+        for( int y = 0; y < image->line_count[1]; y++ ) {
+            for( int x = 0; x < image->stride[1]; x++ ) {
+                g_assert_cmpint( ((uint8_t *) image->data[1])[y * image->stride[1] + x], ==, 102 );
+                g_assert_cmpint( ((uint8_t *) image->data[2])[y * image->stride[2] + x], ==, 240 );
+            }
+        }
+
+        image->free_func( image );
+    }
+}
+
+static void
+test_subsample_10bit() {
+    fill_frame( 1.0f, 1.0f, 1.0f );
+
+    video_subsample_params params = { .chroma = VIDEO_CHROMA_422, .bit_depth = 10, .size = { WIDTH, HEIGHT } };
+    coded_image *image = video_subsample_coded( &frame, &params );
+
+    g_assert_cmpint( image->stride[0], ==, WIDTH * 2 );
+    g_assert_cmpint( image->stride[1], ==, (WIDTH + 1) / 2 * 2 );
+
+    g_assert_cmpint( ((uint16_t *) image->data[0])[0], ==, 940 );
+    g_assert_cmpint( ((uint16_t *) image->data[0])[WIDTH - 1], ==, 940 );
+    g_assert_cmpint( ((uint16_t *) image->data[1])[0], ==, 512 );
+    g_assert_cmpint( ((uint16_t *) image->data[2])[(WIDTH + 1) / 2 - 1], ==, 512 );
+
+    image->free_func( image );
+
+    // Superwhite stays out of the reserved codes
+    fill_frame( 4.0f, 4.0f, 4.0f );
+    image = video_subsample_coded( &frame, &params );
+    g_assert_cmpint( ((uint16_t *) image->data[0])[0], ==, 1019 );
+    image->free_func( image );
+}
+
+static void
+test_subsample_window() {
+    fill_frame( 1.0f, 1.0f, 1.0f );
+
+    // Shift the picture so the first line and column fall outside the window
+    video_subsample_params params = { .chroma = VIDEO_CHROMA_411, .bit_depth = 8,
+        .size = { WIDTH, HEIGHT }, .offset = { -1, -1 } };
+    coded_image *image = video_subsample_coded( &frame, &params );
+    const uint8_t *luma = image->data[0];
+
+    g_assert_cmpint( luma[0], ==, 16 );
+    g_assert_cmpint( luma[1], ==, 16 );
+    g_assert_cmpint( luma[image->stride[0]], ==, 16 );
+    g_assert_cmpint( luma[image->stride[0] + 1], ==, 235 );
+    g_assert_cmpint( ((uint8_t *) image->data[1])[image->stride[1] + 1], ==, 128 );
+
+    image->free_func( image );
+}
+
+static void
+test_subsample_420_fields() {
+    // Alternate red and blue lines, like two fields of different colors
+    fill_frame( 1.0f, 0.0f, 0.0f );
+
+    for( int y = 1; y < HEIGHT; y += 2 ) {
+        for( int x = 0; x < WIDTH; x++ )
+            set_pixel( x, y, 0.0f, 0.0f, 1.0f );
+    }
+
+    video_subsample_params params = { .chroma = VIDEO_CHROMA_420, .bit_depth = 8,
+        .size = { WIDTH, HEIGHT }, .interlaced = true };
+    coded_image *image = video_subsample_coded( &frame, &params );
+    const uint8_t *cr = image->data[2];
+
+    g_assert_cmpint( image->line_count[2], ==, HEIGHT / 2 );
+
+    // Filtered within each field, chroma lines alternate too
+    for( int y = 0; y < image->line_count[2]; y++ )
+        g_assert_cmpint( cr[y * image->stride[2]], ==, (y & 1) ? 118 : 240 );
+
+    image->free_func( image );
+
+    // Across the frame, they mix
+    params.interlaced = false;
+    image = video_subsample_coded( &frame, &params );
+    cr = image->data[2];
+
+    for( int y = 1; y < image->line_count[2] - 1; y++ )
+        g_assert_cmpint( cr[y * image->stride[2]], ==, 179 );
+
+    image->free_func( image );
+}
+
+void
+test_setup_video_subsample() {
+    init_half();
+
+    g_test_add_func( "/video/subsample/flat", test_subsample_flat );
+    g_test_add_func( "/video/subsample/10bit", test_subsample_10bit );
+    g_test_add_func( "/video/subsample/window", test_subsample_window );
+    g_test_add_func( "/video/subsample/420_fields", test_subsample_420_fields );
+}
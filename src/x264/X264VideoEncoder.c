@@ -33,18 +33,22 @@ typedef struct {
 static int
 X264EncoderParams_init( py_obj_X264EncoderParams *self, PyObject *args, PyObject *kw ) {
     PyObject *frame_rate_obj = NULL, *sar_obj = NULL, *timebase_obj = NULL,
-        *annexb_obj = NULL, *repeat_headers_obj = NULL, *interlaced_obj = NULL;
-    int width = -1, height = -1, qp = -1, bitrate = -1, max_bitrate = -1;
+        *annexb_obj = NULL, *repeat_headers_obj = NULL, *interlaced_obj = NULL,
+        *sliced_threads_obj = NULL;
+    int width = -1, height = -1, qp = -1, bitrate = -1, max_bitrate = -1,
+        threads = -1, lookahead = -1, sync_lookahead = -1;
     float crf = -1.0f;
     const char *preset = NULL, *tune = NULL;
 
     static char *kwlist[] = { "preset", "tune", "frame_rate", "sample_aspect_ratio",
         "timebase", "width", "height", "constant_ratefactor", "constant_quantizer",
-        "bitrate", "vbv_max_bitrate", "annex_b", "repeat_headers", "interlaced", NULL };
+        "bitrate", "vbv_max_bitrate", "annex_b", "repeat_headers", "interlaced",
+        "threads", "sliced_threads", "lookahead", "sync_lookahead", NULL };
 
-    if( !PyArg_ParseTupleAndKeywords( args, kw, "|ssOOOiifiiiOOO", kwlist, &preset, &tune,
+    if( !PyArg_ParseTupleAndKeywords( args, kw, "|ssOOOiifiiiOOOiOii", kwlist, &preset, &tune,
             &frame_rate_obj, &sar_obj, &timebase_obj, &width, &height, &crf, &qp,
-            &bitrate, &max_bitrate, &annexb_obj, &repeat_headers_obj, &interlaced_obj ) )
+            &bitrate, &max_bitrate, &annexb_obj, &repeat_headers_obj, &interlaced_obj,
+            &threads, &sliced_threads_obj, &lookahead, &sync_lookahead ) )
         return -1;
 
     // Parse and validate the arguments
@@ -126,6 +130,19 @@ X264EncoderParams_init( py_obj_X264EncoderParams *self, PyObject *args, PyObject
     if( repeat_headers_obj )
         self->params.b_repeat_headers = PyObject_IsTrue( repeat_headers_obj );
 
+    // Threading; anything left out keeps the preset's choice
+    if( threads != -1 )
+        self->params.i_threads = threads;      // Zero is X264_THREADS_AUTO
+
+    if( sliced_threads_obj )
+        self->params.b_sliced_threads = PyObject_IsTrue( sliced_threads_obj );
+
+    if( lookahead != -1 )
+        self->params.rc.i_lookahead = lookahead;
+
+    if( sync_lookahead != -1 )
+        self->params.i_sync_lookahead = sync_lookahead;     // Zero turns off the lookahead thread
+
     // For the moment, these can't be changed
     self->params.i_csp = X264_CSP_I420;
     self->params.vui.i_overscan = 2;      // yes overscan
@@ -191,27 +208,144 @@ typedef struct {
     CodedImageSourceHolder source;
     x264_t *encoder;
 
+    // Set once a frame couldn't be pulled or encoded; the stream can't go on
+    // past a missing frame
+    bool failed;
+
     PyObject *sps, *pps, *sei;
+
+    // Pulls source frames ahead on another thread (see the prefetch argument)
+    int prefetch;
+    GThread *prefetch_thread;
+    GMutex mutex;
+    GCond cond;
+
+    // Protected by mutex: pulled frames in order, NULL where the pull failed
+    GQueue images;
+    int next_prefetch_frame;
+    bool cancel;
 } py_obj_X264VideoEncoder;
 
+static gpointer
+prefetch_thread( py_obj_X264VideoEncoder *self ) {
+    g_mutex_lock( &self->mutex );
+
+    while( !self->cancel && self->next_prefetch_frame <= self->end_frame ) {
+        if( (int) g_queue_get_length( &self->images ) >= self->prefetch ) {
+            g_cond_wait( &self->cond, &self->mutex );
+            continue;
+        }
+
+        int frame = self->next_prefetch_frame++;
+        g_mutex_unlock( &self->mutex );
+
+        coded_image *image = self->source.source.funcs->getFrame( self->source.source.obj, frame, 0 );
+
+        g_mutex_lock( &self->mutex );
+        g_queue_push_tail( &self->images, image );
+        g_cond_broadcast( &self->cond );
+    }
+
+    g_mutex_unlock( &self->mutex );
+    return NULL;
+}
+
+static coded_image *
+pull_frame( py_obj_X264VideoEncoder *self ) {
+    if( !self->prefetch_thread )
+        return self->source.source.funcs->getFrame( self->source.source.obj, self->current_frame, 0 );
+
+    // The source might need the GIL to finish the frame we're waiting on;
+    // let go of it if the caller pulled with it held
+    PyThreadState *thread_state = PyGILState_Check() ? PyEval_SaveThread() : NULL;
+
+    g_mutex_lock( &self->mutex );
+
+    while( g_queue_is_empty( &self->images ) )
+        g_cond_wait( &self->cond, &self->mutex );
+
+    coded_image *image = g_queue_pop_head( &self->images );
+
+    g_cond_broadcast( &self->cond );
+    g_mutex_unlock( &self->mutex );
+
+    if( thread_state )
+        PyEval_RestoreThread( thread_state );
+
+    return image;
+}
+
+static void
+stop_prefetch( py_obj_X264VideoEncoder *self ) {
+    if( !self->prefetch_thread )
+        return;
+
+    g_mutex_lock( &self->mutex );
+    self->cancel = true;
+    g_cond_broadcast( &self->cond );
+    g_mutex_unlock( &self->mutex );
+
+    // The source might need the GIL to finish its current frame
+    Py_BEGIN_ALLOW_THREADS
+    g_thread_join( self->prefetch_thread );
+    Py_END_ALLOW_THREADS
+
+    self->prefetch_thread = NULL;
+
+    coded_image *image;
+
+    while( !g_queue_is_empty( &self->images ) ) {
+        if( (image = g_queue_pop_head( &self->images )) && image->free_func )
+            image->free_func( image );
+    }
+}
+
+/*
+    Function: close_encoder
+    Stops the prefetch thread and lets go of the encoder and source. Needs the GIL.
+*/
+static void
+close_encoder( py_obj_X264VideoEncoder *self ) {
+    if( self->prefetch_thread ) {
+        stop_prefetch( self );
+        g_mutex_clear( &self->mutex );
+        g_cond_clear( &self->cond );
+    }
+
+    if( self->encoder ) {
+        x264_encoder_close( self->encoder );
+        self->encoder = NULL;
+    }
+
+    py_coded_image_take_source( NULL, &self->source );
+    Py_CLEAR( self->sei );
+    Py_CLEAR( self->pps );
+    Py_CLEAR( self->sps );
+}
+
 static int
 X264VideoEncoder_init( py_obj_X264VideoEncoder *self, PyObject *args, PyObject *kw ) {
-    self->source.csource = NULL;
-    self->sps = NULL;
-    self->pps = NULL;
-    self->sei = NULL;
+    // If this is a second call to __init__, don't leave the old thread running
+    close_encoder( self );
+    self->failed = false;
+    self->cancel = false;
 
     PyObject *source_obj;
     py_obj_X264EncoderParams *params_obj;
 
     static char *kwlist[] = { "source", "start_frame", "end_frame",
-        "params", NULL };
+        "params", "prefetch", NULL };
 
-    if( !PyArg_ParseTupleAndKeywords( args, kw, "OiiO!", kwlist, &source_obj,
+    if( !PyArg_ParseTupleAndKeywords( args, kw, "OiiO!|i", kwlist, &source_obj,
             &self->current_frame, &self->end_frame,
-            &py_type_X264EncoderParams, &params_obj ) )
+            &py_type_X264EncoderParams, &params_obj, &self->prefetch ) )
         return -1;
 
+    if( self->prefetch < 0 ) {
+        PyErr_SetString( PyExc_ValueError, "prefetch must not be negative." );
+        return -1;
+    }
+
     self->start_frame = self->current_frame;
     x264_param_t params = params_obj->params;
 
@@ -224,6 +358,11 @@ X264VideoEncoder_init( py_obj_X264VideoEncoder *self, PyObject *args, PyObject *
 
     self->encoder = x264_encoder_open( &params );
 
+    if( !self->encoder ) {
+        PyErr_Format( PyExc_Exception, "Failed to open the x264 encoder." );
+        return -1;
+    }
+
     // Grab the headers here; we're copying x264's example on the IDs
     x264_nal_t *nals;
     int count;
@@ -237,19 +376,22 @@ X264VideoEncoder_init( py_obj_X264VideoEncoder *self, PyObject *args, PyObject *
     self->pps = PyBytes_FromStringAndSize( (char*) nals[1].p_payload, nals[1].i_payload );
     self->sei = PyBytes_FromStringAndSize( (char*) nals[2].p_payload, nals[2].i_payload );
 
+    if( self->prefetch ) {
+        g_mutex_init( &self->mutex );
+        g_cond_init( &self->cond );
+        g_queue_init( &self->images );
+        self->next_prefetch_frame = self->start_frame;
+
+        self->prefetch_thread = g_thread_new( "X264VideoEncoder prefetch thread",
+            (GThreadFunc) prefetch_thread, self );
+    }
+
     return 0;
 }
 
 static void
 X264VideoEncoder_dealloc( py_obj_X264VideoEncoder *self ) {
-    if( self->encoder )
-        x264_encoder_close( self->encoder );
-
-    py_coded_image_take_source( NULL, &self->source );
-    Py_CLEAR( self->sei );
-    Py_CLEAR( self->pps );
-    Py_CLEAR( self->sps );
-
+    close_encoder( self );
     Py_TYPE(self)->tp_free( (PyObject*) self );
 }
 
@@ -291,13 +433,19 @@ X264VideoEncoder_get_next_packet( py_obj_X264VideoEncoder *self ) {
     x264_nal_t *nals;
     int result, nal_count;
 
+    if( self->failed ) {
+        py_codec_packet_set_error( PyExc_Exception, "The encoder has already failed." );
+        return NULL;
+    }
+
     while( self->current_frame <= self->end_frame ) {
-        coded_image *image = self->source.source.funcs->getFrame( self->source.source.obj, self->current_frame, 0 );
+        coded_image *image = pull_frame( self );
 
         if( !image ) {
-            // TODO: Report an error instead of ending the stream early
-            self->current_frame = self->end_frame;
-            continue;
+            self->failed = true;
+            py_codec_packet_set_error( PyExc_Exception, "Could not get frame %d from the source.",
+                self->current_frame );
+            return NULL;
         }
 
         x264_picture_t pict = {
@@ -316,7 +464,9 @@ X264VideoEncoder_get_next_packet( py_obj_X264VideoEncoder *self ) {
             image->free_func( image );
 
         if( result < 0 ) {
-            g_warning( "Failed in x264_encoder_encode." );
+            self->failed = true;
+            py_codec_packet_set_error( PyExc_Exception, "Failed in x264_encoder_encode at frame %d.",
+                self->current_frame );
             return NULL;
         }
 
@@ -353,7 +503,8 @@ X264VideoEncoder_get_next_packet( py_obj_X264VideoEncoder *self ) {
     result = x264_encoder_encode( self->encoder, &nals, &nal_count, NULL, &pict_out );
 
     if( result < 0 ) {
-        g_warning( "Failed in x264_encoder_encode at end of stream." );
+        self->failed = true;
+        py_codec_packet_set_error( PyExc_Exception, "Failed in x264_encoder_encode at end of stream." );
         return NULL;
     }
 
@@ -425,6 +576,14 @@ static PyMemberDef X264VideoEncoder_members[] = {
     { NULL }
 };
 
+/*
+    X264VideoEncoder(source, start_frame, end_frame, params, prefetch=0)
+
+    Encodes frames from a coded image source with x264. If prefetch is nonzero, up to
+    that many source frames are pulled ahead on a background thread, so producing
+    them overlaps with encoding; the source then has to be safe to call from another
+    thread.
+*/
 static PyTypeObject py_type_X264VideoEncoder = {
     PyVarObject_HEAD_INIT(NULL, 0)
     .tp_name = "fluggo.media.x264.X264VideoEncoder",
@@ -0,0 +1,61 @@
+import unittest, fractions, os, tempfile, time
+from fluggo.media import process
+
+try:
+    from fluggo.media import alsa
+except ImportError:
+    alsa = None
+
+@unittest.skipIf(alsa is None, 'ALSA support was not built')
+class test_AlsaPlayer(unittest.TestCase):
+    def test_null_backend(self):
+        player = alsa.AlsaPlayer(48000, 2, None, backend='null', sample_format='s32')
+
+        self.assertEqual('s32', player.sample_format)
+        self.assertFalse(player.mmap)
+
+        player.play(1)
+        time.sleep(0.2)
+        player.stop()
+
+        self.assertGreater(player.get_presentation_time(), 0)
+
+    def test_file_backend(self):
+        fd, path = tempfile.mkstemp()
+        os.close(fd)
+
+        try:
+            player = alsa.AlsaPlayer(48000, 2, None, backend='file', device=path, sample_format='s16')
+            self.assertEqual('s16', player.sample_format)
+
+            player.play(1)
+            time.sleep(0.3)
+            player.stop()
+            del player
+
+            with open(path, 'rb') as f:
+                data = f.read()
+
+            # Whole frames of silence, and the sink shouldn't get far ahead of real time
+            self.assertEqual(0, len(data) % 4)
+            self.assertGreater(len(data), 0)
+            self.assertLess(len(data), 48000 * 4)
+            self.assertEqual(bytes(len(data)), data)
+        finally:
+            os.remove(path)
+
+    @unittest.skipUnless(os.path.exists('/dev/full'), 'Needs /dev/full to fail writes')
+    def test_device_error(self):
+        # A device that fails for good stops playback instead of taking the process with it
+        player = alsa.AlsaPlayer(48000, 2, None, backend='file', device='/dev/full', sample_format='s16')
+        self.assertIsNone(player.device_error)
+
+        player.play(1)
+        time.sleep(0.3)
+
+        self.assertIsInstance(player.device_error, OSError)
+        player.stop()
+
+    def test_bad_backend(self):
+        with self.assertRaises(ValueError):
+            alsa.AlsaPlayer(48000, 2, None, backend='carrier pigeon')
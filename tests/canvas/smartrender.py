@@ -0,0 +1,169 @@
+import unittest, fractions, os, tempfile
+from fluggo.media import process
+from fluggo.media.basetypes import *
+from fluggo.editor.graph.video import SequenceVideoManager, SpaceVideoManager
+from fluggo.editor.graph import smartrender
+from fluggo.editor import model, plugins
+
+DV_URN = 'urn:libav:codec-format:dvvideo'
+
+dv_format = plugins.VideoFormat(interlaced=True,
+    full_frame=box2i(-8, -1, -8 + 720 - 1, -1 + 480 - 1),
+    pixel_aspect_ratio=fractions.Fraction(10, 11),
+    frame_rate=fractions.Fraction(30000, 1001))
+
+class FakeDecoder(plugins.VideoStream):
+    '''Looks like a decoder connector to the planner, without needing a codec.'''
+    def __init__(self, name, length, format_urn=DV_URN, open_packet_stream=None):
+        plugins.VideoStream.__init__(self,
+            process.SolidColorVideoSource(process.LerpFunc((0, 0, 0, 1), (100, 0, 0, 1), 100)),
+            dv_format, (0, length - 1))
+        self.packet_stream = name
+        self.format_urn = format_urn
+        self.open_packet_stream = open_packet_stream or (lambda: name)
+
+slist = model.AssetList()
+
+for name in ('a', 'b', 'd'):
+    slist[name] = model.RuntimeSourceAsset(model.RuntimeSource(name, {'video': FakeDecoder(name, 20)}))
+
+slist['short'] = model.RuntimeSourceAsset(model.RuntimeSource('short', {'video': FakeDecoder('short', 5)}))
+slist['mpeg'] = model.RuntimeSourceAsset(model.RuntimeSource('mpeg', {'video': FakeDecoder('mpeg', 20, 'urn:libav:codec-format:mpeg2video')}))
+slist['red'] = model.RuntimeSourceAsset(model.RuntimeSource('red', {'video':
+    plugins.VideoStream(process.SolidColorVideoSource(process.LerpFunc((0, 0, 0, 1), (100, 0, 0, 1), 100)), dv_format, (0, 99))}))
+
+def ref(name):
+    return model.AssetStreamRef(name, 'video')
+
+def write_dv(testcase, frames):
+    '''Write a DV file RawDVSource can read, with frame i marked at byte 80, and return its path.'''
+    fd, path = tempfile.mkstemp(suffix='.dv')
+
+    with os.fdopen(fd, 'wb') as f:
+        for i in range(frames):
+            frame = bytearray(120000)
+            frame[0], frame[3], frame[80] = 0x1f, 0x3f, i
+            f.write(frame)
+
+    testcase.addCleanup(os.remove, path)
+    return path
+
+def strip(plan):
+    '''Leave out the decoders, which the tests don't care about.'''
+    return [range_[:4] for range_ in plan]
+
+class test_smartrender(unittest.TestCase):
+    def make_sequence(self):
+        # A cut, a dissolve into b, an unrelated clip, then a gap before d
+        return model.Sequence(type='video', items=[
+            model.SequenceItem(source=ref('a'), offset=2, length=10),
+            model.SequenceItem(source=ref('b'), offset=0, length=10, transition_length=4),
+            model.SequenceItem(source=ref('red'), offset=0, length=5),
+            model.SequenceItem(source=ref('d'), offset=0, length=5, transition_length=-3)])
+
+    def test_sequence(self):
+        manager = SequenceVideoManager(self.make_sequence(), slist, dv_format)
+        plan = smartrender.plan_sequence(manager, DV_URN)
+
+        self.assertEqual([
+            (0, 6, 'a', 2),
+            (6, 4, None, None),
+            (10, 6, 'b', 4),
+            (16, 8, None, None),
+            (24, 5, 'd', 0)], strip(plan))
+
+    def test_sequence_part(self):
+        manager = SequenceVideoManager(self.make_sequence(), slist, dv_format)
+        plan = smartrender.plan_sequence(manager, DV_URN, 3, 12)
+
+        self.assertEqual([
+            (3, 3, 'a', 5),
+            (6, 4, None, None),
+            (10, 2, 'b', 4)], strip(plan))
+
+    def test_adjacent_cuts(self):
+        # Cutting a clip in two shouldn't split its packets
+        sequence = model.Sequence(type='video', items=[
+            model.SequenceItem(source=ref('a'), offset=0, length=5),
+            model.SequenceItem(source=ref('a'), offset=5, length=5),
+            model.SequenceItem(source=ref('short'), offset=3, length=4),
+            model.SequenceItem(source=ref('mpeg'), offset=0, length=4)])
+        manager = SequenceVideoManager(sequence, slist, dv_format)
+
+        # short runs past the end of its source, and mpeg isn't DV
+        self.assertEqual([(0, 10, 'a', 0), (10, 8, None, None)],
+            strip(smartrender.plan_sequence(manager, DV_URN)))
+
+    def test_format_mismatch(self):
+        manager = SequenceVideoManager(self.make_sequence(), slist, plugins.VideoFormat())
+        self.assertEqual([(0, 29, None, None)], strip(smartrender.plan_sequence(manager, DV_URN)))
+
+    def test_space(self):
+        # a alone, then overlapped by red, red alone, a gap, and a sequence of b and d
+        space = model.Space('', dv_format, plugins.AudioFormat())
+        space[:] = [
+            model.Clip(type='video', x=0, length=10, offset=2, source=ref('a')),
+            model.Clip(type='video', x=8, length=4, offset=0, source=ref('red')),
+            model.Sequence(type='video', x=15, items=[
+                model.SequenceItem(source=ref('b'), offset=0, length=5),
+                model.SequenceItem(source=ref('d'), offset=3, length=4)])]
+        manager = SpaceVideoManager(space, slist)
+
+        self.assertEqual([
+            (0, 8, 'a', 2),
+            (8, 7, None, None),
+            (15, 5, 'b', 0),
+            (20, 4, 'd', 3),
+            (24, 2, None, None)], strip(smartrender.plan_space(manager, DV_URN, 0, 26)))
+
+        # Sequence frames are counted from the start of the space
+        self.assertEqual([(17, 3, 'b', 2), (20, 1, 'd', 3)],
+            strip(smartrender.plan_space(manager, DV_URN, 17, 21)))
+
+    def test_create_packet_source(self):
+        encoded = []
+
+        def encode(first_frame, last_frame):
+            encoded.append((first_frame, last_frame))
+            return process.CodecPacketSequence([])
+
+        plan = [smartrender.ExportRange(0, 3, None, None, None)]
+        source = smartrender.create_packet_source(plan, encode)
+
+        self.assertEqual([(0, 2)], encoded)
+        self.assertEqual(3, source.progress_count)
+
+    def test_no_private_stream(self):
+        # Without a way to open its own copy, the export would have to move the
+        # decoder's stream, so the frames get encoded instead
+        decoder = FakeDecoder('a', 20)
+        decoder.open_packet_stream = None
+
+        assets = model.AssetList()
+        assets['a'] = model.RuntimeSourceAsset(model.RuntimeSource('a', {'video': decoder}))
+
+        sequence = model.Sequence(type='video', items=[model.SequenceItem(source=ref('a'), offset=0, length=5)])
+        manager = SequenceVideoManager(sequence, assets, dv_format)
+
+        self.assertEqual([(0, 5, None, None)], strip(smartrender.plan_sequence(manager, DV_URN)))
+
+    def test_render_while_decoding(self):
+        path = write_dv(self, 20)
+        shared = process.RawDVSource(path)
+        decoder = FakeDecoder(shared, 20, open_packet_stream=lambda: process.RawDVSource(path))
+
+        plan = [smartrender.ExportRange(0, 4, shared, 2, decoder),
+            smartrender.ExportRange(4, 3, shared, 12, decoder)]
+        source = smartrender.create_packet_source(plan, None)
+
+        # The decoder keeps reading the shared stream in between the export's packets
+        shared.seek(5)
+        rendered, decoded = [], []
+
+        for i in range(7):
+            rendered.append(source.get_next_packet().data[80])
+            decoded.append(shared.get_next_packet().data[80])
+
+        self.assertIsNone(source.get_next_packet())
+        self.assertEqual([2, 3, 4, 5, 12, 13, 14], rendered)
+        self.assertEqual(list(range(5, 12)), decoded)
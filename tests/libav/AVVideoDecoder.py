@@ -0,0 +1,160 @@
+import unittest, fractions, os, tempfile, threading
+from fluggo.media import process
+
+try:
+    from fluggo.media import libav
+except ImportError:
+    libav = None
+
+WIDTH, HEIGHT = 720, 480
+FRAMES = 24
+
+def marker(frame):
+    '''Luma level that identifies a frame.'''
+    return 32 + frame * 8
+
+class MarkedSource(process.CodedImageSource):
+    '''NTSC DV-shaped 4:1:1 pictures, each a flat gray that says which frame it is.'''
+    def get_frame(self, frame):
+        chroma = bytearray([128] * (WIDTH // 4 * HEIGHT))
+
+        return [process.CodedImage(bytearray([marker(frame)] * (WIDTH * HEIGHT)), WIDTH, HEIGHT),
+            process.CodedImage(chroma, WIDTH // 4, HEIGHT),
+            process.CodedImage(bytearray(chroma), WIDTH // 4, HEIGHT)]
+
+def read_marker(decoder, frame):
+    '''Return the luma level in the middle of the decoded frame.'''
+    luma = decoder.get_frame(frame)[0]
+    middle = (luma.line_count // 2) * luma.stride + WIDTH // 2
+    return luma.data[middle]
+
+@unittest.skipIf(libav is None, 'libav support was not built')
+class test_AVVideoDecoder(unittest.TestCase):
+    @classmethod
+    def setUpClass(cls):
+        encoder = libav.AVVideoEncoder(MarkedSource(), 'dvvideo', 0, FRAMES - 1,
+            fractions.Fraction(30000, 1001), (WIDTH, HEIGHT), fractions.Fraction(10, 11), True)
+
+        fd, cls.path = tempfile.mkstemp(suffix='.dv')
+
+        with os.fdopen(fd, 'wb') as f:
+            while True:
+                packet = encoder.get_next_packet()
+
+                if packet is None:
+                    break
+
+                f.write(packet.data)
+
+    @classmethod
+    def tearDownClass(cls):
+        os.remove(cls.path)
+
+    def open(self, **kw):
+        return libav.AVVideoDecoder(process.RawDVSource(self.path), 'dvvideo', **kw)
+
+    def assertMarker(self, decoder, frame):
+        # DV is lossy, but not on a flat picture
+        self.assertAlmostEqual(marker(frame), read_marker(decoder, frame), delta=3)
+
+    def test_random_access(self):
+        for decoders in (1, 2):
+            with self.subTest(decoders=decoders):
+                decoder = self.open(decoders=decoders, cache_size=0)
+
+                for frame in (7, 2, 2, 19, 0, 11, 10, FRAMES - 1, 3):
+                    self.assertMarker(decoder, frame)
+
+                self.assertGreater(decoder.seeks, 0)
+
+    def test_past_end(self):
+        decoder = self.open(decoders=2)
+        self.assertIsNone(decoder.get_frame(FRAMES + 5))
+
+    def test_cache_hits(self):
+        decoder = self.open(decoders=1)
+
+        self.assertMarker(decoder, 5)
+        decoded = decoder.frames_decoded
+
+        self.assertMarker(decoder, 5)
+        self.assertEqual(1, decoder.cache_hits)
+        self.assertEqual(decoded, decoder.frames_decoded)
+        self.assertGreater(decoder.cache_used, 0)
+
+    def test_cache_eviction(self):
+        decoder = self.open(decoders=2)
+
+        self.assertMarker(decoder, 0)
+        picture_size = decoder.cache_used
+
+        # Room for two pictures; the least recently used goes first
+        decoder.cache_size = picture_size * 2
+        self.assertMarker(decoder, 1)
+        self.assertMarker(decoder, 0)
+        self.assertMarker(decoder, 2)
+        self.assertEqual(1, decoder.cache_hits)
+        self.assertLessEqual(decoder.cache_used, picture_size * 2)
+
+        misses = decoder.cache_misses
+        self.assertMarker(decoder, 0)
+        self.assertMarker(decoder, 1)
+        self.assertEqual(2, decoder.cache_hits)
+        self.assertEqual(misses + 1, decoder.cache_misses)
+
+        # Turning the cache off empties it
+        decoder.cache_size = 0
+        self.assertEqual(0, decoder.cache_used)
+
+    def test_pool_reuse(self):
+        # Many more pictures than decoders, from several threads at once
+        decoder = self.open(decoders=2, cache_size=0)
+        self.assertEqual(2, decoder.decoders)
+
+        errors = []
+
+        def pull(start):
+            try:
+                for frame in range(start, FRAMES, 3):
+                    self.assertMarker(decoder, frame)
+            except Exception as ex:
+                errors.append(ex)
+
+        threads = [threading.Thread(target=pull, args=(i,)) for i in range(3)]
+
+        for thread in threads:
+            thread.start()
+
+        for thread in threads:
+            thread.join()
+
+        self.assertEqual([], errors)
+        self.assertEqual(FRAMES, decoder.frames_decoded)
+
+    def test_concurrent_misses(self):
+        # Everyone asking for the same frame at once gets one decode between them
+        decoder = self.open(decoders=4)
+        barrier = threading.Barrier(4)
+        results = []
+
+        def pull():
+            barrier.wait()
+            results.append(read_marker(decoder, 9))
+
+        threads = [threading.Thread(target=pull) for i in range(4)]
+
+        for thread in threads:
+            thread.start()
+
+        for thread in threads:
+            thread.join()
+
+        self.assertEqual(4, len(results))
+        self.assertEqual(1, decoder.frames_decoded)
+        self.assertEqual(1, decoder.cache_misses)
+        self.assertEqual(3, decoder.cache_hits)
+
+    def test_bad_args(self):
+        self.assertRaises(ValueError, self.open, decoders=-1)
+        self.assertRaises(ValueError, self.open, cache_size=-1)
+        self.assertRaises(ValueError, self.open, thread_type='fiber')
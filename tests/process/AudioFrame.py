@@ -0,0 +1,32 @@
+import unittest, array
+from fluggo.media import process
+
+class test_AudioFrame(unittest.TestCase):
+    def test_wrap(self):
+        data = array.array('f', range(12))
+        frame = process.AudioFrame(data, 10, 15, 2, current_min_sample=11)
+
+        self.assertEqual(11, frame.current_min_sample)
+        self.assertEqual(15, frame.current_max_sample)
+        self.assertIsNone(frame.sample(10, 0))
+        self.assertEqual(5.0, frame.sample(12, 1))
+
+        view = memoryview(frame)
+        self.assertEqual((6, 2), view.shape)
+        self.assertEqual('f', view.format)
+        self.assertFalse(view.readonly)
+
+        # No copy: writes show up on both sides
+        view[2, 1] = 99.0
+        self.assertEqual(99.0, data[5])
+        self.assertEqual(99.0, frame.sample(12, 1))
+
+    def test_read_only(self):
+        frame = process.AudioFrame(bytes(48), 0, 5, 2)
+        self.assertTrue(memoryview(frame).readonly)
+
+    def test_bad_args(self):
+        self.assertRaises(ValueError, process.AudioFrame, bytes(40), 0, 5, 2)
+        self.assertRaises(ValueError, process.AudioFrame, bytes(48), 5, 0, 2)
+        self.assertRaises(ValueError, process.AudioFrame, bytes(48), 0, 5, 0)
+        self.assertRaises(ValueError, process.AudioFrame, memoryview(bytearray(49))[1:], 0, 5, 2)
@@ -0,0 +1,39 @@
+import unittest, os, tempfile
+from fluggo.media import process
+
+class test_AudioPeakIndex(unittest.TestCase):
+    def test_silence(self):
+        index = process.AudioPeakIndex(None, 0, 99999, channels=2)
+
+        self.assertTrue(index.wait(10.0))
+        self.assertTrue(index.complete)
+        self.assertEqual(1.0, index.progress)
+
+        peaks = index.query(0, 99999, 50)
+        self.assertEqual(50, len(peaks))
+        self.assertEqual((0.0, 0.0, 0.0), peaks[0])
+
+        self.assertEqual(10, len(index.query(0, 99999, 10, channel=1)))
+
+        with self.assertRaises(ValueError):
+            index.query(0, 99999, 10, channel=2)
+
+    def test_cache(self):
+        fd, path = tempfile.mkstemp()
+        os.close(fd)
+        os.remove(path)
+
+        try:
+            index = process.AudioPeakIndex(None, 0, 99999, cache_path=path, key='silence')
+            self.assertTrue(index.wait(10.0))
+            self.assertTrue(os.path.exists(path))
+
+            # Same key loads without reading the source
+            index = process.AudioPeakIndex(None, 0, 99999, cache_path=path, key='silence')
+            self.assertTrue(index.complete)
+
+            # A different key means start over
+            index = process.AudioPeakIndex(None, 0, 99999, cache_path=path, key='noise')
+            self.assertTrue(index.wait(10.0))
+        finally:
+            os.remove(path)
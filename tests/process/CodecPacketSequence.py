@@ -0,0 +1,50 @@
+import unittest
+from fluggo.media import process
+import dvframes
+
+class test_CodecPacketSequence(unittest.TestCase):
+    def write_source(self, first, count):
+        return process.RawDVSource(dvframes.write_file(self, range(first, first + count)))
+
+    def test_splice(self):
+        a = self.write_source(0, 10)
+        b = self.write_source(100, 5)
+
+        # The second range reads b from where it is, like a fresh encoder
+        sequence = process.CodecPacketSequence([(a, 5, 3), (b, None, 2), (a, 0, 2)])
+        self.assertEqual(7, sequence.progress_count)
+
+        expected = [5, 6, 7, 100, 101, 0, 1]
+
+        for i, marker in enumerate(expected):
+            packet = sequence.get_next_packet()
+            self.assertEqual(i, packet.pts)
+            self.assertEqual(i, packet.dts)
+            self.assertEqual(marker, packet.data[80])
+
+        self.assertIsNone(sequence.get_next_packet())
+        self.assertEqual(7, sequence.progress)
+
+    def test_short_range(self):
+        # A range that runs out would leave a hole, so the sequence fails instead
+        a = self.write_source(0, 3)
+        sequence = process.CodecPacketSequence([(a, 1, 4), (a, 0, 1)])
+
+        self.assertEqual(1, sequence.get_next_packet().data[80])
+        self.assertEqual(2, sequence.get_next_packet().data[80])
+
+        self.assertRaises(Exception, sequence.get_next_packet)
+        self.assertRaises(Exception, sequence.get_next_packet)
+
+    def test_bad_seek(self):
+        a = self.write_source(0, 3)
+        sequence = process.CodecPacketSequence([(a, 0, 1), (a, 10, 1)])
+
+        self.assertEqual(0, sequence.get_next_packet().data[80])
+        self.assertRaises(Exception, sequence.get_next_packet)
+
+    def test_bad_args(self):
+        a = self.write_source(0, 3)
+        self.assertRaises(TypeError, process.CodecPacketSequence, 5)
+        self.assertRaises(ValueError, process.CodecPacketSequence, [(a, 0, -1)])
+        self.assertRaises(Exception, process.CodecPacketSequence, [(None, 0, 1)])
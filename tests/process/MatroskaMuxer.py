@@ -0,0 +1,63 @@
+import unittest, os, tempfile
+from fluggo.media import process
+import dvframes
+
+class test_MatroskaMuxer(unittest.TestCase):
+    def temp_path(self, suffix):
+        fd, path = tempfile.mkstemp(suffix=suffix)
+        os.close(fd)
+        self.addCleanup(os.remove, path)
+        return path
+
+    def write_source(self, frames):
+        return process.RawDVSource(dvframes.write_file(self, range(frames)))
+
+    def test_write(self):
+        path = self.temp_path('.mkv')
+
+        muxer = process.MatroskaMuxer(path, title='Test')
+        muxer.add_video_track(self.write_source(3), 'V_MS/VFW/FOURCC', (30000, 1001), (720, 480),
+            sample_aspect_ratio=(10, 11), interlaced=True, codec_private=b'\x01\x02', prefix=b'SEI')
+        muxer.add_tag('DESCRIPTION', 'A test')
+        muxer.run()
+
+        with open(path, 'rb') as f:
+            data = f.read()
+
+        self.assertEqual(b'\x1a\x45\xdf\xa3', data[0:4])
+        self.assertIn(b'matroska', data[0:64])
+        self.assertIn(b'V_MS/VFW/FOURCC', data)
+        self.assertIn(b'A test', data)
+
+        # The prefix goes only on the first frame
+        first = data.index(b'SEI')
+        self.assertEqual(0, data[first + 3 + 80])
+        self.assertEqual(1, data.count(b'SEI'))
+        self.assertGreater(len(data), 3 * 120000)
+
+    def test_source_fails(self):
+        # A sequence with a range that runs short fails, and so does the file
+        source = process.CodecPacketSequence([(self.write_source(3), 0, 5)])
+
+        muxer = process.MatroskaMuxer(self.temp_path('.mkv'))
+        muxer.add_video_track(source, 'V_MS/VFW/FOURCC', (30000, 1001), (720, 480))
+        self.assertRaises(Exception, muxer.run)
+
+    def test_no_tracks(self):
+        muxer = process.MatroskaMuxer(self.temp_path('.mkv'))
+        self.assertRaises(Exception, muxer.run)
+
+    def test_too_many_tracks(self):
+        # Track numbers have to fit in one byte in each block
+        source = self.write_source(1)
+        muxer = process.MatroskaMuxer(self.temp_path('.mkv'))
+
+        for i in range(126):
+            muxer.add_audio_track(source, 'A_PCM/INT/LIT', 48000, 2)
+
+        self.assertRaises(ValueError, muxer.add_audio_track, source, 'A_PCM/INT/LIT', 48000, 2)
+        self.assertRaises(ValueError, muxer.add_video_track, source, 'V_MS/VFW/FOURCC', (30000, 1001), (720, 480))
+
+    def test_bad_args(self):
+        self.assertRaises(ValueError, process.MatroskaMuxer, 'x.mkv', doc_type='avi')
+        self.assertRaises(ValueError, process.MatroskaMuxer, 'x.mkv', timecode_scale=0)
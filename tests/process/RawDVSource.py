@@ -0,0 +1,51 @@
+import unittest, os, tempfile
+from fluggo.media import process
+import dvframes
+
+class test_RawDVSource(unittest.TestCase):
+    def write_file(self, frames, pal=False):
+        return dvframes.write_file(self, range(frames), pal)
+
+    def test_ntsc(self):
+        source = process.RawDVSource(self.write_file(3))
+
+        self.assertEqual(120000, source.frame_size)
+        self.assertEqual(3, source.frame_count)
+
+        for i in range(3):
+            packet = source.get_next_packet()
+            self.assertEqual(i, packet.pts)
+            self.assertEqual(i, packet.dts)
+            self.assertTrue(packet.keyframe)
+            self.assertEqual(120000, len(packet.data))
+            self.assertEqual(i, packet.data[80])
+
+        self.assertIsNone(source.get_next_packet())
+
+    def test_pal(self):
+        source = process.RawDVSource(self.write_file(2, pal=True))
+
+        self.assertEqual(144000, source.frame_size)
+        self.assertEqual(2, source.frame_count)
+
+    def test_seek(self):
+        source = process.RawDVSource(self.write_file(5), readahead=2)
+
+        # Step backwards
+        for i in reversed(range(5)):
+            source.seek(i)
+            self.assertEqual(i, source.get_next_packet().data[80])
+
+        with self.assertRaises(Exception):
+            source.seek(-1)
+
+    def test_not_dv(self):
+        fd, path = tempfile.mkstemp()
+
+        with os.fdopen(fd, 'wb') as f:
+            f.write(b'\xff' * 1000)
+
+        self.addCleanup(os.remove, path)
+
+        with self.assertRaises(Exception):
+            process.RawDVSource(path)
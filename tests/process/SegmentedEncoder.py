@@ -0,0 +1,71 @@
+import unittest, os, tempfile
+from fluggo.media import process
+import dvframes
+
+class test_SegmentedEncoder(unittest.TestCase):
+    def factory(self, first_frame, last_frame):
+        # Stands in for an encoder: one file per segment, timestamps from zero
+        self.segments.append((first_frame, last_frame))
+        return process.RawDVSource(dvframes.write_file(self, range(first_frame, last_frame + 1)))
+
+    def setUp(self):
+        self.segments = []
+
+    def test_order(self):
+        encoder = process.SegmentedEncoder(self.factory, 5, 14, segment_size=3, workers=2)
+
+        self.assertEqual(10, encoder.progress_count)
+
+        for i in range(10):
+            packet = encoder.get_next_packet()
+            self.assertEqual(i, packet.pts)
+            self.assertEqual(i, packet.dts)
+            self.assertEqual(i + 5, packet.data[80])
+
+        self.assertIsNone(encoder.get_next_packet())
+        self.assertEqual(10, encoder.progress)
+        self.assertEqual([(5, 7), (8, 10), (11, 13), (14, 14)], self.segments)
+
+    def test_release_early(self):
+        # Dropping the encoder partway through shouldn't hang the workers
+        encoder = process.SegmentedEncoder(self.factory, 0, 99, segment_size=10, workers=4)
+        encoder.get_next_packet()
+        del encoder
+
+    def test_factory_fails(self):
+        def factory(first_frame, last_frame):
+            if first_frame >= 6:
+                raise ValueError('No encoder for you')
+
+            return self.factory(first_frame, last_frame)
+
+        encoder = process.SegmentedEncoder(factory, 0, 9, segment_size=3, workers=1)
+
+        # No partial stream; the factory's exception comes out, and keeps coming out
+        self.assertRaises(ValueError, encoder.get_next_packet)
+        self.assertRaises(ValueError, encoder.get_next_packet)
+
+        # If even the first one fails, so does the constructor
+        self.assertRaises(ValueError, process.SegmentedEncoder, factory, 6, 9)
+
+    def test_factory_fails_muxed(self):
+        def factory(first_frame, last_frame):
+            if first_frame >= 6:
+                raise ValueError('No encoder for you')
+
+            return self.factory(first_frame, last_frame)
+
+        fd, path = tempfile.mkstemp(suffix='.mkv')
+        os.close(fd)
+        self.addCleanup(os.remove, path)
+
+        muxer = process.MatroskaMuxer(path)
+        muxer.add_video_track(process.SegmentedEncoder(factory, 0, 9, segment_size=3, workers=1),
+            'V_MS/VFW/FOURCC', (30000, 1001), (720, 480))
+        self.assertRaises(ValueError, muxer.run)
+
+    def test_bad_args(self):
+        self.assertRaises(TypeError, process.SegmentedEncoder, None, 0, 10)
+        self.assertRaises(ValueError, process.SegmentedEncoder, self.factory, 10, 0)
+        self.assertRaises(ValueError, process.SegmentedEncoder, self.factory, 0, 10, segment_size=0)
+        self.assertRaises(ValueError, process.SegmentedEncoder, self.factory, 0, 10, max_queued=-1)
@@ -0,0 +1,31 @@
+'''Fake DV files for the tests that need packets to read.
+
+The frames are blank apart from the header DIF block, which is all RawDVSource
+looks at, and a marker byte at offset 80 so a test can tell which frame it got.'''
+
+import os, tempfile
+
+NTSC_FRAME_SIZE = 120000
+PAL_FRAME_SIZE = 144000
+
+def make_frame(index, pal=False):
+    frame = bytearray(PAL_FRAME_SIZE if pal else NTSC_FRAME_SIZE)
+
+    # Header DIF block: section type zero, DSF flag for 625/50
+    frame[0] = 0x1f
+    frame[3] = 0xbf if pal else 0x3f
+    frame[80] = index
+
+    return bytes(frame)
+
+def write_file(testcase, frames, pal=False):
+    '''Write a DV file with a frame for each marker in *frames*, remove it when
+    *testcase* is done, and return its path.'''
+    fd, path = tempfile.mkstemp(suffix='.dv')
+
+    with os.fdopen(fd, 'wb') as f:
+        for i in frames:
+            f.write(make_frame(i, pal))
+
+    testcase.addCleanup(os.remove, path)
+    return path
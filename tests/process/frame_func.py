@@ -77,3 +77,87 @@ class test_AnimationFunc(tupletester):
 
 
 
+
+    def test_batch(self):
+        func = process.AnimationFunc()
+        func.add(process.POINT_LINEAR, 0.0, (0.0, 10.0))
+        func.add(process.POINT_HOLD, 4.0, (4.0, 6.0))
+        func.add(process.POINT_LINEAR, 6.0, (1.0, 1.0))
+        func.add(process.POINT_LINEAR, 8.0, (3.0, 5.0))
+
+        frames = [-1.0, 0.0, 1.0, 3.5, 4.0, 5.5, 6.0, 7.0, 8.0, 9.0, 2.0, -3.0]
+        expected = [(0.0, 10.0), (0.0, 10.0), (1.0, 9.0), (3.5, 6.5), (4.0, 6.0), (4.0, 6.0),
+            (1.0, 1.0), (2.0, 3.0), (3.0, 5.0), (3.0, 5.0), (2.0, 8.0), (0.0, 10.0)]
+
+        for a, b in zip(expected, func.get_values(frames)):
+            self.assertTupleAlmost(a + (0.0, 0.0), b)
+
+    def test_remove(self):
+        func = process.AnimationFunc()
+        pt1 = func.add(process.POINT_LINEAR, 0.0, 0.0)
+        pt2 = func.add(process.POINT_LINEAR, 2.0, 4.0)
+
+        self.assertAlmostEqual(2.0, func.get_values(1.0)[0][0])
+
+        func.remove(pt2)
+        self.assertEqual(len(func), 1)
+        self.assertAlmostEqual(0.0, func.get_values(1.0)[0][0])
+
+        func.remove(pt1)
+        self.assertAlmostEqual(0.0, func.get_values(1.0)[0][0])
+
+class test_ExpressionFunc(tupletester):
+    def test_arithmetic(self):
+        func = process.ExpressionFunc('clamp(frame / 10, 0, 1) * 2 + 1')
+
+        self.assertTupleAlmost((1.0, 0.0, 0.0, 0.0), func.get_values(-5.0)[0])
+        self.assertTupleAlmost((2.0, 0.0, 0.0, 0.0), func.get_values(5.0)[0])
+        self.assertTupleAlmost((3.0, 0.0, 0.0, 0.0), func.get_values(20.0)[0])
+
+    def test_components(self):
+        func = process.ExpressionFunc(('frame', None, 'ease_in_out(frame / 4)', '2 ** 3'))
+        values = func.get_values([0.0, 2.0, 4.0])
+
+        self.assertTupleAlmost((0.0, 0.0, 0.0, 8.0), values[0])
+        self.assertTupleAlmost((2.0, 0.0, 0.5, 8.0), values[1])
+        self.assertTupleAlmost((4.0, 0.0, 1.0, 8.0), values[2])
+
+    def test_inputs(self):
+        lerp = process.LerpFunc((0.0, 10.0), (10.0, 0.0), 10)
+        func = process.ExpressionFunc('fade + fade.y + fade(frame + 1)', inputs={'fade': lerp, 'k': 3.0})
+
+        self.assertTupleAlmost((11.0, 0.0, 0.0, 0.0), func.get_values(0.0)[0])
+        self.assertTupleAlmost((15.0, 0.0, 0.0, 0.0), func.get_values(4.0)[0])
+
+    def test_batch(self):
+        func = process.ExpressionFunc('sin(frame * pi / 2)')
+        frames = [float(i) for i in range(200)]
+        values = func.get_values(frames)
+
+        for i in range(200):
+            self.assertAlmostEqual([0.0, 1.0, 0.0, -1.0][i % 4], values[i][0])
+
+    def test_errors(self):
+        self.assertRaises(ValueError, process.ExpressionFunc, '1 +')
+        self.assertRaises(ValueError, process.ExpressionFunc, 'nothing')
+        self.assertRaises(ValueError, process.ExpressionFunc, 'min(1)')
+        self.assertRaises(ValueError, process.ExpressionFunc, 'x', inputs={'frame': 1.0})
+
+    def test_single_args(self):
+        # A builtin with one argument at the very top of the stack
+        text = '1 + (' * 31 + 'abs(frame)' + ')' * 31
+        func = process.ExpressionFunc(text)
+        self.assertTupleAlmost((33.0, 0.0, 0.0, 0.0), func.get_values(-2.0)[0])
+
+    def test_no_reinit(self):
+        func = process.ExpressionFunc('frame')
+        self.assertRaises(Exception, func.__init__, 'frame * 2')
+        self.assertTupleAlmost((3.0, 0.0, 0.0, 0.0), func.get_values(3.0)[0])
+
+    def test_no_cycles(self):
+        func = process.ExpressionFunc.__new__(process.ExpressionFunc)
+        self.assertRaises(ValueError, func.__init__, 'a', inputs={'a': func})
+
+        first = process.ExpressionFunc.__new__(process.ExpressionFunc)
+        second = process.ExpressionFunc('a + 1', inputs={'a': first})
+        self.assertRaises(ValueError, first.__init__, 'b', inputs={'b': second})
@@ -0,0 +1,65 @@
+import unittest, threading
+from fluggo.media import process
+from fluggo.media.basetypes import *
+import dvframes
+
+THREADS = 4
+
+def run_threads(target):
+    '''Run target(i) on THREADS threads at once, and return any exceptions they raised.'''
+    errors = []
+
+    def run(i):
+        try:
+            target(i)
+        except Exception as ex:
+            errors.append(ex)
+
+    threads = [threading.Thread(target=run, args=(i,)) for i in range(THREADS)]
+
+    for thread in threads:
+        thread.start()
+
+    for thread in threads:
+        thread.join()
+
+    return errors
+
+class PythonSource(process.CodedImageSource):
+    def get_frame(self, frame):
+        return [process.CodedImage(bytearray([frame] * 8), 4, 2)]
+
+class test_threads(unittest.TestCase):
+    def test_video(self):
+        source = process.SolidColorVideoSource(process.LerpFunc((0, 0, 0, 1), (100, 0, 0, 1), 100), box2i(0, 0, 3, 3))
+
+        def pull(i):
+            for frame in range(50):
+                self.assertAlmostEqual(float(frame), source.get_frame_f32(frame, box2i(0, 0, 3, 3)).pixel(1, 1).r, 4)
+                self.assertAlmostEqual(float(frame), source.get_frame_f16(frame, box2i(0, 0, 3, 3)).pixel(2, 2).r, 1)
+
+        self.assertEqual([], run_threads(pull))
+
+    def test_python_callback(self):
+        # The cache pulls from the Python source without the GIL, so each call has to take it back
+        cache = process.CodedImageCache(PythonSource(), cache_size=64)
+
+        def pull(i):
+            for frame in range(i, 100, 3):
+                self.assertEqual(bytearray([frame] * 8), cache.get_frame(frame)[0].data)
+
+        self.assertEqual([], run_threads(pull))
+
+    def test_packets(self):
+        path = dvframes.write_file(self, range(20))
+
+        def pull(i):
+            source = process.RawDVSource(path)
+            source.seek(i)
+
+            for frame in range(i, 20):
+                self.assertEqual(frame, source.get_next_packet().data[80])
+
+            self.assertIsNone(source.get_next_packet())
+
+        self.assertEqual([], run_threads(pull))
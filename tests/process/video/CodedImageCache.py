@@ -0,0 +1,58 @@
+import unittest
+from fluggo.media import process
+
+class CountingSource(process.CodedImageSource):
+    def __init__(self):
+        self.calls = 0
+
+    def get_frame(self, frame):
+        self.calls += 1
+        return [process.CodedImage(bytearray([frame] * 8), 4, 2)]
+
+class test_CodedImageCache(unittest.TestCase):
+    def test_hit(self):
+        source = CountingSource()
+        cache = process.CodedImageCache(source)
+
+        first = cache.get_frame(3)
+        second = cache.get_frame(3)
+
+        self.assertEqual(source.calls, 1)
+        self.assertEqual(first, second)
+        self.assertEqual(second[0].data, bytearray([3] * 8))
+        self.assertEqual(second[0].stride, 4)
+        self.assertEqual(second[0].line_count, 2)
+
+        stats = cache.cache_stats
+        self.assertEqual(stats['hits'], 1)
+        self.assertEqual(stats['misses'], 1)
+        self.assertEqual(stats['used'], 8)
+
+    def test_eviction(self):
+        source = CountingSource()
+        cache = process.CodedImageCache(source, cache_size=16)
+
+        for i in range(3):
+            cache.get_frame(i)
+
+        self.assertEqual(cache.cache_stats['frames'], 2)
+        self.assertEqual(cache.cache_stats['used'], 16)
+
+        # Frame 0 was the least recently used
+        cache.get_frame(0)
+        self.assertEqual(source.calls, 4)
+
+        cache.get_frame(2)
+        self.assertEqual(source.calls, 4)
+
+    def test_invalidate(self):
+        source = CountingSource()
+        cache = process.CodedImageCache(source)
+
+        cache.get_frame(0)
+        cache.invalidate()
+        self.assertEqual(cache.cache_stats['frames'], 0)
+
+        cache.get_frame(0)
+        self.assertEqual(source.calls, 2)
+
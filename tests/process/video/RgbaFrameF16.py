@@ -1,4 +1,4 @@
-import unittest
+import unittest, struct
 from fluggo.media import process
 from fluggo.media.basetypes import *
 
@@ -22,3 +22,28 @@ class test_RgbaFrameF16(unittest.TestCase):
         for x, y in zip(frame.pixel(0, 0), color):
             self.assertAlmostEqual(x, y, 3)
 
+    def test_buffer(self):
+        color = (1.0, 0.5, 0.25, 0.125)
+        solid = process.SolidColorVideoSource(color, box2i((0, 0), (2, 2)))
+        frame = solid.get_frame_f16(0, box2i((0, 0), (3, 1)))
+
+        view = memoryview(frame)
+        self.assertEqual((2, 4, 4), view.shape)
+        self.assertEqual((32, 8, 2), view.strides)
+        self.assertEqual('e', view.format)
+        self.assertEqual(color, struct.unpack_from('4e', view.tobytes(), 32 + 2 * 8))
+
+    def test_wrap(self):
+        data = bytearray(struct.pack('16e', *range(16)))
+        frame = process.RgbaFrameF16(data, box2i(0, 0, 1, 1))
+
+        self.assertEqual(frame.current_window, box2i(0, 0, 1, 1))
+        self.assertEqual((12.0, 13.0, 14.0, 15.0), tuple(frame.pixel(1, 1)))
+
+        # No copy: writes to the buffer show up in the frame
+        struct.pack_into('e', data, 0, 2.5)
+        self.assertEqual(2.5, frame.pixel(0, 0)[0])
+        self.assertFalse(memoryview(frame).readonly)
+
+        self.assertTrue(memoryview(process.RgbaFrameF16(bytes(data), box2i(0, 0, 1, 1))).readonly)
+        self.assertRaises(ValueError, process.RgbaFrameF16, bytes(8), box2i(0, 0, 1, 1))
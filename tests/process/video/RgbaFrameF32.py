@@ -0,0 +1,65 @@
+import unittest, struct, ctypes
+from fluggo.media import process
+from fluggo.media.basetypes import *
+
+class Py_buffer(ctypes.Structure):
+    _fields_ = [('buf', ctypes.c_void_p), ('obj', ctypes.c_void_p), ('len', ctypes.c_ssize_t),
+        ('itemsize', ctypes.c_ssize_t), ('readonly', ctypes.c_int), ('ndim', ctypes.c_int),
+        ('format', ctypes.c_char_p), ('shape', ctypes.c_void_p), ('strides', ctypes.c_void_p),
+        ('suboffsets', ctypes.c_void_p), ('internal', ctypes.c_void_p)]
+
+PyBUF_SIMPLE, PyBUF_FORMAT = 0, 0x0004
+
+class test_RgbaFrameF32(unittest.TestCase):
+    def test_solid(self):
+        color = (1.0, 0.5, 0.25, 0.125)
+        solid = process.SolidColorVideoSource(color, box2i((0, 0), (2, 2)))
+        frame = solid.get_frame_f32(0, box2i((0, 0), (3, 3)))
+
+        self.assertEqual(frame.current_window, box2i(0, 0, 2, 2))
+        self.assertEqual(frame.full_window, box2i(0, 0, 3, 3))
+        self.assertEqual(color, tuple(frame.pixel(0, 0)))
+
+    def test_buffer(self):
+        color = (1.0, 0.5, 0.25, 0.125)
+        solid = process.SolidColorVideoSource(color, box2i((0, 0), (2, 2)))
+        frame = solid.get_frame_f32(0, box2i((0, 0), (3, 1)))
+
+        view = memoryview(frame)
+        self.assertEqual((2, 4, 4), view.shape)
+        self.assertEqual((64, 16, 4), view.strides)
+        self.assertEqual('f', view.format)
+        self.assertEqual(color, struct.unpack_from('4f', view.tobytes(), 64 + 2 * 16))
+
+    def test_simple_buffer(self):
+        # Asked for no shape, the frame should look like plain bytes
+        frame = process.RgbaFrameF32(bytearray(struct.pack('16f', *range(16))), box2i(0, 0, 1, 1))
+
+        for flags, format in ((PyBUF_SIMPLE, None), (PyBUF_FORMAT, b'B')):
+            with self.subTest(flags=flags):
+                view = Py_buffer()
+                self.assertEqual(0, ctypes.pythonapi.PyObject_GetBuffer(ctypes.py_object(frame), ctypes.byref(view), flags))
+
+                try:
+                    self.assertEqual(64, view.len)
+                    self.assertEqual(1, view.itemsize)
+                    self.assertEqual(1, view.ndim)
+                    self.assertEqual(format, view.format)
+                    self.assertIsNone(view.shape)
+                finally:
+                    ctypes.pythonapi.PyBuffer_Release(ctypes.byref(view))
+
+    def test_wrap(self):
+        data = bytearray(struct.pack('16f', *range(16)))
+        frame = process.RgbaFrameF32(data, box2i(0, 0, 1, 1))
+
+        self.assertEqual(frame.current_window, box2i(0, 0, 1, 1))
+        self.assertEqual((12.0, 13.0, 14.0, 15.0), tuple(frame.pixel(1, 1)))
+
+        # No copy: writes to the buffer show up in the frame
+        struct.pack_into('f', data, 0, 2.5)
+        self.assertEqual(2.5, frame.pixel(0, 0)[0])
+        self.assertFalse(memoryview(frame).readonly)
+
+        self.assertTrue(memoryview(process.RgbaFrameF32(bytes(data), box2i(0, 0, 1, 1))).readonly)
+        self.assertRaises(ValueError, process.RgbaFrameF32, bytes(8), box2i(0, 0, 1, 1))
@@ -0,0 +1,30 @@
+import sys, unittest
+from fluggo.media import process
+from fluggo.media.basetypes import *
+
+class test_SubsampleFilter(unittest.TestCase):
+    def test_422(self):
+        # Linear red: Y = 0.2126, Cb = -0.114572, Cr = 0.5
+        solid = process.SolidColorVideoSource((1.0, 0.0, 0.0, 1.0))
+        planes = process.SubsampleFilter(solid, v2i(8, 4), chroma='4:2:2').get_frame(0)
+
+        self.assertEqual(len(planes), 3)
+        self.assertEqual((planes[0].stride, planes[0].line_count), (8, 4))
+        self.assertEqual((planes[1].stride, planes[1].line_count), (4, 4))
+        self.assertEqual(planes[0].data, bytearray([63] * 32))
+        self.assertEqual(planes[1].data, bytearray([102] * 16))
+        self.assertEqual(planes[2].data, bytearray([240] * 16))
+
+    def test_420_10bit(self):
+        solid = process.SolidColorVideoSource((1.0, 1.0, 1.0, 1.0))
+        planes = process.SubsampleFilter(solid, v2i(8, 4), bit_depth=10).get_frame(0)
+
+        self.assertEqual((planes[0].stride, planes[0].line_count), (16, 4))
+        self.assertEqual((planes[1].stride, planes[1].line_count), (8, 2))
+        self.assertEqual(planes[0].data[0:2], bytearray((940).to_bytes(2, sys.byteorder)))
+        self.assertEqual(planes[2].data[0:2], bytearray((512).to_bytes(2, sys.byteorder)))
+
+    def test_bad_chroma(self):
+        solid = process.SolidColorVideoSource((1.0, 1.0, 1.0, 1.0))
+        self.assertRaises(ValueError, process.SubsampleFilter, solid, v2i(8, 4), chroma='4:4:4')
+
@@ -0,0 +1,65 @@
+import unittest
+from fluggo.media import process
+from fluggo.media.basetypes import *
+
+class test_VideoFrameCache(unittest.TestCase):
+    def check_color(self, color1, color2):
+        for x, y in zip(color1, color2):
+            self.assertAlmostEqual(x, y, 6)
+
+    def test_hit(self):
+        color = (1.0, 0.5, 0.333333, 0.2)
+        solid = process.SolidColorVideoSource(color, box2i(0, 0, 2, 2))
+        cache = process.VideoFrameCache(solid)
+
+        frame = cache.get_frame_f32(0, box2i(0, 0, 3, 3))
+        frame = cache.get_frame_f32(0, box2i(0, 0, 3, 3))
+
+        self.assertEqual(frame.current_window, box2i(0, 0, 2, 2))
+        self.check_color(frame.pixel(0, 0), color)
+
+        stats = cache.cache_stats
+        self.assertEqual(stats['hits'], 1)
+        self.assertEqual(stats['misses'], 1)
+        self.assertEqual(stats['frames'], 1)
+
+    def test_loop(self):
+        solid = process.SolidColorVideoSource(process.LerpFunc((0.0, 0.0, 0.0, 1.0), (0.1, 0.1, 0.1, 1.0), 1))
+        cache = process.VideoFrameCache(solid)
+
+        for i in range(5):
+            cache.get_frame_f32(i, box2i(0, 0, 1, 1))
+
+        for i in range(5):
+            frame = cache.get_frame_f32(i, box2i(0, 0, 1, 1))
+            self.check_color(frame.pixel(0, 0), rgba(i * 0.1, i * 0.1, i * 0.1, 1.0))
+
+        stats = cache.cache_stats
+        self.assertEqual(stats['misses'], 5)
+        self.assertEqual(stats['hits'], 5)
+
+    def test_invalidate(self):
+        solid = process.SolidColorVideoSource((1.0, 1.0, 1.0, 1.0), box2i(0, 0, 2, 2))
+        cache = process.VideoFrameCache(solid)
+
+        cache.get_frame_f32(0, box2i(0, 0, 2, 2))
+        cache.invalidate()
+
+        stats = cache.cache_stats
+        self.assertEqual(stats['frames'], 0)
+        self.assertEqual(stats['used'], 0)
+
+    def test_budget(self):
+        solid = process.SolidColorVideoSource((1.0, 1.0, 1.0, 1.0), box2i(0, 0, 2, 2))
+        cache = process.VideoFrameCache(solid)
+        budget = process.VideoFrameCache.global_stats()['budget']
+
+        try:
+            process.VideoFrameCache.set_global_budget(0)
+            frame = cache.get_frame_f32(0, box2i(0, 0, 2, 2))
+
+            self.check_color(frame.pixel(0, 0), (1.0, 1.0, 1.0, 1.0))
+            self.assertEqual(process.VideoFrameCache.global_stats()['used'], 0)
+        finally:
+            process.VideoFrameCache.set_global_budget(budget)
+
@@ -0,0 +1,59 @@
+import unittest, fractions
+from fluggo.media import process
+from X264VideoEncoder import GradientSource, read_all, WIDTH, HEIGHT
+
+try:
+    from fluggo.media import x264
+except ImportError:
+    x264 = None
+
+FRAMES = 30
+
+@unittest.skipIf(x264 is None, 'x264 support was not built')
+class test_SegmentedEncoder(unittest.TestCase):
+    def factory(self, first_frame, last_frame):
+        # This preset uses B-frames, so decode order and presentation order differ
+        params = x264.X264EncoderParams(preset='veryfast', width=WIDTH, height=HEIGHT,
+            frame_rate=fractions.Fraction(30000, 1001), constant_quantizer=30, threads=1)
+        encoder = x264.X264VideoEncoder(GradientSource(), first_frame, last_frame, params)
+        self.segments.append((first_frame, last_frame, encoder.get_header()))
+        return encoder
+
+    def setUp(self):
+        self.segments = []
+
+    def check_stream(self, **kw):
+        encoder = process.SegmentedEncoder(self.factory, 0, FRAMES - 1, segment_size=8, workers=2, **kw)
+        packets = read_all(encoder)
+
+        self.assertEqual([(0, 7), (8, 15), (16, 23), (24, 29)], [seg[:2] for seg in self.segments])
+        self.assertEqual(list(range(FRAMES)), sorted(packet.pts for packet in packets))
+
+        # Every segment's encoder was set up the same, so one header serves for all
+        header = encoder.get_header()
+        self.assertTrue(header)
+
+        for seg in self.segments:
+            self.assertEqual(header, seg[2])
+
+        # Decode timestamps keep going up across the segment joins
+        for before, after in zip(packets, packets[1:]):
+            self.assertLess(before.dts, after.dts)
+
+        for packet in packets:
+            self.assertLessEqual(packet.dts, packet.pts)
+
+        # Each segment's packets come together, starting on a keyframe at its first frame
+        for first_frame, last_frame, _ in self.segments:
+            indexes = [i for i, packet in enumerate(packets) if first_frame <= packet.pts <= last_frame]
+
+            self.assertEqual(list(range(indexes[0], indexes[-1] + 1)), indexes)
+            self.assertTrue(packets[indexes[0]].keyframe)
+            self.assertEqual(first_frame, packets[indexes[0]].pts)
+
+    def test_segments(self):
+        self.check_stream()
+
+    def test_max_queued(self):
+        # Workers have to wait for room here, but the stream comes out the same
+        self.check_stream(max_queued=1)
@@ -0,0 +1,105 @@
+import unittest, fractions, threading
+from fluggo.media import process
+
+try:
+    from fluggo.media import x264
+except ImportError:
+    x264 = None
+
+WIDTH, HEIGHT = 64, 48
+FRAMES = 12
+
+class GradientSource(process.CodedImageSource):
+    '''Hands out I420 images from Python, so every pull needs the GIL.'''
+    def get_frame(self, frame):
+        luma = bytearray((x + y + frame * 4) & 0xFF for y in range(HEIGHT) for x in range(WIDTH))
+        chroma = bytearray([128] * (WIDTH // 2 * HEIGHT // 2))
+
+        return [process.CodedImage(luma, WIDTH, HEIGHT),
+            process.CodedImage(chroma, WIDTH // 2, HEIGHT // 2),
+            process.CodedImage(bytearray(chroma), WIDTH // 2, HEIGHT // 2)]
+
+class FailingSource(GradientSource):
+    '''Stops handing out frames partway through.'''
+    def get_frame(self, frame):
+        if frame >= FRAMES // 2:
+            return None
+
+        return GradientSource.get_frame(self, frame)
+
+def make_params(**kw):
+    return x264.X264EncoderParams(preset='ultrafast', width=WIDTH, height=HEIGHT,
+        frame_rate=fractions.Fraction(30000, 1001), constant_quantizer=30, **kw)
+
+def read_all(source):
+    packets = []
+
+    while True:
+        packet = source.get_next_packet()
+
+        if packet is None:
+            return packets
+
+        packets.append(packet)
+
+@unittest.skipIf(x264 is None, 'x264 support was not built')
+class test_X264VideoEncoder(unittest.TestCase):
+    def check_encode(self, params, prefetch=0):
+        encoder = x264.X264VideoEncoder(GradientSource(), 0, FRAMES - 1, params, prefetch=prefetch)
+        packets = read_all(encoder)
+
+        self.assertEqual(list(range(FRAMES)), sorted(packet.pts for packet in packets))
+        self.assertTrue(packets[0].keyframe)
+
+    def test_threading_params(self):
+        for kw in [dict(threads=1), dict(threads=2), dict(threads=0),
+                dict(threads=2, sliced_threads=True), dict(threads=2, sliced_threads=False),
+                dict(lookahead=0), dict(lookahead=5),
+                dict(threads=2, sync_lookahead=0), dict(threads=2, sync_lookahead=4)]:
+            with self.subTest(**kw):
+                self.check_encode(make_params(**kw))
+
+    def test_prefetch(self):
+        for prefetch in (1, 4, FRAMES * 2):
+            with self.subTest(prefetch=prefetch):
+                self.check_encode(make_params(threads=2), prefetch=prefetch)
+
+    def test_prefetch_from_thread(self):
+        # The prefetch thread takes the GIL to pull from the Python source
+        # while another Python thread waits on the encoder
+        results = []
+        thread = threading.Thread(target=lambda: self.check_encode(make_params(), prefetch=2) or results.append(True))
+        thread.start()
+        thread.join(30)
+
+        self.assertFalse(thread.is_alive())
+        self.assertEqual([True], results)
+
+    def test_prefetch_stops_early(self):
+        # Dropping the encoder before it's done has to stop the prefetch thread cleanly
+        encoder = x264.X264VideoEncoder(GradientSource(), 0, FRAMES - 1, make_params(), prefetch=4)
+        self.assertIsNotNone(encoder.get_next_packet())
+        del encoder
+
+    def test_source_failure(self):
+        for prefetch in (0, 2):
+            with self.subTest(prefetch=prefetch):
+                encoder = x264.X264VideoEncoder(FailingSource(), 0, FRAMES - 1, make_params(), prefetch=prefetch)
+                self.assertRaises(Exception, read_all, encoder)
+
+                # The stream can't pick up again after a missing frame
+                self.assertRaises(Exception, encoder.get_next_packet)
+
+    def test_reinit(self):
+        encoder = x264.X264VideoEncoder(GradientSource(), 0, FRAMES - 1, make_params(), prefetch=4)
+        self.assertIsNotNone(encoder.get_next_packet())
+
+        encoder.__init__(GradientSource(), 0, FRAMES - 1, make_params(), prefetch=2)
+        packets = read_all(encoder)
+
+        self.assertEqual(list(range(FRAMES)), sorted(packet.pts for packet in packets))
+
+    def test_bad_args(self):
+        self.assertRaises(ValueError, x264.X264VideoEncoder, GradientSource(), 0, FRAMES - 1, make_params(), prefetch=-1)
+        self.assertRaises(TypeError, make_params, threads='two')
+        self.assertRaises(TypeError, make_params, lookahead=1.5)